@@ -0,0 +1,146 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stddef.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include "plan_impl.h"
+
+/*
+ * A bump allocator for the transient data of a command: the names and
+ * details of the activities in a day that's been read in, and the todos of a
+ * listing. These used to be allocated (and freed) one at a time, so a large
+ * listing spent most of its time in umem. Now they're carved out of a few
+ * large blocks, and all of them go at once, when the arena is reset.
+ *
+ * An arena starts with a single block. When a block fills up, another (at
+ * least as large as the request) is added in front of it. When an arena
+ * that ended up with more than one block is reset, they're all swapped for a
+ * single block of their combined size, so an arena that's reset once per day
+ * (or per command, in the daemon) soon stops growing. Arenas aren't
+ * MT-safe: each belongs to a plan_day_t, or to one thread. An arena that's
+ * all zeroes is empty, and ready to use.
+ */
+#define	ARENA_ALIGN	8
+#define	ARENA_BLKSZ	(16 * 1024)
+
+typedef struct arena_blk {
+	struct arena_blk *ab_next;
+	size_t		ab_size;	/* of ab_data */
+	size_t		ab_used;
+	uint64_t	ab_data[1];
+} arena_blk_t;
+
+#define	ARENA_HDR	offsetof(arena_blk_t, ab_data)
+
+static arena_blk_t *
+arena_blk(size_t size, arena_blk_t *next)
+{
+	arena_blk_t *ab = umem_alloc(ARENA_HDR + size, UMEM_NOFAIL);
+
+	ab->ab_next = next;
+	ab->ab_size = size;
+	ab->ab_used = 0;
+	return (ab);
+}
+
+void *
+arena_alloc(arena_t *ar, size_t n)
+{
+	arena_blk_t *ab = ar->ar_head;
+	void *p;
+
+	n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (ab == NULL || ab->ab_size - ab->ab_used < n) {
+		ab = arena_blk(MAX(n, ARENA_BLKSZ), ab);
+		ar->ar_head = ab;
+	}
+	p = (char *)ab->ab_data + ab->ab_used;
+	ab->ab_used += n;
+	return (p);
+}
+
+void *
+arena_zalloc(arena_t *ar, size_t n)
+{
+	void *p = arena_alloc(ar, n);
+
+	bzero(p, n);
+	return (p);
+}
+
+/*
+ * Copies the first `len` bytes of `s` into the arena, NUL-terminated.
+ */
+char *
+arena_strdup(arena_t *ar, const char *s, size_t len)
+{
+	char *p = arena_alloc(ar, len + 1);
+
+	bcopy(s, p, len);
+	p[len] = '\0';
+	return (p);
+}
+
+void
+arena_fini(arena_t *ar)
+{
+	arena_blk_t *ab = ar->ar_head;
+	arena_blk_t *next;
+
+	while (ab != NULL) {
+		next = ab->ab_next;
+		umem_free(ab, ARENA_HDR + ab->ab_size);
+		ab = next;
+	}
+	ar->ar_head = NULL;
+}
+
+/*
+ * Frees everything allocated from the arena, keeping a block to allocate
+ * from next time.
+ */
+void
+arena_reset(arena_t *ar)
+{
+	arena_blk_t *ab = ar->ar_head;
+	size_t size = 0;
+
+	if (ab == NULL) {
+		return;
+	}
+	if (ab->ab_next == NULL) {
+		ab->ab_used = 0;
+		return;
+	}
+	while (ab != NULL) {
+		size += ab->ab_size;
+		ab = ab->ab_next;
+	}
+	arena_fini(ar);
+	ar->ar_head = arena_blk(size, NULL);
+}
@@ -47,10 +47,16 @@ atomic_read(int fd, void *buf, size_t sz)
 		probe_ix++;
 	}
 
+	/*
+	 * A short read (or EOF, or an error) leaves the rest of the buffer
+	 * untouched.
+	 */
 	do {
-		red = read(fd, buf, (sz-red));
-		total_read += red;
-	} while (total_read < sz && red != -1);
+		red = read(fd, (char *)buf + total_read, (sz-total_read));
+		if (red > 0) {
+			total_read += red;
+		}
+	} while (total_read < sz && red > 0);
 }
 
 
@@ -71,7 +77,10 @@ atomic_write(int fd, void *buf, size_t sz)
 	}
 
 	do {
-		written = write(fd, buf, (sz-written));
-		total_written += written;
-	} while (total_written < sz && written != -1);
+		written = write(fd, (char *)buf + total_written,
+		    (sz-total_written));
+		if (written > 0) {
+			total_written += written;
+		}
+	} while (total_written < sz && written > 0);
 }
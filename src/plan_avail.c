@@ -0,0 +1,296 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include "plan_impl.h"
+
+/*
+ * Finding a time that suits several people ("plan avail"), each with a
+ * plandb of their own. The stores keep their state in globals, and each
+ * plandb has its own resolution, so rather than open one plandb after
+ * another in this process, we run "plan busy" on each of them (with PLAN_DB
+ * set to it), all at once. Each prints a minute map for every day in the
+ * range (see free_busy in plan_free.c): a bit a minute, set if that person is
+ * busy, asleep or not.
+ *
+ * A person's maps for the whole range are read into one array, a day after
+ * the other, and OR'd into the maps of everyone so far, so the minutes left
+ * clear are the ones where everyone is free (the AND of the free maps). That
+ * is one pass over a few dense arrays per person, written as plain loops over
+ * 64-bit words, with nothing in them that keeps the compiler from using
+ * vector instructions. We don't write those ourselves, since this has to
+ * build for SPARC as well as x86. A month of days for one person is 23
+ * Kbytes, so dozens of people over months are read and combined in far less
+ * time than it takes to start the processes.
+ */
+
+extern char *plan_path;
+extern char *daystr[];
+extern scope_t plan_scope(day_t, tm_t *);
+extern void scope_to_tm(scope_t, tm_t *);
+extern void batch_flush(void);
+
+typedef struct av_db {
+	char		*ad_root;
+	pid_t		ad_pid;
+	FILE		*ad_f;
+} av_db_t;
+
+/*
+ * dst |= src, for n words.
+ */
+static void
+av_or(uint64_t *restrict dst, const uint64_t *restrict src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] |= src[i];
+	}
+}
+
+/*
+ * Starts "plan busy <range>" on ad_root, with its stdout going to ad_f.
+ */
+static int
+av_start(av_db_t *ad, char *range)
+{
+	struct stat st;
+	int fds[2];
+	char *av[4];
+
+	if (stat(ad->ad_root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		printf("%s: not a plandb\n", ad->ad_root);
+		return (-1);
+	}
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return (-1);
+	}
+	fflush(stdout);
+	ad->ad_pid = fork();
+	if (ad->ad_pid == -1) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return (-1);
+	}
+	if (ad->ad_pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		(void) setenv("PLAN_DB", ad->ad_root, 1);
+		av[0] = plan_path;
+		av[1] = "busy";
+		av[2] = range;
+		av[3] = NULL;
+		(void) execvp(plan_path, av);
+		_exit(1);
+	}
+	close(fds[1]);
+	ad->ad_f = fdopen(fds[0], "r");
+	return (0);
+}
+
+/*
+ * Reads the maps that av_start's child prints into mm[], checking that there's
+ * one for each of the `ndays` days from `from` on, and waits for the child.
+ */
+static int
+av_read(av_db_t *ad, scope_t from, size_t ndays, uint64_t *mm)
+{
+	char line[32 + MM_WORDS * 17];
+	char *p;
+	char *e;
+	size_t d = 0;
+	scope_t s;
+	int status;
+	int w;
+	tm_t tm;
+	int err = 0;
+
+	scope_to_tm(from, &tm);
+	while (fgets(line, sizeof (line), ad->ad_f) != NULL) {
+		s = strtol(line, &p, 10);
+		if (d == ndays || s != plan_scope(-1, &tm)) {
+			err = 1;
+			break;
+		}
+		for (w = 0; w < MM_WORDS; w++) {
+			mm[d * MM_WORDS + w] = strtoull(p, &e, 16);
+			if (e == p) {
+				err = 1;
+			}
+			p = e;
+		}
+		d++;
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		(void) mktime(&tm);
+	}
+	fclose(ad->ad_f);
+	(void) waitpid(ad->ad_pid, &status, 0);
+	if (err || d != ndays || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		printf("%s: couldn't read its days\n", ad->ad_root);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Prints the runs of free minutes in a day's map that are at least `dur`
+ * minutes long. Returns the number of them.
+ */
+static int
+av_print_day(uint64_t *mm, size_t dur, scope_t date, int wday, int cnt)
+{
+	size_t m = 0;
+	size_t end;
+	size_t w;
+	uint64_t bits;
+	int n = 0;
+
+	while (m < MM_MINS) {
+		/*
+		 * The next free minute, and then the next busy one after it
+		 * (there always is one, past the end of the day).
+		 */
+		w = m / 64;
+		bits = ~mm[w] & (~(uint64_t)0 << (m % 64));
+		while (bits == 0 && ++w < MM_WORDS) {
+			bits = ~mm[w];
+		}
+		if (bits == 0) {
+			break;
+		}
+		m = w * 64 + __builtin_ctzll(bits);
+		bits = mm[w] & (~(uint64_t)0 << (m % 64));
+		while (bits == 0) {
+			bits = mm[++w];
+		}
+		end = w * 64 + __builtin_ctzll(bits);
+		if (m >= MM_MINS) {
+			break;
+		}
+		if (end - m >= dur) {
+			if (cnt + n == 0) {
+				printf("%-10s %-9s %7s %7s %7s\n", "DATE", "DAY",
+				    "START", "END", "LENGTH");
+			}
+			printf("%04d-%02d-%02d %-9s   %02d:%02d   %02d:%02d  "
+			    "%02dh%02dm\n", date / 10000, (date / 100) % 100,
+			    date % 100, daystr[wday], (int)(m / 60),
+			    (int)(m % 60), (int)(end / 60), (int)(end % 60),
+			    (int)((end - m) / 60), (int)((end - m) % 60));
+			n++;
+		}
+		m = end;
+	}
+	return (n);
+}
+
+/*
+ * Lists the times, from `from` to `to` (inclusive), when everyone with a
+ * plandb in roots[] is free, for at least `dur` minutes. Returns the number of
+ * them, or -1 if a plandb couldn't be read.
+ */
+int
+avail_find(size_t dur, scope_t from, scope_t to, char **roots, int nroots)
+{
+	av_db_t *ads;
+	uint64_t *all;
+	uint64_t *one;
+	char range[32];
+	size_t ndays = 0;
+	size_t sz;
+	size_t d;
+	tm_t tm;
+	int cnt = 0;
+	int err = 0;
+	int started = 0;
+	int i;
+
+	batch_flush();
+
+	scope_to_tm(from, &tm);
+	while (plan_scope(-1, &tm) <= to) {
+		ndays++;
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		(void) mktime(&tm);
+	}
+	(void) snprintf(range, sizeof (range), "%04d-%02d-%02d..%04d-%02d-%02d",
+	    from / 10000, (from / 100) % 100, from % 100,
+	    to / 10000, (to / 100) % 100, to % 100);
+
+	sz = ndays * MM_WORDS * sizeof (uint64_t);
+	all = umem_zalloc(sz, UMEM_NOFAIL);
+	one = umem_alloc(sz, UMEM_NOFAIL);
+	ads = umem_zalloc(nroots * sizeof (av_db_t), UMEM_NOFAIL);
+
+	for (i = 0; i < nroots; i++) {
+		ads[i].ad_root = roots[i];
+		if (av_start(&ads[i], range) != 0) {
+			err = 1;
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++) {
+		if (av_read(&ads[i], from, ndays, one) != 0) {
+			err = 1;
+			continue;
+		}
+		av_or(all, one, ndays * MM_WORDS);
+	}
+
+	if (!err) {
+		scope_to_tm(from, &tm);
+		for (d = 0; d < ndays; d++) {
+			cnt += av_print_day(&all[d * MM_WORDS], dur,
+			    plan_scope(-1, &tm), tm.tm_wday, cnt);
+			tm.tm_mday++;
+			tm.tm_isdst = -1;
+			(void) mktime(&tm);
+		}
+		if (cnt == 0) {
+			printf("There's no time when everyone is free.\n");
+		}
+	}
+
+	umem_free(ads, nroots * sizeof (av_db_t));
+	umem_free(one, sz);
+	umem_free(all, sz);
+	return (err ? -1 : cnt);
+}
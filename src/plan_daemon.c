@@ -0,0 +1,373 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <signal.h>
+#include "plan_impl.h"
+
+/*
+ * The plan daemon. Scripts that run plan many times a minute pay for the same
+ * start-up over and over (looking up the home directory, setting up the umem
+ * caches and the dmday daymap, and, with the log backend, reading the entire
+ * log). The daemon does all of that once, and then serves commands over a
+ * Unix socket in ~/.plandb. When the socket is there, the plan command is
+ * nothing more than a thin client that ships its arguments to the daemon and
+ * copies the output back to the terminal.
+ *
+ * Every request is run in a child that the daemon forks. The child starts out
+ * with a copy-on-write snapshot of the daemon's warm state, so it doesn't
+ * touch the disk for anything the daemon already has in memory. And since a
+ * lot of the command code calls exit() on bad input, running it in a child
+ * means that a bad request can't take the daemon down. Requests are run one at
+ * a time, and before each one the daemon syncs its store, picking up whatever
+ * the previous request (or any other plan process) changed.
+ *
+ * The request is a plan_req_t header followed by the arguments, each
+ * terminated by a NUL. The response is whatever the command printed, and ends
+ * when the daemon closes the connection.
+ */
+
+#define	PLAN_REQ_MAGIC	0x504c4e31	/* "PLN1" */
+#define	PLAN_REQ_MAXLEN	(64 * 1024)
+#define	PLAN_SOCK	"/.plandb/plan.sock"
+
+typedef struct plan_req {
+	uint32_t	pr_magic;
+	uint32_t	pr_argc;
+	uint32_t	pr_len;
+} plan_req_t;
+
+extern plan_store_t *store;
+extern void wal_close(void);
+extern void names_close(void);
+extern void text_close(void);
+extern void res_sync(void);
+
+static int
+sock_addr(struct sockaddr_un *sun)
+{
+	char *home = getenv("HOME");
+
+	if (home == NULL) {
+		struct passwd *pwd = getpwuid(getuid());
+		if (pwd == NULL) {
+			return (-1);
+		}
+		home = pwd->pw_dir;
+	}
+
+	bzero(sun, sizeof (struct sockaddr_un));
+	sun->sun_family = AF_UNIX;
+	if (strlen(home) + strlen(PLAN_SOCK) >= sizeof (sun->sun_path)) {
+		return (-1);
+	}
+	strcpy(sun->sun_path, home);
+	strcat(sun->sun_path, PLAN_SOCK);
+	return (0);
+}
+
+static int
+sock_connect(void)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (sock_addr(&sun) != 0) {
+		return (-1);
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return (-1);
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof (sun)) != 0) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+static void
+copy_out(int from, int to)
+{
+	char buf[4096];
+	ssize_t r;
+
+	while ((r = read(from, buf, sizeof (buf))) > 0) {
+		if (write(to, buf, r) != r) {
+			break;
+		}
+	}
+}
+
+/*
+ * Sends the command to the daemon, and copies the daemon's response to
+ * stdout. Returns -1, without having done anything, if there is no daemon to
+ * talk to, in which case the caller runs the command itself.
+ */
+int
+plan_client(int ac, char *av[])
+{
+	plan_req_t req;
+	char *buf;
+	size_t len = 0;
+	size_t off = 0;
+	int i = 0;
+	int fd;
+
+	while (i < ac) {
+		len += strlen(av[i]) + 1;
+		i++;
+	}
+	if (len > PLAN_REQ_MAXLEN || (fd = sock_connect()) == -1) {
+		return (-1);
+	}
+
+	buf = umem_alloc(sizeof (req) + len, UMEM_NOFAIL);
+	req.pr_magic = PLAN_REQ_MAGIC;
+	req.pr_argc = ac;
+	req.pr_len = len;
+	bcopy(&req, buf, sizeof (req));
+	i = 0;
+	while (i < ac) {
+		size_t al = strlen(av[i]) + 1;
+		bcopy(av[i], buf + sizeof (req) + off, al);
+		off += al;
+		i++;
+	}
+	if (write(fd, buf, sizeof (req) + len) != sizeof (req) + len) {
+		umem_free(buf, sizeof (req) + len);
+		close(fd);
+		return (-1);
+	}
+	umem_free(buf, sizeof (req) + len);
+	shutdown(fd, SHUT_WR);
+
+	copy_out(fd, STDOUT_FILENO);
+	close(fd);
+	return (0);
+}
+
+static int
+read_full(int fd, void *buf, size_t sz)
+{
+	size_t total = 0;
+	ssize_t r;
+
+	while (total < sz) {
+		r = read(fd, (char *)buf + total, sz - total);
+		if (r <= 0) {
+			return (-1);
+		}
+		total += r;
+	}
+	return (0);
+}
+
+/*
+ * Reads a request off of `fd`, and unpacks the arguments into an argv. The
+ * argv and the buffer backing it are returned in `*avp` and `*bufp`.
+ */
+static int
+read_req(int fd, int *acp, char ***avp, char **bufp, size_t *lenp)
+{
+	plan_req_t req;
+	char **av;
+	char *buf;
+	size_t off = 0;
+	int i = 0;
+
+	if (read_full(fd, &req, sizeof (req)) != 0 ||
+	    req.pr_magic != PLAN_REQ_MAGIC || req.pr_len > PLAN_REQ_MAXLEN ||
+	    req.pr_argc == 0 || req.pr_argc > req.pr_len) {
+		return (-1);
+	}
+
+	buf = umem_alloc(req.pr_len + 1, UMEM_NOFAIL);
+	if (read_full(fd, buf, req.pr_len) != 0) {
+		umem_free(buf, req.pr_len + 1);
+		return (-1);
+	}
+	buf[req.pr_len] = '\0';
+
+	av = umem_zalloc((req.pr_argc + 1) * sizeof (char *), UMEM_NOFAIL);
+	while (i < req.pr_argc && off < req.pr_len) {
+		av[i] = buf + off;
+		off += strlen(av[i]) + 1;
+		i++;
+	}
+	if (i != req.pr_argc) {
+		umem_free(av, (req.pr_argc + 1) * sizeof (char *));
+		umem_free(buf, req.pr_len + 1);
+		return (-1);
+	}
+
+	*acp = req.pr_argc;
+	*avp = av;
+	*bufp = buf;
+	*lenp = req.pr_len;
+	return (0);
+}
+
+/*
+ * Runs a single request in a child, with the child's stdout and stderr
+ * connected to the client.
+ */
+static void
+serve(int lfd, int cfd, int ac, char *av[], int (*dispatch)(int, char **))
+{
+	pid_t pid;
+	int status;
+
+	store->ps_sync();
+	res_sync();
+
+	pid = fork();
+	if (pid == -1) {
+		dprintf(cfd, "plan daemon: can't fork\n");
+		return;
+	}
+
+	if (pid == 0) {
+		close(lfd);
+		dup2(cfd, STDOUT_FILENO);
+		dup2(cfd, STDERR_FILENO);
+		close(cfd);
+		(void) dispatch(ac, av);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(0);
+	}
+
+	(void) waitpid(pid, &status, 0);
+}
+
+/*
+ * Starts the daemon. We return to the caller once the daemon is listening,
+ * and the daemon itself never returns.
+ */
+int
+plan_daemon(int (*dispatch)(int, char **))
+{
+	struct sockaddr_un sun;
+	int lfd;
+	int cfd;
+	int fd;
+	pid_t pid;
+
+	if (sock_addr(&sun) != 0) {
+		printf("Can't find the plan daemon socket path\n");
+		return (-1);
+	}
+
+	/*
+	 * If we can connect to the socket, a daemon is already running.
+	 * Otherwise the socket is left over from a daemon that died, and we
+	 * can reuse the path.
+	 */
+	if ((fd = sock_connect()) != -1) {
+		close(fd);
+		printf("The plan daemon is already running\n");
+		return (0);
+	}
+	unlink(sun.sun_path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd == -1 ||
+	    bind(lfd, (struct sockaddr *)&sun, sizeof (sun)) != 0 ||
+	    listen(lfd, 16) != 0) {
+		perror("plan daemon");
+		return (-1);
+	}
+	chmod(sun.sun_path, S_IRUSR | S_IWUSR);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("plan daemon");
+		return (-1);
+	}
+	if (pid != 0) {
+		close(lfd);
+		printf("plan daemon started (pid %d)\n", (int)pid);
+		return (0);
+	}
+
+	(void) setsid();
+	(void) signal(SIGPIPE, SIG_IGN);
+	fd = open("/dev/null", O_RDWR);
+	dup2(fd, STDIN_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+
+	for (;;) {
+		int ac;
+		char **av;
+		char *buf;
+		size_t len;
+
+		cfd = accept(lfd, NULL, NULL);
+		if (cfd == -1) {
+			continue;
+		}
+
+		if (read_req(cfd, &ac, &av, &buf, &len) != 0) {
+			close(cfd);
+			continue;
+		}
+
+		if (ac >= 2 && strcmp(av[0], "daemon") == 0 &&
+		    strcmp(av[1], "stop") == 0) {
+			dprintf(cfd, "plan daemon stopped\n");
+			close(cfd);
+			break;
+		}
+
+		serve(lfd, cfd, ac, av, dispatch);
+		close(cfd);
+		umem_free(av, (ac + 1) * sizeof (char *));
+		umem_free(buf, len + 1);
+	}
+
+	close(lfd);
+	unlink(sun.sun_path);
+	store->ps_sync();
+	wal_close();
+	names_close();
+	text_close();
+	store->ps_close();
+	exit(0);
+	return (0);
+}
@@ -0,0 +1,420 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <umem.h>
+#include <strings.h>
+#include "plan_impl.h"
+#include "plan_probes.h"
+
+/*
+ * The allocator that activities are placed into. It used to be a vmem arena
+ * spanning the 1440 minutes of a day, but vmem only exists on illumos, and
+ * all we ever asked of it was a run of free minutes between two bounds. So a
+ * day is now a bitmap with one bit per slot (a minute, by default), set while
+ * the slot is free.
+ *
+ * Runs of free slots are found a 64-bit word at a time: whole words of
+ * busy (or free) slots are skipped with a single compare, and the edges of
+ * a run are found by counting trailing zeros. The bits past the last slot
+ * are kept clear, so a run never extends past the end of the day.
+ *
+ * At the finer resolutions (see plan_res.c) a day is 86400 slots, or 1350
+ * words, and walking those a word at a time for every activity adds up. So
+ * there is a summary level above the words: a bit per word that's set if
+ * the word has any free slot (dm_some), and one that's set if every slot in
+ * it is free (dm_full). Looking for a free slot skips 64 words that have
+ * none with a single compare of dm_some, and looking for a busy one skips 64
+ * wholly free words with one of dm_full.
+ *
+ * The placement policies mirror the vmem ones we used: DM_FIRSTFIT takes the
+ * lowest run that fits, and DM_BESTFIT takes the smallest free run that fits
+ * (measuring the whole run, not just the part between the bounds), so that
+ * the big runs are left for the long activities. Either way, an activity goes
+ * at the start of its run, or at its lower bound if that's further along.
+ */
+
+#define	DM_WBITS	64
+#define	DM_ONES		(~(uint64_t)0)
+
+static int
+dm_ctz(uint64_t w)
+{
+	return (__builtin_ctzll(w));
+}
+
+static int
+dm_clz(uint64_t w)
+{
+	return (__builtin_clzll(w));
+}
+
+/*
+ * Returns the mask of the slots that word `w` holds (all but the last word
+ * hold 64).
+ */
+static uint64_t
+dm_wmask(daymap_t *dm, size_t w)
+{
+	if (w == dm->dm_nwords - 1 && dm->dm_nslots % DM_WBITS) {
+		return (DM_ONES >> (DM_WBITS - dm->dm_nslots % DM_WBITS));
+	}
+	return (DM_ONES);
+}
+
+/*
+ * Brings the summary bits of word `w` up to date.
+ */
+static void
+dm_sum(daymap_t *dm, size_t w)
+{
+	uint64_t bit = (uint64_t)1 << (w % DM_WBITS);
+
+	if (dm->dm_free[w] != 0) {
+		dm->dm_some[w / DM_WBITS] |= bit;
+	} else {
+		dm->dm_some[w / DM_WBITS] &= ~bit;
+	}
+	if (dm->dm_free[w] == dm_wmask(dm, w)) {
+		dm->dm_full[w / DM_WBITS] |= bit;
+	} else {
+		dm->dm_full[w / DM_WBITS] &= ~bit;
+	}
+}
+
+/*
+ * Sets (or clears) the bits of [start, start + len).
+ */
+static void
+dm_fill(daymap_t *dm, size_t start, size_t len, int free)
+{
+	size_t end = start + len;
+	size_t w;
+	uint64_t mask;
+
+	while (start < end) {
+		w = start / DM_WBITS;
+		mask = DM_ONES << (start % DM_WBITS);
+		if (end - w * DM_WBITS < DM_WBITS) {
+			mask &= DM_ONES >> (DM_WBITS - (end - w * DM_WBITS));
+		}
+		if (free) {
+			dm->dm_free[w] |= mask;
+		} else {
+			dm->dm_free[w] &= ~mask;
+		}
+		dm_sum(dm, w);
+		start = (w + 1) * DM_WBITS;
+	}
+}
+
+void
+daymap_free(daymap_t *dm, size_t start, size_t len)
+{
+	dm_fill(dm, start, len, 1);
+}
+
+/*
+ * Marks [start, start + len) busy, whether or not it was free. This is for
+ * time that is taken by something other than the activities being placed.
+ */
+void
+daymap_claim(daymap_t *dm, size_t start, size_t len)
+{
+	if (start >= dm->dm_nslots) {
+		return;
+	}
+	if (len > dm->dm_nslots - start) {
+		len = dm->dm_nslots - start;
+	}
+	dm_fill(dm, start, len, 0);
+}
+
+daymap_t *
+daymap_create(size_t nslots)
+{
+	daymap_t *dm = umem_zalloc(sizeof (daymap_t), UMEM_NOFAIL);
+
+	dm->dm_nslots = nslots;
+	dm->dm_nwords = (nslots + DM_WBITS - 1) / DM_WBITS;
+	dm->dm_nsum = (dm->dm_nwords + DM_WBITS - 1) / DM_WBITS;
+	dm->dm_free = umem_zalloc(dm->dm_nwords * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	dm->dm_some = umem_zalloc(dm->dm_nsum * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	dm->dm_full = umem_zalloc(dm->dm_nsum * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	daymap_free(dm, 0, nslots);
+	PLAN_DAYMAP_CREATE(dm);
+	return (dm);
+}
+
+void
+daymap_destroy(daymap_t *dm)
+{
+	umem_free(dm->dm_free, dm->dm_nwords * sizeof (uint64_t));
+	umem_free(dm->dm_some, dm->dm_nsum * sizeof (uint64_t));
+	umem_free(dm->dm_full, dm->dm_nsum * sizeof (uint64_t));
+	umem_free(dm, sizeof (daymap_t));
+}
+
+/*
+ * Returns the first word at or after `w` that has a free slot (if `free` is
+ * set) or a busy one (if it isn't), going by the summary. Returns dm_nwords
+ * if there is none.
+ */
+static size_t
+dm_sum_next(daymap_t *dm, size_t w, int free)
+{
+	size_t sw = w / DM_WBITS;
+	uint64_t bits;
+
+	if (w >= dm->dm_nwords) {
+		return (dm->dm_nwords);
+	}
+	bits = free ? dm->dm_some[sw] : ~dm->dm_full[sw];
+	bits &= DM_ONES << (w % DM_WBITS);
+	while (bits == 0) {
+		if (++sw == dm->dm_nsum) {
+			return (dm->dm_nwords);
+		}
+		bits = free ? dm->dm_some[sw] : ~dm->dm_full[sw];
+	}
+	w = sw * DM_WBITS + dm_ctz(bits);
+	return (w < dm->dm_nwords ? w : dm->dm_nwords);
+}
+
+/*
+ * Returns the first slot at or after `from` that is free (if `free` is set)
+ * or busy (if it isn't). Returns dm_nslots if there is none.
+ */
+static size_t
+dm_next(daymap_t *dm, size_t from, int free)
+{
+	size_t w = from / DM_WBITS;
+	uint64_t bits;
+
+	if (from >= dm->dm_nslots) {
+		return (dm->dm_nslots);
+	}
+	bits = free ? dm->dm_free[w] : ~dm->dm_free[w];
+	bits &= DM_ONES << (from % DM_WBITS);
+	if (bits == 0) {
+		if ((w = dm_sum_next(dm, w + 1, free)) == dm->dm_nwords) {
+			return (dm->dm_nslots);
+		}
+		bits = free ? dm->dm_free[w] : ~dm->dm_free[w];
+	}
+	from = w * DM_WBITS + dm_ctz(bits);
+	return (from < dm->dm_nslots ? from : dm->dm_nslots);
+}
+
+/*
+ * Returns the first slot of the free run that `slot` (a free slot) is in.
+ */
+static size_t
+dm_run_start(daymap_t *dm, size_t slot)
+{
+	size_t w = slot / DM_WBITS;
+	size_t sw;
+	uint64_t busy = ~dm->dm_free[w];
+	uint64_t part;
+
+	/*
+	 * Only look at the slots below `slot`.
+	 */
+	busy &= (slot % DM_WBITS) ? DM_ONES >> (DM_WBITS - slot % DM_WBITS) : 0;
+	if (busy != 0) {
+		return (w * DM_WBITS + (DM_WBITS - dm_clz(busy)));
+	}
+
+	/*
+	 * Find the last word below `w` that isn't wholly free.
+	 */
+	sw = w / DM_WBITS;
+	part = ~dm->dm_full[sw];
+	part &= (w % DM_WBITS) ? DM_ONES >> (DM_WBITS - w % DM_WBITS) : 0;
+	while (part == 0) {
+		if (sw == 0) {
+			return (0);
+		}
+		part = ~dm->dm_full[--sw];
+	}
+	w = sw * DM_WBITS + (DM_WBITS - 1 - dm_clz(part));
+	busy = ~dm->dm_free[w];
+	return (w * DM_WBITS + (DM_WBITS - dm_clz(busy)));
+}
+
+/*
+ * Finds `len` free slots, starting at or after `min` and ending at or before
+ * `max`, marks them busy, and returns the first one. Returns -1 if there's
+ * no room.
+ */
+int
+daymap_alloc(daymap_t *dm, size_t len, size_t min, size_t max, int flags)
+{
+	size_t best = 0;
+	size_t bestsz = 0;
+	size_t pos = min;
+	size_t start;
+	size_t end;
+	size_t rsz;
+	int loc = -1;
+
+	if (max > dm->dm_nslots) {
+		max = dm->dm_nslots;
+	}
+	while (len != 0 && pos + len <= max) {
+		if ((start = dm_next(dm, pos, 1)) + len > max) {
+			break;
+		}
+		end = dm_next(dm, start, 0);
+		if (start + len <= (end < max ? end : max)) {
+			rsz = end - (start == min ? dm_run_start(dm, start) :
+			    start);
+			if (bestsz == 0 || rsz < bestsz) {
+				best = start;
+				bestsz = rsz;
+			}
+			if ((flags & DM_FIRSTFIT) || rsz == len) {
+				break;
+			}
+		}
+		pos = end;
+	}
+
+	if (bestsz != 0) {
+		dm_fill(dm, best, len, 0);
+		loc = best;
+	}
+	PLAN_DAYMAP_ALLOC(loc, len, min, max);
+	return (loc);
+}
+
+/*
+ * Finds the first run of free slots at or after `from` that starts before
+ * `max`, and returns its bounds (the end clipped to `max`) in *start and
+ * *end. Returns -1 if there is none. This is for callers that weigh up where
+ * to put things themselves (see plan_pack.c), rather than use daymap_alloc.
+ */
+int
+daymap_run(daymap_t *dm, size_t from, size_t max, size_t *start, size_t *end)
+{
+	size_t s;
+	size_t e;
+
+	if (max > dm->dm_nslots) {
+		max = dm->dm_nslots;
+	}
+	if ((s = dm_next(dm, from, 1)) >= max) {
+		return (-1);
+	}
+	e = dm_next(dm, s, 0);
+	*start = s;
+	*end = (e < max ? e : max);
+	return (0);
+}
+
+/*
+ * Returns the first slot at or after `from` that starts `len` free slots
+ * ending at or before `max`, or dm_nslots if there's none.
+ */
+static size_t
+dm_fit(daymap_t *dm, size_t from, size_t len, size_t max)
+{
+	size_t start;
+	size_t end;
+
+	for (;;) {
+		if ((start = dm_next(dm, from, 1)) + len > max) {
+			return (dm->dm_nslots);
+		}
+		end = dm_next(dm, start, 0);
+		if (end - start >= len) {
+			return (start);
+		}
+		from = end;
+	}
+}
+
+/*
+ * Finds room for `n` runs of `len` free slots, one after the other, each at
+ * least `gap` slots after the end of the one before it, all between `min`
+ * and `max`, and (unless `spread` is 0) with no more than `spread` slots from
+ * the start of the first to the end of the last. Marks them busy, and puts
+ * where they start in locs[]. Returns -1 if there's no such room.
+ *
+ * This is how the chunks of an activity with constraints are placed: as one.
+ * Once the first run is down, putting each of the others as early as it will
+ * go leaves the most room for the ones after it, so for any first run, that
+ * is the only layout worth trying. And if the runs end up spread too far, no
+ * first run before the end of the last one, less the spread, can do better,
+ * so that's where we look next. Each try moves the first run along, and the
+ * whole search costs about as much as a daymap_alloc for each run.
+ */
+int
+daymap_alloc_chain(daymap_t *dm, size_t len, size_t n, size_t gap,
+    size_t spread, size_t min, size_t max, int *locs)
+{
+	size_t first;
+	size_t from = min;
+	size_t pos;
+	size_t i;
+
+	if (max > dm->dm_nslots) {
+		max = dm->dm_nslots;
+	}
+	if (len == 0 || n == 0) {
+		return (-1);
+	}
+
+	for (;;) {
+		if ((first = dm_fit(dm, from, len, max)) == dm->dm_nslots) {
+			return (-1);
+		}
+		pos = first;
+		locs[0] = first;
+		for (i = 1; i < n; i++) {
+			/*
+			 * A later first run would only push this one later,
+			 * so if it doesn't fit now, it never will.
+			 */
+			pos = dm_fit(dm, pos + len + gap, len, max);
+			if (pos == dm->dm_nslots) {
+				return (-1);
+			}
+			locs[i] = pos;
+		}
+		if (spread == 0 || pos + len - first <= spread) {
+			break;
+		}
+		from = pos + len - spread;
+	}
+
+	for (i = 0; i < n; i++) {
+		dm_fill(dm, locs[i], len, 0);
+	}
+	PLAN_DAYMAP_ALLOC(locs[0], len * n, min, max);
+	return (0);
+}
@@ -0,0 +1,479 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "plan_impl.h"
+
+/*
+ * Finding free time ("plan free"). Given a duration and a range of dates, we
+ * list the days that have a free block at least that long, with the longest
+ * free run each of them has, and where the first long enough block starts.
+ *
+ * A day's free time is what placement would see: the slots of its awake
+ * range, less what its own activities have taken, what the previous day
+ * carries over past midnight, and what the next day has taken (the awake
+ * range can run past midnight). Working that out takes a daymap and a walk
+ * of three days' activities, so we only do it for the days that differ: one
+ * of each weekday, which the dates the store doesn't have list as, and the
+ * dates it has, along with the days either side of them. The rest of a range
+ * costs a copy per date, so a year of mostly empty dates is as quick as a
+ * week.
+ *
+ * The longest free run of each day then goes into a segment tree, each node
+ * holding the longest run of the days under it. The days that can fit the
+ * duration are found by going down from the root, skipping any run of days
+ * that can't (however many there are) with one compare.
+ *
+ * The same days can be printed as minute maps instead (free_busy), for
+ * comparing with other plandbs, which may not have the same resolution.
+ */
+
+extern plan_store_t *store;
+extern size_t plan_slots;
+extern int plan_res;
+extern char *daystr[];
+extern scope_t plan_scope(day_t, tm_t *);
+extern void scope_to_tm(scope_t, tm_t *);
+extern void act_rec_free(act_rec_t *);
+extern void res_fmt_time(char *, size_t, int);
+extern void res_fmt_dur(char *, size_t, size_t);
+extern daymap_t *daymap_create(size_t);
+extern void daymap_destroy(daymap_t *);
+extern void daymap_free(daymap_t *, size_t, size_t);
+extern void daymap_claim(daymap_t *, size_t, size_t);
+extern int daymap_run(daymap_t *, size_t, size_t, size_t *, size_t *);
+extern void batch_flush(void);
+
+typedef struct free_day {
+	scope_t		fd_date;
+	scope_t		fd_scope;	/* what it lists as */
+	int		fd_wday;
+	size_t		fd_long;	/* its longest free run */
+	int		fd_first;	/* where the first fit starts, or -1 */
+} free_day_t;
+
+/*
+ * fq_days[] has a day either side of the range (the neighbours of its first
+ * and last days), so the range itself is fq_days[1] to fq_days[fq_ndays].
+ */
+typedef struct free_query {
+	free_day_t	*fq_days;
+	size_t		fq_ndays;
+	size_t		fq_next;	/* for the walk of the store's dates */
+	size_t		fq_dur;
+	daymap_t	*fq_map;
+	free_day_t	fq_wk[7];
+	uint8_t		fq_wkdone[7];
+	size_t		*fq_tree;
+	size_t		fq_nleaf;
+	uint64_t	fq_wkmins[7][MM_WORDS];
+	uint8_t		fq_wkminsdone[7];
+} free_query_t;
+
+static void
+free_have_cb(void *arg, scope_t s)
+{
+	free_query_t *fq = arg;
+
+	while (fq->fq_days[fq->fq_next].fd_date < s) {
+		fq->fq_next++;
+	}
+	fq->fq_days[fq->fq_next].fd_scope = s;
+}
+
+/*
+ * Claims the placed chunks of an activity in fc_map, fc_off slots after the
+ * start of the day they're placed in (fc_off is negative for the previous
+ * day, which only takes what it carries over past midnight).
+ */
+typedef struct free_claim {
+	daymap_t	*fc_map;
+	ssize_t		fc_off;
+} free_claim_t;
+
+static void
+free_claim_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	free_claim_t *fc = arg;
+	ssize_t start;
+	ssize_t end;
+	size_t i;
+
+	for (i = 0; i < r->ar_ntimes; i++) {
+		if (r->ar_time[i] < 0 || r->ar_dur == 0) {
+			continue;
+		}
+		start = r->ar_time[i] + fc->fc_off;
+		end = start + r->ar_dur;
+		if (end <= 0) {
+			continue;
+		}
+		if (start < 0) {
+			start = 0;
+		}
+		daymap_claim(fc->fc_map, start, end - start);
+	}
+	act_rec_free(r);
+}
+
+/*
+ * Works out the free time of fq_days[i], given its neighbours.
+ */
+static void
+free_day(free_query_t *fq, size_t i)
+{
+	free_day_t *fd = &fq->fq_days[i];
+	daymap_t *dm = fq->fq_map;
+	free_claim_t fc;
+	size_t base;
+	size_t off;
+	size_t end;
+	size_t from;
+	size_t rs;
+	size_t re;
+
+	fd->fd_long = 0;
+	fd->fd_first = -1;
+
+	store->ps_awake_get(fd->fd_scope, &base, &off);
+	end = base + off;
+	if (end > dm->dm_nslots) {
+		end = dm->dm_nslots;
+	}
+	daymap_claim(dm, 0, dm->dm_nslots);
+	if (base < end) {
+		daymap_free(dm, base, end - base);
+	}
+
+	fc.fc_map = dm;
+	fc.fc_off = -(ssize_t)plan_slots;
+	store->ps_act_walk(fq->fq_days[i - 1].fd_scope, 0, free_claim_act, &fc);
+	fc.fc_off = 0;
+	store->ps_act_walk(fd->fd_scope, 0, free_claim_act, &fc);
+	fc.fc_off = plan_slots;
+	store->ps_act_walk(fq->fq_days[i + 1].fd_scope, 0, free_claim_act,
+	    &fc);
+
+	from = base;
+	while (daymap_run(dm, from, end, &rs, &re) == 0) {
+		if (re - rs > fd->fd_long) {
+			fd->fd_long = re - rs;
+		}
+		if (fd->fd_first == -1 && re - rs >= fq->fq_dur) {
+			fd->fd_first = rs;
+		}
+		from = re;
+	}
+}
+
+/*
+ * A date the store doesn't have, between two others it doesn't have, is just
+ * its weekday (between the weekdays either side of it), so each weekday's
+ * free time is worked out once, the first time it's needed.
+ */
+static void
+free_fill(free_query_t *fq, size_t i)
+{
+	free_day_t *fd = &fq->fq_days[i];
+	int wd = fd->fd_wday;
+
+	if (PS_ISDATE(fq->fq_days[i - 1].fd_scope) ||
+	    PS_ISDATE(fd->fd_scope) || PS_ISDATE(fq->fq_days[i + 1].fd_scope)) {
+		free_day(fq, i);
+		return;
+	}
+	if (!fq->fq_wkdone[wd]) {
+		free_day(fq, i);
+		fq->fq_wk[wd] = *fd;
+		fq->fq_wkdone[wd] = 1;
+		return;
+	}
+	fd->fd_long = fq->fq_wk[wd].fd_long;
+	fd->fd_first = fq->fq_wk[wd].fd_first;
+}
+
+/*
+ * The tree is kept in an array, with the root at 1, the children of node n at
+ * 2n and 2n + 1, and the days at fq_nleaf onwards (the leaves past the last
+ * day are 0).
+ */
+static void
+free_tree(free_query_t *fq)
+{
+	size_t n;
+
+	fq->fq_nleaf = 1;
+	while (fq->fq_nleaf < fq->fq_ndays) {
+		fq->fq_nleaf *= 2;
+	}
+	fq->fq_tree = umem_zalloc(2 * fq->fq_nleaf * sizeof (size_t),
+	    UMEM_NOFAIL);
+	for (n = 0; n < fq->fq_ndays; n++) {
+		fq->fq_tree[fq->fq_nleaf + n] = fq->fq_days[n + 1].fd_long;
+	}
+	for (n = fq->fq_nleaf - 1; n > 0; n--) {
+		fq->fq_tree[n] = MAX(fq->fq_tree[2 * n],
+		    fq->fq_tree[2 * n + 1]);
+	}
+}
+
+/*
+ * Returns the first day (counting from 0) at or after day `d` that has a free
+ * run at least `dur` long, or fq_ndays if there's none. From d's leaf, we go
+ * up until there's a subtree to the right with a long enough run in it, then
+ * down that subtree, keeping to the left.
+ */
+static size_t
+free_next(free_query_t *fq, size_t d, size_t dur)
+{
+	size_t n = fq->fq_nleaf + d;
+
+	if (d >= fq->fq_ndays) {
+		return (fq->fq_ndays);
+	}
+	while (fq->fq_tree[n] < dur) {
+		while (n & 1) {
+			if (n == 1) {
+				return (fq->fq_ndays);
+			}
+			n >>= 1;
+		}
+		n++;
+	}
+	while (n < fq->fq_nleaf) {
+		n *= 2;
+		if (fq->fq_tree[n] < dur) {
+			n++;
+		}
+	}
+	return (n - fq->fq_nleaf);
+}
+
+/*
+ * Sets fq up for the days from `from` to `to`: counts them, then fills in
+ * their dates (and what they list as), from the day before `from` to the day
+ * after `to`.
+ */
+static void
+free_setup(free_query_t *fq, scope_t from, scope_t to)
+{
+	free_day_t *fd;
+	tm_t tm;
+	size_t i;
+
+	batch_flush();
+
+	bzero(fq, sizeof (*fq));
+	scope_to_tm(from, &tm);
+	while (plan_scope(-1, &tm) <= to) {
+		fq->fq_ndays++;
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		(void) mktime(&tm);
+	}
+	fq->fq_days = umem_zalloc((fq->fq_ndays + 2) * sizeof (free_day_t),
+	    UMEM_NOFAIL);
+	scope_to_tm(from, &tm);
+	tm.tm_mday--;
+	for (i = 0; i < fq->fq_ndays + 2; i++) {
+		tm.tm_isdst = -1;
+		(void) mktime(&tm);
+		fd = &fq->fq_days[i];
+		fd->fd_date = plan_scope(-1, &tm);
+		fd->fd_wday = tm.tm_wday;
+		fd->fd_scope = tm.tm_wday;
+		tm.tm_mday++;
+	}
+	store->ps_range(fq->fq_days[0].fd_date,
+	    fq->fq_days[fq->fq_ndays + 1].fd_date, free_have_cb, fq);
+	fq->fq_map = daymap_create(PD_SPANS * plan_slots);
+}
+
+static void
+free_teardown(free_query_t *fq)
+{
+	daymap_destroy(fq->fq_map);
+	umem_free(fq->fq_days, (fq->fq_ndays + 2) * sizeof (free_day_t));
+}
+
+/*
+ * Lists the days from `from` to `to` (inclusive) that have `dur` slots of free
+ * time in a row. Returns the number of them.
+ */
+int
+free_find(size_t dur, scope_t from, scope_t to)
+{
+	free_query_t fq;
+	free_day_t *fd;
+	char long_fmt[RES_FMTLEN];
+	char time_fmt[RES_FMTLEN];
+	char dur_fmt[RES_FMTLEN];
+	size_t n;
+	size_t i;
+	int cnt = 0;
+
+	free_setup(&fq, from, to);
+	fq.fq_dur = dur;
+	for (i = 1; i <= fq.fq_ndays; i++) {
+		free_fill(&fq, i);
+	}
+	free_tree(&fq);
+
+	res_fmt_dur(dur_fmt, sizeof (dur_fmt), dur);
+	for (n = free_next(&fq, 0, dur); n < fq.fq_ndays;
+	    n = free_next(&fq, n + 1, dur)) {
+		fd = &fq.fq_days[n + 1];
+		if (cnt == 0) {
+			printf("%-10s %-9s %7s %7s\n", "DATE", "DAY",
+			    "LONGEST", "FIRST");
+		}
+		res_fmt_dur(long_fmt, sizeof (long_fmt), fd->fd_long);
+		res_fmt_time(time_fmt, sizeof (time_fmt), fd->fd_first);
+		printf("%04d-%02d-%02d %-9s %7s %7s\n", fd->fd_date / 10000,
+		    (fd->fd_date / 100) % 100, fd->fd_date % 100,
+		    daystr[fd->fd_wday], long_fmt, time_fmt);
+		cnt++;
+	}
+	if (cnt == 0) {
+		printf("No day has %s free in a row.\n", dur_fmt);
+	} else {
+		printf("(%d/%lu days have %s free)\n", cnt,
+		    (ulong_t)fq.fq_ndays, dur_fmt);
+	}
+
+	umem_free(fq.fq_tree, 2 * fq.fq_nleaf * sizeof (size_t));
+	free_teardown(&fq);
+	return (cnt);
+}
+
+/*
+ * Marks the minutes from `m0` up to `m1` free in a minute map.
+ */
+static void
+mm_clear(uint64_t *mm, size_t m0, size_t m1)
+{
+	size_t w;
+	uint64_t mask;
+
+	while (m0 < m1) {
+		w = m0 / 64;
+		mask = ~(uint64_t)0 << (m0 % 64);
+		if (m1 - w * 64 < 64) {
+			mask &= ~(uint64_t)0 >> (64 - (m1 - w * 64));
+		}
+		mm[w] &= ~mask;
+		m0 = (w + 1) * 64;
+	}
+}
+
+/*
+ * Fills in the minute map of fq_days[i], by the clock: a minute is busy unless
+ * it's in the day's awake range, or the part of the previous day's that runs
+ * past midnight, and no activity (the day's own, or the previous day's) has
+ * any of it. Unlike free_day, nothing after midnight counts; that belongs to
+ * the next day's map.
+ */
+static void
+free_day_mins(free_query_t *fq, size_t i, uint64_t *mm)
+{
+	free_day_t *fd = &fq->fq_days[i];
+	daymap_t *dm = fq->fq_map;
+	free_claim_t fc;
+	size_t base;
+	size_t off;
+	size_t from;
+	size_t rs;
+	size_t re;
+
+	daymap_claim(dm, 0, dm->dm_nslots);
+	store->ps_awake_get(fd->fd_scope, &base, &off);
+	if (base < plan_slots) {
+		daymap_free(dm, base, MIN(base + off, plan_slots) - base);
+	}
+	store->ps_awake_get(fq->fq_days[i - 1].fd_scope, &base, &off);
+	if (base + off > plan_slots) {
+		daymap_free(dm, 0, MIN(base + off - plan_slots, plan_slots));
+	}
+
+	fc.fc_map = dm;
+	fc.fc_off = -(ssize_t)plan_slots;
+	store->ps_act_walk(fq->fq_days[i - 1].fd_scope, 0, free_claim_act, &fc);
+	fc.fc_off = 0;
+	store->ps_act_walk(fd->fd_scope, 0, free_claim_act, &fc);
+
+	/*
+	 * A slot can be longer or shorter than a minute, so a minute is only
+	 * free if every slot it overlaps is.
+	 */
+	(void) memset(mm, 0xff, MM_WORDS * sizeof (uint64_t));
+	from = 0;
+	while (daymap_run(dm, from, plan_slots, &rs, &re) == 0) {
+		mm_clear(mm, (rs * plan_res + 59) / 60, re * plan_res / 60);
+		from = re;
+	}
+}
+
+/*
+ * Prints the minute map of every day from `from` to `to`, a line a day: the
+ * date, and then MM_WORDS words, in hex. This is what "plan avail" reads from
+ * each plandb it's given. As with free_find, a date that is only its weekday,
+ * after another that is only its weekday, is worked out once per weekday.
+ */
+int
+free_busy(scope_t from, scope_t to)
+{
+	free_query_t fq;
+	uint64_t mm[MM_WORDS];
+	free_day_t *fd;
+	size_t i;
+	int w;
+
+	free_setup(&fq, from, to);
+	for (i = 1; i <= fq.fq_ndays; i++) {
+		fd = &fq.fq_days[i];
+		if (PS_ISDATE(fq.fq_days[i - 1].fd_scope) ||
+		    PS_ISDATE(fd->fd_scope)) {
+			free_day_mins(&fq, i, mm);
+		} else {
+			if (!fq.fq_wkminsdone[fd->fd_wday]) {
+				free_day_mins(&fq, i, fq.fq_wkmins[fd->fd_wday]);
+				fq.fq_wkminsdone[fd->fd_wday] = 1;
+			}
+			bcopy(fq.fq_wkmins[fd->fd_wday], mm, sizeof (mm));
+		}
+		printf("%d", fd->fd_date);
+		for (w = 0; w < MM_WORDS; w++) {
+			printf(" %016llx", (unsigned long long)mm[w]);
+		}
+		printf("\n");
+	}
+	free_teardown(&fq);
+	return (0);
+}
@@ -23,6 +23,7 @@
  */
 
 #include <sys/avl.h>
+#include <stdint.h>
 
 #define	CMP_DATE(x, y)\
 	(x->tm_year == y->tm_year &&\
@@ -34,6 +35,7 @@
 #define	LS_IS_PRDAY(f)	(f & 4)
 #define	LS_IS_PRBOTH(f)	(f & 8)
 #define LS_IS_DESC(f)	(f & 16)
+#define	LS_IS_SUM(f)	(f & 32)
 
 #define	THIS	0
 #define	GEN	1
@@ -61,6 +63,7 @@ typedef enum err {
 	TIME_ENODUR,
 	TIME_ELENGTH,
 	TIME_ECHUNK,
+	TIME_ECONFLICT,
 	TIME_TD,
 	RA_EFIT,
 	RA_EARRA,
@@ -71,8 +74,19 @@ typedef enum err {
 	DESTROY_TD_EEXIST,
 	RN_ENEWEXIST,
 	RN_TD_ENEWEXIST,
+	CHUNK_EEXIST,
+	CHUNK_ESPREAD,
 } err_t;
 
+/*
+ * Times and durations are counted in slots of plan_res seconds (a minute,
+ * unless the database has been set to another resolution, see plan_res.c),
+ * and there are plan_slots of them in a day.
+ */
+#define	RES_DEFAULT	60
+#define	RES_DAYSECS	86400
+#define	RES_FMTLEN	16
+
 typedef struct todo {
 	size_t		td_name_len;
 	char		*td_name;
@@ -82,26 +96,270 @@ typedef struct todo {
 } todo_t;
 
 
-typedef struct act {
-	size_t		act_name_len;
-	char		act_dyn;
-	day_t		act_day;
-	tm_t		act_date;
-	char		*act_name;
-	int		act_time;
-	size_t		act_dur;
-	char		*act_det;
-	char		*act_vmmin;
-	char		*act_vmmax;
-	char		*act_loc;
-	int		act_fd_dur;
-	int		act_fd_time;
-} act_t;
+/*
+ * A bump allocator for data that's thrown away all at once (see
+ * plan_arena.c).
+ */
+typedef struct arena {
+	struct arena_blk *ar_head;	/* the block being allocated from */
+} arena_t;
+
+/*
+ * A table of interned names, each with a small integer id (see
+ * plan_intern.c).
+ */
+typedef struct intern_ent {
+	char		*ie_name;
+	size_t		ie_len;
+	uint32_t	ie_hash;
+} intern_ent_t;
+
+typedef struct intern {
+	uint32_t	*in_hash;	/* ids + 1, 0 for an empty slot */
+	size_t		in_nhash;
+	intern_ent_t	*in_ents;	/* by id */
+	size_t		in_n;
+	arena_t		in_arena;	/* the names */
+} intern_t;
+
+/*
+ * A set of intervals of slots, [iv_start, iv_end), that can be asked which of
+ * them overlap a given interval (see plan_itree.c). iv_id is the caller's.
+ */
+typedef struct ival {
+	int		iv_start;
+	int		iv_end;
+	uint32_t	iv_id;
+} ival_t;
+
+typedef struct itree {
+	ival_t		*it_ivs;	/* by start */
+	int		*it_maxend;
+	size_t		it_n;
+} itree_t;
+
+typedef void (*itree_walk_f)(void *, ival_t *, ival_t *);
+
+/*
+ * A day's minutes by the clock, as a bitmap with a set bit for each busy one
+ * (see plan_avail.c). It's padded to three cache lines, and the minutes past
+ * the end of the day are always busy.
+ */
+#define	MM_MINS		1440
+#define	MM_WORDS	24
+
+/*
+ * The part of an activity that placing it never looks at: its name, details
+ * and chunk constraints (see act_rec_t). There is one of these per activity,
+ * shared by all of its chunks, and its index is the id of the activity's
+ * name in pd_names.
+ */
+typedef struct act_cold {
+	char		*ac_name;
+	size_t		ac_name_len;
+	char		*ac_det;
+	size_t		ac_gap;
+	size_t		ac_spread;
+} act_cold_t;
+
+#define	ACT_FDYN	0x1	/* placed anywhere within the awake range */
+#define	ACT_FDIRTY	0x2	/* its record is new (overlaid) */
+#define	ACT_FCHAINED	0x4	/* its chunks are placed together */
 
 #define	RAE_CODE_SUCCESS	0
 #define	RAE_CODE_FIT		1
 #define	RAE_CODE_ARRANGE 	2
 typedef struct ra_err {
 	int		rae_code;
-	act_t		*rae_act;
+	size_t		rae_idx;	/* the chunk that didn't fit */
 } ra_err_t;
+
+/*
+ * The slots of a day that activities are placed into (see plan_daymap.c).
+ * A set bit in dm_free is a free slot. dm_some and dm_full summarize dm_free,
+ * with a bit per word.
+ */
+typedef struct daymap {
+	size_t		dm_nslots;
+	size_t		dm_nwords;
+	size_t		dm_nsum;
+	uint64_t	*dm_free;
+	uint64_t	*dm_some;
+	uint64_t	*dm_full;
+} daymap_t;
+
+#define	DM_BESTFIT	0x1
+#define	DM_FIRSTFIT	0x2
+
+/*
+ * How the dynamic activities of a day are placed (PLAN_SCHED): one at a time,
+ * each in the gap that fits it best, or, if that leaves one out, by searching
+ * for an arrangement that fits them all (see plan_pack.c).
+ */
+#define	SCHED_BESTFIT	0
+#define	SCHED_PACK	1
+
+/*
+ * An activity can run past midnight, into the next day, so a day's daymap
+ * spans PD_SPANS days: the day itself, followed by the next one. Before a day
+ * is placed, whatever the previous day carries over past midnight is claimed
+ * at the start of the first span, and the next day's static activities are
+ * claimed in the second (pd_fenced is set while they are).
+ */
+#define	PD_SPANS	2
+
+/*
+ * A day that is being (re)allocated: the activities read from the store, the
+ * daymap they're placed in, and the outcome. Only one thread may use a
+ * plan_day_t at a time, so threads that place days in parallel each need
+ * their own (and their own daymap).
+ *
+ * The activities are kept as a struct of arrays, with an entry per chunk
+ * (the chunks of an activity are adjacent). What placement goes over, the
+ * times, durations, bounds and flags, is in arrays of its own, so a day with
+ * thousands of chunks is placed and totalled up over a few dense arrays.
+ * Everything else is in pd_cold[], an entry per activity, which pd_act[]
+ * points chunks at. The arrays grow as needed.
+ */
+typedef struct plan_day {
+	daymap_t	*pd_map;
+	int		*pd_time;	/* its start time, or -1 */
+	int		*pd_loc;	/* where it was placed, or -1 */
+	int		*pd_prev;	/* where it was when read, or -1 */
+	size_t		*pd_dur;
+	size_t		*pd_min;	/* where it may be placed */
+	size_t		*pd_max;
+	uint8_t		*pd_flags;
+	uint32_t	*pd_act;	/* its activity's id (in pd_cold[]) */
+	size_t		pd_maxacts;
+	size_t		pd_elems;
+	act_cold_t	*pd_cold;
+	size_t		pd_maxcold;
+	size_t		pd_ncold;
+	intern_t	pd_names;
+	arena_t		pd_arena;	/* details */
+	day_t		pd_day;		/* -1 for a date */
+	tm_t		pd_date;
+	int		pd_fenced;
+	ra_err_t	pd_err;
+} plan_day_t;
+
+#define	PD_DYN(pd, j)		((pd)->pd_flags[j] & ACT_FDYN)
+#define	PD_CHAINED(pd, j)	((pd)->pd_flags[j] & ACT_FCHAINED)
+#define	PD_COLD(pd, j)		(&(pd)->pd_cold[(pd)->pd_act[j]])
+#define	PD_NAME(pd, j)		(PD_COLD(pd, j)->ac_name)
+
+/*
+ * A day's occupancy, as the store keeps it (see plan_occ.c): an occ_hdr_t,
+ * followed by two maps of do_nwords words each, with a bit per slot of the
+ * day's PD_SPANS days. The first has the slots that any of the day's chunks
+ * take, and the second the ones its static chunks take. A lo greater than
+ * its hi means there are no chunks of that kind.
+ */
+typedef struct occ_hdr {
+	uint64_t	oh_busy;	/* how long the placed chunks take */
+	uint32_t	oh_nslots;	/* plan_slots, when it was made */
+	uint32_t	oh_unplaced;	/* dynamic chunks that have no time */
+	uint32_t	oh_over;	/* chunks that run off the map */
+	int32_t		oh_stalo;	/* where the static chunks start */
+	int32_t		oh_stahi;	/* and end */
+	int32_t		oh_dynlo;	/* likewise for the dynamic ones */
+	int32_t		oh_dynhi;
+} occ_hdr_t;
+
+typedef struct day_occ {
+	occ_hdr_t	*do_hdr;	/* the start of the whole thing */
+	uint64_t	*do_all;
+	uint64_t	*do_sta;
+	size_t		do_nwords;	/* in each map */
+	size_t		do_size;	/* of the whole thing */
+} day_occ_t;
+
+/*
+ * Every day or date that holds activities or todos is addressed by a scope.
+ * Weekday templates are the day_t values (0..6), dates are encoded as
+ * YYYYMMDD, and the general todo list has a scope of its own.
+ */
+typedef int32_t scope_t;
+#define	PS_GENERAL	(-1)
+#define	PS_ISDATE(s)	((s) > SAT)
+
+/*
+ * This is the persistent part of an activity, as the storage backends see it.
+ * A chunked activity has one start time per chunk; unplaced chunks have a
+ * start time of -1. The chunks of an activity that has a gap or a spread (in
+ * slots, 0 if it has none) are placed together, in order, with at least
+ * ar_gap slots between one and the next, and no more than ar_spread from the
+ * start of the first to the end of the last.
+ */
+typedef struct act_rec {
+	char		ar_dyn;
+	size_t		ar_dur;
+	size_t		ar_ntimes;
+	int		*ar_time;
+	size_t		ar_gap;
+	size_t		ar_spread;
+} act_rec_t;
+
+/*
+ * The walk callbacks are handed the name, record and (optionally) details of
+ * every activity or todo in a scope. The callback owns the act_rec_t and must
+ * act_rec_free() it. The name and details are only valid during the call.
+ */
+typedef void (*act_walk_f)(void *, char *, act_rec_t *, char *);
+typedef void (*todo_walk_f)(void *, char *, int, char *);
+typedef void (*scope_walk_f)(void *, scope_t);
+
+/*
+ * The kinds of names kept in the name index (plan_names.c).
+ */
+typedef enum nm_kind {
+	NM_ACT,
+	NM_TODO
+} nm_kind_t;
+
+typedef void (*names_walk_f)(void *, nm_kind_t, scope_t);
+
+/*
+ * A storage backend. The manip code never touches the file system directly,
+ * it goes through one of these. All of the functions return 0 on success and
+ * -1 if the named activity or todo doesn't exist (or, for create and rename,
+ * already exists). ps_sync brings a long-running process up to date with
+ * changes made to the store by other processes, and ps_flush makes every
+ * change made so far durable. ps_range calls back with every date (between
+ * two dates, inclusive) that exists, in order, without having to probe the
+ * dates that don't. ps_act_count says how many activities a scope has, so
+ * that a walk's caller can make room for them all up front. ps_occ_get reads a
+ * day's occupancy (see day_occ_t) into a buffer of the given size, and returns
+ * -1 if the store has none of that size, and ps_occ_put keeps one. Creating,
+ * changing or destroying any of a day's activities drops its occupancy, so a
+ * store never hands back one that is out of date.
+ */
+typedef struct plan_store {
+	const char	*ps_name;
+	int		(*ps_open)(int);
+	void		(*ps_close)(void);
+	void		(*ps_sync)(void);
+	void		(*ps_flush)(void);
+	int		(*ps_have)(scope_t);
+	void		(*ps_walk)(scope_walk_f, void *);
+	void		(*ps_range)(scope_t, scope_t, scope_walk_f, void *);
+	void		(*ps_awake_get)(scope_t, size_t *, size_t *);
+	void		(*ps_awake_put)(scope_t, size_t, size_t);
+	int		(*ps_act_create)(scope_t, char *);
+	int		(*ps_act_destroy)(scope_t, char *);
+	int		(*ps_act_rename)(scope_t, char *, char *);
+	int		(*ps_act_get)(scope_t, char *, act_rec_t *);
+	int		(*ps_act_put)(scope_t, char *, act_rec_t *);
+	int		(*ps_act_det)(scope_t, char *, char *);
+	void		(*ps_act_walk)(scope_t, int, act_walk_f, void *);
+	size_t		(*ps_act_count)(scope_t);
+	int		(*ps_occ_get)(scope_t, void *, size_t);
+	void		(*ps_occ_put)(scope_t, void *, size_t);
+	int		(*ps_todo_create)(scope_t, char *);
+	int		(*ps_todo_destroy)(scope_t, char *);
+	int		(*ps_todo_rename)(scope_t, char *, char *);
+	int		(*ps_todo_time)(scope_t, char *, int);
+	int		(*ps_todo_det)(scope_t, char *, char *);
+	void		(*ps_todo_walk)(scope_t, int, todo_walk_f, void *);
+} plan_store_t;
@@ -0,0 +1,1198 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+
+#include <sys/types.h>
+#include <sys/avl.h>
+#include <stddef.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "plan_impl.h"
+
+/*
+ * Here we import calendar data (CSV or iCalendar) into the plandb, and export
+ * it back out. Both directions stream: we never hold more than IMP_FLUSH
+ * events, or more than one day of the plandb, in memory.
+ *
+ * Imported events are grouped by date. Each date's activities are created,
+ * their records are staged in the overlay, and every date is then placed
+ * exactly once, by resched_scopes() (which places dates in parallel and
+ * commits them all in one WAL transaction). Importing an event one command at
+ * a time would reschedule its date once per event.
+ *
+ * The CSV format is one event per line:
+ *
+ *	date,name,start,duration,details
+ *	2013-04-01,gym,07:30,01h00m,
+ *	2013-04-01,reading,,00h30m*2,"chapters 3, 4"
+ *	2013-04-01,@taxes,17:00,,
+ *
+ * The date is YYYY-MM-DD (or YYYYMMDD). An empty start makes the activity
+ * dynamic. The duration is written like the one in `plan set duration` (or is
+ * a number of minutes). Names starting with '@' are todos, whose start is the
+ * time they're due. The header line is optional. Times and durations that
+ * don't fall on the plandb's resolution are rounded to it (starts down, and
+ * durations up).
+ *
+ * From iCalendar files, we take every VEVENT's DTSTART, DTEND or DURATION,
+ * SUMMARY, and DESCRIPTION. Timed events become static activities, and
+ * all-day events become todos. Recurrence rules aren't expanded, and events
+ * that run past midnight are cut short at midnight.
+ */
+
+extern int create_act(char *, day_t, tm_t *);
+extern int create_todo(char *, day_t, tm_t *);
+extern int set_time_todo(char *, int, tm_t *, int);
+extern int set_details_act(char *, int, tm_t *, char *);
+extern int set_details_todo(char *, int, tm_t *, char *);
+extern void stage_act(scope_t, char *, act_rec_t *);
+extern void resched_scopes(scope_t *, size_t);
+
+extern plan_store_t *store;
+extern void scope_to_tm(scope_t, tm_t *);
+extern void act_rec_init(act_rec_t *, size_t);
+extern void act_rec_free(act_rec_t *);
+
+extern int plan_res;
+extern size_t plan_slots;
+extern void res_fmt_time(char *, size_t, int);
+extern void res_fmt_dur(char *, size_t, size_t);
+
+#define	IMP_FLUSH	4096
+#define	IMP_MAXNAME	200
+#define	CSV_NFIELDS	5
+
+typedef struct imp_ev {
+	struct imp_ev	*ie_next;
+	char		*ie_name;
+	char		*ie_det;
+	int		ie_todo;
+	int		ie_time;	/* slots since 00:00, or -1 */
+	size_t		ie_dur;		/* slots per chunk */
+	size_t		ie_chunks;
+} imp_ev_t;
+
+typedef struct imp_day {
+	avl_node_t	id_node;
+	scope_t		id_scope;
+	imp_ev_t	*id_evs;
+	imp_ev_t	**id_tail;
+} imp_day_t;
+
+/*
+ * A growable buffer, that the CSV and iCalendar readers read into.
+ */
+typedef struct imp_buf {
+	char		*ib_buf;
+	size_t		ib_sz;
+	size_t		ib_len;
+} imp_buf_t;
+
+static avl_tree_t imp_days;
+static size_t imp_nbuf;
+static size_t imp_nevs;
+static size_t imp_ndays;
+static size_t imp_nskip;
+static size_t imp_ntrunc;
+
+static int
+imp_day_cmp(const void *l, const void *r)
+{
+	const imp_day_t *ld = l;
+	const imp_day_t *rd = r;
+
+	if (ld->id_scope < rd->id_scope) {
+		return (-1);
+	}
+	if (ld->id_scope > rd->id_scope) {
+		return (1);
+	}
+	return (0);
+}
+
+static char *
+imp_strdup(const char *str)
+{
+	size_t len = strlen(str);
+	char *dup = umem_zalloc(len + 1, UMEM_NOFAIL);
+
+	bcopy(str, dup, len);
+	return (dup);
+}
+
+static void
+imp_strfree(char *str)
+{
+	if (str != NULL) {
+		umem_free(str, strlen(str) + 1);
+	}
+}
+
+static void
+buf_putc(imp_buf_t *b, char c)
+{
+	if (b->ib_len == b->ib_sz) {
+		size_t nsz = b->ib_sz ? b->ib_sz * 2 : 256;
+		char *nbuf = umem_alloc(nsz, UMEM_NOFAIL);
+		if (b->ib_sz) {
+			bcopy(b->ib_buf, nbuf, b->ib_len);
+			umem_free(b->ib_buf, b->ib_sz);
+		}
+		b->ib_buf = nbuf;
+		b->ib_sz = nsz;
+	}
+	b->ib_buf[b->ib_len++] = c;
+}
+
+static void
+buf_free(imp_buf_t *b)
+{
+	if (b->ib_sz) {
+		umem_free(b->ib_buf, b->ib_sz);
+	}
+	bzero(b, sizeof (imp_buf_t));
+}
+
+/*
+ * Names become file names in the xattr backend, so they can't hold a '/'. We
+ * also keep them short enough to leave room for the suffix that tells apart
+ * events of the same name on the same date.
+ */
+static void
+imp_name(const char *in, char *out)
+{
+	size_t i = 0;
+
+	while (*in == ' ' || *in == '@') {
+		in++;
+	}
+	while (in[i] != '\0' && i < IMP_MAXNAME) {
+		out[i] = (in[i] == '/' || in[i] == '\n' || in[i] == '\r') ?
+		    '-' : in[i];
+		i++;
+	}
+	out[i] = '\0';
+	if (i == 0) {
+		(void) strcpy(out, "untitled");
+	}
+}
+
+static int
+imp_have(imp_day_t *id, char *n, int todo)
+{
+	imp_ev_t *ie = id->id_evs;
+
+	while (ie != NULL) {
+		if (ie->ie_todo == todo && strcmp(ie->ie_name, n) == 0) {
+			return (1);
+		}
+		ie = ie->ie_next;
+	}
+	return (0);
+}
+
+static void imp_flush(void);
+
+/*
+ * Buffers an event until the next flush.
+ */
+static void
+imp_add(scope_t s, const char *name, int todo, int time, size_t dur,
+    size_t chunks, const char *det)
+{
+	imp_day_t key;
+	imp_day_t *id;
+	imp_ev_t *ie;
+	char n[IMP_MAXNAME + 16];
+	size_t nlen;
+	int dup = 1;
+
+	key.id_scope = s;
+	if ((id = avl_find(&imp_days, &key, NULL)) == NULL) {
+		id = umem_zalloc(sizeof (imp_day_t), UMEM_NOFAIL);
+		id->id_scope = s;
+		id->id_tail = &id->id_evs;
+		avl_add(&imp_days, id);
+	}
+
+	imp_name(name, n);
+	nlen = strlen(n);
+	while (imp_have(id, n, todo)) {
+		dup++;
+		(void) snprintf(n + nlen, sizeof (n) - nlen, "-%d", dup);
+	}
+
+	ie = umem_zalloc(sizeof (imp_ev_t), UMEM_NOFAIL);
+	ie->ie_name = imp_strdup(n);
+	ie->ie_det = (det != NULL && *det != '\0') ? imp_strdup(det) : NULL;
+	ie->ie_todo = todo;
+	ie->ie_time = time;
+	ie->ie_dur = dur;
+	ie->ie_chunks = chunks;
+	*id->id_tail = ie;
+	id->id_tail = &ie->ie_next;
+
+	imp_nevs++;
+	if (++imp_nbuf == IMP_FLUSH) {
+		imp_flush();
+	}
+}
+
+/*
+ * Writes out every buffered event, and then places all of the dates that got
+ * new activities.
+ */
+static void
+imp_flush(void)
+{
+	imp_day_t *id;
+	imp_ev_t *ie;
+	scope_t *scopes;
+	size_t n = 0;
+	size_t sz;
+	act_rec_t r;
+	tm_t tm;
+	void *cookie = NULL;
+
+	if (avl_numnodes(&imp_days) == 0) {
+		return;
+	}
+
+	sz = avl_numnodes(&imp_days) * sizeof (scope_t);
+	scopes = umem_alloc(sz, UMEM_NOFAIL);
+
+	for (id = avl_first(&imp_days); id != NULL;
+	    id = AVL_NEXT(&imp_days, id)) {
+		int acts = 0;
+
+		scope_to_tm(id->id_scope, &tm);
+		for (ie = id->id_evs; ie != NULL; ie = ie->ie_next) {
+			if (ie->ie_todo) {
+				(void) create_todo(ie->ie_name, -1, &tm);
+				if (ie->ie_time >= 0) {
+					(void) set_time_todo(ie->ie_name, -1,
+					    &tm, ie->ie_time);
+				}
+				if (ie->ie_det) {
+					(void) set_details_todo(ie->ie_name,
+					    -1, &tm, ie->ie_det);
+				}
+				continue;
+			}
+
+			/*
+			 * If the activity already exists (say, we're importing
+			 * the same file again), we overwrite it.
+			 */
+			(void) create_act(ie->ie_name, -1, &tm);
+			if (ie->ie_det) {
+				(void) set_details_act(ie->ie_name, -1, &tm,
+				    ie->ie_det);
+			}
+			act_rec_init(&r, ie->ie_chunks);
+			r.ar_dur = ie->ie_dur;
+			r.ar_dyn = (ie->ie_time == -1 || ie->ie_chunks > 1);
+			if (!r.ar_dyn) {
+				r.ar_time[0] = ie->ie_time;
+			}
+			stage_act(id->id_scope, ie->ie_name, &r);
+			act_rec_free(&r);
+			acts = 1;
+		}
+		if (acts) {
+			scopes[n++] = id->id_scope;
+		}
+	}
+
+	resched_scopes(scopes, n);
+	umem_free(scopes, sz);
+
+	while ((id = avl_destroy_nodes(&imp_days, &cookie)) != NULL) {
+		while ((ie = id->id_evs) != NULL) {
+			id->id_evs = ie->ie_next;
+			imp_strfree(ie->ie_name);
+			imp_strfree(ie->ie_det);
+			umem_free(ie, sizeof (imp_ev_t));
+		}
+		umem_free(id, sizeof (imp_day_t));
+		imp_ndays++;
+	}
+	imp_nbuf = 0;
+}
+
+/*
+ * Turns a date (YYYY-MM-DD or YYYYMMDD) into a scope. Returns -1 if the date
+ * isn't valid.
+ */
+static scope_t
+imp_date(const char *str)
+{
+	int y;
+	int m;
+	int d;
+	char junk;
+	tm_t tm;
+
+	if (sscanf(str, "%4d-%2d-%2d%c", &y, &m, &d, &junk) != 3 &&
+	    (strlen(str) != 8 ||
+	    sscanf(str, "%4d%2d%2d%c", &y, &m, &d, &junk) != 3)) {
+		return (-1);
+	}
+
+	bzero(&tm, sizeof (tm_t));
+	tm.tm_year = y - 1900;
+	tm.tm_mon = m - 1;
+	tm.tm_mday = d;
+	tm.tm_hour = 12;
+	tm.tm_isdst = -1;
+	(void) mktime(&tm);
+	if (tm.tm_year != y - 1900 || tm.tm_mon != m - 1 || tm.tm_mday != d) {
+		return (-1);
+	}
+	return (y * 10000 + m * 100 + d);
+}
+
+/*
+ * Converts seconds to slots, rounding down (or up, if `up` is set).
+ */
+static long
+imp_slots(long secs, int up)
+{
+	return ((secs + (up ? plan_res - 1 : 0)) / plan_res);
+}
+
+/*
+ * Parses "hh:mm" (or "hh:mm:ss") into slots since 00:00.
+ */
+static int
+imp_time(const char *str)
+{
+	int h;
+	int m;
+	int sec = 0;
+	char junk;
+	int n = sscanf(str, "%2d:%2d:%2d%c", &h, &m, &sec, &junk);
+
+	if ((n != 2 && n != 3) || h < 0 || h > 23 || m < 0 || m > 59 ||
+	    sec < 0 || sec > 59) {
+		return (-1);
+	}
+	return (imp_slots(h * 3600 + m * 60 + sec, 0));
+}
+
+/*
+ * Parses a duration, written as <hrs>h<mins>m or <hrs>h<mins>m<secs>s (with an
+ * optional *<chunks>), or as a number of minutes, into slots.
+ */
+static int
+imp_dur(const char *str, size_t *dur, size_t *chunks)
+{
+	char *end;
+	unsigned long h;
+	unsigned long m;
+	unsigned long sec = 0;
+
+	*dur = 0;
+	*chunks = 1;
+	if (*str == '\0') {
+		return (0);
+	}
+
+	h = strtoul(str, &end, 10);
+	if (end == str) {
+		return (-1);
+	}
+	if (*end == '\0') {
+		*dur = imp_slots(h * 60, 1);
+		return (h > 1440 ? -1 : 0);
+	}
+	if (*end != 'h') {
+		return (-1);
+	}
+	str = end + 1;
+	m = strtoul(str, &end, 10);
+	if (end == str || *end != 'm' || m > 59) {
+		return (-1);
+	}
+	end++;
+	if (*end >= '0' && *end <= '9') {
+		str = end;
+		sec = strtoul(str, &end, 10);
+		if (*end != 's' || sec > 59) {
+			return (-1);
+		}
+		end++;
+	}
+	*dur = imp_slots(h * 3600 + m * 60 + sec, 1);
+	if (*end == '*') {
+		str = end + 1;
+		*chunks = strtoul(str, &end, 10);
+		if (end == str || *chunks == 0) {
+			return (-1);
+		}
+	}
+	if (*end != '\0' || *dur * *chunks > plan_slots) {
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Reads one CSV record into `b`, and points `fields` into it. Fields can be
+ * quoted with '"' (and "" is a quote), in which case they can hold commas
+ * and newlines. Fields past the ones we care about are ignored. Returns the
+ * number of fields, or -1 at EOF.
+ */
+static int
+csv_read(FILE *f, imp_buf_t *b, char **fields, int *lineno)
+{
+	size_t offs[CSV_NFIELDS];
+	int nf = 1;
+	int inq = 0;
+	int c;
+	int i;
+
+	b->ib_len = 0;
+	offs[0] = 0;
+	if ((c = getc(f)) == EOF) {
+		return (-1);
+	}
+	(*lineno)++;
+
+	for (; ; c = getc(f)) {
+		if (c == EOF) {
+			break;
+		}
+		if (inq) {
+			if (c == '"') {
+				if ((c = getc(f)) != '"') {
+					inq = 0;
+					(void) ungetc(c, f);
+					continue;
+				}
+			}
+			if (c == '\n') {
+				(*lineno)++;
+			}
+			buf_putc(b, c);
+			continue;
+		}
+		if (c == '\n') {
+			break;
+		}
+		if (c == '\r') {
+			continue;
+		}
+		if (c == '"') {
+			inq = 1;
+			continue;
+		}
+		if (c == ',') {
+			buf_putc(b, '\0');
+			if (nf < CSV_NFIELDS) {
+				offs[nf] = b->ib_len;
+			}
+			nf++;
+			continue;
+		}
+		buf_putc(b, c);
+	}
+	buf_putc(b, '\0');
+
+	if (nf > CSV_NFIELDS) {
+		nf = CSV_NFIELDS;
+	}
+	i = 0;
+	while (i < nf) {
+		fields[i] = b->ib_buf + offs[i];
+		i++;
+	}
+	while (i < CSV_NFIELDS) {
+		fields[i++] = "";
+	}
+	return (nf);
+}
+
+static void
+import_csv(FILE *f)
+{
+	imp_buf_t b;
+	char *fields[CSV_NFIELDS];
+	int lineno = 0;
+	int first;
+	int nf;
+	int todo;
+	int time;
+	size_t dur;
+	size_t chunks;
+	scope_t s;
+
+	bzero(&b, sizeof (imp_buf_t));
+	while ((nf = csv_read(f, &b, fields, &lineno)) != -1) {
+		first = (lineno == 1);
+		if (nf == 1 && *fields[0] == '\0') {
+			continue;
+		}
+		if (first && strcmp(fields[0], "date") == 0) {
+			continue;
+		}
+
+		if ((s = imp_date(fields[0])) == -1) {
+			printf("line %d: \"%s\" is not a valid date\n",
+			    lineno, fields[0]);
+			imp_nskip++;
+			continue;
+		}
+
+		todo = (*fields[1] == '@');
+		time = -1;
+		if (*fields[2] != '\0' && (time = imp_time(fields[2])) == -1) {
+			printf("line %d: \"%s\" is not a valid time\n",
+			    lineno, fields[2]);
+			imp_nskip++;
+			continue;
+		}
+
+		if (imp_dur(fields[3], &dur, &chunks) != 0 ||
+		    (time != -1 && !todo && time + dur * chunks > plan_slots)) {
+			printf("line %d: \"%s\" is not a valid duration\n",
+			    lineno, fields[3]);
+			imp_nskip++;
+			continue;
+		}
+
+		imp_add(s, fields[1], todo, time, dur, chunks, fields[4]);
+	}
+	buf_free(&b);
+}
+
+/*
+ * Reads one (unfolded) iCalendar content line into `b`. Returns -1 at EOF.
+ */
+static int
+ics_read(FILE *f, imp_buf_t *b)
+{
+	int c;
+
+	b->ib_len = 0;
+	if ((c = getc(f)) == EOF) {
+		return (-1);
+	}
+	for (; ; c = getc(f)) {
+		if (c == '\r') {
+			continue;
+		}
+		if (c == EOF) {
+			break;
+		}
+		if (c == '\n') {
+			/*
+			 * A line that starts with white space continues the
+			 * previous one.
+			 */
+			c = getc(f);
+			if (c == ' ' || c == '\t') {
+				continue;
+			}
+			(void) ungetc(c, f);
+			break;
+		}
+		buf_putc(b, c);
+	}
+	buf_putc(b, '\0');
+	return (0);
+}
+
+/*
+ * Undoes the iCalendar escapes in TEXT values, in place.
+ */
+static void
+ics_unescape(char *str)
+{
+	char *in = str;
+	char *out = str;
+
+	while (*in != '\0') {
+		if (*in == '\\' && in[1] != '\0') {
+			in++;
+			*out++ = (*in == 'n' || *in == 'N') ? '\n' : *in;
+			in++;
+			continue;
+		}
+		*out++ = *in++;
+	}
+	*out = '\0';
+}
+
+/*
+ * Days since 1970-01-01 of a proleptic Gregorian date (so that we can turn
+ * UTC times into local ones without timegm()).
+ */
+static long
+ics_days(int y, int m, int d)
+{
+	long era;
+	long yoe;
+	long doy;
+
+	y -= (m <= 2);
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	return (era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468);
+}
+
+/*
+ * Parses a DATE (YYYYMMDD) or DATE-TIME (YYYYMMDDTHHMMSS, with a trailing
+ * 'Z' for UTC) value into local time. Returns -1 if it's neither, 0 for a
+ * DATE-TIME, and 1 for a DATE.
+ */
+static int
+ics_when(const char *val, time_t *when)
+{
+	int y;
+	int mo;
+	int d;
+	int h = 0;
+	int mi = 0;
+	int sec = 0;
+	tm_t tm;
+	size_t len = strlen(val);
+
+	if (len < 8 || sscanf(val, "%4d%2d%2d", &y, &mo, &d) != 3) {
+		return (-1);
+	}
+	if (len > 8 && (val[8] != 'T' ||
+	    sscanf(val + 9, "%2d%2d%2d", &h, &mi, &sec) != 3)) {
+		return (-1);
+	}
+
+	if (len > 8 && val[len - 1] == 'Z') {
+		*when = (time_t)ics_days(y, mo, d) * 86400 + h * 3600 +
+		    mi * 60 + sec;
+		return (0);
+	}
+
+	bzero(&tm, sizeof (tm_t));
+	tm.tm_year = y - 1900;
+	tm.tm_mon = mo - 1;
+	tm.tm_mday = d;
+	tm.tm_hour = h;
+	tm.tm_min = mi;
+	tm.tm_sec = sec;
+	tm.tm_isdst = -1;
+	*when = mktime(&tm);
+	return (len == 8);
+}
+
+/*
+ * Parses a DURATION value (like "PT1H30M" or "P1D") into seconds.
+ */
+static long
+ics_dur(const char *val)
+{
+	long total = 0;
+	long n;
+	char *end;
+
+	if (*val == '+') {
+		val++;
+	}
+	if (*val++ != 'P') {
+		return (-1);
+	}
+	while (*val != '\0') {
+		if (*val == 'T') {
+			val++;
+			continue;
+		}
+		n = strtol(val, &end, 10);
+		if (end == val) {
+			return (-1);
+		}
+		switch (*end) {
+		case 'W':
+			total += n * 7 * 86400;
+			break;
+		case 'D':
+			total += n * 86400;
+			break;
+		case 'H':
+			total += n * 3600;
+			break;
+		case 'M':
+			total += n * 60;
+			break;
+		case 'S':
+			total += n;
+			break;
+		default:
+			return (-1);
+		}
+		val = end + 1;
+	}
+	return (total);
+}
+
+typedef struct ics_ev {
+	int		ev_kind;	/* -1 if there's no DTSTART */
+	time_t		ev_start;
+	time_t		ev_end;
+	int		ev_have_end;
+	long		ev_dur;		/* -1 if there's no DURATION */
+	int		ev_rrule;
+	char		*ev_summary;
+	char		*ev_desc;
+} ics_ev_t;
+
+static size_t ics_nrrule;
+
+static void
+ics_ev_reset(ics_ev_t *ev)
+{
+	imp_strfree(ev->ev_summary);
+	imp_strfree(ev->ev_desc);
+	bzero(ev, sizeof (ics_ev_t));
+	ev->ev_kind = -1;
+	ev->ev_dur = -1;
+}
+
+static void
+ics_ev_add(ics_ev_t *ev)
+{
+	tm_t tm;
+	scope_t s;
+	long start;
+	long dur = 0;
+	char *name = ev->ev_summary ? ev->ev_summary : "";
+
+	if (ev->ev_kind == -1) {
+		imp_nskip++;
+		return;
+	}
+	if (ev->ev_rrule) {
+		ics_nrrule++;
+	}
+
+	(void) localtime_r(&ev->ev_start, &tm);
+	s = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+
+	if (ev->ev_kind == 1) {
+		imp_add(s, name, 1, -1, 0, 1, ev->ev_desc);
+		return;
+	}
+
+	start = imp_slots(tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec, 0);
+	if (ev->ev_have_end) {
+		dur = ev->ev_end - ev->ev_start;
+	} else if (ev->ev_dur != -1) {
+		dur = ev->ev_dur;
+	}
+	if (dur < 0) {
+		dur = 0;
+	}
+	dur = imp_slots(dur, 1);
+	if (start + dur > plan_slots) {
+		dur = plan_slots - start;
+		imp_ntrunc++;
+	}
+	imp_add(s, name, 0, start, dur, 1, ev->ev_desc);
+}
+
+static void
+import_ics(FILE *f)
+{
+	imp_buf_t b;
+	ics_ev_t ev;
+	int in_ev = 0;
+	int depth = 0;
+	char *line;
+	char *val;
+	char *params;
+	int inq;
+
+	bzero(&b, sizeof (imp_buf_t));
+	bzero(&ev, sizeof (ics_ev_t));
+	ics_ev_reset(&ev);
+
+	while (ics_read(f, &b) != -1) {
+		line = b.ib_buf;
+
+		/*
+		 * Split "NAME;PARAMS:VALUE". Parameter values can be quoted,
+		 * and can hold a ':'.
+		 */
+		inq = 0;
+		val = line;
+		while (*val != '\0' && (inq || *val != ':')) {
+			if (*val == '"') {
+				inq = !inq;
+			}
+			val++;
+		}
+		if (*val == '\0') {
+			continue;
+		}
+		*val++ = '\0';
+		params = strchr(line, ';');
+		if (params != NULL) {
+			*params++ = '\0';
+		} else {
+			params = "";
+		}
+
+		if (strcasecmp(line, "BEGIN") == 0) {
+			if (in_ev) {
+				depth++;
+			} else if (strcasecmp(val, "VEVENT") == 0) {
+				in_ev = 1;
+				depth = 0;
+				ics_ev_reset(&ev);
+			}
+			continue;
+		}
+		if (strcasecmp(line, "END") == 0) {
+			if (in_ev && depth > 0) {
+				depth--;
+			} else if (in_ev && strcasecmp(val, "VEVENT") == 0) {
+				ics_ev_add(&ev);
+				in_ev = 0;
+			}
+			continue;
+		}
+
+		/*
+		 * Properties of nested components (like VALARM) aren't the
+		 * event's.
+		 */
+		if (!in_ev || depth > 0) {
+			continue;
+		}
+
+		if (strcasecmp(line, "DTSTART") == 0) {
+			ev.ev_kind = ics_when(val, &ev.ev_start);
+			if (strstr(params, "VALUE=DATE") != NULL &&
+			    strstr(params, "VALUE=DATE-TIME") == NULL) {
+				ev.ev_kind = (ev.ev_kind == -1) ? -1 : 1;
+			}
+		} else if (strcasecmp(line, "DTEND") == 0) {
+			ev.ev_have_end = (ics_when(val, &ev.ev_end) != -1);
+		} else if (strcasecmp(line, "DURATION") == 0) {
+			ev.ev_dur = ics_dur(val);
+		} else if (strcasecmp(line, "RRULE") == 0) {
+			ev.ev_rrule = 1;
+		} else if (strcasecmp(line, "SUMMARY") == 0) {
+			ics_unescape(val);
+			imp_strfree(ev.ev_summary);
+			ev.ev_summary = imp_strdup(val);
+		} else if (strcasecmp(line, "DESCRIPTION") == 0) {
+			ics_unescape(val);
+			imp_strfree(ev.ev_desc);
+			ev.ev_desc = imp_strdup(val);
+		}
+	}
+	ics_ev_reset(&ev);
+	buf_free(&b);
+}
+
+/*
+ * Imports the events in `path` (or stdin, if `path` is "-"). Returns -1 if
+ * the format isn't one we know.
+ */
+int
+plan_import(char *fmt, char *path)
+{
+	void (*import)(FILE *);
+	FILE *f;
+
+	if (strcmp(fmt, "csv") == 0) {
+		import = import_csv;
+	} else if (strcmp(fmt, "ics") == 0) {
+		import = import_ics;
+	} else {
+		return (-1);
+	}
+
+	if (strcmp(path, "-") == 0) {
+		f = stdin;
+	} else if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return (0);
+	}
+
+	avl_create(&imp_days, imp_day_cmp, sizeof (imp_day_t),
+	    offsetof(imp_day_t, id_node));
+	import(f);
+	imp_flush();
+	avl_destroy(&imp_days);
+
+	if (f != stdin) {
+		(void) fclose(f);
+	}
+
+	printf("Imported %lu events (placed %lu days)", (ulong_t)imp_nevs,
+	    (ulong_t)imp_ndays);
+	if (imp_nskip) {
+		printf(", skipped %lu", (ulong_t)imp_nskip);
+	}
+	printf("\n");
+	if (imp_ntrunc) {
+		printf("%lu events ran past midnight, and were cut short\n",
+		    (ulong_t)imp_ntrunc);
+	}
+	if (ics_nrrule) {
+		printf("%lu recurring events were imported once (recurrence "
+		    "rules aren't expanded)\n", (ulong_t)ics_nrrule);
+	}
+	return (0);
+}
+
+typedef struct exp_ctx {
+	FILE		*ec_f;
+	int		ec_ics;
+	scope_t		ec_scope;
+	size_t		ec_nunplaced;
+	char		ec_stamp[17];
+} exp_ctx_t;
+
+/*
+ * Writes a CSV field, quoting it if it has to be.
+ */
+static void
+csv_put(FILE *f, const char *str)
+{
+	if (strpbrk(str, ",\"\r\n") == NULL) {
+		(void) fputs(str, f);
+		return;
+	}
+	(void) putc('"', f);
+	while (*str != '\0') {
+		if (*str == '"') {
+			(void) putc('"', f);
+		}
+		(void) putc(*str++, f);
+	}
+	(void) putc('"', f);
+}
+
+/*
+ * Writes an iCalendar content line, escaping `val` (if it's TEXT), and
+ * folding the line at 75 octets.
+ */
+static void
+ics_put(FILE *f, const char *name, const char *val, int text)
+{
+	char esc[3];
+	const char *piece;
+	size_t col = strlen(name) + 1;
+	size_t plen;
+
+	(void) fprintf(f, "%s:", name);
+	while (*val != '\0') {
+		piece = val;
+		plen = 1;
+		if (text && (*val == '\\' || *val == ';' || *val == ',' ||
+		    *val == '\n')) {
+			esc[0] = '\\';
+			esc[1] = (*val == '\n') ? 'n' : *val;
+			esc[2] = '\0';
+			piece = esc;
+			plen = 2;
+		}
+		if (col + plen > 75) {
+			(void) fputs("\r\n ", f);
+			col = 1;
+		}
+		(void) fwrite(piece, 1, plen, f);
+		col += plen;
+		val++;
+	}
+	(void) fputs("\r\n", f);
+}
+
+static void
+exp_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	exp_ctx_t *ec = arg;
+	scope_t s = ec->ec_scope;
+	char uid[300];
+	char fmt[RES_FMTLEN];
+	long secs;
+	size_t i;
+
+	if (!ec->ec_ics) {
+		(void) fprintf(ec->ec_f, "%04d-%02d-%02d,", s / 10000,
+		    (s / 100) % 100, s % 100);
+		csv_put(ec->ec_f, n);
+		(void) putc(',', ec->ec_f);
+		if (!r->ar_dyn && r->ar_ntimes && r->ar_time[0] >= 0) {
+			res_fmt_time(fmt, sizeof (fmt), r->ar_time[0]);
+			(void) fputs(fmt, ec->ec_f);
+		}
+		res_fmt_dur(fmt, sizeof (fmt), r->ar_dur);
+		(void) fprintf(ec->ec_f, ",%s", fmt);
+		if (r->ar_ntimes > 1) {
+			(void) fprintf(ec->ec_f, "*%lu", (ulong_t)r->ar_ntimes);
+		}
+		(void) putc(',', ec->ec_f);
+		csv_put(ec->ec_f, det ? det : "");
+		(void) putc('\n', ec->ec_f);
+		act_rec_free(r);
+		return;
+	}
+
+	/*
+	 * Every chunk is an event of its own. Activities that haven't been
+	 * placed (they have no duration, or didn't fit) have no time to
+	 * export.
+	 */
+	for (i = 0; i < r->ar_ntimes; i++) {
+		if (r->ar_time[i] < 0 || r->ar_dur == 0) {
+			ec->ec_nunplaced++;
+			continue;
+		}
+		(void) fputs("BEGIN:VEVENT\r\n", ec->ec_f);
+		(void) snprintf(uid, sizeof (uid), "%d-%lu-%s@plan", s,
+		    (ulong_t)i, n);
+		ics_put(ec->ec_f, "UID", uid, 0);
+		(void) fprintf(ec->ec_f, "DTSTAMP:%s\r\n", ec->ec_stamp);
+		secs = (long)r->ar_time[i] * plan_res;
+		(void) fprintf(ec->ec_f, "DTSTART:%dT%02ld%02ld%02ld\r\n", s,
+		    secs / 3600, (secs / 60) % 60, secs % 60);
+		secs = (long)r->ar_dur * plan_res;
+		(void) fprintf(ec->ec_f, "DURATION:PT%ldH%ldM%ldS\r\n",
+		    secs / 3600, (secs / 60) % 60, secs % 60);
+		ics_put(ec->ec_f, "SUMMARY", n, 1);
+		if (det) {
+			ics_put(ec->ec_f, "DESCRIPTION", det, 1);
+		}
+		(void) fputs("END:VEVENT\r\n", ec->ec_f);
+	}
+	act_rec_free(r);
+}
+
+static void
+exp_todo(void *arg, char *n, int time, char *det)
+{
+	exp_ctx_t *ec = arg;
+	scope_t s = ec->ec_scope;
+	char uid[300];
+	char fmt[RES_FMTLEN];
+
+	if (!ec->ec_ics) {
+		(void) fprintf(ec->ec_f, "%04d-%02d-%02d,@", s / 10000,
+		    (s / 100) % 100, s % 100);
+		csv_put(ec->ec_f, n);
+		res_fmt_time(fmt, sizeof (fmt), time);
+		(void) fprintf(ec->ec_f, ",%s,,", fmt);
+		csv_put(ec->ec_f, det ? det : "");
+		(void) putc('\n', ec->ec_f);
+		return;
+	}
+
+	(void) snprintf(uid, sizeof (uid), "%d-todo-%s@plan", s, n);
+	(void) fputs("BEGIN:VEVENT\r\n", ec->ec_f);
+	ics_put(ec->ec_f, "UID", uid, 0);
+	(void) fprintf(ec->ec_f, "DTSTAMP:%s\r\n", ec->ec_stamp);
+	(void) fprintf(ec->ec_f, "DTSTART;VALUE=DATE:%d\r\n", s);
+	ics_put(ec->ec_f, "SUMMARY", n, 1);
+	if (det) {
+		ics_put(ec->ec_f, "DESCRIPTION", det, 1);
+	}
+	(void) fputs("END:VEVENT\r\n", ec->ec_f);
+}
+
+static void
+exp_scope(void *arg, scope_t s)
+{
+	exp_ctx_t *ec = arg;
+
+	if (!PS_ISDATE(s)) {
+		return;
+	}
+	ec->ec_scope = s;
+	store->ps_act_walk(s, 1, exp_act, ec);
+	store->ps_todo_walk(s, 1, exp_todo, ec);
+}
+
+/*
+ * Exports every date in the plandb to `path` (or stdout, if `path` is NULL
+ * or "-"). The weekday templates and the general todo list aren't calendar
+ * data, and aren't exported. Returns -1 if the format isn't one we know.
+ */
+int
+plan_export(char *fmt, char *path)
+{
+	exp_ctx_t ec;
+	time_t now = time(NULL);
+	tm_t tm;
+
+	bzero(&ec, sizeof (exp_ctx_t));
+	if (strcmp(fmt, "csv") == 0) {
+		ec.ec_ics = 0;
+	} else if (strcmp(fmt, "ics") == 0) {
+		ec.ec_ics = 1;
+	} else {
+		return (-1);
+	}
+
+	if (path == NULL || strcmp(path, "-") == 0) {
+		ec.ec_f = stdout;
+	} else if ((ec.ec_f = fopen(path, "w")) == NULL) {
+		perror(path);
+		return (0);
+	}
+
+	(void) gmtime_r(&now, &tm);
+	(void) strftime(ec.ec_stamp, sizeof (ec.ec_stamp), "%Y%m%dT%H%M%SZ",
+	    &tm);
+
+	if (ec.ec_ics) {
+		(void) fputs("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+		    "PRODID:-//plan//plan export//EN\r\n", ec.ec_f);
+	} else {
+		(void) fputs("date,name,start,duration,details\n", ec.ec_f);
+	}
+
+	store->ps_walk(exp_scope, &ec);
+
+	if (ec.ec_ics) {
+		(void) fputs("END:VCALENDAR\r\n", ec.ec_f);
+	}
+	if (ec.ec_f != stdout) {
+		(void) fclose(ec.ec_f);
+	} else {
+		(void) fflush(stdout);
+	}
+
+	if (ec.ec_nunplaced) {
+		fprintf(stderr, "%lu activities have no time, and weren't "
+		    "exported\n", (ulong_t)ec.ec_nunplaced);
+	}
+	return (0);
+}
@@ -0,0 +1,157 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include "plan_impl.h"
+
+/*
+ * Interned names. While a day is loaded (or, for "plan list -s", for a whole
+ * command), each distinct activity name is kept once, and handed out as a
+ * small integer id: 0 for the first name interned, 1 for the next, and so on.
+ * Chunks of the same activity, and the same activity on different days, can
+ * then be told apart by comparing ids, and anything kept per activity can be
+ * kept in an array indexed by id, rather than in a table keyed by name.
+ *
+ * The names are kept in the table's arena, and looked up through an
+ * open-addressed hash table of ids (plus one, so that 0 is an empty slot),
+ * which is doubled whenever it's half full. Reset the table and every id
+ * (and name) it handed out is gone. Like arenas, these aren't MT-safe, and
+ * one that's all zeroes is empty.
+ */
+#define	IN_MINHASH	64
+
+extern void *arena_alloc(arena_t *, size_t);
+extern char *arena_strdup(arena_t *, const char *, size_t);
+extern void arena_reset(arena_t *);
+extern void arena_fini(arena_t *);
+
+/*
+ * FNV-1a.
+ */
+static uint32_t
+in_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)s[i];
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static void
+in_grow(intern_t *in)
+{
+	size_t nhash = in->in_nhash ? in->in_nhash * 2 : IN_MINHASH;
+	uint32_t *hash = umem_zalloc(nhash * sizeof (uint32_t), UMEM_NOFAIL);
+	size_t max = nhash / 2;
+	intern_ent_t *ents = umem_alloc(max * sizeof (intern_ent_t),
+	    UMEM_NOFAIL);
+	size_t i;
+	size_t h;
+
+	for (i = 0; i < in->in_n; i++) {
+		ents[i] = in->in_ents[i];
+		h = ents[i].ie_hash & (nhash - 1);
+		while (hash[h] != 0) {
+			h = (h + 1) & (nhash - 1);
+		}
+		hash[h] = i + 1;
+	}
+	if (in->in_nhash) {
+		umem_free(in->in_hash, in->in_nhash * sizeof (uint32_t));
+		umem_free(in->in_ents, (in->in_nhash / 2) *
+		    sizeof (intern_ent_t));
+	}
+	in->in_hash = hash;
+	in->in_ents = ents;
+	in->in_nhash = nhash;
+}
+
+/*
+ * Returns the id of the first `len` bytes of `s`, which are interned if they
+ * haven't been yet.
+ */
+uint32_t
+intern(intern_t *in, const char *s, size_t len)
+{
+	uint32_t h = in_hash(s, len);
+	intern_ent_t *ie;
+	size_t i;
+
+	if (2 * (in->in_n + 1) > in->in_nhash) {
+		in_grow(in);
+	}
+	i = h & (in->in_nhash - 1);
+	while (in->in_hash[i] != 0) {
+		ie = &in->in_ents[in->in_hash[i] - 1];
+		if (ie->ie_hash == h && ie->ie_len == len &&
+		    bcmp(ie->ie_name, s, len) == 0) {
+			return (in->in_hash[i] - 1);
+		}
+		i = (i + 1) & (in->in_nhash - 1);
+	}
+
+	ie = &in->in_ents[in->in_n];
+	ie->ie_name = arena_strdup(&in->in_arena, s, len);
+	ie->ie_len = len;
+	ie->ie_hash = h;
+	in->in_hash[i] = ++in->in_n;
+	return (in->in_n - 1);
+}
+
+char *
+intern_name(intern_t *in, uint32_t id)
+{
+	return (in->in_ents[id].ie_name);
+}
+
+void
+intern_reset(intern_t *in)
+{
+	if (in->in_n == 0) {
+		return;
+	}
+	bzero(in->in_hash, in->in_nhash * sizeof (uint32_t));
+	in->in_n = 0;
+	arena_reset(&in->in_arena);
+}
+
+void
+intern_fini(intern_t *in)
+{
+	if (in->in_nhash) {
+		umem_free(in->in_hash, in->in_nhash * sizeof (uint32_t));
+		umem_free(in->in_ents, (in->in_nhash / 2) *
+		    sizeof (intern_ent_t));
+	}
+	in->in_nhash = 0;
+	in->in_n = 0;
+	arena_fini(&in->in_arena);
+}
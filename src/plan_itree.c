@@ -0,0 +1,161 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <umem.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "plan_impl.h"
+
+/*
+ * Interval trees, for finding the static activities whose times overlap.
+ * The intervals never change once the tree is built, so rather than keep a
+ * balanced tree of nodes, we sort them by start, and treat the array as the
+ * tree: the root of the intervals in [lo, hi) is the middle one, and the
+ * halves either side of it are its subtrees. Each interval also has the
+ * latest end of any interval in its subtree (it_maxend[]).
+ *
+ * Looking for the intervals that overlap [start, end) skips every subtree
+ * whose latest end is at or before `start`, and, since the array is sorted,
+ * everything to the right of an interval that starts at or after `end`. So
+ * a query costs O(log n) plus the number of overlaps it finds, and finding
+ * every overlapping pair in a set of n intervals, by asking about each one
+ * in turn, costs O((n + k) log n) for k pairs.
+ */
+
+static int
+iv_comp(const void *a, const void *b)
+{
+	const ival_t *x = a;
+	const ival_t *y = b;
+
+	if (x->iv_start != y->iv_start) {
+		return (x->iv_start < y->iv_start ? -1 : 1);
+	}
+	if (x->iv_end != y->iv_end) {
+		return (x->iv_end < y->iv_end ? -1 : 1);
+	}
+	return (0);
+}
+
+static int
+it_fill(itree_t *it, size_t lo, size_t hi)
+{
+	size_t mid = lo + (hi - lo) / 2;
+	int m;
+	int c;
+
+	if (lo >= hi) {
+		return (INT_MIN);
+	}
+	m = it->it_ivs[mid].iv_end;
+	if ((c = it_fill(it, lo, mid)) > m) {
+		m = c;
+	}
+	if ((c = it_fill(it, mid + 1, hi)) > m) {
+		m = c;
+	}
+	it->it_maxend[mid] = m;
+	return (m);
+}
+
+/*
+ * Builds a tree over the `n` intervals in ivs[], which it sorts, and keeps
+ * (the caller frees them, after itree_fini).
+ */
+void
+itree_build(itree_t *it, ival_t *ivs, size_t n)
+{
+	it->it_ivs = ivs;
+	it->it_n = n;
+	it->it_maxend = NULL;
+	if (n == 0) {
+		return;
+	}
+	qsort(ivs, n, sizeof (ival_t), iv_comp);
+	it->it_maxend = umem_alloc(n * sizeof (int), UMEM_NOFAIL);
+	(void) it_fill(it, 0, n);
+}
+
+void
+itree_fini(itree_t *it)
+{
+	if (it->it_n != 0) {
+		umem_free(it->it_maxend, it->it_n * sizeof (int));
+	}
+	it->it_n = 0;
+}
+
+static size_t
+it_find(itree_t *it, size_t lo, size_t hi, size_t from, ival_t *q,
+    itree_walk_f cb, void *arg)
+{
+	size_t mid = lo + (hi - lo) / 2;
+	ival_t *iv = &it->it_ivs[mid];
+	size_t n = 0;
+
+	if (lo >= hi || hi <= from || it->it_maxend[mid] <= q->iv_start) {
+		return (0);
+	}
+	n += it_find(it, lo, mid, from, q, cb, arg);
+	if (iv->iv_start >= q->iv_end) {
+		return (n);
+	}
+	if (mid >= from && iv->iv_end > q->iv_start && iv != q) {
+		if (cb != NULL) {
+			cb(arg, q, iv);
+		}
+		n++;
+	}
+	n += it_find(it, mid + 1, hi, from, q, cb, arg);
+	return (n);
+}
+
+/*
+ * Calls back with every interval in the tree that overlaps `q` (other than q
+ * itself, if it's in the tree), and returns how many there were. cb can be
+ * NULL, to only count them.
+ */
+size_t
+itree_overlaps(itree_t *it, ival_t *q, itree_walk_f cb, void *arg)
+{
+	return (it_find(it, 0, it->it_n, 0, q, cb, arg));
+}
+
+/*
+ * Calls back once with each pair of intervals in the tree that overlap, and
+ * returns how many pairs there were. Each interval is only asked about the
+ * ones after it, which start no earlier, so no pair is found twice.
+ */
+size_t
+itree_pairs(itree_t *it, itree_walk_f cb, void *arg)
+{
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < it->it_n; i++) {
+		n += it_find(it, 0, it->it_n, i + 1, &it->it_ivs[i], cb, arg);
+	}
+	return (n);
+}
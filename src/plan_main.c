@@ -24,10 +24,10 @@
 
 #include <stdint.h>
 #include <strings.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <umem.h>
-#include <sys/vmem.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -39,6 +39,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <tzfile.h>
+#include <setjmp.h>
+#include <limits.h>
 #include "plan_impl.h"
 #include "plan_probes.h"
 
@@ -53,11 +55,87 @@ static int pdb_fd;
 int days_fd;
 int dates_fd;
 int todos_fd;
-int write_dur;
 static int cur_cmd = 0;
-vmem_t *vmday;
-umem_cache_t *act_cache;
-umem_cache_t *todo_cache;
+daymap_t *dmday;
+char *plan_path;
+
+/*
+ * Declarations from plan_store.c
+ */
+extern plan_store_t *store;
+extern scope_t plan_scope(day_t, tm_t *);
+extern int plan_store_select(const char *);
+
+/*
+ * Declarations from plan_daemon.c
+ */
+extern int plan_client(int, char **);
+extern int plan_daemon(int (*)(int, char **));
+
+/*
+ * Declarations from plan_wal.c
+ */
+extern void wal_open(int);
+extern void wal_close(void);
+
+/*
+ * Declarations from plan_daymap.c
+ */
+extern daymap_t *daymap_create(size_t);
+
+/*
+ * Declarations from plan_res.c
+ */
+extern int plan_res;
+extern size_t plan_slots;
+extern void res_open(int);
+extern int res_valid(long);
+extern long res_from_secs(long);
+
+/*
+ * Declarations from plan_pack.c
+ */
+extern int pack_select(const char *);
+
+/*
+ * Declarations from plan_names.c
+ */
+extern void names_open(int);
+extern void names_close(void);
+
+/*
+ * Declarations from plan_text.c
+ */
+extern void text_open(int);
+extern void text_close(void);
+extern int text_search(char **, int, scope_t, scope_t);
+
+/*
+ * Declarations from plan_manip.c
+ */
+extern void batch_begin(void);
+extern void batch_end(void);
+extern void check_begin(void);
+extern int check_end(void);
+extern void check_abort(void);
+extern int list_conflicts(scope_t, scope_t);
+
+/*
+ * Declarations from plan_free.c
+ */
+extern int free_find(size_t, scope_t, scope_t);
+extern int free_busy(scope_t, scope_t);
+
+/*
+ * Declarations from plan_avail.c
+ */
+extern int avail_find(size_t, scope_t, scope_t, char **, int);
+
+/*
+ * Declarations from plan_import.c
+ */
+extern int plan_import(char *, char *);
+extern int plan_export(char *, char *);
 
 /*
  * Declarations from plan_manip.c
@@ -69,16 +147,22 @@ extern int destroy_act(char *, day_t, tm_t *);
 extern int rename_todo(char *, char *, day_t, tm_t *);
 extern int rename_act(char *, char *, day_t, tm_t *);
 extern int set_awake(day_t, tm_t *, size_t, size_t);
+extern int set_awake_week(size_t, size_t);
+extern int set_res(int);
 extern int set_dur(char *, int, tm_t *, size_t, size_t);
+extern int set_chunks(char *, int, tm_t *, size_t, size_t);
 extern int set_time_act(char *, int, tm_t *, int, char);
 extern int set_details_act(char *, int, tm_t *, char *);
 extern int set_details_todo(char *, int, tm_t *, char *);
 extern void list(day_t, tm_t *, int, int);
 extern void list_week(int, int);
+extern void list_range(scope_t, scope_t, int);
+extern int find_name(char *, scope_t, scope_t);
 extern void list_today(int);
 extern void list_this_week(int);
 extern void list_next_week(int);
 extern void list_gen_todo(int);
+extern void list_totals(void);
 
 
 /*
@@ -86,6 +170,8 @@ extern void list_gen_todo(int);
  */
 static void usage(int ix, int usage_bool);
 static void print_usage_all(void);
+void plan_exit(int);
+static int plan_dispatch(int ac, char *av[]);
 
 typedef enum plan_help {
 	HELP_CREATE,
@@ -97,7 +183,20 @@ typedef enum plan_help {
 	HELP_SET_DURATION,
 	HELP_SET_DETAILS,
 	HELP_SET_AWAKE,
+	HELP_SET_RESOLUTION,
+	HELP_SET_CHUNKS,
 	HELP_LIST,
+	HELP_DAEMON,
+	HELP_BATCH,
+	HELP_IMPORT,
+	HELP_EXPORT,
+	HELP_FIND,
+	HELP_SEARCH,
+	HELP_CHECK,
+	HELP_FREE,
+	HELP_CONFLICTS,
+	HELP_BUSY,
+	HELP_AVAIL,
 } plan_help_t;
 
 typedef struct plan_cmd {
@@ -109,42 +208,10 @@ typedef struct plan_cmd {
 size_t set_cmd_len[] = {5, 8, 4, 7};
 
 
-static int
-act_ctor(void *buf, void *ignored, int flags)
-{
-	act_t *act = buf;
-	bzero(act, sizeof (act_t));
-	/* actions are dynamic by default */
-	act->act_dyn = 1;
-	return (0);
-}
-
-static void
-act_dtor(void *buf, void *ignored)
-{
-	act_t *act = buf;
-	bzero(act, sizeof (act_t));
-	act->act_dyn = 1;
-}
-
-static int
-todo_ctor(void *buf, void *ignored, int flags)
-{
-	act_t *act = buf;
-	bzero(act, sizeof (todo_t));
-	return (0);
-}
-
-static void
-todo_dtor(void *buf, void *ignored)
-{
-	act_t *act = buf;
-	bzero(act, sizeof (todo_t));
-}
-
 /*
- * This function parses time in 24 hour "hh:mm" format, into the integer
- * pointed to by `*time`, which counts the number of minutes since 00:00.
+ * This function parses time in 24 hour "hh:mm" (or "hh:mm:ss") format, into
+ * the integer pointed to by `*time`, which counts the number of slots since
+ * 00:00. The time has to fall on a slot boundary.
  */
 static int
 parse_time(char *t, int *time)
@@ -155,7 +222,7 @@ parse_time(char *t, int *time)
 	if (*c > '2') {
 		printf("Hours are a 2-digit value\n.");
 		printf("The first digit can't be greater than '2'\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	int hrs = 0;
@@ -166,14 +233,14 @@ parse_time(char *t, int *time)
 	if (hrs > 23) {
 		printf("The max hour value is 23. You speicified %d\n",
 			hrs);
-		exit(0);
+		plan_exit(0);
 	}
 	PLAN_GOT_HERE((int)0);
 
 	c++;
 	if (*c != ':') {
 		printf("Error, missing colon ':'. Format is hh:mm\n");
-		exit(0);
+		plan_exit(0);
 	}
 	c++;
 	int mins = 0;
@@ -188,12 +255,31 @@ parse_time(char *t, int *time)
 	if (mins > 59) {
 		printf("The max minute value is 59. You speicified %d\n",
 			hrs);
-		exit(0);
+		plan_exit(0);
 	}
 	PLAN_GOT_HERE((int)mins);
-	mins += (hrs * 60);
-	PLAN_GOT_HERE((int)mins);
-	*time = mins;
+
+	int secs = 0;
+	c++;
+	if (*c == ':') {
+		c++;
+		secs = (*c - 48) * 10;
+		c++;
+		secs += (*c - 48);
+		if (secs < 0 || secs > 59) {
+			printf("The max second value is 59.\n");
+			plan_exit(0);
+		}
+	}
+
+	long slot = res_from_secs((hrs * 3600) + (mins * 60) + secs);
+	if (slot == -1) {
+		printf("The time has to be a multiple of the resolution "
+		    "(%d seconds).\n", plan_res);
+		plan_exit(0);
+	}
+	PLAN_GOT_HERE((int)slot);
+	*time = slot;
 	return (0);
 }
 
@@ -226,6 +312,40 @@ parse_date(const char *d, tm_t **tm)
 
 }
 
+/*
+ * Parses either a single date, or a range of dates given as <date>..<date>,
+ * into the scopes of the first and last date. Returns -1 if either date is
+ * invalid, or if the range is backwards.
+ */
+static int
+parse_range(char *r, scope_t *from, scope_t *to)
+{
+	char *dots = strstr(r, "..");
+	tm_t ft;
+	tm_t tt;
+	tm_t *fp = &ft;
+	tm_t *tp = &tt;
+
+	bzero(&ft, sizeof (ft));
+	bzero(&tt, sizeof (tt));
+	if (dots != NULL) {
+		*dots = '\0';
+		parse_date(dots + 2, &tp);
+	}
+	parse_date(r, &fp);
+	if (dots == NULL) {
+		tp = fp;
+	} else {
+		*dots = '.';
+	}
+	if (fp == NULL || tp == NULL) {
+		return (-1);
+	}
+	*from = plan_scope(-1, fp);
+	*to = plan_scope(-1, tp);
+	return (*from > *to ? -1 : 0);
+}
+
 /*
  * Here we parse a textual representation of the day into an integer.  The
  * meanings of the integer mappings can be found in the day_t enum in
@@ -295,6 +415,11 @@ handle_err(err_t e, char *n, day_t d, tm_t *date)
 		printf(" Activity has more than one chunk.\n");
 		break;
 
+	case TIME_ECONFLICT:
+		printf("Can't set time on activity %s.", n);
+		printf(" It would overlap a static activity.\n");
+		break;
+
 	case DUR_EEXIST:
 		printf("Can't set duration on activity %s.", n);
 		printf(" Activity doesn't exist.\n");
@@ -310,6 +435,16 @@ handle_err(err_t e, char *n, day_t d, tm_t *date)
 		printf(" Duration has zero (0) chunks.\n");
 		break;
 
+	case CHUNK_EEXIST:
+		printf("Can't set chunks on activity %s.", n);
+		printf(" Activity doesn't exist.\n");
+		break;
+
+	case CHUNK_ESPREAD:
+		printf("Can't set chunks on activity %s.", n);
+		printf(" Its chunks and gaps don't fit in the spread.\n");
+		break;
+
 	case CREATE_EEXIST:
 		printf("Can't create activity %s.", n);
 		printf(" Activity already exists.\n");
@@ -358,13 +493,13 @@ do_create(int ac, char *av[])
 	c = strchr(av[1], '/');
 	if (D == NULL && d == -1 && *av[1] != '*' && *av[1] != '@') {
 		printf("\"%s\" is not a valid day or date\n", av[1]);
-		exit(0);
+		plan_exit(0);
 	}
 
 
 	if (c == NULL && *av[1] != '@') {
 		printf("A '/' must separate the date or day from the name\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	int cerr;
@@ -423,13 +558,13 @@ do_destroy(int ac, char *av[])
 
 	if (c == NULL && *av[1] != '@') {
 		printf("A '/' must separate the date or day from the name\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 
 	if (D == 0 && d == -1 && !week && *av[1] != '@') {
 		printf("\"%s\" is not a valid day or date\n", av[1]);
-		exit(0);
+		plan_exit(0);
 	}
 
 	int dret;
@@ -477,7 +612,7 @@ do_rename(int ac, char *av[])
 	char *old = NULL;
 	if (ac < 3) {
 		usage(cur_cmd, 1);
-		exit(0);
+		plan_exit(0);
 	}
 
 	old = strchr(av[1], '/');
@@ -487,7 +622,7 @@ do_rename(int ac, char *av[])
 
 	if (old == NULL || new == NULL) {
 		printf("A '/' must separate the date or day from the name\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	old++;
@@ -500,12 +635,12 @@ do_rename(int ac, char *av[])
 
 	if (*old == '@' && *new != '@') {
 		printf("Can't rename a todo to an activity.\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	if (*old != '@' && *new == '@') {
 		printf("Can't rename an activity to a todo.\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 
@@ -537,7 +672,7 @@ skip_ampersand_errors:;
 		printf("When renaming, days must be identical.\n");
 	}
 
-	exit(0);
+	plan_exit(0);
 
 	return (0);
 }
@@ -569,7 +704,7 @@ do_describe(int ac, char *av[])
 
 	if (slash == target) {
 		printf("Please enter a day or date before the slash\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	if (slash) {
@@ -577,7 +712,7 @@ do_describe(int ac, char *av[])
 		if ((*target) == '\0') {
 			printf("Please enter an activity"
 				" or todo after the slash\n");
-			exit(0);
+			plan_exit(0);
 		}
 	}
 
@@ -594,40 +729,25 @@ do_describe(int ac, char *av[])
 }
 
 /*
- * Here we parse a duration formated as <hrs>h<mins>m
- * We write the result into the variable dur points to.
- * dur's quantum of currency is minutes.
+ * Here we parse a duration formated as <hrs>h<mins>m (or <hrs>h<mins>m<secs>s)
+ * optionally followed by *<chunks>. We write the result into the variable dur
+ * points to. dur's quantum of currency is slots, so the duration has to be a
+ * whole number of them.
  */
-#define	DTSTL\
-	"Duration too short to be chunked, and too long to be non-chunked.\n"
 static int
 parse_dur(char *d, size_t *dur, size_t *chunks)
 {
 
 	size_t hrs;
 	size_t mins;
+	size_t secs = 0;
 	char *c = d;
 	size_t slen = strlen(d);
-	int chunked = 0;
 	if (slen < 6) {
 		printf("Duration too short.\n");
-		exit(0);
+		plan_exit(0);
 	}
 
-	if (slen > 6 && slen < 7) {
-		printf(DTSTL);
-		exit(0);
-	}
-
-	if (slen >= 8) {
-		chunked++;
-	}
-
-	if (slen == 6) {
-		chunked = 0;
-	}
-
-
 	/*
 	 * We can only have 24 hour-long durs
 	 */
@@ -648,34 +768,48 @@ parse_dur(char *d, size_t *dur, size_t *chunks)
 	c++;
 	PLAN_GOT_HERE((int)c);
 	mins += *c - 48;
+	c += 2;	/* skip the 'm' */
 
-	if (mins > 59 || hrs > 24) {
+	if (*c >= '0' && *c <= '9') {
+		if (slen < 9 || *(c+2) != 's') {
+			return (-1);
+		}
+		secs = (*c - 48) * 10;
+		c++;
+		secs += *c - 48;
+		c += 2;	/* skip the 's' */
+	}
+
+	if (mins > 59 || hrs > 24 || secs > 59) {
 		printf("Duration has more than 24 hrs or more than 59 mins.");
-		exit(1);
+		plan_exit(1);
 		return (-1);
 	}
 
-	*dur = (hrs * 60) + mins;
-
-	PLAN_PARSE_DUR(*dur);
-
-	if (*dur > 1440) {
+	secs += (hrs * 3600) + (mins * 60);
+	if (secs > RES_DAYSECS) {
 		return (-1);
 	}
+	if (res_from_secs(secs) == -1) {
+		printf("The duration has to be a multiple of the resolution "
+		    "(%d seconds).\n", plan_res);
+		plan_exit(0);
+	}
 
-	if (!chunked) {
+	*dur = res_from_secs(secs);
+
+	PLAN_PARSE_DUR(*dur);
+
+	if (*c == '\0') {
 		return (0);
 	}
 
-	c++;	/* Now we're at 'm' */
-	PLAN_GOT_HERE((int)c);
-	c++;	/* and /now/ we're at '*' */
 	PLAN_GOT_HERE((int)c);
 
-	if (*c != '*') {
+	if (*c != '*' || chunks == NULL) {
 		printf("Expected '*', found '%c' instead, in \"%s\"\n",
 			*c, d);
-		exit(0);
+		plan_exit(0);
 	}
 
 	c++;
@@ -683,10 +817,10 @@ parse_dur(char *d, size_t *dur, size_t *chunks)
 	char *invch;
 	*chunks = (size_t)strtol(c, &invch, 0);
 
-	if (*invch != '\0') {
+	if (*invch != '\0' || invch == c) {
 		printf("Expected a digit, found '%c' instead in \"%s\"\n",
 			(*invch), d);
-		exit(0);
+		plan_exit(0);
 	}
 
 	return (0);
@@ -703,6 +837,7 @@ do_awake(int ac, char *av[])
 	int week = 0;
 	size_t base;
 	size_t off;
+	int btime;
 	int ret;
 	tm_t t;
 	tm_t *date = &t;
@@ -712,28 +847,36 @@ do_awake(int ac, char *av[])
 
 	if (comma == NULL) {
 		usage(cur_cmd, 1);
-		exit(0);
+		plan_exit(0);
 	}
 
 	if (*av[2] >= 48 && *av[2] <= 57) {
 		parse_date(av[2], &date);
+	} else if (strcmp(av[2], "week") == 0) {
+		week = 1;
+		date = NULL;
 	} else {
 		day = parse_day(av[2]);
 		date = NULL;
 	}
 
 	/*
-	 * Yes, strictly speaking the 2nd arg to parse_time has the wrong type,
-	 * but we're never going to notice the discrepancy in overflow-max,
-	 * because we never take an invalid input.
+	 * parse_time gives us an int, which we widen into base (passing &base
+	 * to parse_time would leave the upper half of it uninitialized).
 	 */
-	ret = parse_time(c, (int*)&base);
+	ret = parse_time(c, &btime);
 	if (ret < 0) {
 		return (-1);
 	}
+	base = btime;
 	ret = parse_dur((comma+1), &off, NULL);
 
-	int wi = 0;
+	/*
+	 * Setting the whole week reschedules all seven days, together.
+	 */
+	if (week) {
+		return (set_awake_week(base, off));
+	}
 
 	ret = set_awake(day, date, base, off);
 	/* handle_err(ret, n, day, date); */
@@ -763,14 +906,9 @@ do_time(int ac, char *av[])
 
 	if (day == -1 && date == 0) {
 		day_err();
-		exit(0);
+		plan_exit(0);
 	}
 
-	/*
-	 * When modifying time, we don't need to write duration data back to
-	 * the dur xattr (as the dur doesn't change).
-	 */
-	write_dur = 0;
 	/*
 	 * We are auto fitting.
 	 */
@@ -782,7 +920,7 @@ do_time(int ac, char *av[])
 		}
 		str = set_time_act(n, day, date, 0, 1);
 		handle_err(str, n, day, date);
-		return (0);
+		return (str);
 	}
 
 
@@ -796,7 +934,7 @@ do_time(int ac, char *av[])
 		str = set_time_act(n, day, date, time, 0);
 		handle_err(str, n, day, date);
 
-		return (0);
+		return (str);
 	}
 
 	return (0);
@@ -824,7 +962,7 @@ do_dur(int ac, char *av[])
 
 	if (day == -1 && date == 0) {
 		day_err();
-		exit(0);
+		plan_exit(0);
 	}
 
 	if (slash == NULL && date) {
@@ -837,7 +975,7 @@ do_dur(int ac, char *av[])
 
 	if (*(slash+1) == '@') {
 		printf("Only actions can have a duration\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	char *n = (slash+1);
@@ -851,7 +989,8 @@ do_dur(int ac, char *av[])
 	if (r == -1) {
 		printf("Valid duration format\n");
 		printf("\t<integer-0..24>h<integer-0..59>m\n");
-		exit(0);
+		printf("\t<integer-0..24>h<integer-0..59>m<integer-0..59>s\n");
+		plan_exit(0);
 	}
 
 	PLAN_DO_DUR(&dur, dur);
@@ -867,6 +1006,93 @@ do_dur(int ac, char *av[])
 	return (sdr);
 }
 
+/*
+ * Here we parse the command line and set the gap between the chunks of an
+ * activity, optionally followed by the spread they have to fit in, as in
+ * chunks=00h30m,06h00m (at least half an hour between chunks, and all of
+ * them within six hours). A gap of 00h00m and no spread lifts the
+ * constraints, and so does chunks=0, which parse_dur would turn down.
+ */
+static int
+do_chunks(int ac, char *av[])
+{
+	day_t day = -1;
+	tm_t t;
+	tm_t *date = &t;
+	size_t gap;
+	size_t spread = 0;
+	char *slash = strchr(av[2], '/');
+	char *g = av[1] + 7;
+	char *comma = strchr(g, ',');
+	int r;
+
+	day = parse_day(av[2]);
+	parse_date(av[2], &date);
+
+	if ((day == -1 && date == 0) || slash == NULL) {
+		day_err();
+		plan_exit(0);
+	}
+
+	if (*(slash+1) == '@') {
+		printf("Only actions can have chunks\n");
+		plan_exit(0);
+	}
+
+	if (strcmp(g, "0") == 0) {
+		gap = 0;
+		r = 0;
+	} else {
+		if (comma != NULL) {
+			*comma = '\0';
+		}
+		r = parse_dur(g, &gap, NULL);
+		if (r == 0 && comma != NULL) {
+			r = parse_dur(comma + 1, &spread, NULL);
+		}
+	}
+	if (r == -1) {
+		usage(cur_cmd, 1);
+		plan_exit(0);
+	}
+
+	r = set_chunks(slash + 1, day, date, gap, spread);
+	handle_err(r, slash + 1, day, date);
+	return (r);
+}
+
+/*
+ * Here we parse the command line and change the resolution of the plandb,
+ * given in seconds (<secs>s) or minutes (<mins>m).
+ */
+static int
+do_res(int ac, char *av[])
+{
+	char *v = strchr(av[1], '=') + 1;
+	char *end;
+	long secs = strtol(v, &end, 10);
+
+	if (end == v) {
+		usage(cur_cmd, 1);
+		plan_exit(0);
+	}
+
+	if (*end == 'm') {
+		secs *= 60;
+		end++;
+	} else if (*end == 's') {
+		end++;
+	}
+
+	if (*end != '\0' || !res_valid(secs)) {
+		printf("The resolution has to divide the day evenly, and be ");
+		printf("from 1 second to 60 minutes.\n");
+		plan_exit(0);
+	}
+
+	return (set_res(secs));
+}
+
 #define	SNCMD	(sizeof (set_cmd_tbl) / sizeof (set_cmd_tbl[0]))
 
 static plan_cmd_t set_cmd_tbl[] = {
@@ -876,12 +1102,20 @@ static plan_cmd_t set_cmd_tbl[] = {
 	{NULL, NULL, NULL},
 	{"time", do_time, HELP_SET_TIME},
 	{NULL, NULL, NULL},
+	{"resolution", do_res, HELP_SET_RESOLUTION},
+	{NULL, NULL, NULL},
+	{"chunks", do_chunks, HELP_SET_CHUNKS},
+	{NULL, NULL, NULL},
 };
 
 static int
 do_set(int ac, char *av[])
 {
-	if (ac < 3) {
+	/*
+	 * The resolution belongs to the whole plandb, so it's the one property
+	 * that isn't set on a day.
+	 */
+	if (ac < 3 && (ac < 2 || strncmp(av[1], "resolution=", 11) != 0)) {
 		return (-1);
 	}
 
@@ -890,7 +1124,7 @@ do_set(int ac, char *av[])
 	if (*eq == NULL) {
 		printf(
 		    "An '=' must separate the property name from the value\n");
-		exit(0);
+		plan_exit(0);
 	}
 
 	size_t eqlen = eq - av[1];
@@ -917,10 +1151,14 @@ do_set(int ac, char *av[])
 
 	if (do_ret == -1) {
 		printf("Can't set an invalid property.\n");
-		exit(0);
+		plan_exit(0);
 	}
 
-	return (0);
+	/*
+	 * Anything other than 0 has been reported already; plan-check wants to
+	 * know, so that it doesn't go on to check the rest.
+	 */
+	return (do_ret);
 }
 
 /*
@@ -934,10 +1172,11 @@ do_list(int ac, char *av[])
 	tm_t *date = &t;
 	day_t day = -1;
 	int cc;
-	char *ls_target;
+	char *ls_target = NULL;
+	scope_t from, to;
 	extern char *optarg;
 
-	while ((cc = getopt(ac, av, ":t:a:d")) != -1) {
+	while ((cc = getopt(ac, av, ":t:a:ds")) != -1) {
 		switch (cc) {
 
 		case 't':
@@ -945,7 +1184,7 @@ do_list(int ac, char *av[])
 
 			if (LS_IS_ACT(flag)) {
 				usage(cur_cmd, 1);
-				exit(0);
+				plan_exit(0);
 			}
 
 			ls_target = optarg;
@@ -955,7 +1194,7 @@ do_list(int ac, char *av[])
 			flag = flag ^ 1;
 			if (LS_IS_TODO(flag)) {
 				usage(cur_cmd, 1);
-				exit(0);
+				plan_exit(0);
 			}
 			ls_target = optarg;
 			break;
@@ -964,18 +1203,26 @@ do_list(int ac, char *av[])
 			flag = flag ^ 16;
 			break;
 
+		case 's':
+			flag = flag ^ 32;
+			break;
+
 		/* fallthrough */
 		case ':':
 		case '?':
 			usage(cur_cmd, 1);
-			exit(0);
+			plan_exit(0);
 			break;
 		}
 	}
 
+	if (ls_target == NULL) {
+		return (-1);
+	}
+
 	if (strcmp("today", ls_target) == 0) {
 		list_today(flag);
-		return (0);
+		goto done;
 	}
 
 	if (strcmp("general", ls_target) == 0) {
@@ -985,32 +1232,509 @@ do_list(int ac, char *av[])
 
 	if (strcmp("week", ls_target) == 0) {
 		list_week(flag, GEN);
-		return (0);
+		goto done;
 	}
 
 	if (strcmp("this_week", ls_target) == 0) {
 		list_week(flag, THIS);
-		return (0);
+		goto done;
 	}
 
 	if (strcmp("next_week", ls_target) == 0) {
 		list_week(flag, NEXT);
-		return (0);
+		goto done;
+	}
+
+	if (strstr(ls_target, "..") != NULL) {
+		if (parse_range(ls_target, &from, &to) != 0) {
+			printf("The range of dates has been mis-specified.\n");
+			plan_exit(0);
+		}
+		list_range(from, to, flag);
+		goto done;
 	}
 
 	day = parse_day(ls_target);
 	parse_date(ls_target, &date);
 	if (day != -1 || date) {
 		list(day, date, flag, 0);
-		return (SUCCESS);
+		goto done;
 	}
 
 
 
 	printf("Either the day or date has been mis-specified.\n");
-	exit(0);
+	plan_exit(0);
+
+done:
+	if (LS_IS_SUM(flag)) {
+		list_totals();
+	}
+	return (SUCCESS);
+}
+
+/*
+ * Here we start or stop the plan daemon. Stopping is handled by the daemon
+ * itself (the request gets forwarded to it), so if we get here, there's no
+ * daemon to stop.
+ */
+static int
+do_daemon(int ac, char *av[])
+{
+	if (strcmp(av[1], "start") == 0) {
+		(void) plan_daemon(plan_dispatch);
+		return (0);
+	}
+
+	if (strcmp(av[1], "stop") == 0) {
+		printf("The plan daemon isn't running\n");
+		return (0);
+	}
+
+	return (-1);
+}
+
+/*
+ * The command handlers bail out with plan_exit() instead of exit(). Outside
+ * of batch mode the two are the same. In batch mode we jump back into
+ * do_batch(), which moves on to the next command, so that one bad line
+ * doesn't throw away the rest of the script.
+ */
+static jmp_buf batch_env;
+static int batching = 0;
+
+void
+plan_exit(int code)
+{
+	if (batching) {
+		longjmp(batch_env, 1);
+	}
+	exit(code);
 }
 
+#define	BATCH_LINE	4096
+#define	BATCH_MAXARGS	64
+
+/*
+ * Splits a line of a batch script into words. Words are separated by white
+ * space, and can be quoted with "..." or '...' (so that descriptions can
+ * contain spaces). Returns the number of words, or -1 if a quote is left
+ * open.
+ */
+static int
+batch_split(char *line, char *bav[])
+{
+	int bac = 0;
+	char *c = line;
+	char *w;
+	char q;
+
+	for (;;) {
+		while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r') {
+			c++;
+		}
+		if (*c == '\0' || *c == '#') {
+			break;
+		}
+		if (bac == BATCH_MAXARGS) {
+			return (-1);
+		}
+		if (*c == '"' || *c == '\'') {
+			q = *c++;
+			w = c;
+			while (*c != q) {
+				if (*c == '\0') {
+					return (-1);
+				}
+				c++;
+			}
+		} else {
+			w = c;
+			while (*c != '\0' && *c != ' ' && *c != '\t' &&
+			    *c != '\n' && *c != '\r') {
+				c++;
+			}
+			if (*c == '\0') {
+				bav[bac++] = w;
+				break;
+			}
+		}
+		*c++ = '\0';
+		bav[bac++] = w;
+	}
+	return (bac);
+}
+
+/*
+ * If a command calls exit() directly (instead of plan_exit()), we still
+ * want the changes that were queued up by the batch to be committed.
+ */
+static void
+batch_atexit(void)
+{
+	if (batching) {
+		batching = 0;
+		batch_end();
+	}
+}
+
+/*
+ * Runs a script of plan commands (one per line, without the leading `plan`)
+ * in a single process. This saves us from opening the store, replaying the
+ * WAL, and setting up the arena once per command. More importantly,
+ * reallocation is deferred: a day that is touched by many commands in the
+ * script is reallocated and written out only once, at the end.
+ */
+static int
+do_batch(int ac, char *av[])
+{
+	static char line[BATCH_LINE];
+	static char *bav[BATCH_MAXARGS + 1];
+	static int lineno;
+	static int ncmds;
+	static int registered = 0;
+	int bac;
+	int c;
+	size_t len;
+	FILE *f;
+	hrtime_t start;
+	hrtime_t elapsed;
+
+	if (ac != 2) {
+		return (-1);
+	}
+
+	if (batching) {
+		printf("Batch scripts can't be nested\n");
+		return (0);
+	}
+
+	if (strcmp(av[1], "-") == 0) {
+		f = stdin;
+	} else if ((f = fopen(av[1], "r")) == NULL) {
+		perror(av[1]);
+		return (0);
+	}
+
+	if (!registered) {
+		(void) atexit(batch_atexit);
+		registered = 1;
+	}
+
+	lineno = 0;
+	ncmds = 0;
+	start = gethrtime();
+	batch_begin();
+	batching = 1;
+
+	while (fgets(line, sizeof (line), f) != NULL) {
+		lineno++;
+		/*
+		 * A line that didn't fit is skipped whole, rather than having
+		 * the rest of it run as a command of its own.
+		 */
+		len = strlen(line);
+		if (len > 0 && line[len - 1] != '\n' && !feof(f)) {
+			printf("line %d: longer than %d characters\n", lineno,
+			    BATCH_LINE - 2);
+			while ((c = getc(f)) != EOF && c != '\n')
+				;
+			continue;
+		}
+		bac = batch_split(line, bav);
+		if (bac == 0) {
+			continue;
+		}
+		if (bac < 0) {
+			printf("line %d: unterminated quote or too many "
+			    "arguments\n", lineno);
+			continue;
+		}
+		bav[bac] = NULL;
+
+		if (strcmp(bav[0], "batch") == 0 ||
+		    strcmp(bav[0], "daemon") == 0) {
+			printf("line %d: \"%s\" can't be used in a batch\n",
+			    lineno, bav[0]);
+			continue;
+		}
+
+		ncmds++;
+		if (setjmp(batch_env) == 0) {
+			optind = 1;
+			if (plan_dispatch(bac, bav) < 0) {
+				printf("line %d: invalid command\n", lineno);
+			}
+		}
+	}
+
+	batching = 0;
+	batch_end();
+
+	if (f != stdin) {
+		(void) fclose(f);
+	}
+
+	elapsed = gethrtime() - start;
+	fprintf(stderr, "batch: %d commands in %lld.%06lld secs",
+	    ncmds, (long long)(elapsed / NANOSEC),
+	    (long long)((elapsed % NANOSEC) / 1000));
+	if (elapsed > 0) {
+		fprintf(stderr, " (%lld commands/sec)",
+		    (long long)((hrtime_t)ncmds * NANOSEC / elapsed));
+	}
+	fprintf(stderr, "\n");
+	return (0);
+}
+
+/*
+ * Imports the events in a CSV or iCalendar file into the plandb.
+ */
+static int
+do_import(int ac, char *av[])
+{
+	if (ac != 3) {
+		return (-1);
+	}
+	return (plan_import(av[1], av[2]));
+}
+
+/*
+ * Exports the plandb's dates as CSV or iCalendar.
+ */
+static int
+do_export(int ac, char *av[])
+{
+	if (ac != 2 && ac != 3) {
+		return (-1);
+	}
+	return (plan_export(av[1], ac == 3 ? av[2] : NULL));
+}
+
+/*
+ * Finds every day and date that has an activity or todo by the given name,
+ * optionally only looking at a range of dates.
+ */
+static int
+do_find(int ac, char *av[])
+{
+	scope_t from = PS_GENERAL;
+	scope_t to = INT_MAX;
+
+	if (ac != 2 && ac != 3) {
+		return (-1);
+	}
+	if (ac == 3 && parse_range(av[2], &from, &to) != 0) {
+		printf("The range of dates has been mis-specified.\n");
+		plan_exit(0);
+	}
+	(void) find_name(av[1], from, to);
+	return (0);
+}
+
+/*
+ * Searches the details of activities and todos. If the last argument is a
+ * date or a range of dates, it limits the search rather than being searched
+ * for.
+ */
+static int
+do_search(int ac, char *av[])
+{
+	scope_t from = PS_GENERAL;
+	scope_t to = INT_MAX;
+
+	if (ac < 2) {
+		return (-1);
+	}
+	if (ac > 2 && parse_range(av[ac - 1], &from, &to) == 0) {
+		ac--;
+	}
+	(void) text_search(av + 1, ac - 1, from, to);
+	return (0);
+}
+
+/*
+ * Shows what a set of changes would do, without making any of them. The
+ * arguments are pairs of what "plan set" takes, as in
+ *
+ *	plan plan-check duration=01h00m mon/study chunks=00h30m mon/gym
+ *
+ * and every day they touch is placed in memory, with all of the changes in
+ * place. Each activity that would change or move is listed with its new
+ * time, or the one that wouldn't fit is reported. Only the properties that
+ * go through placement (duration, time, and chunks) can be checked. Since
+ * nothing is written, this is cheap enough to run on every edit in a UI.
+ */
+static int
+do_check(int ac, char *av[])
+{
+	char *sav[4];
+	char *slash;
+	int i;
+	int r;
+
+	if (ac < 3 || (ac - 1) % 2 != 0) {
+		return (-1);
+	}
+
+	if (batching) {
+		printf("Changes can't be checked in a batch\n");
+		return (0);
+	}
+
+	for (i = 1; i < ac; i += 2) {
+		slash = strchr(av[i + 1], '/');
+		if (strncmp(av[i], "duration=", 9) != 0 &&
+		    strncmp(av[i], "time=", 5) != 0 &&
+		    strncmp(av[i], "chunks=", 7) != 0) {
+			printf("Only duration, time and chunks can be "
+			    "checked\n");
+			return (0);
+		}
+		if (slash == NULL || *(slash + 1) == '@') {
+			printf("Only changes to activities can be checked\n");
+			return (0);
+		}
+	}
+
+	check_begin();
+	sav[0] = "set";
+	sav[3] = NULL;
+	for (i = 1; i < ac; i += 2) {
+		sav[1] = av[i];
+		sav[2] = av[i + 1];
+		r = do_set(3, sav);
+		if (r != 0) {
+			if (r < 0) {
+				printf("%s %s: invalid change\n", av[i],
+				    av[i + 1]);
+			}
+			check_abort();
+			return (0);
+		}
+	}
+	(void) check_end();
+	return (0);
+}
+
+/*
+ * Lists the days that have a block of free time at least as long as the given
+ * duration, in the given range of dates, or in the 30 days from today.
+ */
+#define	FREE_NDAYS	30
+
+static int
+do_free(int ac, char *av[])
+{
+	scope_t from;
+	scope_t to;
+	size_t dur;
+	time_t ct;
+	tm_t tm;
+
+	if (ac != 2 && ac != 3) {
+		return (-1);
+	}
+	if (parse_dur(av[1], &dur, NULL) != 0 || dur == 0) {
+		printf("The duration has been mis-specified.\n");
+		plan_exit(0);
+	}
+	if (ac == 3) {
+		if (parse_range(av[2], &from, &to) != 0) {
+			printf("The range of dates has been mis-specified.\n");
+			plan_exit(0);
+		}
+	} else {
+		ct = time(NULL);
+		tm = *localtime(&ct);
+		from = plan_scope(-1, &tm);
+		tm.tm_mday += FREE_NDAYS - 1;
+		tm.tm_isdst = -1;
+		(void) mktime(&tm);
+		to = plan_scope(-1, &tm);
+	}
+	(void) free_find(dur, from, to);
+	return (0);
+}
+
+/*
+ * Lists the static activities that overlap, in a day, a date or a range of
+ * dates, or ("all", or nothing at all) in every day and date there is.
+ */
+static int
+do_conflicts(int ac, char *av[])
+{
+	scope_t from = PS_GENERAL;
+	scope_t to = INT_MAX;
+	day_t day;
+
+	if (ac != 1 && ac != 2) {
+		return (-1);
+	}
+	if (ac == 1) {
+		(void) list_conflicts(from, to);
+		return (0);
+	}
+	if ((day = parse_day(av[1])) != -1) {
+		from = day;
+		to = day;
+	} else if (strcmp(av[1], "all") != 0 &&
+	    parse_range(av[1], &from, &to) != 0) {
+		printf("Either the day or date has been mis-specified.\n");
+		plan_exit(0);
+	}
+	(void) list_conflicts(from, to);
+	return (0);
+}
+
+/*
+ * Prints a minute map of each day in a range of dates (see free_busy), for
+ * "plan avail" to read.
+ */
+static int
+do_busy(int ac, char *av[])
+{
+	scope_t from;
+	scope_t to;
+
+	if (ac != 2) {
+		return (-1);
+	}
+	if (parse_range(av[1], &from, &to) != 0) {
+		printf("The range of dates has been mis-specified.\n");
+		plan_exit(1);
+	}
+	return (free_busy(from, to));
+}
+
+/*
+ * Lists the times in a range of dates when everyone is free for at least the
+ * given duration, going by each of the plandbs given, as in
+ *
+ *	plan avail 01h00m 2026-11-02..2026-11-06 ~/.plandb /home/kim/.plandb
+ */
+static int
+do_avail(int ac, char *av[])
+{
+	scope_t from;
+	scope_t to;
+	size_t dur;
+
+	if (ac < 4) {
+		return (-1);
+	}
+	if (parse_dur(av[1], &dur, NULL) != 0 || dur == 0) {
+		printf("The duration has been mis-specified.\n");
+		plan_exit(0);
+	}
+	if (parse_range(av[2], &from, &to) != 0) {
+		printf("The range of dates has been mis-specified.\n");
+		plan_exit(0);
+	}
+	(void) avail_find((dur * plan_res + 59) / 60, from, to, av + 3,
+	    ac - 3);
+	return (0);
+}
 
 static plan_cmd_t cmd_tbl[] = {
 	{"create", do_create, HELP_CREATE},
@@ -1025,12 +1749,36 @@ static plan_cmd_t cmd_tbl[] = {
 	{NULL, NULL, NULL},
 	{"list", do_list, HELP_LIST},
 	{NULL, NULL, NULL},
+	{"daemon", do_daemon, HELP_DAEMON},
+	{NULL, NULL, NULL},
+	{"batch", do_batch, HELP_BATCH},
+	{NULL, NULL, NULL},
+	{"import", do_import, HELP_IMPORT},
+	{NULL, NULL, NULL},
+	{"export", do_export, HELP_EXPORT},
+	{NULL, NULL, NULL},
+	{"find", do_find, HELP_FIND},
+	{NULL, NULL, NULL},
+	{"search", do_search, HELP_SEARCH},
+	{NULL, NULL, NULL},
+	{"plan-check", do_check, HELP_CHECK},
+	{NULL, NULL, NULL},
+	{"free", do_free, HELP_FREE},
+	{NULL, NULL, NULL},
+	{"conflicts", do_conflicts, HELP_CONFLICTS},
+	{NULL, NULL, NULL},
+	{"busy", do_busy, HELP_BUSY},
+	{NULL, NULL, NULL},
+	{"avail", do_avail, HELP_AVAIL},
+	{NULL, NULL, NULL},
 };
 
 #define	NCMD	(sizeof (cmd_tbl) / sizeof (cmd_tbl[0]))
 
 #define	LIST_USAGE\
-	"\tlist -a | -t today | <day> | <date> | week | this_week | next_week\n"\
+	"\tlist [-d] [-s] -a | -t today | <day> | <date> | week | this_week |"\
+	" next_week\n"\
+	"\tlist [-d] [-s] -a | -t <date>..<date>\n"\
 	"\tlist -t general\n"
 
 static void
@@ -1071,17 +1819,70 @@ usage(int ix, int usage_bool)
 		break;
 
 	case HELP_SET:
-		printf("\tset awake=<24-hr-time>,<hrs>h<mins>m <day|date>\n");
+		printf(
+		    "\tset awake=<24-hr-time>,<hrs>h<mins>m <day|date|week>\n");
 		printf("\tset duration=<hrs>h<mins>m <day|date>/<activity>\n");
 		printf("\tset time=autofit <day|date>/<activity>\n");
 		printf("\tset time=<24-hr-time> <day|date>/<activity>\n");
 		printf("\tset time=<24-hr-time> <day|date>/@<todo>\n");
+		printf("\tset resolution=<secs>s|<mins>m\n");
+		printf("\tset chunks=<hrs>h<mins>m[,<hrs>h<mins>m] "
+		    "<day|date>/<activity>\n");
+		printf("\tset chunks=0 <day|date>/<activity>\n");
 		break;
 
 	case HELP_LIST:
 		printf(LIST_USAGE);
 		break;
 
+	case HELP_DAEMON:
+		printf("\tdaemon start | stop\n");
+		break;
+
+	case HELP_BATCH:
+		printf("\tbatch <file> | -\n");
+		break;
+
+	case HELP_IMPORT:
+		printf("\timport csv|ics <file> | -\n");
+		break;
+
+	case HELP_EXPORT:
+		printf("\texport csv|ics [<file> | -]\n");
+		break;
+
+	case HELP_FIND:
+		printf("\tfind <name> [<date> | <date>..<date>]\n");
+		break;
+
+	case HELP_SEARCH:
+		printf("\tsearch <word> ... [<date> | <date>..<date>]\n");
+		break;
+
+	case HELP_CHECK:
+		printf("\tplan-check <property>=<value> <day|date>/<activity> "
+		    "...\n");
+		printf("\t(a Saturday pushed further into a changed Sunday isn't "
+		    "shown moving it)\n");
+		break;
+
+	case HELP_FREE:
+		printf("\tfree <hrs>h<mins>m [<date> | <date>..<date>]\n");
+		break;
+
+	case HELP_CONFLICTS:
+		printf("\tconflicts [<day> | <date> | <date>..<date> | all]\n");
+		break;
+
+	case HELP_BUSY:
+		printf("\tbusy <date> | <date>..<date>\n");
+		break;
+
+	case HELP_AVAIL:
+		printf("\tavail <hrs>h<mins>m <date> | <date>..<date> "
+		    "<plandb> ...\n");
+		break;
+
 	}
 
 
@@ -1099,6 +1900,56 @@ print_usage_all()
 	}
 }
 
+/*
+ * Runs the command named by av[0]. This is called by main(), and by the plan
+ * daemon for every request it serves.
+ */
+static int
+plan_dispatch(int ac, char *av[])
+{
+	int do_ret = -1;
+	int i = 0;
+	while (i < NCMD) {
+		if (cmd_tbl[i].name == NULL) {
+			i++;
+			continue;
+		}
+
+		if (strcmp(av[0], cmd_tbl[i].name) == 0) {
+			cur_cmd = i;
+			do_ret = cmd_tbl[i].func(ac, av);
+			if (do_ret < 0) {
+				usage(i, 1);
+			}
+			break;
+		}
+		i++;
+	}
+
+	if (do_ret < 0) {
+		//print_usage_all();
+	}
+
+	return (do_ret);
+}
+
+/*
+ * These commands are never forwarded to the daemon: the one that starts the
+ * daemon, and the ones that read or write files named on the command line
+ * (the daemon runs in another directory, and doesn't have our stdin). Batch
+ * scripts also get more out of running in-process, where our state stays
+ * warm across their commands.
+ */
+static int
+local_cmd(int ac, char *av[])
+{
+	if (strcmp(av[0], "daemon") == 0) {
+		return (strcmp(av[1], "start") == 0);
+	}
+	return (strcmp(av[0], "batch") == 0 || strcmp(av[0], "import") == 0 ||
+	    strcmp(av[0], "export") == 0 || strcmp(av[0], "avail") == 0);
+}
+
 static int
 my_umem_retry()
 {
@@ -1119,44 +1970,31 @@ main(int ac, char *av[])
 		sleep(7);
 	}
 
+	plan_path = av[0];
 	pn = basename(av[0]);
 
-	if (ac < 3) {
+	/*
+	 * Every command takes an argument, except "conflicts", which looks at
+	 * every day and date without one.
+	 */
+	if (ac < 3 && (ac < 2 || strcmp(av[1], "conflicts") != 0)) {
 		print_usage_all();
 		return (0);
 	}
 
 	/*
-	 * We use umem caches because, in addition to being fast, they allow us
-	 * to construct objects upon allocation (less house keeping involved).
+	 * If the plan daemon is running, it does all of the work, and we skip
+	 * all of the set-up below. It only serves the user's own plandb, so
+	 * not when PLAN_DB names another one.
 	 */
-	act_cache = umem_cache_create("act_cache",
-			sizeof (act_t),
-			0,
-			act_ctor,
-			act_dtor,
-			NULL,
-			NULL,
-			NULL,
-			0);
-
-	todo_cache = umem_cache_create("todo_cache",
-			sizeof (todo_t),
-			0,
-			todo_ctor,
-			todo_dtor,
-			NULL,
-			NULL,
-			NULL,
-			0);
+	char *db = getenv("PLAN_DB");
+	if (db == NULL && !local_cmd((ac-1), (av+1)) &&
+	    plan_client((ac-1), (av+1)) == 0) {
+		return (0);
+	}
 
 	umem_nofail_callback(my_umem_retry);
 
-	/*
-	 * By default, we update all xattr's.
-	 */
-	write_dur = 1;
-
 	/*
 	 * We always place .plandb in the current user's home directory. We
 	 * find the home directory, concatenate the two paths, and open the
@@ -1165,19 +2003,32 @@ main(int ac, char *av[])
 	 * way, we can peruse an existing .plandb directory, that might not
 	 * have any subdirectories. This allows the user to create ~/.plandb
 	 * before using `plan`. This way they could, for example dedicate a ZFS
-	 * datasetfor .plandb if they should desire this.
+	 * datasetfor .plandb if they should desire this. PLAN_DB can name
+	 * another db root instead (plan avail reads other people's this way).
 	 */
-	uid_t uid = getuid();
-	struct passwd *pwd = getpwuid(uid);
-	char *home = pwd->pw_dir;
-	size_t hl = strlen(home);
-	size_t pdbl = hl+9;
-	/* the db root */
-	char *pdb_path = umem_alloc(pdbl, UMEM_NOFAIL);
-	strcpy(pdb_path, home);
-	strcat(pdb_path, "/.plandb");
+	size_t pdbl;
+	char *pdb_path;
+	if (db != NULL) {
+		pdbl = strlen(db) + 1;
+		pdb_path = umem_alloc(pdbl, UMEM_NOFAIL);
+		strcpy(pdb_path, db);
+	} else {
+		uid_t uid = getuid();
+		struct passwd *pwd = getpwuid(uid);
+		char *home = pwd->pw_dir;
+		size_t hl = strlen(home);
+		pdbl = hl+9;
+		/* the db root */
+		pdb_path = umem_alloc(pdbl, UMEM_NOFAIL);
+		strcpy(pdb_path, home);
+		strcat(pdb_path, "/.plandb");
+	}
 	mkdir(pdb_path, ALLRWX);
 	DIR *pdb_dir = opendir(pdb_path);
+	if (pdb_dir == NULL) {
+		perror(pdb_path);
+		exit(1);
+	}
 	pdb_fd = dirfd(pdb_dir);
 	mkdirat(pdb_fd, "days", ALLRWX);
 	mkdirat(pdb_fd, "dates", ALLRWX);
@@ -1196,63 +2047,58 @@ main(int ac, char *av[])
 	dates_fd = openat(pdb_fd, "dates", O_RDONLY);
 	todos_fd = openat(pdb_fd, "todos", O_RDONLY);
 
+	/*
+	 * The storage backend defaults to the directory layout above, but can
+	 * be picked with the PLAN_STORE environment variable ("xattr" or
+	 * "log"). This way, both backends can be benchmarked on the same data
+	 * (the log is seeded from the directories the first time it's used).
+	 */
+	char *store_name = getenv("PLAN_STORE");
+	if (plan_store_select(store_name) != 0) {
+		printf("Unknown storage backend \"%s\"\n", store_name);
+		exit(0);
+	}
+	if (store->ps_open(pdb_fd) != 0) {
+		exit(0);
+	}
 
 	/*
-	 * While vmem is a rather sexy resource allocator, a horrible, horrible
-	 * flaw in the 2001 umem/vmem paper is that the authors neglected to
-	 * mention that we can't allocate integer resources that have an
-	 * initial span starting at 0 AND a non-zero size (but an initial span
-	 * with size 0 _can_ start at 0). This situation is further exacerbated
-	 * by the psuedo-code examples that show the creation of hypothetical
-	 * arenas that do indeed have a span based at zero, with a non-zero
-	 * size.  This comment is here so that the next poor soul who looks at
-	 * this code doesn't interpret the `(void*)1` as a careless error on my
-	 * part. Trying to "fix" it with a `(void*)0` will result in a
-	 * umem_panic (which raises a SIGABRT), which will in turn result in
-	 * threats of violence directed at the dev machine, raised
-	 * blood-pressure, lowered life-expectancy, significantly less hair,
-	 * and possibly a restraining order from your room mate directed at you
-	 * (or vice-versa). You're welcome.
+	 * Likewise, PLAN_SCHED picks how dynamic activities are placed
+	 * ("bestfit" or "pack", see plan_pack.c).
 	 */
-	vmday = vmem_create(
-			"vmday",
-			(void*)1,
-			1440,
-			1,
-			NULL,
-			NULL,
-			NULL,
-			1,
-			VM_NOSLEEP);
+	char *sched_name = getenv("PLAN_SCHED");
+	if (pack_select(sched_name) != 0) {
+		printf("Unknown scheduler \"%s\"\n", sched_name);
+		exit(0);
+	}
 
 	/*
-	 * Used while debugging, may be useful in the future.
+	 * Times and durations in the store are in slots of the plandb's
+	 * resolution, which has to be known before anything is read (the WAL
+	 * may change it).
 	 */
-	PLAN_VMEM_CREATE(vmday);
+	res_open(pdb_fd);
 
-	int do_ret = -1;
-	int i = 0;
-	while (i < NCMD) {
-		if (cmd_tbl[i].name == NULL) {
-			i++;
-			continue;
-		}
+	/*
+	 * Any changes that were committed to the WAL, but may not have made it
+	 * to the store, are replayed here.
+	 */
+	wal_open(pdb_fd);
+	names_open(pdb_fd);
+	text_open(pdb_fd);
 
-		if (strcmp(av[1], cmd_tbl[i].name) == 0) {
-			cur_cmd = i;
-			do_ret = cmd_tbl[i].func((ac-1), (av+1));
-			if (do_ret < 0) {
-				usage(i, 1);
-			}
-			break;
-		}
-		i++;
-	}
+	/*
+	 * The slots of the days that commands place activities into (a day, and
+	 * the next, for activities that run past midnight).
+	 */
+	dmday = daymap_create(PD_SPANS * plan_slots);
 
-	if (do_ret < 0) {
-		//print_usage_all();
-	}
+	(void) plan_dispatch((ac-1), (av+1));
 
+	wal_close();
+	names_close();
+	text_close();
+	store->ps_close();
 	umem_free(pdb_path, pdbl);
 	return (0);
 }
@@ -23,64 +23,130 @@
  */
 
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <dirent.h>
+#include <sys/param.h>
+#include <sys/avl.h>
+#include <stddef.h>
+#include <pthread.h>
 #include <umem.h>
-#include <sys/vmem.h>
 #include <strings.h>
+#include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 #include "plan_impl.h"
 #include "plan_probes.h"
-#define	MEM2TIME(p) ((int)(p - 1))
-#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
 
 char *daystr[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday",
 	"Friday", "Saturday"};
 /*
- * We can, at most, have 1440 actions in a day. Here, we queue up the
- * actions as we reallocate them in the loop in read_act_dir.
+ * Here, we queue up the actions as we reallocate them in the loop in
+ * read_act_dir. Commands work on
+ * one day at a time, using day0 (which places into dmday).
  */
-static act_t *a[1440];
+static plan_day_t day0;
 static todo_t **t;
 static size_t tsz;
 static size_t t_elems;
-static size_t a_elems;
+static arena_t t_arena;
 
-extern int write_dur;
-extern int days_fd;
-extern int dates_fd;
-extern int exdates_fd;
-extern int todos_fd;
-extern vmem_t *vmday;
+/*
+ * `list -s` totals each activity across all of the days it lists. Each
+ * day's names are interned afresh when it's loaded, so we keep a second
+ * table for the whole command, and map a day's ids onto it.
+ */
+typedef struct ls_total {
+	size_t	lt_days;
+	size_t	lt_dur;
+} ls_total_t;
+
+static intern_t ls_names;
+static ls_total_t *ls_tot;
+static size_t ls_maxtot;
+
+extern daymap_t *dmday;
+extern int plan_res;
+extern size_t plan_slots;
+extern void res_fmt_time(char *, size_t, int);
+extern void res_fmt_dur(char *, size_t, size_t);
+extern daymap_t *daymap_create(size_t);
+extern void daymap_destroy(daymap_t *);
+extern int daymap_alloc(daymap_t *, size_t, size_t, size_t, int);
+extern void daymap_free(daymap_t *, size_t, size_t);
+extern void daymap_claim(daymap_t *, size_t, size_t);
+extern int daymap_alloc_chain(daymap_t *, size_t, size_t, size_t, size_t,
+    size_t, size_t, int *);
+extern int plan_sched;
+extern int pack_acts(plan_day_t *);
+extern void occ_init(day_occ_t *);
+extern void occ_fini(day_occ_t *);
+extern void occ_add(day_occ_t *, int, size_t, int);
+extern void occ_del(day_occ_t *, int, size_t, int);
+extern void occ_read(day_occ_t *, scope_t);
+extern void occ_write(day_occ_t *, scope_t);
+extern int occ_fits(day_occ_t *, size_t, size_t);
+extern int occ_spill(day_occ_t *);
+extern void occ_claim(uint64_t *, size_t, size_t, daymap_t *, size_t);
+extern int occ_clashes(day_occ_t *, daymap_t *);
+extern plan_store_t *store;
 
 extern short month_day_tbl[];
 
-extern umem_cache_t *act_cache;
-extern umem_cache_t *todo_cache;
 
-extern void atomic_read(int, void*, size_t);
-extern void atomic_write(int, void*, size_t);
+extern scope_t plan_scope(day_t, tm_t *);
+extern void scope_to_tm(scope_t, tm_t *);
+extern void act_rec_init(act_rec_t *, size_t);
+extern void act_rec_free(act_rec_t *);
+
+extern void *arena_alloc(arena_t *, size_t);
+extern void *arena_zalloc(arena_t *, size_t);
+extern char *arena_strdup(arena_t *, const char *, size_t);
+extern void arena_reset(arena_t *);
+extern void arena_fini(arena_t *);
+extern uint32_t intern(intern_t *, const char *, size_t);
+extern char *intern_name(intern_t *, uint32_t);
+extern void intern_reset(intern_t *);
+extern void intern_fini(intern_t *);
+extern void itree_build(itree_t *, ival_t *, size_t);
+extern void itree_fini(itree_t *);
+extern size_t itree_overlaps(itree_t *, ival_t *, itree_walk_f, void *);
+extern size_t itree_pairs(itree_t *, itree_walk_f, void *);
+
+extern void wal_begin(void);
+extern void wal_end(void);
+extern void wal_act(scope_t, char *, act_rec_t *);
+extern void wal_awake(scope_t, size_t, size_t);
+extern void wal_todo(scope_t, char *, int);
+extern void wal_res(int);
+
+extern void plan_exit(int);
+
+extern void names_add(nm_kind_t, scope_t, char *);
+extern void names_del(nm_kind_t, scope_t, char *);
+extern void names_rename(nm_kind_t, scope_t, char *, char *);
+extern void names_walk(char *, scope_t, scope_t, names_walk_f, void *);
+
+extern void text_set(nm_kind_t, scope_t, char *, char *);
+extern void text_del(nm_kind_t, scope_t, char *);
+extern void text_rename(nm_kind_t, scope_t, char *, char *);
 
 /*
- * Here we compare two activities. But since this function is to be used on an
- * array of _pointer_ and NOT on an array of activities, we pass pointers to
- * the pointers. So, we have to dereference them twice to get at the data.
- * More importantly, activities are sorted by their start-time, and not their
- * name.
+ * Chunks are sorted by their start time (for listing) through an array of
+ * keys, each of which is a start time followed by the chunk's index in the
+ * plan_day_t, so that the arrays of the day itself stay where they are, and
+ * chunks that start at the same time keep the order they were read in.
  */
 static int
-comp_act_ptrs(const void *a1, const void *a2)
+comp_act_keys(const void *k1, const void *k2)
 {
-	act_t *a1p = *(act_t **)a1;
-	act_t *a2p = *(act_t **)a2;
+	uint64_t k1v = *(uint64_t *)k1;
+	uint64_t k2v = *(uint64_t *)k2;
 
-	if (a1p->act_time < a2p->act_time) {
+	if (k1v < k2v) {
 		return (-1);
 	}
 
-	if (a1p->act_time > a2p->act_time) {
+	if (k1v > k2v) {
 		return (1);
 	}
 
@@ -104,150 +170,236 @@ comp_todo_ptrs(const void *t1, const void *t2)
 	return (0);
 }
 
-static size_t
-get_total_usage()
+/*
+ * Returns the day that commands place activities into.
+ */
+static plan_day_t *
+plan_day0(void)
 {
-	int i = 0;
-	size_t usage = 0;
-	while (i < a_elems && a_elems != 0) {
-		usage += a[i]->act_dur;
-		i++;
-	}
-	return (usage);
+	day0.pd_map = dmday;
+	return (&day0);
 }
 
-static int
-openday(day_t day)
-{
-	char *path;
-	switch (day) {
-
-	case MON:
-		path = "mon";
-		break;
-	case TUES:
-		path = "tues";
-		break;
-	case WED:
-		path = "wed";
-		break;
-	case THUR:
-		path = "thur";
-		break;
-	case FRI:
-		path = "fri";
-		break;
-	case SAT:
-		path = "sat";
-		break;
-	case SUN:
-		path = "sun";
-		break;
-
-	default:
-		return (-1);
-	}
-
-	mkdirat(days_fd, path, ALLRWX);
-	return (openat(days_fd, path, O_RDONLY));
-}
+/*
+ * Makes room for `n` more chunks in pd's arrays, and for `ncold` more
+ * activities in pd->pd_cold[]. Each activity takes one entry per chunk, and
+ * nothing bounds how many there are in a day (an activity without a duration
+ * doesn't use up any slots), so the arrays grow. read_act_dir sizes them for
+ * the whole scope before it reads it, so they only grow during the read for
+ * an activity that has more than one chunk. They're kept from one read to the
+ * next.
+ */
+#define	PD_MINACTS	64
 
-static int
-havedate(tm_t *date)
+static void *
+pd_grow(void *old, size_t elsz, size_t used, size_t oldn, size_t newn)
 {
-	char ypath[] = {0, 0, 0, 0, 0};
-	char mpath[] = {0, 0, 0};
-	char dpath[] = {0, 0, 0};
+	void *new = umem_alloc(newn * elsz, UMEM_NOFAIL);
 
+	if (oldn) {
+		bcopy(old, new, used * elsz);
+		umem_free(old, oldn * elsz);
+	}
+	return (new);
+}
 
-	strftime(ypath, sizeof (ypath), "%Y", date);
-	strftime(mpath, sizeof (ypath), "%m", date);
-	strftime(dpath, sizeof (ypath), "%d", date);
-	int yfd = openat(dates_fd, &ypath[0], O_RDONLY);
-	int mfd = openat(yfd, &mpath[0], O_RDONLY);
-	int dfd = openat(mfd, &dpath[0], O_RDONLY);
-	close(yfd);
-	close(mfd);
-	close(dfd);
+static void
+pd_reserve(plan_day_t *pd, size_t ncold, size_t n)
+{
+	size_t used = pd->pd_elems;
+	size_t old = pd->pd_maxacts;
+	size_t sz;
 
-	if (yfd == -1 || mfd == -1 || dfd == -1) {
-		return (0);
+	sz = pd->pd_maxcold ? pd->pd_maxcold : PD_MINACTS;
+	while (sz < pd->pd_ncold + ncold) {
+		sz *= 2;
+	}
+	if (sz != pd->pd_maxcold) {
+		pd->pd_cold = pd_grow(pd->pd_cold, sizeof (act_cold_t),
+		    pd->pd_ncold, pd->pd_maxcold, sz);
+		pd->pd_maxcold = sz;
 	}
 
-	return (1);
+	sz = old ? old : PD_MINACTS;
+	while (sz < used + n) {
+		sz *= 2;
+	}
+	if (sz == old) {
+		return;
+	}
+	pd->pd_time = pd_grow(pd->pd_time, sizeof (int), used, old, sz);
+	pd->pd_loc = pd_grow(pd->pd_loc, sizeof (int), used, old, sz);
+	pd->pd_prev = pd_grow(pd->pd_prev, sizeof (int), used, old, sz);
+	pd->pd_dur = pd_grow(pd->pd_dur, sizeof (size_t), used, old, sz);
+	pd->pd_min = pd_grow(pd->pd_min, sizeof (size_t), used, old, sz);
+	pd->pd_max = pd_grow(pd->pd_max, sizeof (size_t), used, old, sz);
+	pd->pd_flags = pd_grow(pd->pd_flags, sizeof (uint8_t), used, old, sz);
+	pd->pd_act = pd_grow(pd->pd_act, sizeof (uint32_t), used, old, sz);
+	pd->pd_maxacts = sz;
 }
 
-static int
-opendate(tm_t *date)
+static size_t
+get_total_usage(plan_day_t *pd)
 {
-	char ypath[] = {0, 0, 0, 0, 0};
-	char mpath[] = {0, 0, 0};
-	char dpath[] = {0, 0, 0};
-
+	size_t i = 0;
+	size_t usage = 0;
+	while (i < pd->pd_elems) {
+		usage += pd->pd_dur[i];
+		i++;
+	}
+	return (usage);
+}
 
-	strftime(ypath, sizeof (ypath), "%Y", date);
-	strftime(mpath, sizeof (mpath), "%m", date);
-	strftime(dpath, sizeof (dpath), "%d", date);
+/*
+ * When we change the duration or time of an activity, we don't write the new
+ * record to the store before reallocating. Instead, the new record goes into
+ * the overlay below, and read_act_dir uses it in place of the stored record.
+ * If the reallocation fails, nothing has been written, and there's nothing
+ * to undo. If it succeeds, commit_act_arr writes out the records that
+ * changed, new record included, and the overlay is dropped.
+ *
+ * In batch mode (see batch_begin) we don't reallocate right away. The
+ * overlay keeps collecting changes, and every day that has changes gets
+ * reallocated once, when the batch ends.
+ */
+typedef struct act_ov {
+	avl_node_t	ov_node;
+	scope_t		ov_scope;
+	char		*ov_name;
+	size_t		ov_name_len;
+	act_rec_t	ov_rec;
+} act_ov_t;
+
+static avl_tree_t ov_tree;
+static int ov_init;
+static int realloc_defer;
 
-	mkdirat(dates_fd, ypath, ALLRWX);
+static int
+ov_cmp(const void *l, const void *r)
+{
+	const act_ov_t *lo = l;
+	const act_ov_t *ro = r;
+	int c;
 
-	int yfd = openat(dates_fd, &ypath[0], O_RDONLY);
+	if (lo->ov_scope < ro->ov_scope) {
+		return (-1);
+	}
+	if (lo->ov_scope > ro->ov_scope) {
+		return (1);
+	}
+	c = strcmp(lo->ov_name, ro->ov_name);
+	if (c < 0) {
+		return (-1);
+	}
+	if (c > 0) {
+		return (1);
+	}
+	return (0);
+}
 
-	mkdirat(yfd, &mpath[0], ALLRWX);
+static act_ov_t *
+ov_find(scope_t s, char *n)
+{
+	act_ov_t key;
 
-	int mfd = openat(yfd, &mpath[0], O_RDONLY);
+	if (!ov_init) {
+		avl_create(&ov_tree, ov_cmp, sizeof (act_ov_t),
+		    offsetof(act_ov_t, ov_node));
+		ov_init = 1;
+	}
+	key.ov_scope = s;
+	key.ov_name = n;
+	return (avl_find(&ov_tree, &key, NULL));
+}
 
-	mkdirat(mfd, dpath, ALLRWX);
+static void
+ov_free(act_ov_t *ov)
+{
+	avl_remove(&ov_tree, ov);
+	umem_free(ov->ov_name, ov->ov_name_len + 1);
+	act_rec_free(&ov->ov_rec);
+	umem_free(ov, sizeof (act_ov_t));
+}
 
-	int dfd = openat(mfd, &dpath[0], O_RDONLY);
+static void
+rec_copy(act_rec_t *dst, act_rec_t *src)
+{
+	act_rec_init(dst, src->ar_ntimes);
+	dst->ar_dyn = src->ar_dyn;
+	dst->ar_dur = src->ar_dur;
+	dst->ar_gap = src->ar_gap;
+	dst->ar_spread = src->ar_spread;
+	bcopy(src->ar_time, dst->ar_time, src->ar_ntimes * sizeof (int));
+}
 
-	close(yfd);
-	close(mfd);
-	return (dfd);
+static void
+ov_put(scope_t s, char *n, act_rec_t *r)
+{
+	act_ov_t *ov = ov_find(s, n);
+
+	if (ov == NULL) {
+		ov = umem_zalloc(sizeof (act_ov_t), UMEM_NOFAIL);
+		ov->ov_scope = s;
+		ov->ov_name_len = strlen(n);
+		ov->ov_name = umem_zalloc(ov->ov_name_len + 1, UMEM_NOFAIL);
+		bcopy(n, ov->ov_name, ov->ov_name_len);
+		avl_add(&ov_tree, ov);
+	} else {
+		act_rec_free(&ov->ov_rec);
+	}
+	rec_copy(&ov->ov_rec, r);
 }
 
-static int
-openacts(int dfd)
+/*
+ * Drops all of the overlaid records for a scope.
+ */
+static void
+ov_clear(scope_t s)
 {
-	mkdirat(dfd, "acts", ALLRWX);
-	return (openat(dfd, "acts", O_RDONLY));
+	act_ov_t key;
+	act_ov_t *ov;
+	avl_index_t where;
+
+	(void) ov_find(s, "");
+	key.ov_scope = s;
+	key.ov_name = "";
+	ov = avl_find(&ov_tree, &key, &where);
+	if (ov == NULL) {
+		ov = avl_nearest(&ov_tree, where, AVL_AFTER);
+	}
+	while (ov != NULL && ov->ov_scope == s) {
+		act_ov_t *next = AVL_NEXT(&ov_tree, ov);
+		ov_free(ov);
+		ov = next;
+	}
 }
 
+/*
+ * Gets the current record of an activity, which is the overlaid record if
+ * there is one.
+ */
 static int
-opentodos(int dfd)
+act_get(scope_t s, char *n, act_rec_t *r)
 {
-	if (dfd != -1) {
-		mkdirat(dfd, "todos", ALLRWX);
-		return (openat(dfd, "todos", O_RDONLY));
+	act_ov_t *ov = ov_find(s, n);
+
+	if (ov != NULL) {
+		rec_copy(r, &ov->ov_rec);
+		return (0);
 	}
-	return (todos_fd);
+	return (store->ps_act_get(s, n, r));
 }
 
+static int
+havedate(tm_t *date)
+{
+	return (store->ps_have(plan_scope(-1, date)));
+}
 
 static int
 get_awake_range(int day, tm_t *date, size_t *s, size_t *off)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
-	int awake_xattr = openat(dfd, "awake", O_XATTR | O_RDONLY);
-	int dur_xattr = openat(dfd, "dur", O_XATTR | O_RDONLY);
-	/*
-	 * If this day has no awake or dur attr's we apparently have full day
-	 * on our hands.
-	 */
-	if (awake_xattr == -1 || dur_xattr == -1) {
-		*s = 0;
-		*off = 1440;
-	}
-	atomic_read(awake_xattr, s, sizeof (size_t));
-	atomic_read(awake_xattr, off, sizeof (size_t));
-	close(awake_xattr);
-	close(dur_xattr);
-	close(dfd);
+	store->ps_awake_get(plan_scope(day, date), s, off);
 	return (0);
 }
 
@@ -255,138 +407,73 @@ get_awake_range(int day, tm_t *date, size_t *s, size_t *off)
 int
 create_act(char *n, day_t day, tm_t *date)
 {
-	int dfd;
-
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
 
-	int adfd = openacts(dfd);
-	int afd = openat(adfd, n, O_RDWR, ALLRWX);
-	if (afd != -1) {
+	if (store->ps_act_create(s, n) != 0) {
 		return (CREATE_EEXIST);
 	}
-	size_t dval = 0;
-	char yval = 1;
-	int tval = -1;
-	afd = openat(adfd, n, O_CREAT | O_RDWR, ALLRWX);
-	int time_xattr = openat(afd, "time",
-		O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	int dur_xattr = openat(afd, "dur",
-		O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	int dyn_xattr = openat(afd, "dyn",
-		O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	atomic_write(time_xattr, &tval, sizeof (int));
-	atomic_write(dur_xattr, &dval, sizeof (size_t));
-	atomic_write(dyn_xattr, &yval, sizeof (char));
-	close(dfd);
-	close(adfd);
-	close(afd);
-	close(time_xattr);
-	close(dur_xattr);
-	close(dyn_xattr);
+	names_add(NM_ACT, s, n);
 	return (0);
 }
 
 int
 create_todo(char *n, int day, tm_t *date)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
-
+	scope_t s = plan_scope(day, date);
 
-	int tdfd;
-	tdfd = opentodos(dfd);
-
-	int tfd = openat(tdfd, n, O_RDWR, ALLRWX);
-	if (tfd != -1) {
+	if (store->ps_todo_create(s, n) != 0) {
 		return (CREATE_TD_EEXIST);
 	}
-	int tval = 0;
-	tfd = openat(tdfd, n, O_CREAT | O_RDWR, ALLRWX);
-	if (tfd == -1) {
-		perror("ctodo");
-		exit(0);
-	}
-	int time_xattr = openat(tfd, "time",
-		O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	if (time_xattr == -1) {
-		perror("ctodo");
-		exit(0);
-	}
-	atomic_write(time_xattr, &tval, sizeof (int));
-	close(dfd);
-	close(tdfd);
-	close(tfd);
-	close(time_xattr);
+	names_add(NM_TODO, s, n);
 	return (0);
-
 }
 
 
 int
 destroy_act(char *n, day_t day, tm_t *date)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
-	int adfd = openacts(dfd);
-	int uaret = unlinkat(adfd, n, 0);
-	if (uaret == -1) {
+	scope_t s = plan_scope(day, date);
+	act_ov_t *ov;
+
+	if (store->ps_act_destroy(s, n) != 0) {
 		return (DESTROY_EEXIST);
 	}
-	close(dfd);
-	close(adfd);
+	names_del(NM_ACT, s, n);
+	text_del(NM_ACT, s, n);
+	if ((ov = ov_find(s, n)) != NULL) {
+		ov_free(ov);
+	}
 	return (0);
 }
 
 int
 destroy_todo(char *n, day_t day, tm_t *date)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
-	int tdfd = opentodos(dfd);
-	int uaret = unlinkat(tdfd, n, 0);
-	if (uaret == -1) {
+	scope_t s = plan_scope(day, date);
+
+	if (store->ps_todo_destroy(s, n) != 0) {
 		return (DESTROY_TD_EEXIST);
 	}
-	close(dfd);
-	close(tdfd);
+	names_del(NM_TODO, s, n);
+	text_del(NM_TODO, s, n);
 	return (0);
 }
 
 int
 rename_act(char *old, char *new, day_t day, tm_t *date)
 {
-	int dfd;
-
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
+	act_ov_t *ov;
 
-	int adfd = openacts(dfd);
-	int nfd = openat(adfd, new, O_RDONLY);
-	if (nfd >= 0) {
+	if (store->ps_act_rename(s, old, new) != 0) {
 		return (RN_ENEWEXIST);
 	}
-	renameat(adfd, old, adfd, new);
-	close(dfd);
-	close(adfd);
+	names_rename(NM_ACT, s, old, new);
+	text_rename(NM_ACT, s, old, new);
+	if ((ov = ov_find(s, old)) != NULL) {
+		ov_put(s, new, &ov->ov_rec);
+		ov_free(ov);
+	}
 	return (0);
 }
 
@@ -394,756 +481,1883 @@ rename_act(char *old, char *new, day_t day, tm_t *date)
 int
 rename_todo(char *old, char *new, day_t day, tm_t *date)
 {
-	int dfd;
-
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
 
-	int adfd = opentodos(dfd);
-	int nfd = openat(adfd, new, O_RDONLY);
-	if (nfd >= 0) {
+	if (store->ps_todo_rename(s, old, new) != 0) {
 		return (RN_TD_ENEWEXIST);
 	}
-	renameat(adfd, old, adfd, new);
-	close(dfd);
-	close(adfd);
+	names_rename(NM_TODO, s, old, new);
+	text_rename(NM_TODO, s, old, new);
 	return (0);
 }
 
 
 
-static ra_err_t realloc_err;
 
 /*
- * The below macro was used
+ * This is the todo_walk_f that read_todo_dir hands to the store. It appends
+ * the todo to t[], growing t[] as needed. The todos, their names and details,
+ * and t[] itself all come from t_arena, and are freed together by
+ * free_todo_arr(); when t[] grows, the old one is left in the arena.
  */
 static void
-read_todo_dir(int tfd, int det)
+load_todo(void *arg, char *n, int time, char *det)
 {
-
-	struct dirent *de = NULL;
-	DIR *todos_dir = fdopendir(tfd);
-	size_t i = 0;
+	size_t i = t_elems;
 	size_t tsz2 = 0;
-	tsz = 0;
 	size_t psz = sizeof (todo_t *);
-	int dotdirs = 1;
-	while ((de = readdir(todos_dir)) != NULL) {
-		/*
-		 * The first 2 dirents are always '.' and '..'
-		 * We skip those.
-		 */
-		if (dotdirs < 3) {
-			dotdirs++;
-			continue;
+
+	if ((i*psz) == tsz) {
+		if (i == 0) {
+			tsz2 = 100*psz;
+		} else {
+			tsz2 = tsz * 2;
 		}
-		if ((i*psz) == tsz) {
-			PLAN_GOT_HERE(0);
-			if (i == 0) {
-			PLAN_GOT_HERE(1);
-				tsz = 100*psz;
-				tsz2 = tsz;
-			} else {
-			PLAN_GOT_HERE(2);
-				tsz2 = tsz * 2;
-			}
-			todo_t **t2 = umem_alloc(tsz2, UMEM_NOFAIL);
-			PLAN_GOT_HERE(3);
-			if (i) {
-				bcopy(t, t2, tsz);
-			}
-			PLAN_GOT_HERE(4);
-			umem_free(t, tsz);
-			PLAN_GOT_HERE(5);
-			t = t2;
-			PLAN_GOT_HERE(6);
-			tsz = tsz2;
-			PLAN_GOT_HERE(7);
-		}
-		int sl = strnlen(de->d_name, 255);
-			PLAN_GOT_HERE(8);
-		t[i] = umem_cache_alloc(todo_cache, UMEM_NOFAIL);
-			PLAN_GOT_HERE(9);
-		char *name_str = umem_zalloc((sl+1), UMEM_NOFAIL);
-			PLAN_GOT_HERE(10);
-		bcopy(de->d_name, name_str, (sl+1));
-			PLAN_GOT_HERE(11);
-		t[i]->td_name_len = sl;
-			PLAN_GOT_HERE(12);
-		t[i]->td_name = name_str;
-			PLAN_GOT_HERE(13);
-		int todo_fd = openat(tfd, de->d_name, O_RDWR);
-			PLAN_GOT_HERE(14);
-		int time_xattr = openat(todo_fd, "time",
-			O_XATTR | O_RDWR | O_CREAT, ALLRWX);
-			PLAN_GOT_HERE(15);
-
-		PLAN_READ_TODO(t[i]->td_name, t[i]->td_time);
-
-		atomic_read(time_xattr, &t[i]->td_time,
-			sizeof (int));
-		
-		struct stat det_stat;
-		size_t len;
-		if (det) {
-			fstat(todo_fd, &det_stat);
-			len = det_stat.st_size + 1; /* +1 for \0 */
-			if (len - 1) {
-				t[i]->td_det = umem_zalloc(len, UMEM_NOFAIL);
-				atomic_read(todo_fd, t[i]->td_det, len);
-			}
+		todo_t **t2 = arena_alloc(&t_arena, tsz2);
+		if (i) {
+			bcopy(t, t2, tsz);
 		}
+		t = t2;
+		tsz = tsz2;
+	}
+	int sl = strnlen(n, 255);
+	t[i] = arena_zalloc(&t_arena, sizeof (todo_t));
+	t[i]->td_name_len = sl;
+	t[i]->td_name = arena_strdup(&t_arena, n, sl);
+	t[i]->td_time = time;
 
-		PLAN_READ_TODO(t[i]->td_name, t[i]->td_time);
-			PLAN_GOT_HERE(16);
-
-		close(time_xattr);
-			PLAN_GOT_HERE(17);
-
-		close(todo_fd);
-		i++;
+	if (det) {
+		t[i]->td_det = arena_strdup(&t_arena, det, strlen(det));
 	}
-	t_elems = i;
+
+	PLAN_READ_TODO(t[i]->td_name, t[i]->td_time);
+	t_elems = i + 1;
 }
 
 static void
-mk_copy_act(act_t *src, act_t **des)
+read_todo_dir(scope_t s, int det)
 {
-	*des = umem_cache_alloc(act_cache, UMEM_NOFAIL);
-	bcopy(src, *des, sizeof (act_t));
-	(*des)->act_name_len = 0;
-	(*des)->act_name = src->act_name;
-	/* *des->act_dyn = src->act_dyn; */
+	t_elems = 0;
+	store->ps_todo_walk(s, det, load_todo, NULL);
 }
 
 /*
- * loop
- *   open act-name attrs
- *     open the attrs of those names
+ * If we know that the action is dynamic, we can place it anywhere within the
+ * start and end of the day. If it is not dynamic, we have to fit it within
+ * it's starting time and the end of the day. The end of the day can be past
+ * midnight (an awake range of 20:00,12h00m ends at 08:00 the next day), and
+ * a day that's awake until midnight doesn't stop a static activity from
+ * running past it.
  */
 static void
-read_act_dir(int afd, size_t base, size_t off, int det)
+act_set_bounds(plan_day_t *pd, size_t j, size_t base, size_t off)
 {
-	struct dirent *de = NULL;
-	int time_xattr;
-	int dur_xattr;
-	int dyn_xattr;
-	int i = 0;
-	DIR *acts_dir = fdopendir(afd);
-	int dotdirs = 1;
-	while ((de = readdir(acts_dir)) != NULL) {
-		PLAN_GOT_HERE((int)(de->d_name));
-		/*
-		 * The first 2 dirents are always '.' and '..'
-		 * We skip those.
-		 */
-		if (dotdirs < 3) {
-			dotdirs++;
-			continue;
-		}
-
-		PLAN_GOT_HERE((int)(de->d_name));
-		int sl = strnlen(de->d_name, 255);
-		a[i] = umem_cache_alloc(act_cache, UMEM_NOFAIL);
-		PLAN_ACT_PTR(a[i]);
-		char *name_str = umem_zalloc((sl+1), UMEM_NOFAIL);
-		bcopy(de->d_name, name_str, sl);
-		a[i]->act_name_len = sl;
-		a[i]->act_name = name_str;
-		int act_fd = openat(afd, de->d_name, O_RDWR);
-		if (act_fd == -1) {
-			perror("act_fd");
-			exit(0);
-		}
-		time_xattr =
-			openat(act_fd, "time",
-				O_CREAT | O_XATTR | O_RDWR, ALLRWX);
-		a[i]->act_fd_time = time_xattr;
-		if (time_xattr == -1) {
-			perror("time_xattr - open");
-			exit(0);
-		}
-		dur_xattr =
-			openat(act_fd, "dur",
-				O_CREAT | O_XATTR | O_RDWR, ALLRWX);
-		a[i]->act_fd_dur = dur_xattr;
-		dyn_xattr =
-			openat(act_fd, "dyn",
-				O_CREAT | O_XATTR | O_RDWR, ALLRWX);
-
-
-		int txr;
-		struct stat time_stat;
-		fstat(time_xattr, &time_stat);
-		int ntimes = (time_stat.st_size)/sizeof (int);
-		atomic_read(dur_xattr, &(a[i]->act_dur),
-			sizeof (size_t));
-		atomic_read(dyn_xattr, &(a[i]->act_dyn),
-			sizeof (char));
-
-		struct stat det_stat;
-		size_t len;
-		if (det) {
-			fstat(act_fd, &det_stat);
-			len = det_stat.st_size + 1; /* +1 for \0 */
-			if (len-1) {
-				a[i]->act_det = umem_zalloc(len, UMEM_NOFAIL);
-				atomic_read(act_fd, a[i]->act_det, len);
-			}
-		}
-
-		// lseek(time_xattr, 0, SEEK_SET);
-		// lseek(dyn_xattr, 0, SEEK_SET);
-		lseek(dur_xattr, 0, SEEK_SET);
-
-		atomic_read(time_xattr, &(a[i]->act_time),
-			sizeof (int));
-		PLAN_READ_ACT(a[i]->act_name, a[i]->act_time, a[i]->act_dur);
-		ntimes--;
-
-
-		/*
-		 * If we know that the action is dynamic, we can place
-		 * it anywhere within the start and end of the day.
-		 * If it is not dynamic, we have to fit it within it's
-		 * starting time and the end of the day.
-		 */
-vm_set:;
-		if (a[i]->act_dyn) {
-			a[i]->act_vmmin = (void *) (1 + base);
-			a[i]->act_vmmax = a[i]->act_vmmin + off;
-		} else {
-			a[i]->act_vmmin = (void *)(1 + a[i]->act_time);
-			a[i]->act_vmmax =
-				a[i]->act_vmmin + a[i]->act_dur;
-			/*
-			 * If the min boundary is lower than when the
-			 * user starts the day, or the max boundary is
-			 * greater than when the user ends the day, we
-			 * can't fit this particular action into the
-			 * day. And so, we must bail, informing the
-			 * user of the inconsistency.
-			 */
-			char *dstart = (void *) (1 + base);
-			char *dend = dstart + off;
-			if ((a[i]->act_vmmin) < dstart ||
-			    (a[i]->act_vmmax > dend)) {
-				realloc_err.rae_code = RAE_CODE_FIT;
-				realloc_err.rae_act = a[i];
-			}
-		}
+	size_t end = base + off;
 
-		/*
-		 * We know that there are no more than 1 chunks, so we seek the
-		 * time_xattr to zero, so that we can overwrite the initial
-		 * data.
-		 */
-		if (!ntimes) {
-			lseek(time_xattr, 0, SEEK_SET);
+	if (PD_DYN(pd, j)) {
+		pd->pd_min[j] = base;
+		pd->pd_max[j] = end;
+	} else {
+		if (end >= plan_slots) {
+			end = PD_SPANS * plan_slots;
 		}
-
+		pd->pd_min[j] = pd->pd_time[j];
+		pd->pd_max[j] = pd->pd_time[j] + pd->pd_dur[j];
 		/*
-		 * If we are allocating an activity in chunks, we read through
-		 * the rest of the time-xattr file, creating new activities,
-		 * which are clones of the initial a[i], but differ only in the
-		 * starting time of the activity, and the vmem related values.
-		 * The reason we do this and, and don't have some nested
-		 * structure (like a tree or a list) is because we want to be
-		 * able to list all activities in chronological order, using
-		 * the qsort routine to sort them in this order.  Ultimately,
-		 * any kind of nesting would save a slim amount of memory, but
-		 * spike our CPU consumption.
+		 * If the min boundary is lower than when the user starts the
+		 * day, or the max boundary is greater than when the user ends
+		 * the day, we can't fit this particular action into the day.
+		 * And so, we must bail, informing the user of the
+		 * inconsistency.
 		 */
-		while (ntimes > 0) {
-			PLAN_NTIMES(ntimes);
-			mk_copy_act(a[i], &(a[(i+1)]));
-			i++;
-			atomic_read(time_xattr, &(a[i]->act_time),
-				sizeof (int));
-			PLAN_READ_ACT(a[i]->act_name, a[i]->act_time,
-				a[i]->act_dur);
-			if (txr == -1) {
-				perror("plan - time_xattr RD");
-				exit(0);
-			}
-			ntimes--;
-			goto vm_set;
+		if (pd->pd_time[j] < (int)base || pd->pd_max[j] > end) {
+			pd->pd_err.rae_code = RAE_CODE_FIT;
+			pd->pd_err.rae_idx = j;
 		}
-		close(dyn_xattr);
-
-		PLAN_GOT_HERE(a[i]->act_dur);
-		i++;
 	}
-	closedir(acts_dir);
-	a_elems = i;
 }
 
+typedef struct act_load {
+	plan_day_t	*al_day;
+	scope_t		al_scope;
+	size_t		al_base;
+	size_t		al_off;
+} act_load_t;
+
 /*
- * realloc_acts, given a day-start and day-duration, reallocates all of the
- * previously allocated actions into the new constraints. External variables
- * used are days_fd, a (the array of act_t's), vmday.
- * We return the file descriptor to the date or day file.
- * XXX: add support for chunked durations.
+ * This is the act_walk_f that read_act_dir hands to the store. It interns the
+ * activity's name, appends the activity to pd->pd_cold[] (at its name's id),
+ * and its chunks to the rest of pd's arrays.
  */
-#define	RA_DYN		1
-#define	RA_STA		2
-#define	RA_ALL		3
-#define	RA_ISDYN(x)	(x & 0x0001)
-#define	RA_ISSTA(x)	(x & 0x0002)
-static ra_err_t *
-realloc_acts(day_t day, tm_t *date, size_t base, size_t off)
+static void
+load_act(void *arg, char *n, act_rec_t *r, char *det)
 {
+	act_load_t *al = arg;
+	plan_day_t *pd = al->al_day;
+	size_t i = pd->pd_elems;
+	size_t c = 0;
+	size_t nc;
+	int sl = strnlen(n, 255);
+	uint8_t flags = 0;
+	uint32_t id = intern(&pd->pd_names, n, sl);
+	act_cold_t *ac;
+
 	/*
-	 * We have (re)set realloc_err so that we don't bail when bulk
-	 * processing the entire week.
+	 * A store never has two activities of the same name in a scope, but
+	 * a day can't hold both if one does, so the first one read wins.
 	 */
-	realloc_err.rae_code = RAE_CODE_SUCCESS;
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
+	if (id != pd->pd_ncold) {
+		act_rec_free(r);
+		return;
 	}
-	int afd = openacts(dfd);
 
-	read_act_dir(afd, base, off, 0);
+	act_ov_t *ov = ov_find(al->al_scope, n);
 
-	/*
-	 * We now take all of the data we have about the actions, and try to
-	 * reallocate them in the day, within the specified awake times. This
-	 * loop runs twice. The first time it allocates all of the activities
-	 * that have a starting time (static activities), and then it loops
-	 * again to allocate all of the activities that have no starting time,
-	 * but have a duration (dynamic activities).
-	 * XXX: When reading the acts, we should store them in 2 arrays, so
-	 * that we loop over each array once, instead of the same array twice.
-	 * This way, we get O(n) performance instead of O(2n).
-	 */
-	int j = 0;
-	int k = 1;
-alloc_again:;
-	while (j <= (a_elems-1) && a_elems != 0) {
-		PLAN_REALLOC_LOOP(a[j]);
+	if (ov != NULL) {
+		act_rec_free(r);
+		rec_copy(r, &ov->ov_rec);
+	}
 
-		if (!date) {
-			a[j]->act_day = day;
-		} else {
-			a[j]->act_day = -1;
-			a[j]->act_date.tm_mon = date->tm_mon;
-			a[j]->act_date.tm_mday = date->tm_mday;
-			a[j]->act_date.tm_year = date->tm_year;
-		}
+	nc = r->ar_ntimes ? r->ar_ntimes : 1;
+	pd_reserve(pd, 1, nc);
 
-		if ((a[j]->act_dyn == 0 && !k)) {
-			j++;
-			continue;
-		}
+	ac = &pd->pd_cold[id];
+	ac->ac_name_len = sl;
+	ac->ac_name = intern_name(&pd->pd_names, id);
+	ac->ac_det = NULL;
+	ac->ac_gap = r->ar_gap;
+	ac->ac_spread = r->ar_spread;
+	PLAN_ACT_PTR(ac);
 
-		if ((a[j]->act_dyn == 1 && k)) {
-			j++;
-			continue;
-		}
+	if (det) {
+		ac->ac_det = arena_strdup(&pd->pd_arena, det, strlen(det));
+	}
 
-		/*
-		 * When activities are first created, they have a duration of
-		 * zero. We can't allocate a zero-sized block of time. How can
-		 * you allocate nothing? So we skip activities that don't have
-		 * a duration set.
-		 */
-		if ((a[j]->act_dur == 0)) {
-			j++;
-			continue;
+	if (r->ar_dyn) {
+		flags |= ACT_FDYN;
+		if (r->ar_gap != 0 || r->ar_spread != 0) {
+			flags |= ACT_FCHAINED;
 		}
+	}
+	if (ov != NULL) {
+		flags |= ACT_FDIRTY;
+	}
 
-		PLAN_VMEM_XALLOC(NULL, (a[j]->act_dur), (a[j]->act_vmmin),
-			(a[j]->act_vmmax));
-		char *r = vmem_xalloc(vmday, (a[j]->act_dur), 0, 0, 0,
-				(a[j]->act_vmmin), (a[j]->act_vmmax),
-				VM_BESTFIT | VM_NOSLEEP);
-
-		PLAN_VMEM_XALLOC(r, (a[j]->act_dur), (a[j]->act_vmmin),
-			(a[j]->act_vmmax));
-
-		if (!r) {
-			realloc_err.rae_code = RAE_CODE_ARRANGE;
-			realloc_err.rae_act = a[j];
+	/*
+	 * Each chunk of an activity gets an entry of its own, which differs
+	 * from the others only in its start time (and placement bounds). The
+	 * reason we do this, and don't have some nested structure (like a
+	 * tree or a list) is that the chunks can then be listed in
+	 * chronological order, along with every other activity, by sorting
+	 * the entries.
+	 */
+	while (c < nc) {
+		if (c > 0) {
+			PLAN_NTIMES(r->ar_ntimes - c);
 		}
-		PLAN_GOT_HERE(0);
-		a[j]->act_loc = r;
-		PLAN_GOT_HERE(1);
-
-		/*
-		 * And now, we have modify the time and dur members.
-		 */
-		a[j]->act_time = MEM2TIME(r);
-		PLAN_GOT_HERE(2);
-		j++;
-		PLAN_GOT_HERE(3);
-	}
-	if (k) {
-		j = 0;
-		k--;
-		PLAN_GOT_HERE(4);
-		goto alloc_again;
+		pd->pd_time[i] = r->ar_ntimes ? r->ar_time[c] : -1;
+		pd->pd_prev[i] = pd->pd_time[i];
+		pd->pd_loc[i] = -1;
+		pd->pd_dur[i] = r->ar_dur;
+		pd->pd_flags[i] = flags;
+		pd->pd_act[i] = id;
+		PLAN_READ_ACT(ac->ac_name, pd->pd_time[i], pd->pd_dur[i]);
+		act_set_bounds(pd, i, al->al_base, al->al_off);
+		i++;
+		c++;
 	}
-	PLAN_GOT_HERE(5);
-	close(dfd);
-	PLAN_GOT_HERE(6);
-	close(afd);
-	PLAN_GOT_HERE(7);
-	return (&realloc_err);
+
+	act_rec_free(r);
+	pd->pd_ncold++;
+	pd->pd_elems = i;
 }
 
 /*
- * We commit the information in a[] to disk. We take the filedes of the acts/
- * directory as an argument.
+ * Frees pd's arrays (and arena) themselves, for a plan_day_t that is going
+ * away.
  */
 static void
-commit_act_arr(int afd)
+pd_fini(plan_day_t *pd)
 {
-	int j = 0;
-	while (j < a_elems) {
-		PLAN_COMMIT_ACTS_LOOP(a[j]);
-		int time_xattr = a[j]->act_fd_time;
-		int dur_xattr = a[j]->act_fd_dur;
-
-		atomic_write(time_xattr, &a[j]->act_time, sizeof (int));
-
-		/*
-		 * In some cases (like modifying time xattr), we don't need to
-		 * write the dur as it doesn't change during the set_time_act
-		 * function.
-		 */
-		if (write_dur) {
-			atomic_write(dur_xattr, &a[j]->act_dur, sizeof (size_t));
-		}
-
-		PLAN_COMMIT_ACT(a[j]->act_name, a[j]->act_time, a[j]->act_dur);
-		j++;
-	}
-
+	size_t sz = pd->pd_maxacts;
+
+	if (sz) {
+		umem_free(pd->pd_time, sz * sizeof (int));
+		umem_free(pd->pd_loc, sz * sizeof (int));
+		umem_free(pd->pd_prev, sz * sizeof (int));
+		umem_free(pd->pd_dur, sz * sizeof (size_t));
+		umem_free(pd->pd_min, sz * sizeof (size_t));
+		umem_free(pd->pd_max, sz * sizeof (size_t));
+		umem_free(pd->pd_flags, sz * sizeof (uint8_t));
+		umem_free(pd->pd_act, sz * sizeof (uint32_t));
+	}
+	if (pd->pd_maxcold) {
+		umem_free(pd->pd_cold, pd->pd_maxcold * sizeof (act_cold_t));
+	}
+	intern_fini(&pd->pd_names);
+	arena_fini(&pd->pd_arena);
+	pd->pd_maxacts = 0;
+	pd->pd_maxcold = 0;
 }
 
+/*
+ * Reads every activity in the scope into pd, setting up the
+ * placement bounds for the given day-start and day-duration.
+ */
 static void
-free_todo_arr()
+read_act_dir(plan_day_t *pd, scope_t s, size_t base, size_t off, int det)
 {
-	int j = 0;
-	while (j < (t_elems) && t_elems != 0) {
-		/*
-		 * Here we specify the buffer size as the name length + 1 due
-		 * to the trailing NULL.
-		 */
-		umem_free(t[j]->td_name, (t[j]->td_name_len + 1));
-		umem_cache_free(todo_cache, t[j]);
-		j++;
-	}
-	if (tsz) {
-		umem_free(t, tsz);
-		tsz = 0;
-	}
-	t_elems = 0;
+	act_load_t al;
+	size_t n;
+
+	al.al_day = pd;
+	al.al_scope = s;
+	al.al_base = base;
+	al.al_off = off;
+	pd->pd_elems = 0;
+	pd->pd_ncold = 0;
+	intern_reset(&pd->pd_names);
+	n = store->ps_act_count(s);
+	pd_reserve(pd, n, n);
+	store->ps_act_walk(s, det, load_act, &al);
+}
+
+/*
+ * Returns the day next to `s` (the next one if `dir` is 1, the previous one
+ * if it's -1), as far as placing activities goes: the next weekday for a
+ * weekday, and the next date for a date, or that date's weekday if the date
+ * doesn't exist (since that is the day it lists as). This calls mktime, so
+ * it isn't MT-safe.
+ */
+static scope_t
+scope_step(scope_t s, int dir)
+{
+	tm_t tm;
+	scope_t n;
+
+	if (!PS_ISDATE(s)) {
+		return ((s + 7 + dir) % 7);
+	}
+	scope_to_tm(s, &tm);
+	tm.tm_mday += dir;
+	tm.tm_hour = 12;
+	tm.tm_isdst = -1;
+	(void) mktime(&tm);
+	n = plan_scope(-1, &tm);
+	if (!store->ps_have(n)) {
+		return (tm.tm_wday);
+	}
+	return (n);
 }
+
 /*
- * Here we free all of the memory in a[].
+ * Walks a neighbouring day's activities (with their overlaid records, if
+ * fe_ov is set), finding out how far they run past midnight, and claiming
+ * the static ones in fe_map's second span, if there's a map.
  */
+typedef struct fence {
+	daymap_t	*fe_map;
+	scope_t		fe_scope;
+	int		fe_ov;
+	size_t		fe_spill;
+} fence_t;
+
 static void
-free_act_arr()
+fence_act(void *arg, char *n, act_rec_t *r, char *det)
 {
-	int j = 0;
-	while (j < (a_elems) && a_elems != 0) {
-		if (a[j]->act_loc) {
-			vmem_xfree(vmday, a[j]->act_loc, a[j]->act_dur);
+	fence_t *fe = arg;
+	act_ov_t *ov = fe->fe_ov ? ov_find(fe->fe_scope, n) : NULL;
+	size_t end;
+	size_t i = 0;
+
+	if (ov != NULL) {
+		act_rec_free(r);
+		rec_copy(r, &ov->ov_rec);
+	}
+
+	while (i < r->ar_ntimes) {
+		if (r->ar_time[i] < 0 || r->ar_dur == 0) {
+			i++;
+			continue;
 		}
-		/*
-		 * Here we specify the buffer size as the name length + 1 due
-		 * to the trailing NULL.
-		 */
-		if (a[j]->act_name_len != 0) {
-			umem_free(a[j]->act_name, (a[j]->act_name_len + 1));
+		end = r->ar_time[i] + r->ar_dur;
+		if (end > plan_slots && end - plan_slots > fe->fe_spill) {
+			fe->fe_spill = end - plan_slots;
 		}
-		close(a[j]->act_fd_time);
-		close(a[j]->act_fd_dur);
-		umem_cache_free(act_cache, a[j]);
-		j++;
+		if (fe->fe_map != NULL && !r->ar_dyn) {
+			daymap_claim(fe->fe_map, plan_slots + r->ar_time[i],
+			    r->ar_dur);
+		}
+		i++;
 	}
-	a_elems = 0;
+	act_rec_free(r);
 }
 
-#define	FIT_ERR "%s: Activity %s can't fit in the alotted time\n"
-static void
-rae_code_print(ra_err_t *re)
+/*
+ * Returns how far the activities of `s` run past midnight. If `ov` is set,
+ * the overlaid records count.
+ */
+static size_t
+scope_spill(scope_t s, int ov)
 {
+	fence_t fe;
+
+	bzero(&fe, sizeof (fe));
+	fe.fe_scope = s;
+	fe.fe_ov = ov;
+	store->ps_act_walk(s, 0, fence_act, &fe);
+	return (fe.fe_spill);
+}
+
+/*
+ * Returns how far the activities placed in pd run past midnight.
+ */
+static size_t
+pd_spill(plan_day_t *pd)
+{
+	size_t spill = 0;
+	size_t end;
+	size_t j = 0;
+
+	while (j < pd->pd_elems) {
+		if (pd->pd_loc[j] != -1) {
+			end = pd->pd_loc[j] + pd->pd_dur[j];
+			if (end > plan_slots && end - plan_slots > spill) {
+				spill = end - plan_slots;
+			}
+		}
+		j++;
+	}
+	return (spill);
+}
+
+/*
+ * Claims the time that the neighbours of `s` have taken in pd's map: the
+ * start of the day, for however long the previous day runs past midnight,
+ * and the next day's static activities (its dynamic ones are placed around
+ * whatever this day leaves them, once this day is done).
+ */
+static void
+pd_fence(plan_day_t *pd, scope_t s)
+{
+	fence_t fe;
+	size_t spill = scope_spill(scope_step(s, -1), 1);
+
+	if (spill != 0) {
+		daymap_claim(pd->pd_map, 0, spill);
+	}
+	bzero(&fe, sizeof (fe));
+	fe.fe_map = pd->pd_map;
+	fe.fe_scope = scope_step(s, 1);
+	fe.fe_ov = 1;
+	store->ps_act_walk(fe.fe_scope, 0, fence_act, &fe);
+	pd->pd_fenced = 1;
+}
+
+/*
+ * realloc_acts, given a day-start and day-duration, reallocates all of the
+ * previously allocated actions into the new constraints. External variables
+ * used are store and plan_sched. It reads, and places, the whole day (see
+ * keep_acts), which a change to a single activity usually doesn't have to
+ * (see resched_fast).
+ */
+#define	RA_DYN		1
+#define	RA_STA		2
+#define	RA_ALL		3
+#define	RA_ISDYN(x)	(x & 0x0001)
+#define	RA_ISSTA(x)	(x & 0x0002)
+static void place_acts(plan_day_t *, day_t, tm_t *);
+static int keep_acts(plan_day_t *, day_t, tm_t *);
+static void unplace_acts(plan_day_t *);
+static void pd_set_day(plan_day_t *, day_t, tm_t *);
+static int keep_act(plan_day_t *, size_t);
+static size_t act_nchunks(plan_day_t *, size_t);
+static int place_chunks(plan_day_t *, size_t, size_t);
+
+static ra_err_t *
+realloc_acts(plan_day_t *pd, day_t day, tm_t *date, size_t base, size_t off)
+{
+	/*
+	 * We have (re)set realloc_err so that we don't bail when bulk
+	 * processing the entire week.
+	 */
+	pd->pd_err.rae_code = RAE_CODE_SUCCESS;
+
+	read_act_dir(pd, plan_scope(day, date), base, off, 0);
+	pd_fence(pd, plan_scope(day, date));
+	if (pd->pd_err.rae_code != RAE_CODE_SUCCESS ||
+	    keep_acts(pd, day, date) != 0) {
+		unplace_acts(pd);
+		place_acts(pd, day, date);
+	}
+	return (&pd->pd_err);
+}
+
+static void
+pd_set_day(plan_day_t *pd, day_t day, tm_t *date)
+{
+	if (!date) {
+		pd->pd_day = day;
+	} else {
+		pd->pd_day = -1;
+		pd->pd_date.tm_mon = date->tm_mon;
+		pd->pd_date.tm_mday = date->tm_mday;
+		pd->pd_date.tm_year = date->tm_year;
+	}
+}
+
+/*
+ * Places the activities in pd around the ones that don't have to move. A
+ * single change to a day (a new duration, time, or awake range) used to
+ * place every activity in it from scratch, which moved dynamic activities
+ * that nothing had happened to, and rewrote all of them. Now the static
+ * activities go in first, as always, then every dynamic activity that
+ * hasn't changed stays where the store has it (if that's still free, and
+ * within its bounds), and only the changed ones, and the ones they pushed
+ * out, are placed anew. Since the rest keep their times, commit_act_arr
+ * only has to write out the records that moved.
+ *
+ * Every kept activity is still claimed in the daymap here, at one
+ * daymap_alloc each, which is the same work as placing it, minus the search
+ * for a spot. resched_fast gets the same outcome for a single changed
+ * activity from the day's occupancy, without this.
+ *
+ * Returns -1 if something didn't fit this way. The caller then takes
+ * everything back out (unplace_acts) and places the day from scratch, which
+ * may still find room.
+ */
+static int
+keep_acts(plan_day_t *pd, day_t day, tm_t *date)
+{
+	size_t i;
+	size_t j;
+	size_t n;
+	int r;
+
+	pd_set_day(pd, day, date);
+	for (j = 0; j < pd->pd_elems; j++) {
+		if (PD_DYN(pd, j) || pd->pd_dur[j] == 0) {
+			continue;
+		}
+		if ((pd->pd_loc[j] = daymap_alloc(pd->pd_map, pd->pd_dur[j],
+		    pd->pd_min[j], pd->pd_max[j], DM_BESTFIT)) == -1) {
+			return (-1);
+		}
+	}
+
+	/*
+	 * The chunks of an activity with constraints stay where they are
+	 * together, or not at all.
+	 */
+	for (j = 0; j < pd->pd_elems; j += n) {
+		n = PD_CHAINED(pd, j) ? act_nchunks(pd, j) : 1;
+		if (!PD_DYN(pd, j) || pd->pd_dur[j] == 0 ||
+		    (pd->pd_flags[j] & ACT_FDIRTY)) {
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (keep_act(pd, j + i) != 0) {
+				break;
+			}
+		}
+		if (i < n) {
+			while (i > 0) {
+				i--;
+				daymap_free(pd->pd_map, pd->pd_loc[j + i],
+				    pd->pd_dur[j]);
+				pd->pd_loc[j + i] = -1;
+			}
+		}
+	}
+
+	for (j = 0; j < pd->pd_elems; j += n) {
+		n = PD_CHAINED(pd, j) ? act_nchunks(pd, j) : 1;
+		if (!PD_DYN(pd, j) || pd->pd_dur[j] == 0 ||
+		    pd->pd_loc[j] != -1) {
+			continue;
+		}
+		if (PD_CHAINED(pd, j)) {
+			if (place_chunks(pd, j, n) != 0) {
+				return (-1);
+			}
+			continue;
+		}
+		r = daymap_alloc(pd->pd_map, pd->pd_dur[j], pd->pd_min[j],
+		    pd->pd_max[j], DM_BESTFIT);
+		if (r == -1) {
+			return (-1);
+		}
+		pd->pd_loc[j] = r;
+		pd->pd_time[j] = r;
+	}
+	return (0);
+}
+
+/*
+ * Puts a dynamic chunk back where the store has it, if it's free and within
+ * the chunk's bounds. Returns -1 if it isn't.
+ */
+static int
+keep_act(plan_day_t *pd, size_t j)
+{
+	int t = pd->pd_time[j];
+
+	if (t < (int)pd->pd_min[j] || t + pd->pd_dur[j] > pd->pd_max[j]) {
+		return (-1);
+	}
+	pd->pd_loc[j] = daymap_alloc(pd->pd_map, pd->pd_dur[j], t,
+	    t + pd->pd_dur[j], DM_BESTFIT);
+	return (pd->pd_loc[j] == -1 ? -1 : 0);
+}
+
+/*
+ * Returns the number of chunks of the activity that chunk j belongs to,
+ * from j on (the chunks of an activity are adjacent).
+ */
+static size_t
+act_nchunks(plan_day_t *pd, size_t j)
+{
+	size_t k = j + 1;
+
+	while (k < pd->pd_elems && pd->pd_act[k] == pd->pd_act[j]) {
+		k++;
+	}
+	return (k - j);
+}
+
+/*
+ * Places the `n` chunks of the activity from chunk j on together, subject
+ * to its constraints (see daymap_alloc_chain). Returns -1, with none of them
+ * placed, if they don't fit.
+ */
+static int
+place_chunks(plan_day_t *pd, size_t j, size_t n)
+{
+	act_cold_t *ac = PD_COLD(pd, j);
+	int *locs = umem_alloc(n * sizeof (int), UMEM_NOFAIL);
+	int r;
+	size_t i;
+
+	r = daymap_alloc_chain(pd->pd_map, pd->pd_dur[j], n, ac->ac_gap,
+	    ac->ac_spread, pd->pd_min[j], pd->pd_max[j], locs);
+	for (i = 0; i < n; i++) {
+		pd->pd_loc[j + i] = (r == 0) ? locs[i] : -1;
+		pd->pd_time[j + i] = (r == 0) ? locs[i] : -1;
+	}
+	umem_free(locs, n * sizeof (int));
+	return (r);
+}
+
+/*
+ * Takes everything that keep_acts placed back out of the daymap.
+ */
+static void
+unplace_acts(plan_day_t *pd)
+{
+	size_t j;
+
+	for (j = 0; j < pd->pd_elems; j++) {
+		if (pd->pd_loc[j] != -1) {
+			daymap_free(pd->pd_map, pd->pd_loc[j], pd->pd_dur[j]);
+			pd->pd_loc[j] = -1;
+		}
+		pd->pd_time[j] = pd->pd_prev[j];
+	}
+}
+
+/*
+ * Places the activities in pd (which read_act_dir has filled in) into
+ * pd's daymap. This doesn't touch the store, so different days can be placed
+ * in parallel.
+ */
+static void
+place_acts(plan_day_t *pd, day_t day, tm_t *date)
+{
+	/*
+	 * We now take all of the data we have about the actions, and try to
+	 * reallocate them in the day, within the specified awake times. This
+	 * loop runs twice. The first time it allocates all of the activities
+	 * that have a starting time (static activities), and then it loops
+	 * again to allocate all of the activities that have no starting time,
+	 * but have a duration (dynamic activities). Both passes only go over
+	 * the flags and durations, which are packed together.
+	 */
+	size_t j = 0;
+	int k = 1;
+
+	pd_set_day(pd, day, date);
+alloc_again:;
+	while (j < pd->pd_elems) {
+		PLAN_REALLOC_LOOP(PD_COLD(pd, j));
+
+		if ((PD_DYN(pd, j) == 0 && !k)) {
+			j++;
+			continue;
+		}
+
+		if ((PD_DYN(pd, j) != 0 && k)) {
+			j++;
+			continue;
+		}
+
+		/*
+		 * When activities are first created, they have a duration of
+		 * zero. We can't allocate a zero-sized block of time. How can
+		 * you allocate nothing? So we skip activities that don't have
+		 * a duration set.
+		 */
+		if (pd->pd_dur[j] == 0) {
+			j++;
+			continue;
+		}
+
+		/*
+		 * The chunks of an activity with constraints go in together.
+		 */
+		if (PD_CHAINED(pd, j)) {
+			size_t n = act_nchunks(pd, j);
+			if (place_chunks(pd, j, n) != 0) {
+				pd->pd_err.rae_code = RAE_CODE_ARRANGE;
+				pd->pd_err.rae_idx = j;
+			}
+			j += n;
+			continue;
+		}
+
+		int r = daymap_alloc(pd->pd_map, pd->pd_dur[j], pd->pd_min[j],
+		    pd->pd_max[j], DM_BESTFIT);
+
+		if (r == -1) {
+			pd->pd_err.rae_code = RAE_CODE_ARRANGE;
+			pd->pd_err.rae_idx = j;
+		}
+		PLAN_GOT_HERE(0);
+		pd->pd_loc[j] = r;
+		PLAN_GOT_HERE(1);
+
+		/*
+		 * And now, we have modify the time and dur members.
+		 */
+		pd->pd_time[j] = r;
+		PLAN_GOT_HERE(2);
+		j++;
+		PLAN_GOT_HERE(3);
+	}
+	if (k) {
+		j = 0;
+		k--;
+		PLAN_GOT_HERE(4);
+		goto alloc_again;
+	}
+	PLAN_GOT_HERE(5);
+
+	/*
+	 * If a dynamic activity didn't fit, another arrangement of them might
+	 * (if we've been asked to look for one).
+	 */
+	if (pd->pd_err.rae_code == RAE_CODE_ARRANGE && plan_sched == SCHED_PACK &&
+	    pack_acts(pd) == 0) {
+		pd->pd_err.rae_code = RAE_CODE_SUCCESS;
+	}
+}
+
+/*
+ * We commit the chunks in pd to the store. The chunks of an activity are
+ * adjacent in pd (they share an entry in pd_cold[]), so we gather them back
+ * into a single record. Only the records that are new, or that have a chunk
+ * that moved, are written. The day goes into the WAL as a single
+ * transaction, so a crash can't leave it half-written.
+ */
+static void
+commit_act_arr(plan_day_t *pd, scope_t s)
+{
+	size_t j = 0;
+	size_t k;
+	int changed;
+	act_cold_t *ac;
+	act_rec_t r;
+
+	wal_begin();
+	while (j < pd->pd_elems) {
+		k = j;
+		changed = pd->pd_flags[j] & ACT_FDIRTY;
+		while (k < pd->pd_elems && pd->pd_act[k] == pd->pd_act[j]) {
+			changed |= (pd->pd_time[k] != pd->pd_prev[k]);
+			k++;
+		}
+		if (!changed) {
+			j = k;
+			continue;
+		}
+		ac = PD_COLD(pd, j);
+		act_rec_init(&r, (k - j));
+		r.ar_dyn = PD_DYN(pd, j) ? 1 : 0;
+		r.ar_dur = pd->pd_dur[j];
+		r.ar_gap = ac->ac_gap;
+		r.ar_spread = ac->ac_spread;
+		k = j;
+		while (k < (j + r.ar_ntimes)) {
+			PLAN_COMMIT_ACTS_LOOP(ac);
+			r.ar_time[(k - j)] = pd->pd_time[k];
+			PLAN_COMMIT_ACT(ac->ac_name, pd->pd_time[k],
+			    pd->pd_dur[k]);
+			k++;
+		}
+		wal_act(s, ac->ac_name, &r);
+		act_rec_free(&r);
+		j = k;
+	}
+	wal_end();
+}
+
+/*
+ * Hands the store the occupancy of a day that commit_act_arr has written
+ * out (so that the store has the same times for it as pd), for resched_fast
+ * to start from next time.
+ */
+static void
+pd_occ_put(plan_day_t *pd, scope_t s)
+{
+	day_occ_t o;
+	size_t j;
+
+	occ_init(&o);
+	for (j = 0; j < pd->pd_elems; j++) {
+		occ_add(&o, pd->pd_time[j], pd->pd_dur[j], PD_DYN(pd, j) != 0);
+	}
+	occ_write(&o, s);
+	occ_fini(&o);
+}
+
+static void
+free_todo_arr()
+{
+	arena_reset(&t_arena);
+	t = NULL;
+	tsz = 0;
+	t_elems = 0;
+}
+/*
+ * Here we free all of the memory the activities in pd hold, and take them
+ * out of pd's daymap.
+ */
+static void
+free_act_arr(plan_day_t *pd)
+{
+	size_t j = 0;
+
+	if (!pd->pd_fenced) {
+		while (j < pd->pd_elems) {
+			if (pd->pd_loc[j] != -1) {
+				daymap_free(pd->pd_map, pd->pd_loc[j],
+				    pd->pd_dur[j]);
+			}
+			j++;
+		}
+	}
+
+	/*
+	 * The names and details all go at once, with pd's arenas.
+	 */
+	intern_reset(&pd->pd_names);
+	arena_reset(&pd->pd_arena);
+	pd->pd_elems = 0;
+	pd->pd_ncold = 0;
+
+	/*
+	 * What the neighbouring days claimed isn't tracked, so the whole map
+	 * is freed instead.
+	 */
+	if (pd->pd_fenced) {
+		daymap_free(pd->pd_map, 0, pd->pd_map->dm_nslots);
+		pd->pd_fenced = 0;
+	}
+}
+
+#define	FIT_ERR "%s: Activity %s can't fit in the alotted time\n"
+static void
+rae_code_print(plan_day_t *pd)
+{
+	ra_err_t *re = &pd->pd_err;
 
 	if (re->rae_code == RAE_CODE_SUCCESS) {
 		return;
 	}
 
-	char strbuf[30];
-	char *str = NULL;
+	char strbuf[30];
+	char *str = NULL;
+	char *name = PD_NAME(pd, re->rae_idx);
+
+	if (pd->pd_day == -1) {
+		strftime(strbuf, 30, "%Y-%m-%d", &(pd->pd_date));
+		str = strbuf;
+	} else {
+		str = daystr[(pd->pd_day)];
+	}
+
+	if (re->rae_code == RAE_CODE_FIT) {
+		fprintf(stderr, FIT_ERR, str, name);
+	}
+
+	if (re->rae_code == RAE_CODE_ARRANGE) {
+		fprintf(stderr, "%s: Couldn't rearrange activity %s\n",
+			str, name);
+	}
+}
+
+
+/*
+ * Reallocates a day with its overlaid records in place, and writes the day
+ * out if everything fit. Either way, the overlay for the day is dropped.
+ * Returns 1 if the day now runs further (or less far) past midnight than it
+ * did.
+ */
+static int
+resched_day(day_t day, tm_t *date, scope_t s)
+{
+	plan_day_t *pd = plan_day0();
+	size_t base;
+	size_t off;
+	size_t spill = scope_spill(s, 0);
+	int moved = 0;
+	ra_err_t *re;
+
+	get_awake_range(day, date, &base, &off);
+	re = realloc_acts(pd, day, date, base, off);
+
+	if (re->rae_code == RAE_CODE_SUCCESS) {
+		commit_act_arr(pd, s);
+		pd_occ_put(pd, s);
+		moved = (pd_spill(pd) != spill);
+	}
+	rae_code_print(pd);
+	ov_clear(s);
+	free_act_arr(pd);
+	return (moved);
+}
+
+/*
+ * When the time that day `s` takes past midnight changes, the next day is
+ * placed again, around it. That can change how far the next day runs past
+ * its own midnight, and so on, but never for more than a week's worth of
+ * days.
+ */
+static void
+resched_spill(scope_t s)
+{
+	scope_t n;
+	tm_t tm;
+	int i = 0;
+
+	while (i < 7) {
+		n = scope_step(s, 1);
+		if (scope_step(n, -1) != s) {
+			return;
+		}
+		if (PS_ISDATE(n)) {
+			scope_to_tm(n, &tm);
+		}
+		if (!resched_day(PS_ISDATE(n) ? -1 : n,
+		    PS_ISDATE(n) ? &tm : NULL, n)) {
+			return;
+		}
+		s = n;
+		i++;
+	}
+}
+
+static void
+resched_scope(day_t day, tm_t *date, scope_t s)
+{
+	if (resched_day(day, date, s)) {
+		resched_spill(s);
+	}
+}
+
+/*
+ * Reschedules the day of a single changed activity, `n` (whose new record is
+ * `r`), without reading the rest of the day. The day's occupancy (see
+ * plan_occ.c) stands in for its other activities, and its neighbours'
+ * occupancies for them, so the activity's old chunks are taken out of it,
+ * and only its new ones are placed, around everything else. That's what
+ * keep_acts would do, as long as it kept every other chunk where it is. So
+ * if the occupancy has a chunk that keep_acts would move (one that isn't
+ * placed, is out of its bounds, or overlaps another chunk or a neighbour),
+ * or the new chunks don't fit around the others, nothing is written, and
+ * this returns -1, for the day to be placed the long way, which may move
+ * them. Otherwise it writes out the new record (which is all that changed)
+ * and the new occupancy, and returns 1 if the day now runs further (or less
+ * far) past midnight than it did, and 0 if it doesn't.
+ */
+static int
+resched_fast(day_t day, tm_t *date, scope_t s, char *n, act_rec_t *r)
+{
+	daymap_t *dm = plan_day0()->pd_map;
+	day_occ_t o;
+	day_occ_t po;
+	day_occ_t no;
+	act_rec_t old;
+	act_rec_t nr;
+	size_t base;
+	size_t off;
+	size_t end;
+	size_t send;
+	size_t nc;
+	size_t c;
+	int spill;
+	int ospill;
+	int pspill;
+	int t;
+	int ret = -1;
+
+	if (store->ps_act_get(s, n, &old) != 0) {
+		return (-1);
+	}
+	get_awake_range(day, date, &base, &off);
+	end = base + off;
+	send = (end >= plan_slots) ? PD_SPANS * plan_slots : end;
+	occ_init(&o);
+	occ_init(&po);
+	occ_init(&no);
+	nc = r->ar_ntimes ? r->ar_ntimes : 1;
+	act_rec_init(&nr, nc);
+	nr.ar_dyn = r->ar_dyn;
+	nr.ar_dur = r->ar_dur;
+	nr.ar_gap = r->ar_gap;
+	nr.ar_spread = r->ar_spread;
+	for (c = 0; c < nc; c++) {
+		nr.ar_time[c] = r->ar_ntimes ? r->ar_time[c] : -1;
+	}
+
+	/*
+	 * The day without the activity's old chunks has to be one that
+	 * keep_acts would leave as it is.
+	 */
+	occ_read(&o, s);
+	ospill = 0;
+	for (c = 0; c < (old.ar_ntimes ? old.ar_ntimes : 1); c++) {
+		t = old.ar_ntimes ? old.ar_time[c] : -1;
+		if (t >= 0 && old.ar_dur != 0 &&
+		    t + old.ar_dur > plan_slots) {
+			ospill = MAX(ospill, (int)(t + old.ar_dur - plan_slots));
+		}
+		occ_del(&o, t, old.ar_dur, old.ar_dyn);
+	}
+	if (!occ_fits(&o, base, off)) {
+		goto out;
+	}
+	ospill = MAX(ospill, occ_spill(&o));
+
+	/*
+	 * The neighbours go in as pd_fence would put them, and the rest of
+	 * the day around them.
+	 */
+	occ_read(&po, scope_step(s, -1));
+	occ_read(&no, scope_step(s, 1));
+	if ((pspill = occ_spill(&po)) == -1) {
+		goto out;
+	}
+	if (pspill != 0) {
+		daymap_claim(dm, 0, pspill);
+	}
+	occ_claim(no.do_sta, 0, plan_slots, dm, plan_slots);
+	if (occ_clashes(&o, dm)) {
+		goto out;
+	}
+	occ_claim(o.do_all, 0, PD_SPANS * plan_slots, dm, 0);
+
+	/*
+	 * Then the new chunks, as keep_acts places a changed activity.
+	 */
+	if (!nr.ar_dyn) {
+		for (c = 0; c < nc; c++) {
+			t = nr.ar_time[c];
+			if (t < (int)base || t + nr.ar_dur > send ||
+			    (nr.ar_dur != 0 && daymap_alloc(dm, nr.ar_dur, t,
+			    t + nr.ar_dur, DM_BESTFIT) == -1)) {
+				goto out;
+			}
+		}
+	} else if (nr.ar_dur != 0 && (nr.ar_gap != 0 || nr.ar_spread != 0)) {
+		if (daymap_alloc_chain(dm, nr.ar_dur, nc, nr.ar_gap,
+		    nr.ar_spread, base, end, nr.ar_time) != 0) {
+			goto out;
+		}
+	} else if (nr.ar_dur != 0) {
+		for (c = 0; c < nc; c++) {
+			nr.ar_time[c] = daymap_alloc(dm, nr.ar_dur, base, end,
+			    DM_BESTFIT);
+			if (nr.ar_time[c] == -1) {
+				goto out;
+			}
+		}
+	}
+	for (c = 0; c < nc; c++) {
+		occ_add(&o, nr.ar_time[c], nr.ar_dur, nr.ar_dyn);
+	}
+	spill = occ_spill(&o);
+
+	wal_begin();
+	wal_act(s, n, &nr);
+	wal_end();
+	occ_write(&o, s);
+	ret = (spill != ospill);
+out:
+	daymap_free(dm, 0, dm->dm_nslots);
+	occ_fini(&o);
+	occ_fini(&po);
+	occ_fini(&no);
+	act_rec_free(&old);
+	act_rec_free(&nr);
+	return (ret);
+}
+
+/*
+ * Reschedules the day of an activity that has a new record, from the day's
+ * occupancy if it can, and otherwise by overlaying the record and placing
+ * the whole day (unless we're batching, and the day is placed at the end).
+ */
+static void
+resched_act(day_t day, tm_t *date, char *n, act_rec_t *r)
+{
+	scope_t s = plan_scope(day, date);
+	int moved;
+
+	if (!realloc_defer && (!ov_init || avl_numnodes(&ov_tree) == 0) &&
+	    (moved = resched_fast(day, date, s, n, r)) != -1) {
+		if (moved) {
+			resched_spill(s);
+		}
+		return;
+	}
+	ov_put(s, n, r);
+	if (!realloc_defer) {
+		resched_scope(day, date, s);
+	}
+}
+
+/*
+ * When many days have to be rescheduled at once (at the end of a batch, when
+ * importing, or when the awake range of the whole week changes), the days
+ * are placed in parallel by a pool of workers, each with a plan_day_t (an
+ * activity buffer and a daymap) of its own. The store and the WAL aren't
+ * thread-safe, so only the calling thread touches them: it reads a day into
+ * an idle worker's plan_day_t, fences it, and hands it over, and once the
+ * worker has placed it, commits it and hands the worker the next day. So
+ * there's one writer for the whole pass, and the workers never wait on the
+ * store, or on each other, only for their next day.
+ */
+#define	RESCHED_MAXTHR	16
+
+typedef enum rw_state {
+	RW_IDLE,		/* waiting for a day */
+	RW_LOADED,		/* has a day to place */
+	RW_PLACED,		/* has a day to commit */
+	RW_EXIT
+} rw_state_t;
+
+typedef struct resched_wk {
+	pthread_t	rw_tid;
+	pthread_cond_t	rw_cv;
+	rw_state_t	rw_state;
+	plan_day_t	rw_day;
+	size_t		rw_idx;		/* which of rj_scopes it has */
+	day_t		rw_wday;
+	tm_t		rw_tm;
+	tm_t		*rw_date;
+	struct resched_job *rw_job;
+} resched_wk_t;
+
+typedef struct resched_job {
+	pthread_mutex_t	rj_lock;
+	pthread_cond_t	rj_cv;		/* a worker has placed its day */
+	scope_t		*rj_scopes;
+	char		*rj_moved;	/* runs further past midnight */
+	size_t		rj_nscopes;
+} resched_job_t;
+
+/*
+ * Reads day `s` into the worker's plan_day_t, fenced in by its neighbours.
+ */
+static void
+resched_load(resched_wk_t *rw, scope_t s)
+{
+	plan_day_t *pd = &rw->rw_day;
+	size_t base;
+	size_t off;
+
+	rw->rw_wday = s;
+	rw->rw_date = NULL;
+	if (PS_ISDATE(s)) {
+		scope_to_tm(s, &rw->rw_tm);
+		rw->rw_date = &rw->rw_tm;
+		rw->rw_wday = -1;
+	}
+	get_awake_range(rw->rw_wday, rw->rw_date, &base, &off);
+	pd->pd_err.rae_code = RAE_CODE_SUCCESS;
+	read_act_dir(pd, s, base, off, 0);
+	pd_fence(pd, s);
+}
+
+/*
+ * Commits the day the worker has placed (if everything fit), and empties its
+ * plan_day_t for the next one. Returns 1 if the day now runs further (or less
+ * far) past midnight than it did.
+ */
+static int
+resched_commit(resched_wk_t *rw, scope_t s)
+{
+	plan_day_t *pd = &rw->rw_day;
+	size_t spill;
+	int moved = 0;
+
+	if (pd->pd_err.rae_code == RAE_CODE_SUCCESS) {
+		spill = scope_spill(s, 0);
+		commit_act_arr(pd, s);
+		moved = (pd_spill(pd) != spill);
+	}
+	rae_code_print(pd);
+	free_act_arr(pd);
+	return (moved);
+}
+
+static void *
+resched_worker(void *arg)
+{
+	resched_wk_t *rw = arg;
+	resched_job_t *rj = rw->rw_job;
+
+	(void) pthread_mutex_lock(&rj->rj_lock);
+	for (;;) {
+		while (rw->rw_state != RW_LOADED && rw->rw_state != RW_EXIT) {
+			(void) pthread_cond_wait(&rw->rw_cv, &rj->rj_lock);
+		}
+		if (rw->rw_state == RW_EXIT) {
+			break;
+		}
+		(void) pthread_mutex_unlock(&rj->rj_lock);
+		place_acts(&rw->rw_day, rw->rw_wday, rw->rw_date);
+		(void) pthread_mutex_lock(&rj->rj_lock);
+		rw->rw_state = RW_PLACED;
+		(void) pthread_cond_signal(&rj->rj_cv);
+	}
+	(void) pthread_mutex_unlock(&rj->rj_lock);
+	return (NULL);
+}
+
+/*
+ * The writer's side of the pool: keeps every worker busy until all of the
+ * days have been placed and committed. The lock is dropped while reading or
+ * committing a day, so the workers can hand back the days they've placed in
+ * the meantime; a scan that drops it always scans again before waiting, so
+ * none of them are missed.
+ */
+static void
+resched_write(resched_job_t *rj, resched_wk_t *rws, size_t nthr)
+{
+	resched_wk_t *rw;
+	size_t next = 0;
+	size_t busy = 0;
+	size_t i;
+	int progress;
+
+	(void) pthread_mutex_lock(&rj->rj_lock);
+	while (next < rj->rj_nscopes || busy > 0) {
+		progress = 0;
+		for (i = 0; i < nthr; i++) {
+			rw = &rws[i];
+			if (rw->rw_state == RW_PLACED) {
+				(void) pthread_mutex_unlock(&rj->rj_lock);
+				rj->rj_moved[rw->rw_idx] = resched_commit(rw,
+				    rj->rj_scopes[rw->rw_idx]);
+				(void) pthread_mutex_lock(&rj->rj_lock);
+				rw->rw_state = RW_IDLE;
+				busy--;
+				progress = 1;
+			}
+			if (rw->rw_state == RW_IDLE && next < rj->rj_nscopes) {
+				rw->rw_idx = next++;
+				(void) pthread_mutex_unlock(&rj->rj_lock);
+				resched_load(rw, rj->rj_scopes[rw->rw_idx]);
+				(void) pthread_mutex_lock(&rj->rj_lock);
+				rw->rw_state = RW_LOADED;
+				(void) pthread_cond_signal(&rw->rw_cv);
+				busy++;
+				progress = 1;
+			}
+		}
+		if (!progress) {
+			(void) pthread_cond_wait(&rj->rj_cv, &rj->rj_lock);
+		}
+	}
+	for (i = 0; i < nthr; i++) {
+		rws[i].rw_state = RW_EXIT;
+		(void) pthread_cond_signal(&rws[i].rw_cv);
+	}
+	(void) pthread_mutex_unlock(&rj->rj_lock);
+}
+
+/*
+ * Reschedules the given days, with their overlaid records in place. All of
+ * the days are committed in a single WAL transaction, and their overlays are
+ * dropped.
+ *
+ * Days are placed around what their neighbours looked like before the
+ * transaction, so when a day ends up running further (or less far) past
+ * midnight, the next day is placed again in another pass. Like
+ * resched_spill(), this stops after a week's worth of passes.
+ */
+static void
+resched_pass(scope_t *scopes, size_t n, int pass)
+{
+	resched_job_t rj;
+	resched_wk_t *rws;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	scope_t *next;
+	size_t nnext = 0;
+	size_t nthr;
+	size_t nrun = 0;
+	size_t i;
+
+	if (n == 0) {
+		return;
+	}
+
+	nthr = ncpu > 0 ? ncpu : 1;
+	if (nthr > RESCHED_MAXTHR) {
+		nthr = RESCHED_MAXTHR;
+	}
+	if (nthr > n) {
+		nthr = n;
+	}
 
-	if (re->rae_act->act_day == -1) {
-		strftime(strbuf, 30, "%Y-%m-%d", &(re->rae_act->act_date));
-		str = strbuf;
+	(void) pthread_mutex_init(&rj.rj_lock, NULL);
+	(void) pthread_cond_init(&rj.rj_cv, NULL);
+	rj.rj_scopes = scopes;
+	rj.rj_moved = umem_zalloc(n, UMEM_NOFAIL);
+	rj.rj_nscopes = n;
+
+	rws = umem_zalloc(nthr * sizeof (resched_wk_t), UMEM_NOFAIL);
+	for (i = 0; i < nthr; i++) {
+		rws[i].rw_day.pd_map = daymap_create(PD_SPANS * plan_slots);
+		rws[i].rw_job = &rj;
+		rws[i].rw_state = RW_IDLE;
+		(void) pthread_cond_init(&rws[i].rw_cv, NULL);
+	}
+
+	wal_begin();
+	if (nthr > 1) {
+		while (nrun < nthr) {
+			if (pthread_create(&rws[nrun].rw_tid, NULL,
+			    resched_worker, &rws[nrun]) != 0) {
+				break;
+			}
+			nrun++;
+		}
+	}
+	if (nrun > 0) {
+		resched_write(&rj, rws, nrun);
+		for (i = 0; i < nrun; i++) {
+			(void) pthread_join(rws[i].rw_tid, NULL);
+		}
 	} else {
-		str = daystr[(re->rae_act->act_day)];
+		/*
+		 * On one CPU (or if we couldn't start any threads), we do the
+		 * placing ourselves.
+		 */
+		for (i = 0; i < n; i++) {
+			resched_load(&rws[0], scopes[i]);
+			place_acts(&rws[0].rw_day, rws[0].rw_wday,
+			    rws[0].rw_date);
+			rj.rj_moved[i] = resched_commit(&rws[0], scopes[i]);
+		}
 	}
+	wal_end();
 
-	if (re->rae_code == RAE_CODE_FIT) {
-		fprintf(stderr, FIT_ERR, str, re->rae_act->act_name);
+	for (i = 0; i < nthr; i++) {
+		(void) pthread_cond_destroy(&rws[i].rw_cv);
+		daymap_destroy(rws[i].rw_day.pd_map);
+		pd_fini(&rws[i].rw_day);
 	}
+	umem_free(rws, nthr * sizeof (resched_wk_t));
+	(void) pthread_cond_destroy(&rj.rj_cv);
+	(void) pthread_mutex_destroy(&rj.rj_lock);
 
-	if (re->rae_code == RAE_CODE_ARRANGE) {
-		fprintf(stderr, "%s: Couldn't rearrange activity %s\n",
-			str, re->rae_act->act_name);
+	i = 0;
+	while (i < n) {
+		ov_clear(scopes[i]);
+		i++;
+	}
+
+	next = umem_alloc(n * sizeof (scope_t), UMEM_NOFAIL);
+	i = 0;
+	while (i < n) {
+		if (rj.rj_moved[i]) {
+			next[nnext] = scope_step(scopes[i], 1);
+			if (scope_step(next[nnext], -1) == scopes[i]) {
+				nnext++;
+			}
+		}
+		i++;
+	}
+	umem_free(rj.rj_moved, n);
+	if (pass < 7) {
+		resched_pass(next, nnext, pass + 1);
 	}
+	umem_free(next, n * sizeof (scope_t));
 }
 
+void
+resched_scopes(scope_t *scopes, size_t n)
+{
+	resched_pass(scopes, n, 1);
+}
 
 /*
- * XXX: We have to check for conflicts because we are growing/shrinking the #
- * of minutes.  If there are dynamic conflicts, we try to rearrange them. If
- * there are static conflicts we report them. If we can't rearrange dynamic
- * actions, we report that to.
+ * Overlays a new record for an activity, to be placed by the next call to
+ * resched_scopes().
  */
-int
-set_awake(day_t day, tm_t *date, size_t base, size_t off)
+void
+stage_act(scope_t s, char *n, act_rec_t *r)
 {
-	ra_err_t *re = realloc_acts(day, date, base, off);
-	rae_code_print(re);
+	ov_put(s, n, r);
+}
 
-	int dfd;
+/*
+ * Reschedules every day that has changes waiting in the overlay.
+ */
+static void
+resched_all(void)
+{
+	act_ov_t *ov;
+	scope_t *scopes;
+	size_t n = 0;
+	size_t sz;
 
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
+	if (!ov_init || avl_numnodes(&ov_tree) == 0) {
+		return;
 	}
 
 	/*
-	 * Now that all of our reallocation has worked out, we write these
-	 * changes out to the file system, to make them persistent.
+	 * The overlay is sorted by scope, so each day's records are adjacent.
 	 */
-	int awake_xattr = openat(dfd, "awake",
-				O_XATTR | O_CREAT | O_RDWR, ALLRWX);
+	sz = avl_numnodes(&ov_tree) * sizeof (scope_t);
+	scopes = umem_alloc(sz, UMEM_NOFAIL);
+	for (ov = avl_first(&ov_tree); ov != NULL;
+	    ov = AVL_NEXT(&ov_tree, ov)) {
+		if (n == 0 || scopes[n - 1] != ov->ov_scope) {
+			scopes[n++] = ov->ov_scope;
+		}
+	}
+	resched_scopes(scopes, n);
+	umem_free(scopes, sz);
+}
 
-	int afd = openacts(dfd);
+/*
+ * In batch mode, changes to durations and times are queued up, and each
+ * changed day is rescheduled once, by batch_end(), rather than once per
+ * change.
+ */
+void
+batch_begin(void)
+{
+	realloc_defer = 1;
+}
 
+void
+batch_end(void)
+{
+	resched_all();
+	realloc_defer = 0;
+}
 
-	atomic_write(awake_xattr, &base, sizeof (size_t));
+/*
+ * Commits whatever a batch has queued up so far, for the queries (like
+ * free_find) that go to the store themselves.
+ */
+void
+batch_flush(void)
+{
+	if (realloc_defer) {
+		resched_all();
+	}
+}
 
-	atomic_write(awake_xattr, &off, sizeof (size_t));
+/*
+ * A dry run ("plan plan-check") stages its changes in the overlay, just like a
+ * batch does. But rather than committing them, check_end() places each
+ * changed day in memory, prints where its changed (or moved) activities would
+ * end up, and drops the overlay, so nothing is ever written. A day that fits
+ * has its placements overlaid in turn, so that the day after it is placed
+ * around them if it has to be (when the day runs further past midnight than
+ * it did).
+ *
+ * Each day is placed, and printed, once. The changed days are placed in
+ * order, so a day that one of them pushes into is usually still to come, and
+ * is placed around it then. Only a week that wraps around (Saturday running
+ * further into a Sunday that was already placed) isn't placed again; the
+ * usage text says so, and a real change places that Sunday as it should.
+ */
+void
+check_begin(void)
+{
+	realloc_defer = 1;
+}
 
-	close(awake_xattr);
+/*
+ * Prints the activities of a placed day that would change, in the same
+ * columns as "plan list", and overlays their new times.
+ */
+static void
+check_print(plan_day_t *pd, scope_t s, int *hdr)
+{
+	char when[30];
+	char time_fmt[RES_FMTLEN];
+	char prev_fmt[RES_FMTLEN];
+	char dur_fmt[RES_FMTLEN];
+	act_rec_t r;
+	act_rec_t was;
+	act_cold_t *ac;
+	tm_t t;
+	int changed;
+	size_t j = 0;
+	size_t k;
+
+	if (PS_ISDATE(s)) {
+		scope_to_tm(s, &t);
+		(void) strftime(when, sizeof (when), "%Y-%m-%d", &t);
+	} else {
+		(void) snprintf(when, sizeof (when), "%s", daystr[s]);
+	}
 
-	commit_act_arr(afd);
-	close(afd);
-	close(dfd);
+	while (j < pd->pd_elems) {
+		k = j;
+		changed = pd->pd_flags[j] & ACT_FDIRTY;
+		while (k < pd->pd_elems && pd->pd_act[k] == pd->pd_act[j]) {
+			changed |= (pd->pd_time[k] != pd->pd_prev[k]);
+			k++;
+		}
+		if (!changed) {
+			j = k;
+			continue;
+		}
 
-	/*
-	 * Now we free all of the memory we used (in realloc_acts):
-	 * 	act_name member in act_t structures.
-	 * 	act_t structures.
-	 */
-	free_act_arr();
-	return (0);
+		/*
+		 * The times it had are the ones in the store, as the overlay
+		 * holds the change.
+		 */
+		ac = PD_COLD(pd, j);
+		if (store->ps_act_get(s, ac->ac_name, &was) != 0) {
+			act_rec_init(&was, 0);
+		}
+		act_rec_init(&r, (k - j));
+		r.ar_dyn = PD_DYN(pd, j) ? 1 : 0;
+		r.ar_dur = pd->pd_dur[j];
+		r.ar_gap = ac->ac_gap;
+		r.ar_spread = ac->ac_spread;
+		k = j;
+		while (k < (j + r.ar_ntimes)) {
+			r.ar_time[(k - j)] = pd->pd_time[k];
+			(void) snprintf(time_fmt, sizeof (time_fmt), "N/A");
+			(void) snprintf(prev_fmt, sizeof (prev_fmt), "N/A");
+			if (pd->pd_time[k] != -1) {
+				res_fmt_time(time_fmt, sizeof (time_fmt),
+				    pd->pd_time[k]);
+			}
+			if (k - j < was.ar_ntimes && was.ar_time[k - j] != -1) {
+				res_fmt_time(prev_fmt, sizeof (prev_fmt),
+				    was.ar_time[k - j]);
+			}
+			res_fmt_dur(dur_fmt, sizeof (dur_fmt), pd->pd_dur[k]);
+			if (!*hdr) {
+				printf("%-12s %-20s %7s %7s %7s\n", "WHEN",
+				    "NAME", "TIME", "WAS", "DUR");
+				*hdr = 1;
+			}
+			printf("%-12s %-20s %7s %7s %7s\n", when, ac->ac_name,
+			    time_fmt, prev_fmt, dur_fmt);
+			k++;
+		}
+		ov_put(s, ac->ac_name, &r);
+		act_rec_free(&r);
+		act_rec_free(&was);
+		j = k;
+	}
 }
 
 /*
- * The set dur function is interesting because, it not only modifies the
- * duration, but can also modify the time, if we have a chunked duration.
+ * Is `s` one of the first n scopes (placed, or still to be)?
  */
-int
-set_dur(char *n, int day, tm_t *date, size_t dur, size_t chunks)
+static int
+check_listed(scope_t *scopes, size_t n, scope_t s)
 {
-	if (dur > 1440) {
-		return (DUR_ELENGTH);
-	}
+	size_t i;
 
-	if (chunks == 0) {
-		return (DUR_ECHUNKS);
+	for (i = 0; i < n; i++) {
+		if (scopes[i] == s) {
+			return (1);
+		}
 	}
+	return (0);
+}
 
-	PLAN_SET_DUR(n, dur, chunks);
-
+/*
+ * Throws the staged changes away without placing anything, for a check that
+ * was given a change it couldn't stage.
+ */
+void
+check_abort(void)
+{
+	act_ov_t *ov;
 
-	/*
-	 * Needed file desctiptors.
-	 */
-	int time_xattr;
-	int dur_xattr;
-	int dyn_xattr;
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
+	realloc_defer = 0;
+	if (!ov_init) {
+		return;
 	}
-	int adfd = openacts(dfd);
-	int afd = openat(adfd, n, O_RDWR);
-	if (afd == -1) {
-		return (DUR_EEXIST);
+	while ((ov = avl_first(&ov_tree)) != NULL) {
+		ov_free(ov);
 	}
-	dur_xattr = openat(afd, "dur", O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	time_xattr = openat(afd, "time",
-			O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-	dyn_xattr = openat(afd, "dyn", O_XATTR | O_CREAT | O_RDWR, ALLRWX);
+}
 
-	/*
-	 * These variables all hold data that has to be restored in case of
-	 * failure.
-	 */
-	size_t prev_dur = 0;
-	size_t prev_chunks = 1;
-	char prev_dyn = 0;
-	char yes_dyn = 1;
-	struct stat time_st;
-	int prev_time_mono;
-	int *prev_time = &prev_time_mono;
+/*
+ * Places the days with staged changes, reports what would happen, and throws
+ * the changes away. Returns 0 if everything would fit, and -1 if something
+ * wouldn't (the activity that didn't fit is reported, as it would be by a
+ * real change).
+ */
+int
+check_end(void)
+{
+	plan_day_t *pd = plan_day0();
+	act_ov_t *ov;
+	scope_t *scopes;
+	scope_t s;
+	scope_t next;
+	char *depth;
+	size_t n = 0;
+	size_t i = 0;
+	size_t max;
+	size_t base;
+	size_t off;
+	size_t spill;
+	day_t day;
+	tm_t tm;
+	tm_t *date;
+	int hdr = 0;
+	int ret = 0;
+
+	realloc_defer = 0;
+	if (!ov_init || avl_numnodes(&ov_tree) == 0) {
+		printf("Nothing would change\n");
+		return (0);
+	}
 
 	/*
-	 * Get the previous number of chunks.
+	 * Each changed day can push at most a week's worth of days after it
+	 * around, so that's as many days as we'll ever have to look at.
 	 */
-	fstat(time_xattr, &time_st);
-	prev_chunks = time_st.st_size/sizeof(int);
+	max = avl_numnodes(&ov_tree) * 8;
+	scopes = umem_alloc(max * sizeof (scope_t), UMEM_NOFAIL);
+	depth = umem_alloc(max, UMEM_NOFAIL);
+	for (ov = avl_first(&ov_tree); ov != NULL;
+	    ov = AVL_NEXT(&ov_tree, ov)) {
+		if (n == 0 || scopes[n - 1] != ov->ov_scope) {
+			depth[n] = 0;
+			scopes[n++] = ov->ov_scope;
+		}
+	}
 
-	/*
-	 * Get the previous time
-	 */
-	if (prev_chunks > 1) {
-		prev_time = umem_alloc(time_st.st_size, UMEM_NOFAIL);
-		atomic_read(time_xattr, prev_time, time_st.st_size);
-	} else if (prev_chunks > 0) {
-		atomic_read(time_xattr, prev_time, time_st.st_size);
-	} else {
-		*prev_time = 0;
+	while (i < n) {
+		s = scopes[i];
+		day = s;
+		date = NULL;
+		if (PS_ISDATE(s)) {
+			scope_to_tm(s, &tm);
+			date = &tm;
+			day = -1;
+		}
+		spill = scope_spill(s, 0);
+		get_awake_range(day, date, &base, &off);
+		if (realloc_acts(pd, day, date, base, off)->rae_code ==
+		    RAE_CODE_SUCCESS) {
+			check_print(pd, s, &hdr);
+			next = scope_step(s, 1);
+			if (pd_spill(pd) != spill && depth[i] < 7 &&
+			    scope_step(next, -1) == s &&
+			    !check_listed(scopes, n, next)) {
+				depth[n] = depth[i] + 1;
+				scopes[n++] = next;
+			}
+		} else {
+			rae_code_print(pd);
+			ret = -1;
+		}
+		free_act_arr(pd);
+		i++;
 	}
-	lseek(time_xattr, 0, SEEK_SET);
+	umem_free(depth, max);
+	umem_free(scopes, max * sizeof (scope_t));
 
-	/*
-	 * Get previous dyn-attr
-	 */
-	atomic_read(dyn_xattr, &prev_dyn, sizeof (char));
+	check_abort();
+	if (ret == 0 && !hdr) {
+		printf("Nothing would change\n");
+	}
+	return (ret);
+}
 
-	/*
-	 * Get previous duration
-	 */
-	atomic_read(dur_xattr, &prev_dur, sizeof (size_t));
+/*
+ * XXX: We have to check for conflicts because we are growing/shrinking the #
+ * of slots.  If there are dynamic conflicts, we try to rearrange them. If
+ * there are static conflicts we report them. If we can't rearrange dynamic
+ * actions, we report that to.
+ */
+int
+set_awake(day_t day, tm_t *date, size_t base, size_t off)
+{
+	scope_t s = plan_scope(day, date);
+	plan_day_t *pd = plan_day0();
+	size_t spill = scope_spill(s, 0);
+	(void) realloc_acts(pd, day, date, base, off);
+	int moved = (pd_spill(pd) != spill);
+	rae_code_print(pd);
 
 	/*
-	 * Reset our location within the dur and dyn attrs, to file start.
+	 * Now that all of our reallocation has worked out, we write these
+	 * changes out to the store, to make them persistent.
 	 */
-	lseek(dur_xattr, 0, SEEK_SET);
-	lseek(dyn_xattr, 0, SEEK_SET);
+	wal_begin();
+	wal_awake(s, base, off);
+	commit_act_arr(pd, s);
+	wal_end();
+	pd_occ_put(pd, s);
+	ov_clear(s);
 
 	/*
-	 * If were setting the same duration and chunks as we did previously,
-	 * we just return success, as this is old work.
+	 * Now we free all of the memory we used (in realloc_acts): the names
+	 * and details of the activities.
 	 */
-	if (prev_dur == dur && prev_chunks == chunks) {
-		return (SUCCESS);
+	free_act_arr(pd);
+	if (moved) {
+		resched_spill(s);
 	}
+	return (0);
+}
 
-	/*
-	 * If we are trying to set a duration with the same number of chunks
-	 * (or greater), we can just use the time_xattr file as it is. But, if
-	 * we're setting less chunks, we need to close the file and open it
-	 * with the O_TRUNC tag, which removes all data from it.
-	 */
-	if (chunks < prev_chunks) {
-		close(time_xattr);
-		time_xattr = openat(afd, "time",
-				O_TRUNC | O_XATTR | O_CREAT | O_RDWR, ALLRWX);
+/*
+ * Sets the awake range of every weekday. The ranges are committed first, and
+ * then the week is rescheduled in one go (and in one WAL transaction), so
+ * that every day is placed around its neighbours' new times.
+ */
+int
+set_awake_week(size_t base, size_t off)
+{
+	scope_t week[7];
+	day_t d = SUN;
+
+	wal_begin();
+	while (d <= SAT) {
+		wal_awake(d, base, off);
+		week[d] = d;
+		d++;
 	}
+	wal_end();
+	resched_scopes(week, 7);
+	return (0);
+}
 
-	
+/*
+ * Changing the resolution rescales every time, duration and awake range in the
+ * store, from rs_from seconds a slot to rs_to. Start times are rounded down
+ * and durations up, so going to a coarser resolution can leave activities
+ * overlapping, or a dynamic one out of place. Each day is then rescheduled.
+ */
+typedef struct res_scale {
+	int		rs_from;
+	int		rs_to;
+	scope_t		rs_scope;
+	scope_t		*rs_scopes;
+	size_t		rs_nscopes;
+	size_t		rs_sz;
+} res_scale_t;
 
+static size_t
+res_scale(res_scale_t *rs, size_t v, int up)
+{
+	size_t secs = v * rs->rs_from;
 
-	/*
-	 * We now write the new dur value to disk, needed to fulfill the
-	 * reallocation.
-	 */
-	atomic_write(dur_xattr, &dur, sizeof (size_t));
-	lseek(dur_xattr, 0, SEEK_SET);
+	if (up) {
+		return ((secs + rs->rs_to - 1) / rs->rs_to);
+	}
+	return (secs / rs->rs_to);
+}
 
-	int neg_time = -1;
-	if (chunks == 1) {
-		atomic_write(time_xattr, &neg_time, sizeof (int));
+static void
+res_scale_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	res_scale_t *rs = arg;
+	size_t i = 0;
+
+	r->ar_dur = res_scale(rs, r->ar_dur, 1);
+	r->ar_gap = res_scale(rs, r->ar_gap, 1);
+	r->ar_spread = res_scale(rs, r->ar_spread, 1);
+	while (i < r->ar_ntimes) {
+		if (r->ar_time[i] != -1) {
+			r->ar_time[i] = res_scale(rs, r->ar_time[i], 0);
+		}
+		i++;
 	}
+	wal_act(rs->rs_scope, n, r);
+	act_rec_free(r);
+}
 
-	int i = 0;
-	if (chunks > 1) {
+static void
+res_scale_todo(void *arg, char *n, int time, char *det)
+{
+	res_scale_t *rs = arg;
+
+	if (time > 0) {
+		wal_todo(rs->rs_scope, n, res_scale(rs, time, 0));
+	}
+}
+
+static void
+res_scale_scope(void *arg, scope_t s)
+{
+	res_scale_t *rs = arg;
+	size_t base;
+	size_t off;
+	scope_t *ns;
+
+	rs->rs_scope = s;
+	if (s != PS_GENERAL) {
 		/*
-		 * If we have more than one chunk the activity _must_ be
-		 * dynamic. If we have just one chunk, then it can be whatever
-		 * it was previously.
+		 * A day without an awake range of its own gets the whole day,
+		 * whatever the resolution, so we leave it without one.
 		 */
-		atomic_write(dyn_xattr, &yes_dyn, sizeof (char));
-		lseek(dyn_xattr, 0, SEEK_SET);
-		while (i < chunks) {
-			atomic_write(time_xattr, &neg_time, sizeof (int));
-			i++;
+		store->ps_awake_get(s, &base, &off);
+		if (base != 0 || off != plan_slots) {
+			wal_awake(s, res_scale(rs, base, 0),
+			    res_scale(rs, off, 1));
+		}
+		store->ps_act_walk(s, 0, res_scale_act, rs);
+
+		if (rs->rs_nscopes == rs->rs_sz) {
+			ns = umem_alloc((rs->rs_sz * 2 + 16) * sizeof (scope_t),
+			    UMEM_NOFAIL);
+			if (rs->rs_sz) {
+				bcopy(rs->rs_scopes, ns,
+				    rs->rs_nscopes * sizeof (scope_t));
+				umem_free(rs->rs_scopes,
+				    rs->rs_sz * sizeof (scope_t));
+			}
+			rs->rs_scopes = ns;
+			rs->rs_sz = rs->rs_sz * 2 + 16;
 		}
+		rs->rs_scopes[rs->rs_nscopes++] = s;
 	}
-	lseek(time_xattr, 0, SEEK_SET);
+	store->ps_todo_walk(s, 0, res_scale_todo, rs);
+}
 
-	/*
-	 * We close the time, dur, and dyn files so that realloc acts can take
-	 * things from, and so that we can reopen some of them later with
-	 * O_TRUNC (if we fail).
-	 */
-	close(time_xattr);
-	close(dyn_xattr);
-	close(dur_xattr);
+/*
+ * Sets the resolution of the plandb to `secs` seconds a slot. The rescaled
+ * records and the new resolution are committed in one WAL transaction.
+ */
+int
+set_res(int secs)
+{
+	res_scale_t rs;
+
+	if (secs != plan_res) {
+		/*
+		 * Anything waiting to be rescheduled is in the old resolution.
+		 */
+		resched_all();
+
+		bzero(&rs, sizeof (rs));
+		rs.rs_from = plan_res;
+		rs.rs_to = secs;
+		wal_begin();
+		store->ps_walk(res_scale_scope, &rs);
+		wal_res(secs);
+		wal_end();
+
+		if (rs.rs_to > rs.rs_from) {
+			resched_scopes(rs.rs_scopes, rs.rs_nscopes);
+		}
+		if (rs.rs_sz) {
+			umem_free(rs.rs_scopes, rs.rs_sz * sizeof (scope_t));
+		}
+	}
 
+	printf("The resolution is %d second%s (%lu slots a day).\n", plan_res,
+	    (plan_res == 1) ? "" : "s", (ulong_t)plan_slots);
+	return (0);
+}
 
-	size_t base;
-	size_t off;
-	get_awake_range(day, date, &base, &off);
+/*
+ * The set dur function is interesting because, it not only modifies the
+ * duration, but can also modify the time, if we have a chunked duration.
+ */
+int
+set_dur(char *n, int day, tm_t *date, size_t dur, size_t chunks)
+{
+	if (dur > plan_slots) {
+		return (DUR_ELENGTH);
+	}
 
+	if (chunks == 0) {
+		return (DUR_ECHUNKS);
+	}
 
+	PLAN_SET_DUR(n, dur, chunks);
 
-	PLAN_PRECOMMIT_DUR(n, dur);
+	scope_t s = plan_scope(day, date);
 
+	/*
+	 * The new record is based on the previous one.
+	 */
+	act_rec_t prev;
+	act_rec_t r;
+	if (act_get(s, n, &prev) != 0) {
+		return (DUR_EEXIST);
+	}
 
-	ra_err_t *ret = realloc_acts(day, date, base, off);
+	/*
+	 * If were setting the same duration and chunks as we did previously,
+	 * we just return success, as this is old work.
+	 */
+	if (prev.ar_dur == dur && prev.ar_ntimes == chunks) {
+		act_rec_free(&prev);
+		return (SUCCESS);
+	}
 
 	/*
-	 * If reallocation fails, revert to the old duration, old time, old
-	 * dyn, and bail.
+	 * Every chunk starts out unplaced. If we have more than one chunk the
+	 * activity _must_ be dynamic. If we have just one chunk, then it can
+	 * be whatever it was previously (and a static activity keeps its
+	 * start time).
 	 */
-	if (ret->rae_code != RAE_CODE_SUCCESS) {
-
-		dur_xattr =
-			openat(afd, "dur", O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-		dyn_xattr =
-			openat(afd, "dyn", O_XATTR | O_CREAT | O_RDWR, ALLRWX);
-		time_xattr = openat(afd, "time",
-				O_XATTR | O_CREAT | O_RDWR | O_TRUNC, ALLRWX);
-
-		atomic_write(dur_xattr, &prev_dur, sizeof (size_t));
-
-		atomic_write(time_xattr, prev_time, time_st.st_size);
-
-		atomic_write(dyn_xattr, &prev_dyn, sizeof (char));
-
-		goto skip_commit;
+	act_rec_init(&r, chunks);
+	r.ar_dur = dur;
+	r.ar_dyn = prev.ar_dyn;
+	r.ar_gap = prev.ar_gap;
+	r.ar_spread = prev.ar_spread;
+	if (chunks > 1) {
+		r.ar_dyn = 1;
+	} else if (!prev.ar_dyn && prev.ar_ntimes == 1) {
+		r.ar_time[0] = prev.ar_time[0];
 	}
 
-	/* here we write new profiles out to disk */
-	commit_act_arr(adfd);
+	PLAN_PRECOMMIT_DUR(n, dur);
+
+	/*
+	 * If reallocation fails, nothing is written, so the old duration,
+	 * time, and dyn stay in place.
+	 */
+	resched_act(day, date, n, &r);
 
-skip_commit:;
-	close(dfd);
-	close(adfd);
-	close(afd);
-	close(dur_xattr);
-	close(time_xattr);
-	close(dyn_xattr);
-	rae_code_print(ret);
-	free_act_arr();
+	act_rec_free(&r);
+	act_rec_free(&prev);
 
 	return (0);
 }
@@ -1157,149 +2371,131 @@ skip_commit:;
  * I'll modify this function to coalesce the durations into a single chunk
  * [(dur=00h30m*2) becomes (dur=01h00m)].
  */
+static int time_conflicts(scope_t, char *, int, size_t);
+
 int
 set_time_act(char *n, int day, tm_t *date, int time, char dyn)
 {
 	PLAN_GOT_HERE(dyn);
-	int dfd;
-	int adfd;
-	int afd;
-	int time_xattr;
-	int dyn_xattr;
-	int dur_xattr;
-	size_t base;
-	size_t off;
-	size_t dur;
-	size_t chunks;
-	struct stat time_stat;
-	int old_time = -1;
-	ra_err_t *re;
-
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
+	act_rec_t prev;
+	act_rec_t r;
 
 	PLAN_GOT_HERE(dyn);
-	get_awake_range(day, date, &base, &off);
 
-	adfd = openacts(dfd);
-	afd = openat(adfd, n, O_RDWR);
-	if (afd == -1) {
+	if (act_get(s, n, &prev) != 0) {
 		return (TIME_EEXIST);
 	}
-	time_xattr = openat(afd, "time", O_RDWR | O_XATTR | O_CREAT, ALLRWX);
-	dur_xattr = openat(afd, "dur", O_RDWR | O_XATTR | O_CREAT, ALLRWX);
-	dyn_xattr = openat(afd, "dyn", O_RDWR | O_XATTR | O_CREAT, ALLRWX);
 	PLAN_GOT_HERE(dyn);
 
-	fstat(time_xattr, &time_stat);
-	chunks = time_stat.st_size/sizeof (int);
-	if (chunks > 1) {
+	if (prev.ar_ntimes > 1) {
+		act_rec_free(&prev);
 		return (TIME_ECHUNK);
 	}
 
-	atomic_read(time_xattr, &old_time, sizeof (int));
-	lseek(time_xattr, 0, SEEK_SET);
-
-	atomic_read(dur_xattr, &dur, sizeof (size_t));
-	lseek(dur_xattr, 0, SEEK_SET);
-
 	PLAN_GOT_HERE(dyn);
 
-	if (dur == 0) {
+	if (prev.ar_dur == 0) {
+		act_rec_free(&prev);
 		return (TIME_ENODUR);
 	}
 
 	PLAN_GOT_HERE(dyn);
 
-	if ((time + (int)dur) > 1440) {
+	if (time >= (int)plan_slots) {
+		act_rec_free(&prev);
 		return (TIME_ELENGTH);
 	}
 
 	PLAN_GOT_HERE(dyn);
 
-	atomic_write(dyn_xattr, &dyn, sizeof (char));
-	PLAN_GOT_HERE(dyn);
+	if (!dyn && time_conflicts(s, n, time, prev.ar_dur)) {
+		act_rec_free(&prev);
+		return (TIME_ECONFLICT);
+	}
 
+	act_rec_init(&r, 1);
+	r.ar_dur = prev.ar_dur;
+	r.ar_dyn = dyn;
+	r.ar_gap = prev.ar_gap;
+	r.ar_spread = prev.ar_spread;
 	if (!dyn) {
-		atomic_write(time_xattr, &time, sizeof (int));
-		lseek(time_xattr, 0, SEEK_SET);
+		r.ar_time[0] = time;
+	} else if (prev.ar_ntimes) {
+		r.ar_time[0] = prev.ar_time[0];
 	}
 	PLAN_GOT_HERE(dyn);
 
-	close(time_xattr);
-	close(dyn_xattr);
-	close(dur_xattr);
-
-	re = realloc_acts(day, date, base, off);
+	resched_act(day, date, n, &r);
 
-	if (re->rae_code == RAE_CODE_SUCCESS) {
-		commit_act_arr(adfd);
-	} else {
-		rae_code_print(re);
-		time_xattr = openat(afd, "time", O_RDWR | O_XATTR | O_CREAT,
-			ALLRWX);
-		dyn_xattr = openat(afd, "dyn", O_RDWR | O_XATTR | O_CREAT,
-			ALLRWX);
-		atomic_write(time_xattr, &old_time, sizeof (int));
-		close(time_xattr);
-	}
-
-	close(dfd);
-	close(adfd);
-	close(afd);
-	free_act_arr();
+	act_rec_free(&r);
+	act_rec_free(&prev);
 	return (0);
 }
 
+/*
+ * Sets the constraints on how the chunks of an activity are placed: at least
+ * `gap` slots apart, and within `spread` slots of each other, start to end
+ * (either can be 0, for none). The chunks are placed anew.
+ */
 int
-set_time_todo(char *n, int day, tm_t *date, uint64_t time)
+set_chunks(char *n, int day, tm_t *date, size_t gap, size_t spread)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
+	scope_t s = plan_scope(day, date);
+	act_rec_t prev;
+	act_rec_t r;
+	size_t nc;
+
+	if (act_get(s, n, &prev) != 0) {
+		return (CHUNK_EEXIST);
 	}
 
-	int tdfd = opentodos(dfd);
-	int tfd = openat(tdfd, n, O_RDWR);
-	if (tfd == -1) {
+	nc = prev.ar_ntimes ? prev.ar_ntimes : 1;
+	if (gap > plan_slots || (spread != 0 &&
+	    nc * prev.ar_dur + (nc - 1) * gap > spread)) {
+		act_rec_free(&prev);
+		return (CHUNK_ESPREAD);
+	}
+
+	act_rec_init(&r, prev.ar_ntimes);
+	r.ar_dur = prev.ar_dur;
+	r.ar_dyn = prev.ar_dyn;
+	r.ar_gap = gap;
+	r.ar_spread = spread;
+	if (!r.ar_dyn) {
+		bcopy(prev.ar_time, r.ar_time, prev.ar_ntimes * sizeof (int));
+	}
+
+	resched_act(day, date, n, &r);
+
+	act_rec_free(&r);
+	act_rec_free(&prev);
+	return (0);
+}
+
+int
+set_time_todo(char *n, int day, tm_t *date, int time)
+{
+	if (store->ps_todo_time(plan_scope(day, date), n, time) != 0) {
 		printf("Can't set time on todo %s. Doesn't exist.\n",
 			n);
-		exit(0);
+		plan_exit(0);
 	}
-	int time_xattr = openat(tfd, "time", O_XATTR | O_CREAT, ALLRWX);
-	atomic_write(time_xattr, &time, sizeof (uint64_t));
-	close(dfd);
-	close(tfd);
-	close(time_xattr);
 	return (0);
 }
 
 
+/*
+ * Details are stored in the activity.
+ */
 int
 set_details_act(char *n, int day, tm_t *date, char *det)
 {
-	int dfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
 
-	int adfd = openacts(dfd);
-	int afd = openat(adfd, n, O_RDWR);
-	size_t strsz = strlen(det);
-	/*
-	 * Details are stored in the activity.
-	 */
-	atomic_write(afd, det, strsz);
-	close(afd);
-	close(adfd);
-	close(dfd);
+	if (store->ps_act_det(s, n, det) == 0) {
+		text_set(NM_ACT, s, n, det);
+	}
 	return (0);
 }
 
@@ -1307,78 +2503,138 @@ set_details_act(char *n, int day, tm_t *date, char *det)
 int
 set_details_todo(char *n, int day, tm_t *date, char *det)
 {
-	int dfd;
-	int tdfd;
-	if (date) {
-		dfd = opendate(date);
-	} else {
-		dfd = openday(day);
-	}
+	scope_t s = plan_scope(day, date);
 
-	tdfd = opentodos(dfd);
-	int tfd = openat(tdfd, n, O_RDWR);
-	size_t strsz = strlen(det);
-	atomic_write(tfd, det, strsz);
-	close(tfd);
-	close(tdfd);
-	close(dfd);
+	if (store->ps_todo_det(s, n, det) == 0) {
+		text_set(NM_TODO, s, n, det);
+	}
 	return (0);
 }
 
+/*
+ * Adds the day in `pd` to the `list -s` totals. An activity counts once per
+ * day, however many chunks it was split into.
+ */
+static void
+list_sum(plan_day_t *pd)
+{
+	uint32_t *ids;
+	uint32_t i;
+	size_t j;
+
+	ids = umem_alloc(pd->pd_ncold * sizeof (uint32_t), UMEM_NOFAIL);
+	for (i = 0; i < pd->pd_ncold; i++) {
+		ids[i] = intern(&ls_names, pd->pd_cold[i].ac_name,
+		    pd->pd_cold[i].ac_name_len);
+		if (ids[i] >= ls_maxtot) {
+			size_t nmax = MAX(ls_maxtot * 2, 32);
+			ls_total_t *ntot = umem_zalloc(nmax *
+			    sizeof (ls_total_t), UMEM_NOFAIL);
+			if (ls_tot != NULL) {
+				bcopy(ls_tot, ntot,
+				    ls_maxtot * sizeof (ls_total_t));
+				umem_free(ls_tot,
+				    ls_maxtot * sizeof (ls_total_t));
+			}
+			ls_tot = ntot;
+			ls_maxtot = nmax;
+		}
+		ls_tot[ids[i]].lt_days++;
+	}
+
+	for (j = 0; j < pd->pd_elems; j++) {
+		ls_tot[ids[pd->pd_act[j]]].lt_dur += pd->pd_dur[j];
+	}
+
+	umem_free(ids, pd->pd_ncold * sizeof (uint32_t));
+}
+
+/*
+ * Prints the totals gathered by list_sum, in the order the names were first
+ * seen, and forgets them.
+ */
+void
+list_totals(void)
+{
+	char dur_fmt[RES_FMTLEN];
+	uint32_t i;
+
+	if (ls_names.in_n == 0) {
+		return;
+	}
+
+	printf("\n%-20s %6s %7s\n", "NAME", "DAYS", "TOTAL");
+	for (i = 0; i < ls_names.in_n; i++) {
+		res_fmt_dur(dur_fmt, sizeof (dur_fmt), ls_tot[i].lt_dur);
+		printf("%-20s %6lu %7s\n", intern_name(&ls_names, i),
+		    (ulong_t)ls_tot[i].lt_days, dur_fmt);
+	}
+
+	intern_fini(&ls_names);
+	umem_free(ls_tot, ls_maxtot * sizeof (ls_total_t));
+	ls_tot = NULL;
+	ls_maxtot = 0;
+}
+
 /*
  * This function prints a list all of the activities and/or todos in a given
  * day or date, to stdout. It sets the integer pointed to by `no_print`, to 1
- * if anything was printed, or 0 if not.
+ * if anything was printed, or 0 if not. If the caller already knows whether
+ * the date exists, it passes that in `have`; otherwise `have` is -1 and we
+ * ask the store.
  */
 #define	POST_NL 1
 #define NO_NL	0
 #define	PRE_NL	-1
-void
-list(day_t d, tm_t *date, int flag, int nl)
+static void
+list_impl(day_t d, tm_t *date, int flag, int nl, int have)
 {
-	char time_fmt[10];
-	char dur_fmt[10];
+	plan_day_t *pd = plan_day0();
+	char time_fmt[RES_FMTLEN];
+	char dur_fmt[RES_FMTLEN];
 	char *dyn_fmt;
 	char *dyn_true = "true";
 	char *dyn_false = "false";
 	size_t cur_usage;
-	size_t hrs;
-	size_t mins;
-	int thrs;
-	int tmins;
 	int act = LS_IS_ACT(flag);
 	int todo = LS_IS_TODO(flag);
 	int is_prday = LS_IS_PRDAY(flag);
 	int is_prboth = LS_IS_PRBOTH(flag);
 	int pr_desc = LS_IS_DESC(flag);
-	int dfd;
-	int have_date;
+	scope_t s;
+	int have_date = 0;
 
 
 	if (!date && d <= -1) {
-		exit(0);
+		plan_exit(0);
+	}
+
+	/*
+	 * If we're batching, some days may be waiting to be rescheduled. We
+	 * want to list what will actually be committed.
+	 */
+	if (realloc_defer) {
+		resched_all();
 	}
 
 	if (!date) {
-		dfd = openday(d);
+		s = d;
 	} else {
-		have_date = havedate(date);
+		have_date = (have == -1) ? havedate(date) : have;
 
 		if (have_date) {
-			dfd = opendate(date);
+			s = plan_scope(-1, date);
 		} else {
 try_day:;
 			if (d > -1) {
-				dfd = openday(date->tm_wday);
+				s = date->tm_wday;
 				goto skip_exit;
 			}
-			exit(0);
+			plan_exit(0);
 skip_exit:;
 		}
 	}
 
-	int afd;
-	int tfd;
 	size_t base;
 	size_t off;
 	if (have_date) {
@@ -1391,9 +2647,7 @@ skip_exit:;
 
 		int acnt = 0;
 
-		afd = openacts(dfd);
-
-		read_act_dir(afd, base, off, pr_desc);
+		read_act_dir(pd, s, base, off, pr_desc);
 
 
 		/*
@@ -1401,14 +2655,12 @@ skip_exit:;
 		 * might as well close dfd, and open the corresponding day
 		 * instead.
 		 */
-		if (a_elems == 0 && have_date) {
+		if (pd->pd_elems == 0 && have_date) {
 			have_date = 0;
-			close(dfd);
-			close(afd);
 			goto try_day;
 		}
 
-		if (a_elems == 0) {
+		if (pd->pd_elems == 0) {
 			goto noprint_acts;
 		}
 
@@ -1433,9 +2685,18 @@ skip_exit:;
 			printf("%s (%s)\n", daystr[d], str);
 		}
 
-		qsort(a, (a_elems), sizeof (act_t *), comp_act_ptrs);
+		uint64_t *keys = umem_alloc(pd->pd_elems * sizeof (uint64_t),
+		    UMEM_NOFAIL);
+		size_t j;
+		size_t o;
 
-		cur_usage = get_total_usage();
+		for (j = 0; j < pd->pd_elems; j++) {
+			keys[j] = ((uint64_t)(uint32_t)(pd->pd_time[j] + 1) <<
+			    32) | j;
+		}
+		qsort(keys, pd->pd_elems, sizeof (uint64_t), comp_act_keys);
+
+		cur_usage = get_total_usage(pd);
 
 
 		printf("(%d/%d)\n", cur_usage, off);
@@ -1444,55 +2705,56 @@ skip_exit:;
 			"NAME", "DYN", "TIME", "DUR");
 
 
-		while (acnt < a_elems) {
+		while (acnt < pd->pd_elems) {
+			j = (uint32_t)keys[acnt];
 
-			if (a[acnt]->act_dyn) {
+			if (PD_DYN(pd, j)) {
 				dyn_fmt = dyn_true;
 			} else {
 				dyn_fmt = dyn_false;
 			}
 
-			hrs = 0;
-			mins = 0;
-			thrs = 0;
-			tmins = 0;
-
 			int seq_acts = 1;
 			int total_dur = 0;
-			total_dur += a[acnt]->act_dur;
-
-			while ((acnt+seq_acts) < a_elems &&
-				(strcmp((a[acnt]->act_name),
-				    (a[(acnt+seq_acts)]->act_name)) == 0)) {
+			total_dur += pd->pd_dur[j];
 
-				total_dur += a[(acnt+seq_acts)]->act_dur;
+			/*
+			 * Chunks that run on from one another are listed as
+			 * one (chunks with a gap between them are not).
+			 */
+			while ((acnt+seq_acts) < pd->pd_elems) {
+				o = (uint32_t)keys[acnt+seq_acts];
+				if (pd->pd_act[o] != pd->pd_act[j] ||
+				    (pd->pd_time[j] == -1 ?
+				    pd->pd_time[o] != -1 :
+				    pd->pd_time[o] != pd->pd_time[j] + total_dur)) {
+					break;
+				}
+				total_dur += pd->pd_dur[o];
 				seq_acts++;
 			}
 
-			hrs = (total_dur)/60;
-			mins = (total_dur) - (hrs*60);
-			sprintf((char *)&dur_fmt, "%.2dh%.2dm", hrs, mins);
+			res_fmt_dur(dur_fmt, sizeof (dur_fmt), total_dur);
 
-			if (a[acnt]->act_time == -1) {
+			if (pd->pd_time[j] == -1) {
 				sprintf((char *)&time_fmt, "N/A");
 				goto not_assigned_time;
 			}
 
 
-			thrs = (a[acnt]->act_time)/60;
-			tmins = (a[acnt]->act_time) - (thrs*60);
-PLAN_GOT_HERE(a[acnt]->act_time);
-			sprintf((char *)&time_fmt, "%.2d:%.2d", thrs, tmins);
+PLAN_GOT_HERE(pd->pd_time[j]);
+			res_fmt_time(time_fmt, sizeof (time_fmt),
+			    pd->pd_time[j]);
 
 not_assigned_time:;
 			printf("%-20s %6s %7s %7s\n",
-				a[acnt]->act_name,
+				PD_NAME(pd, j),
 				dyn_fmt,
 				&(time_fmt[0]),
 				&(dur_fmt[0]));
 
-			if (pr_desc && a[acnt]->act_det) {
-				printf("  | %s\n", a[acnt]->act_det);
+			if (pr_desc && PD_COLD(pd, j)->ac_det) {
+				printf("  | %s\n", PD_COLD(pd, j)->ac_det);
 			}
 
 			acnt += seq_acts;
@@ -1502,14 +2764,17 @@ not_assigned_time:;
 			printf("\n");
 		}
 
-		free_act_arr();
+		if (LS_IS_SUM(flag)) {
+			list_sum(pd);
+		}
+
+		umem_free(keys, pd->pd_elems * sizeof (uint64_t));
+		free_act_arr(pd);
 noprint_acts:;
-		close(afd);
 	}
 
 	if (todo) {
-		tfd = opentodos(dfd);
-		read_todo_dir(tfd, pr_desc);
+		read_todo_dir(s, pr_desc);
 		if (t_elems == 0) {
 			goto noprint_todos;
 		}
@@ -1540,11 +2805,8 @@ noprint_acts:;
 		printf("%-20s %6s \n",
 			"NAME", "TIME");
 		while (tcnt < t_elems) {
-			thrs = 0;
-			tmins = 0;
-			thrs = (t[tcnt]->td_time)/60;
-			tmins = (t[tcnt]->td_time) - (thrs*60);
-			sprintf((char *)&time_fmt, "%.2d:%.2d", thrs, tmins);
+			res_fmt_time(time_fmt, sizeof (time_fmt),
+			    t[tcnt]->td_time);
 			printf("%-20s %6s\n",
 				t[tcnt]->td_name,
 				&(time_fmt[0]));
@@ -1559,9 +2821,7 @@ noprint_acts:;
 		}
 
 noprint_todos:;
-		close(tfd);
 	}
-	close(dfd);
 }
 
 /*
@@ -1571,10 +2831,9 @@ noprint_todos:;
 void
 list_gen_todo(int flag)
 {
-	char time_fmt[10];
-	int tfd = opentodos(-1);
+	char time_fmt[RES_FMTLEN];
 	int det = LS_IS_DESC(flag);
-	read_todo_dir(tfd, det);
+	read_todo_dir(PS_GENERAL, det);
 	if (t_elems == 0) {
 		goto noprint_todos;
 	}
@@ -1585,11 +2844,7 @@ list_gen_todo(int flag)
 	printf("%-20s %6s \n",
 		"NAME", "TIME");
 	while (tcnt < t_elems) {
-		int thrs = 0;
-		int tmins = 0;
-		thrs = (t[tcnt]->td_time)/60;
-		tmins = (t[tcnt]->td_time) - (thrs*60);
-		sprintf((char *)&time_fmt, "%.2d:%.2d", thrs, tmins);
+		res_fmt_time(time_fmt, sizeof (time_fmt), t[tcnt]->td_time);
 		printf("%-20s %6s\n",
 			t[tcnt]->td_name,
 			&(time_fmt[0]));
@@ -1597,8 +2852,78 @@ list_gen_todo(int flag)
 	}
 
 noprint_todos:;
+	free_todo_arr();
+}
+
+void
+list(day_t d, tm_t *date, int flag, int nl)
+{
+	list_impl(d, date, flag, nl, -1);
+}
+
+/*
+ * Lists every date in a range. The store tells us which dates exist, and we
+ * go straight to the weekday for the rest, so a long range doesn't cost a
+ * lookup per empty date.
+ */
+typedef struct list_range {
+	tm_t	lr_tm;		/* the next date to list */
+	scope_t	lr_next;
+	scope_t	lr_to;
+	int	lr_flag;
+} list_range_t;
+
+static void
+list_range_next(list_range_t *lr, int have)
+{
+	int nl = (lr->lr_next == lr->lr_to) ? NO_NL : POST_NL;
+
+	list_impl(lr->lr_tm.tm_wday, &lr->lr_tm, lr->lr_flag, nl, have);
+	if (LS_IS_ACT(lr->lr_flag)) {
+		free_act_arr(plan_day0());
+	}
+	if (LS_IS_TODO(lr->lr_flag)) {
+		free_todo_arr();
+	}
+	lr->lr_tm.tm_mday++;
+	lr->lr_tm.tm_isdst = -1;
+	(void) mktime(&lr->lr_tm);
+	lr->lr_next = plan_scope(-1, &lr->lr_tm);
+}
+
+static void
+list_range_cb(void *arg, scope_t s)
+{
+	list_range_t *lr = arg;
+
+	while (lr->lr_next < s) {
+		list_range_next(lr, 0);
+	}
+	list_range_next(lr, 1);
+}
+
+void
+list_range(scope_t from, scope_t to, int flag)
+{
+	list_range_t lr;
+
+	/*
+	 * Flush any deferred edits first, since committing them could add
+	 * dates to the store while we're walking it.
+	 */
+	if (realloc_defer) {
+		resched_all();
+	}
+
+	scope_to_tm(from, &lr.lr_tm);
+	lr.lr_next = from;
+	lr.lr_to = to;
+	lr.lr_flag = flag ^ 8;
 
-	close(tfd);
+	store->ps_range(from, to, list_range_cb, &lr);
+	while (lr.lr_next <= to) {
+		list_range_next(&lr, 0);
+	}
 }
 
 
@@ -1606,9 +2931,10 @@ void
 list_week(int flag, int week_type)
 {
 	int i = 0;
-	tm_t *t = NULL;
-	int fl = flag;
+	int fl = flag ^ 4;
+	scope_t from;
 	time_t ct;
+	tm_t *t;
 
 	if (week_type != GEN) {
 		ct = time(NULL);
@@ -1622,33 +2948,27 @@ list_week(int flag, int week_type)
 			ct += (1440*60*7);
 		}
 
-		t = localtime(&ct);
-
-		fl = fl ^ 8;
-	} else {
-		fl = fl ^ 4;
+		from = plan_scope(-1, localtime(&ct));
+		ct += (1440*60*6);
+		list_range(from, plan_scope(-1, localtime(&ct)), flag);
+		return;
 	}
 
 	while (i < 7) {
 		if (i != 6) {
-			list(i, t, fl, POST_NL);
+			list(i, NULL, fl, POST_NL);
 		} else {
-			list(i, t, fl, NO_NL);
+			list(i, NULL, fl, NO_NL);
 		}
 
 		if (LS_IS_ACT(flag)) {
-			free_act_arr();
+			free_act_arr(plan_day0());
 		}
 
 		if (LS_IS_TODO(flag)) {
 			free_todo_arr();
 		}
 
-		if (t) {
-			ct += (1440*60);
-			t = localtime(&ct);
-		}
-
 		i++;
 	}
 }
@@ -1661,3 +2981,409 @@ list_today(int flag)
 	list(t->tm_wday, NULL, (flag ^ 4), NO_NL);
 	list(-1, t, (flag ^ 4), PRE_NL);
 }
+
+/*
+ * `plan find` looks a name up in the name index, and prints every day and
+ * date that has an activity or todo by that name. The index only knows where
+ * the name occurs, so we get the times and durations from the store.
+ */
+typedef struct find_ctx {
+	char	*fc_name;
+	int	fc_time;	/* of the todo, once found */
+	int	fc_cnt;
+} find_ctx_t;
+
+static void
+find_todo(void *arg, char *n, int time, char *det)
+{
+	find_ctx_t *fc = arg;
+
+	if (strcmp(n, fc->fc_name) == 0) {
+		fc->fc_time = time;
+	}
+}
+
+static void
+find_print(void *arg, nm_kind_t kind, scope_t s)
+{
+	find_ctx_t *fc = arg;
+	char when[40];
+	char time_fmt[RES_FMTLEN];
+	char dur_fmt[RES_FMTLEN];
+	char *dyn_fmt = "-";
+	act_rec_t r;
+	size_t dur;
+	tm_t t;
+
+	if (s == PS_GENERAL) {
+		(void) snprintf(when, sizeof (when), "general");
+	} else if (PS_ISDATE(s)) {
+		scope_to_tm(s, &t);
+		(void) strftime(when, sizeof (when), "%Y-%m-%d (%a)", &t);
+	} else {
+		(void) snprintf(when, sizeof (when), "%s", daystr[s]);
+	}
+
+	(void) snprintf(dur_fmt, sizeof (dur_fmt), "-");
+	if (kind == NM_TODO) {
+		fc->fc_time = -1;
+		store->ps_todo_walk(s, 0, find_todo, fc);
+		if (fc->fc_time == -1) {
+			return;
+		}
+		res_fmt_time(time_fmt, sizeof (time_fmt), fc->fc_time);
+	} else {
+		if (act_get(s, fc->fc_name, &r) != 0) {
+			return;
+		}
+		dyn_fmt = r.ar_dyn ? "true" : "false";
+		if (r.ar_ntimes == 0 || r.ar_time[0] == -1) {
+			(void) snprintf(time_fmt, sizeof (time_fmt), "N/A");
+		} else {
+			res_fmt_time(time_fmt, sizeof (time_fmt),
+			    r.ar_time[0]);
+		}
+		dur = r.ar_dur * (r.ar_ntimes ? r.ar_ntimes : 1);
+		res_fmt_dur(dur_fmt, sizeof (dur_fmt), dur);
+		act_rec_free(&r);
+	}
+
+	if (fc->fc_cnt == 0) {
+		printf("%-20s %4s %6s %7s %7s\n",
+			"WHEN", "KIND", "DYN", "TIME", "DUR");
+	}
+	printf("%-20s %4s %6s %7s %7s\n", when,
+	    (kind == NM_TODO) ? "todo" : "act", dyn_fmt, time_fmt, dur_fmt);
+	fc->fc_cnt++;
+}
+
+/*
+ * Only dates from `from` to `to` are printed; weekdays and the general todo
+ * list always are. Returns the number of occurrences printed.
+ */
+int
+find_name(char *n, scope_t from, scope_t to)
+{
+	find_ctx_t fc;
+
+	if (realloc_defer) {
+		resched_all();
+	}
+
+	fc.fc_name = n;
+	fc.fc_cnt = 0;
+	names_walk(n, from, to, find_print, &fc);
+	if (fc.fc_cnt == 0) {
+		printf("Nothing is called \"%s\".\n", n);
+	}
+	return (fc.fc_cnt);
+}
+
+/*
+ * Conflicts. Static activities are put where they're asked to be, so two of
+ * them can overlap, and it only comes out when placing the day fails. So we
+ * put the static chunks of a day into an interval tree, along with the
+ * previous day's (a span back, so that only what runs past midnight lands in
+ * the day), and, when a new time is being checked, the next day's (in the
+ * second span, as pd_fence has them). The tree finds each overlapping pair
+ * directly, rather than failing on the first one.
+ *
+ * A pair that spans midnight is found while listing the later day, but it's
+ * printed as the earlier day's, with the later time past 24:00, the way the
+ * earlier day's placement sees it.
+ */
+#define	CF_PREV		0x1
+#define	CF_NEXT		0x2
+
+typedef struct cf_ent {
+	uint32_t	ce_name;	/* its id in cl_names */
+	int		ce_off;		/* its day's start, in this day */
+} cf_ent_t;
+
+typedef struct cf_load {
+	scope_t		cl_scope;	/* the day being walked */
+	int		cl_off;
+	char		*cl_skip;	/* an activity in this day to leave out */
+	ival_t		*cl_ivs;
+	cf_ent_t	*cl_ents;	/* by iv_id */
+	size_t		cl_n;
+	size_t		cl_max;
+	intern_t	cl_names;
+	char		*cl_when;
+	char		*cl_prev_when;
+	int		cl_spill_only;	/* only list what spans midnight */
+	size_t		cl_cnt;
+} cf_load_t;
+
+static void
+cf_load_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	cf_load_t *cl = arg;
+	act_ov_t *ov = ov_find(cl->cl_scope, n);
+	uint32_t id;
+	size_t i;
+	int start;
+	int end;
+
+	if (ov != NULL) {
+		act_rec_free(r);
+		rec_copy(r, &ov->ov_rec);
+	}
+	if (r->ar_dyn || r->ar_dur == 0 || (cl->cl_off == 0 &&
+	    cl->cl_skip != NULL && strcmp(n, cl->cl_skip) == 0)) {
+		act_rec_free(r);
+		return;
+	}
+
+	id = intern(&cl->cl_names, n, strlen(n));
+	for (i = 0; i < r->ar_ntimes; i++) {
+		if (r->ar_time[i] < 0) {
+			continue;
+		}
+		start = r->ar_time[i] + cl->cl_off;
+		end = start + r->ar_dur;
+		if (end <= 0) {
+			continue;
+		}
+		if (cl->cl_n == cl->cl_max) {
+			size_t nmax = cl->cl_max ? cl->cl_max * 2 : PD_MINACTS;
+			cl->cl_ivs = pd_grow(cl->cl_ivs, sizeof (ival_t),
+			    cl->cl_n, cl->cl_max, nmax);
+			cl->cl_ents = pd_grow(cl->cl_ents, sizeof (cf_ent_t),
+			    cl->cl_n, cl->cl_max, nmax);
+			cl->cl_max = nmax;
+		}
+		cl->cl_ivs[cl->cl_n].iv_start = start;
+		cl->cl_ivs[cl->cl_n].iv_end = end;
+		cl->cl_ivs[cl->cl_n].iv_id = cl->cl_n;
+		cl->cl_ents[cl->cl_n].ce_name = id;
+		cl->cl_ents[cl->cl_n].ce_off = cl->cl_off;
+		cl->cl_n++;
+	}
+	act_rec_free(r);
+}
+
+/*
+ * Loads the static chunks of `s` (and of the days either side of it that
+ * `flags` asks for) into cl, and builds a tree of them. The days either side
+ * are those of `date`, which is `s`, unless `s` is the weekday that a date the
+ * store doesn't have lists as (and the dates either side of it may exist).
+ */
+static void
+cf_load(cf_load_t *cl, itree_t *it, scope_t s, scope_t date, int flags)
+{
+	cl->cl_n = 0;
+	intern_reset(&cl->cl_names);
+	if (flags & CF_PREV) {
+		cl->cl_scope = scope_step(date, -1);
+		cl->cl_off = -(int)plan_slots;
+		store->ps_act_walk(cl->cl_scope, 0, cf_load_act, cl);
+	}
+	cl->cl_scope = s;
+	cl->cl_off = 0;
+	store->ps_act_walk(s, 0, cf_load_act, cl);
+	if (flags & CF_NEXT) {
+		cl->cl_scope = scope_step(date, 1);
+		cl->cl_off = plan_slots;
+		store->ps_act_walk(cl->cl_scope, 0, cf_load_act, cl);
+	}
+	itree_build(it, cl->cl_ivs, cl->cl_n);
+}
+
+static void
+cf_fini(cf_load_t *cl)
+{
+	if (cl->cl_max != 0) {
+		umem_free(cl->cl_ivs, cl->cl_max * sizeof (ival_t));
+		umem_free(cl->cl_ents, cl->cl_max * sizeof (cf_ent_t));
+	}
+	intern_fini(&cl->cl_names);
+}
+
+/*
+ * Returns 1 if the activity `n`, if it were static at `time`, would overlap
+ * another static activity (in its day, or on either side of it).
+ */
+static int
+time_conflicts(scope_t s, char *n, int time, size_t dur)
+{
+	cf_load_t cl;
+	itree_t it;
+	ival_t q;
+	size_t cnt;
+
+	bzero(&cl, sizeof (cl));
+	cl.cl_skip = n;
+	cf_load(&cl, &it, s, s, CF_PREV | CF_NEXT);
+	q.iv_start = time;
+	q.iv_end = time + dur;
+	cnt = itree_overlaps(&it, &q, NULL, NULL);
+	itree_fini(&it);
+	cf_fini(&cl);
+	return (cnt != 0);
+}
+
+/*
+ * Prints a pair that cf_day found. The earlier of the two starts first, so
+ * if either is the previous day's, it's `a`.
+ */
+static void
+cf_print(void *arg, ival_t *a, ival_t *b)
+{
+	cf_load_t *cl = arg;
+	cf_ent_t *ea = &cl->cl_ents[a->iv_id];
+	cf_ent_t *eb = &cl->cl_ents[b->iv_id];
+	char ta[RES_FMTLEN];
+	char tb[RES_FMTLEN];
+	char *when = cl->cl_when;
+	int off = 0;
+
+	if (eb->ce_off != 0) {
+		return;
+	}
+	if (ea->ce_off != 0) {
+		when = cl->cl_prev_when;
+		off = plan_slots;
+	} else if (cl->cl_spill_only) {
+		return;
+	}
+	if (cl->cl_cnt == 0) {
+		printf("%-16s %-20s %7s %-20s %7s\n", "WHEN", "NAME", "TIME",
+		    "OVERLAPS", "TIME");
+	}
+	res_fmt_time(ta, sizeof (ta), a->iv_start + off);
+	res_fmt_time(tb, sizeof (tb), b->iv_start + off);
+	printf("%-16s %-20s %7s %-20s %7s\n", when,
+	    intern_name(&cl->cl_names, ea->ce_name), ta,
+	    intern_name(&cl->cl_names, eb->ce_name), tb);
+	cl->cl_cnt++;
+}
+
+static void
+cf_when(char *when, size_t len, scope_t date, int dir)
+{
+	tm_t t;
+
+	if (PS_ISDATE(date)) {
+		scope_to_tm(date, &t);
+		t.tm_mday += dir;
+		t.tm_isdst = -1;
+		(void) mktime(&t);
+		(void) strftime(when, len, "%Y-%m-%d (%a)", &t);
+	} else {
+		(void) snprintf(when, len, "%s", daystr[(date + 7 + dir) % 7]);
+	}
+}
+
+/*
+ * Prints the conflicts of `s`, as those of `date` (which is `s`, unless `s`
+ * is the weekday that a date the store doesn't have lists as).
+ */
+static void
+cf_day(cf_load_t *cl, scope_t s, scope_t date, int spill_only)
+{
+	char when[40];
+	char prev_when[40];
+	itree_t it;
+
+	cf_when(when, sizeof (when), date, 0);
+	cf_when(prev_when, sizeof (prev_when), date, -1);
+	cl->cl_when = when;
+	cl->cl_prev_when = prev_when;
+	cl->cl_spill_only = spill_only;
+	cf_load(cl, &it, s, date, CF_PREV);
+	(void) itree_pairs(&it, cf_print, cl);
+	itree_fini(&it);
+}
+
+typedef struct cf_range {
+	cf_load_t	*cr_load;
+	tm_t		cr_tm;		/* the next date */
+	scope_t		cr_next;
+} cf_range_t;
+
+static void
+cf_range_next(cf_range_t *cr, int have)
+{
+	cf_day(cr->cr_load, have ? cr->cr_next : cr->cr_tm.tm_wday,
+	    cr->cr_next, 0);
+	cr->cr_tm.tm_mday++;
+	cr->cr_tm.tm_isdst = -1;
+	(void) mktime(&cr->cr_tm);
+	cr->cr_next = plan_scope(-1, &cr->cr_tm);
+}
+
+static void
+cf_range_cb(void *arg, scope_t s)
+{
+	cf_range_t *cr = arg;
+
+	while (cr->cr_next < s) {
+		cf_range_next(cr, 0);
+	}
+	cf_range_next(cr, 1);
+}
+
+/*
+ * Checks every day and date there is. The day after a date that the store
+ * doesn't have isn't one of them, but what the date carries over past
+ * midnight can still overlap it, so that's checked too.
+ */
+static void
+cf_scope_cb(void *arg, scope_t s)
+{
+	scope_t next;
+	tm_t t;
+
+	if (s == PS_GENERAL) {
+		return;
+	}
+	cf_day(arg, s, s, 0);
+	if (PS_ISDATE(s)) {
+		scope_to_tm(s, &t);
+		t.tm_mday++;
+		t.tm_isdst = -1;
+		(void) mktime(&t);
+		next = plan_scope(-1, &t);
+		if (!store->ps_have(next)) {
+			cf_day(arg, t.tm_wday, next, 1);
+		}
+	}
+}
+
+/*
+ * Lists every pair of static activities that overlap: in a weekday (if `from`
+ * is one), in every date from `from` to `to` (as each of them lists, so a date
+ * the store doesn't have is checked as its weekday), or, if `from` is
+ * PS_GENERAL, in every day and date there is. Returns the number of pairs.
+ */
+int
+list_conflicts(scope_t from, scope_t to)
+{
+	cf_load_t cl;
+	cf_range_t cr;
+
+	if (realloc_defer) {
+		resched_all();
+	}
+
+	bzero(&cl, sizeof (cl));
+	if (from == PS_GENERAL) {
+		store->ps_walk(cf_scope_cb, &cl);
+	} else if (!PS_ISDATE(from)) {
+		cf_day(&cl, from, from, 0);
+	} else {
+		cr.cr_load = &cl;
+		scope_to_tm(from, &cr.cr_tm);
+		cr.cr_next = from;
+		store->ps_range(from, to, cf_range_cb, &cr);
+		while (cr.cr_next <= to) {
+			cf_range_next(&cr, 0);
+		}
+	}
+	if (cl.cl_cnt == 0) {
+		printf("No static activities overlap.\n");
+	}
+	cf_fini(&cl);
+	return (cl.cl_cnt);
+}
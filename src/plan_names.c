@@ -0,0 +1,478 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/avl.h>
+#include "plan_impl.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * The name index. Finding every day and date that has an activity (or todo)
+ * called "gym" would otherwise mean walking every scope in the store. So we
+ * keep an inverted index, from names to the scopes they occur in, which is
+ * updated by create, destroy and rename as they happen.
+ *
+ * The index lives in ~/.plandb/names-<store>.idx (one per backend, since the
+ * backends don't share their data). It starts with a header, followed by a
+ * record for every name that was added to or removed from a scope. Records
+ * are only ever appended (under a lock, since other processes append too),
+ * and the whole file is read into an AVL tree, keyed by name and scope, the
+ * first time a process looks something up. After that, we only read the
+ * records that were appended since. When the dead records outnumber the live
+ * entries, we rewrite the file, and bump the generation in the header so that
+ * other processes know to reread it from the start.
+ *
+ * The index only tells us where a name occurs. The time and duration of a
+ * dynamic activity change whenever its day is rescheduled, so we read those
+ * from the store.
+ *
+ * If the index doesn't exist, nothing is appended to it, and it is built from
+ * the store the first time it's needed.
+ */
+
+#define	NM_MAGIC	"PLANNMI1"
+#define	NM_MAGICLEN	8
+#define	NM_COMPACT	1024
+
+typedef enum nm_op {
+	NM_ADD = 1,
+	NM_DEL
+} nm_op_t;
+
+typedef struct nm_hdr {
+	char		nh_magic[NM_MAGICLEN];
+	uint32_t	nh_gen;
+	uint32_t	nh_pad;
+} nm_hdr_t;
+
+typedef struct nm_rec {
+	uint8_t		nr_op;
+	uint8_t		nr_kind;
+	uint16_t	nr_nlen;
+	int32_t		nr_scope;
+} nm_rec_t;
+
+typedef struct nm_ent {
+	avl_node_t	ne_avl;
+	char		*ne_name;
+	scope_t		ne_scope;
+	nm_kind_t	ne_kind;
+} nm_ent_t;
+
+extern plan_store_t *store;
+extern void atomic_read(int, void*, size_t);
+extern void atomic_write(int, void*, size_t);
+extern void act_rec_free(act_rec_t *);
+
+static int nm_pdb_fd = -1;
+static int nm_fd = -1;
+static char nm_path[32];
+static avl_tree_t nm_tree;
+static int nm_loaded;
+static uint32_t nm_gen;
+static off_t nm_off;		/* how much of the file is in nm_tree */
+static size_t nm_nrecs;		/* how many records are in the file */
+
+static int
+nm_cmp(const void *l, const void *r)
+{
+	const nm_ent_t *el = l;
+	const nm_ent_t *er = r;
+	int c = strcmp(el->ne_name, er->ne_name);
+
+	if (c != 0) {
+		return (c < 0 ? -1 : 1);
+	}
+	if (el->ne_scope != er->ne_scope) {
+		return (el->ne_scope < er->ne_scope ? -1 : 1);
+	}
+	if (el->ne_kind != er->ne_kind) {
+		return (el->ne_kind < er->ne_kind ? -1 : 1);
+	}
+	return (0);
+}
+
+static void
+nm_lock(short type)
+{
+	struct flock fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	(void) fcntl(nm_fd, F_SETLKW, &fl);
+}
+
+static void
+nm_free(nm_ent_t *ne)
+{
+	umem_free(ne->ne_name, strlen(ne->ne_name) + 1);
+	umem_free(ne, sizeof (nm_ent_t));
+}
+
+static void
+nm_clear(void)
+{
+	nm_ent_t *ne;
+	void *cookie = NULL;
+
+	if (!nm_loaded) {
+		return;
+	}
+	while ((ne = avl_destroy_nodes(&nm_tree, &cookie)) != NULL) {
+		nm_free(ne);
+	}
+	avl_destroy(&nm_tree);
+	nm_loaded = 0;
+	nm_nrecs = 0;
+}
+
+static void
+nm_init(void)
+{
+	nm_clear();
+	avl_create(&nm_tree, nm_cmp, sizeof (nm_ent_t),
+	    offsetof(nm_ent_t, ne_avl));
+	nm_loaded = 1;
+}
+
+/*
+ * Applies a record to the in-memory tree.
+ */
+static void
+nm_apply(nm_op_t op, nm_kind_t kind, scope_t s, char *n, size_t nlen)
+{
+	nm_ent_t key;
+	nm_ent_t *ne;
+	avl_index_t where;
+	char *name = umem_zalloc(nlen + 1, UMEM_NOFAIL);
+
+	bcopy(n, name, nlen);
+	key.ne_name = name;
+	key.ne_scope = s;
+	key.ne_kind = kind;
+	ne = avl_find(&nm_tree, &key, &where);
+
+	if (op == NM_ADD && ne == NULL) {
+		ne = umem_alloc(sizeof (nm_ent_t), UMEM_NOFAIL);
+		ne->ne_name = name;
+		ne->ne_scope = s;
+		ne->ne_kind = kind;
+		avl_insert(&nm_tree, ne, where);
+		return;
+	}
+	if (op == NM_DEL && ne != NULL) {
+		avl_remove(&nm_tree, ne);
+		nm_free(ne);
+	}
+	umem_free(name, nlen + 1);
+}
+
+/*
+ * Builds the record for an operation. Returns the length of the buffer,
+ * which the caller frees.
+ */
+static size_t
+nm_pack(char **bufp, nm_op_t op, nm_kind_t kind, scope_t s, char *n)
+{
+	nm_rec_t r;
+	size_t nlen = strlen(n);
+	char *buf = umem_alloc(sizeof (r) + nlen, UMEM_NOFAIL);
+
+	r.nr_op = op;
+	r.nr_kind = kind;
+	r.nr_nlen = nlen;
+	r.nr_scope = s;
+	bcopy(&r, buf, sizeof (r));
+	bcopy(n, buf + sizeof (r), nlen);
+	*bufp = buf;
+	return (sizeof (r) + nlen);
+}
+
+/*
+ * Reads the records from nm_off to the end of the file into the tree.
+ * Called with the lock held. Returns -1 if the file isn't a valid index.
+ */
+static int
+nm_read(void)
+{
+	struct stat st;
+	nm_hdr_t h;
+	nm_rec_t r;
+	char *buf;
+	size_t sz;
+	size_t off = 0;
+
+	if (fstat(nm_fd, &st) != 0 || st.st_size < sizeof (h) ||
+	    pread(nm_fd, &h, sizeof (h), 0) != sizeof (h) ||
+	    bcmp(h.nh_magic, NM_MAGIC, NM_MAGICLEN) != 0) {
+		return (-1);
+	}
+	if (!nm_loaded || h.nh_gen != nm_gen || st.st_size < nm_off) {
+		nm_init();
+		nm_gen = h.nh_gen;
+		nm_off = sizeof (h);
+	}
+	if ((sz = st.st_size - nm_off) == 0) {
+		return (0);
+	}
+
+	buf = umem_alloc(sz, UMEM_NOFAIL);
+	if (pread(nm_fd, buf, sz, nm_off) != sz) {
+		umem_free(buf, sz);
+		return (-1);
+	}
+	while (off + sizeof (r) <= sz) {
+		bcopy(buf + off, &r, sizeof (r));
+		if (off + sizeof (r) + r.nr_nlen > sz) {
+			break;
+		}
+		if ((r.nr_op != NM_ADD && r.nr_op != NM_DEL) ||
+		    (r.nr_kind != NM_ACT && r.nr_kind != NM_TODO)) {
+			umem_free(buf, sz);
+			return (-1);
+		}
+		nm_apply(r.nr_op, r.nr_kind, r.nr_scope, buf + off + sizeof (r),
+		    r.nr_nlen);
+		off += sizeof (r) + r.nr_nlen;
+		nm_nrecs++;
+	}
+	nm_off += off;
+	umem_free(buf, sz);
+	return (0);
+}
+
+/*
+ * Writes out the whole tree, as a fresh file with a new generation. Called
+ * with the write lock held.
+ */
+static void
+nm_write(void)
+{
+	nm_hdr_t h;
+	nm_ent_t *ne;
+	char *buf;
+	char *rec;
+	size_t len = sizeof (h);
+	size_t off;
+	size_t rlen;
+
+	for (ne = avl_first(&nm_tree); ne != NULL; ne = AVL_NEXT(&nm_tree, ne)) {
+		len += sizeof (nm_rec_t) + strlen(ne->ne_name);
+	}
+	buf = umem_alloc(len, UMEM_NOFAIL);
+	bzero(&h, sizeof (h));
+	bcopy(NM_MAGIC, h.nh_magic, NM_MAGICLEN);
+	h.nh_gen = ++nm_gen;
+	bcopy(&h, buf, sizeof (h));
+	off = sizeof (h);
+	nm_nrecs = 0;
+	for (ne = avl_first(&nm_tree); ne != NULL; ne = AVL_NEXT(&nm_tree, ne)) {
+		rlen = nm_pack(&rec, NM_ADD, ne->ne_kind, ne->ne_scope,
+		    ne->ne_name);
+		bcopy(rec, buf + off, rlen);
+		umem_free(rec, rlen);
+		off += rlen;
+		nm_nrecs++;
+	}
+
+	ftruncate(nm_fd, 0);
+	atomic_write(nm_fd, buf, len);
+	fsync(nm_fd);
+	nm_off = len;
+	umem_free(buf, len);
+}
+
+typedef struct nm_build {
+	scope_t		nb_scope;
+} nm_build_t;
+
+/* ARGSUSED */
+static void
+nm_build_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	nm_build_t *nb = arg;
+
+	nm_apply(NM_ADD, NM_ACT, nb->nb_scope, n, strlen(n));
+	act_rec_free(r);
+}
+
+/* ARGSUSED */
+static void
+nm_build_todo(void *arg, char *n, int time, char *det)
+{
+	nm_build_t *nb = arg;
+
+	nm_apply(NM_ADD, NM_TODO, nb->nb_scope, n, strlen(n));
+}
+
+static void
+nm_build_scope(void *arg, scope_t s)
+{
+	nm_build_t nb;
+
+	nb.nb_scope = s;
+	if (s != PS_GENERAL) {
+		store->ps_act_walk(s, 0, nm_build_act, &nb);
+	}
+	store->ps_todo_walk(s, 0, nm_build_todo, &nb);
+}
+
+void
+names_open(int pdb_fd)
+{
+	nm_pdb_fd = pdb_fd;
+	(void) snprintf(nm_path, sizeof (nm_path), "names-%s.idx",
+	    store->ps_name);
+	nm_fd = openat(pdb_fd, nm_path, O_RDWR | O_APPEND);
+}
+
+void
+names_close(void)
+{
+	nm_clear();
+	if (nm_fd != -1) {
+		close(nm_fd);
+		nm_fd = -1;
+	}
+}
+
+/*
+ * Appends records to the index. We don't touch the tree here; the next
+ * lookup reads the records back, along with any that other processes have
+ * appended in the meantime.
+ */
+static void
+nm_append(char *buf, size_t len)
+{
+	if (nm_fd == -1) {
+		return;
+	}
+	nm_lock(F_WRLCK);
+	atomic_write(nm_fd, buf, len);
+	nm_lock(F_UNLCK);
+}
+
+void
+names_add(nm_kind_t kind, scope_t s, char *n)
+{
+	char *buf;
+	size_t len = nm_pack(&buf, NM_ADD, kind, s, n);
+
+	nm_append(buf, len);
+	umem_free(buf, len);
+}
+
+void
+names_del(nm_kind_t kind, scope_t s, char *n)
+{
+	char *buf;
+	size_t len = nm_pack(&buf, NM_DEL, kind, s, n);
+
+	nm_append(buf, len);
+	umem_free(buf, len);
+}
+
+/*
+ * A rename is a removal and an addition, appended together, so that a
+ * reader never sees one without the other.
+ */
+void
+names_rename(nm_kind_t kind, scope_t s, char *old, char *new)
+{
+	char *del;
+	char *add;
+	char *buf;
+	size_t dlen = nm_pack(&del, NM_DEL, kind, s, old);
+	size_t alen = nm_pack(&add, NM_ADD, kind, s, new);
+
+	buf = umem_alloc(dlen + alen, UMEM_NOFAIL);
+	bcopy(del, buf, dlen);
+	bcopy(add, buf + dlen, alen);
+	nm_append(buf, dlen + alen);
+	umem_free(buf, dlen + alen);
+	umem_free(del, dlen);
+	umem_free(add, alen);
+}
+
+/*
+ * Calls `cb` for every scope that `n` occurs in, in order. Dates outside of
+ * [from, to] are skipped; weekdays and the general todo list never are.
+ */
+void
+names_walk(char *n, scope_t from, scope_t to, names_walk_f cb, void *arg)
+{
+	nm_ent_t key;
+	nm_ent_t *ne;
+	avl_index_t where;
+	int err;
+
+	if (nm_fd == -1 && (nm_fd = openat(nm_pdb_fd, nm_path,
+	    O_CREAT | O_RDWR | O_APPEND, ALLRWX)) == -1) {
+		perror(nm_path);
+		return;
+	}
+
+	nm_lock(F_RDLCK);
+	err = nm_read();
+	nm_lock(F_UNLCK);
+
+	/*
+	 * If the index is new (or damaged), we build it from the store, and if
+	 * it's mostly dead records, we compact it.
+	 */
+	if (err != 0 || nm_nrecs > 2 * avl_numnodes(&nm_tree) + NM_COMPACT) {
+		nm_lock(F_WRLCK);
+		if (nm_read() != 0) {
+			nm_init();
+			store->ps_walk(nm_build_scope, NULL);
+		}
+		nm_write();
+		nm_lock(F_UNLCK);
+	}
+
+	key.ne_name = n;
+	key.ne_scope = INT_MIN;
+	key.ne_kind = NM_ACT;
+	if ((ne = avl_find(&nm_tree, &key, &where)) == NULL) {
+		ne = avl_nearest(&nm_tree, where, AVL_AFTER);
+	}
+	for (; ne != NULL && strcmp(ne->ne_name, n) == 0;
+	    ne = AVL_NEXT(&nm_tree, ne)) {
+		if (PS_ISDATE(ne->ne_scope) &&
+		    (ne->ne_scope < from || ne->ne_scope > to)) {
+			continue;
+		}
+		cb(arg, ne->ne_kind, ne->ne_scope);
+	}
+}
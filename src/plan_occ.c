@@ -0,0 +1,336 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <umem.h>
+#include <strings.h>
+#include "plan_impl.h"
+
+/*
+ * A day's occupancy: the slots that its own activities take, and which of
+ * them are static. Placing a single changed activity used to mean reading
+ * every activity of its day (and of the days on either side), to find out
+ * what was already taken. The store now keeps each day's occupancy next to
+ * its activities (see ps_occ_get; the log store only keeps it in memory), so
+ * that the change can be placed into it instead (see resched_fast in
+ * plan_manip.c), at a cost that depends on the length of the day in slots,
+ * and not on how many activities it holds.
+ *
+ * An occupancy only depends on the records in the store, not on the awake
+ * range or the neighbouring days. The stores drop it whenever one of the
+ * day's activities changes, and whatever placed the change puts the new one
+ * back. If there's none (or it was made at another resolution), it's built
+ * again from the records, at the cost of the one walk of the day that it then
+ * saves the next time.
+ */
+
+#define	OCC_WBITS	64
+
+extern size_t plan_slots;
+extern plan_store_t *store;
+extern void act_rec_free(act_rec_t *);
+extern void daymap_claim(daymap_t *, size_t, size_t);
+
+static void
+occ_reset(day_occ_t *o)
+{
+	occ_hdr_t *h = o->do_hdr;
+
+	bzero(o->do_hdr, o->do_size);
+	h->oh_nslots = plan_slots;
+	h->oh_stalo = INT32_MAX;
+	h->oh_stahi = INT32_MIN;
+	h->oh_dynlo = INT32_MAX;
+	h->oh_dynhi = INT32_MIN;
+}
+
+/*
+ * Sets up an empty occupancy, for a day of plan_slots slots.
+ */
+void
+occ_init(day_occ_t *o)
+{
+	o->do_nwords = (PD_SPANS * plan_slots + OCC_WBITS - 1) / OCC_WBITS;
+	o->do_size = sizeof (occ_hdr_t) + 2 * o->do_nwords * sizeof (uint64_t);
+	o->do_hdr = umem_alloc(o->do_size, UMEM_NOFAIL);
+	o->do_all = (uint64_t *)(o->do_hdr + 1);
+	o->do_sta = o->do_all + o->do_nwords;
+	occ_reset(o);
+}
+
+void
+occ_fini(day_occ_t *o)
+{
+	umem_free(o->do_hdr, o->do_size);
+	o->do_hdr = NULL;
+}
+
+/*
+ * Sets (or clears) the bits of the slots from `start` on, for `len` slots,
+ * as far as the end of the map.
+ */
+static void
+occ_fill(uint64_t *map, size_t start, size_t len, int set)
+{
+	size_t end = start + len;
+	size_t w;
+	uint64_t m;
+
+	if (end > PD_SPANS * plan_slots) {
+		end = PD_SPANS * plan_slots;
+	}
+	while (start < end) {
+		w = start / OCC_WBITS;
+		m = ~(uint64_t)0 << (start % OCC_WBITS);
+		if (end < (w + 1) * OCC_WBITS) {
+			m &= ~(~(uint64_t)0 << (end % OCC_WBITS));
+		}
+		if (set) {
+			map[w] |= m;
+		} else {
+			map[w] &= ~m;
+		}
+		start = (w + 1) * OCC_WBITS;
+	}
+}
+
+/*
+ * Adds a chunk that starts at `time` (or -1), and takes `dur` slots, to the
+ * occupancy. A dynamic chunk with no duration takes nothing, and goes
+ * nowhere, but a static one still has to be within the day's bounds.
+ */
+void
+occ_add(day_occ_t *o, int time, size_t dur, int dyn)
+{
+	occ_hdr_t *h = o->do_hdr;
+	int end = time + (int)dur;
+
+	if (dyn && dur == 0) {
+		return;
+	}
+	if (!dyn) {
+		h->oh_stalo = MIN(h->oh_stalo, time);
+		h->oh_stahi = MAX(h->oh_stahi, end);
+	}
+	if (time < 0) {
+		h->oh_unplaced += dyn;
+		return;
+	}
+	if (dur == 0) {
+		return;
+	}
+	if (dyn) {
+		h->oh_dynlo = MIN(h->oh_dynlo, time);
+		h->oh_dynhi = MAX(h->oh_dynhi, end);
+	}
+	h->oh_busy += dur;
+	h->oh_over += (end > PD_SPANS * plan_slots);
+	occ_fill(o->do_all, time, dur, 1);
+	if (!dyn) {
+		occ_fill(o->do_sta, time, dur, 1);
+	}
+}
+
+/*
+ * Takes a chunk that occ_add added back out. The bounds stay as they are,
+ * so they may be wider than they need to be, but never narrower.
+ */
+void
+occ_del(day_occ_t *o, int time, size_t dur, int dyn)
+{
+	occ_hdr_t *h = o->do_hdr;
+
+	if (dur == 0) {
+		return;
+	}
+	if (time < 0) {
+		h->oh_unplaced -= dyn;
+		return;
+	}
+	h->oh_busy -= dur;
+	h->oh_over -= (time + dur > PD_SPANS * plan_slots);
+	occ_fill(o->do_all, time, dur, 0);
+	if (!dyn) {
+		occ_fill(o->do_sta, time, dur, 0);
+	}
+}
+
+static void
+occ_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	day_occ_t *o = arg;
+	size_t nc = r->ar_ntimes ? r->ar_ntimes : 1;
+	size_t c = 0;
+
+	while (c < nc) {
+		occ_add(o, r->ar_ntimes ? r->ar_time[c] : -1, r->ar_dur,
+		    r->ar_dyn);
+		c++;
+	}
+	act_rec_free(r);
+}
+
+/*
+ * Reads the occupancy of day `s` from the store, or, if the store hasn't
+ * got one that fits, builds it from the day's records and stores that.
+ */
+void
+occ_read(day_occ_t *o, scope_t s)
+{
+	if (store->ps_occ_get(s, o->do_hdr, o->do_size) == 0 &&
+	    o->do_hdr->oh_nslots == plan_slots) {
+		return;
+	}
+	occ_reset(o);
+	store->ps_act_walk(s, 0, occ_act, o);
+	store->ps_occ_put(s, o->do_hdr, o->do_size);
+}
+
+void
+occ_write(day_occ_t *o, scope_t s)
+{
+	store->ps_occ_put(s, o->do_hdr, o->do_size);
+}
+
+/*
+ * Returns the number of slots taken.
+ */
+static size_t
+occ_count(uint64_t *map, size_t nwords)
+{
+	size_t n = 0;
+	size_t w;
+
+	for (w = 0; w < nwords; w++) {
+		n += __builtin_popcountll(map[w]);
+	}
+	return (n);
+}
+
+/*
+ * Returns 1 if every chunk of the day is placed, within the bounds that an
+ * awake range from `base`, for `off` slots, sets (see act_set_bounds), and
+ * no two chunks overlap. Placing the day again would leave such chunks where
+ * they are, if nothing else moved.
+ */
+int
+occ_fits(day_occ_t *o, size_t base, size_t off)
+{
+	occ_hdr_t *h = o->do_hdr;
+	int end = base + off;
+	int send = (end >= (int)plan_slots) ? PD_SPANS * plan_slots : end;
+
+	if (h->oh_unplaced != 0 || h->oh_over != 0 ||
+	    h->oh_busy != occ_count(o->do_all, o->do_nwords)) {
+		return (0);
+	}
+	if (h->oh_stalo <= h->oh_stahi &&
+	    (h->oh_stalo < (int)base || h->oh_stahi > send)) {
+		return (0);
+	}
+	if (h->oh_dynlo <= h->oh_dynhi &&
+	    (h->oh_dynlo < (int)base || h->oh_dynhi > end)) {
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Returns how far the day runs past midnight (see scope_spill), or -1 if
+ * that can't be told from its map, because a chunk runs off the end of it.
+ */
+int
+occ_spill(day_occ_t *o)
+{
+	size_t w = o->do_nwords;
+	size_t end;
+
+	if (o->do_hdr->oh_over != 0) {
+		return (-1);
+	}
+	while (w > 0 && o->do_all[w - 1] == 0) {
+		w--;
+	}
+	if (w == 0) {
+		return (0);
+	}
+	end = w * OCC_WBITS - __builtin_clzll(o->do_all[w - 1]);
+	return (end > plan_slots ? end - plan_slots : 0);
+}
+
+/*
+ * Claims the runs of set bits in `map`, from slot `from` up to `to`, in the
+ * daymap, `at - from` slots further along.
+ */
+void
+occ_claim(uint64_t *map, size_t from, size_t to, daymap_t *dm, size_t at)
+{
+	size_t w = from / OCC_WBITS;
+	size_t start;
+	uint64_t bits = map[w] & (~(uint64_t)0 << (from % OCC_WBITS));
+	uint64_t m;
+
+	for (;;) {
+		while (bits == 0) {
+			if (++w * OCC_WBITS >= to) {
+				return;
+			}
+			bits = map[w];
+		}
+		start = w * OCC_WBITS + __builtin_ctzll(bits);
+		if (start >= to) {
+			return;
+		}
+		/*
+		 * Then the next clear bit after it, which ends the run.
+		 */
+		m = ~map[w] & (~(uint64_t)0 << (start % OCC_WBITS));
+		while (m == 0 && (w + 1) * OCC_WBITS < to) {
+			m = ~map[++w];
+		}
+		bits = (m == 0) ? 0 : map[w] & (~(uint64_t)0 <<
+		    (__builtin_ctzll(m)));
+		m = (m == 0) ? (w + 1) * OCC_WBITS :
+		    w * OCC_WBITS + __builtin_ctzll(m);
+		daymap_claim(dm, at + start - from, MIN(m, to) - start);
+	}
+}
+
+/*
+ * Returns 1 if any of the slots the day's chunks take is taken in the
+ * daymap (which spans the same PD_SPANS days).
+ */
+int
+occ_clashes(day_occ_t *o, daymap_t *dm)
+{
+	size_t w;
+
+	for (w = 0; w < o->do_nwords; w++) {
+		if (o->do_all[w] & ~dm->dm_free[w]) {
+			return (1);
+		}
+	}
+	return (0);
+}
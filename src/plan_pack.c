@@ -0,0 +1,413 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include "plan_impl.h"
+#include "plan_probes.h"
+
+/*
+ * Packing the dynamic activities of a day. place_acts() puts them in one at
+ * a time, each into the gap that fits it best, in the order they were read
+ * from the store. That's quick, and it's nearly always good enough, but it
+ * never revisits a choice: a short activity can take the only gap a long one
+ * would have fit in, and the day fails to schedule even though another order
+ * would have fit everything.
+ *
+ * So with PLAN_SCHED=pack in the environment, a day that fails that way is
+ * handed to pack_acts(), which treats the dynamic activities as a packing
+ * problem. They're placed largest first (the small ones fit in whatever is
+ * left over), and each is tried in the few gaps that fit it best, flush with
+ * either end of the gap, backtracking when a later one doesn't fit anywhere.
+ * The search gives up on a branch as soon as the free time that's still
+ * usable (in gaps at least as long as the shortest activity left) is less
+ * than the time the activities left need. Chunks of the same activity are
+ * interchangeable, so each is only tried after the one before it, which
+ * keeps the search from trying every order of them.
+ *
+ * The search is depth-first, with an explicit stack, and bounded: at most
+ * PK_BRANCH places are tried for each activity, and it stops after
+ * PK_BUDGET of wall time. If it runs out, or there's no arrangement, the
+ * day is left as place_acts() had it (and fails, as it would have).
+ */
+
+int plan_sched = SCHED_BESTFIT;
+
+#define	PK_BRANCH	8
+#define	PK_BUDGET	(NANOSEC / 20)
+#define	PK_CHECK	256
+
+extern void daymap_free(daymap_t *, size_t, size_t);
+extern void daymap_claim(daymap_t *, size_t, size_t);
+extern int daymap_run(daymap_t *, size_t, size_t, size_t *, size_t *);
+
+typedef struct pk_ent {
+	size_t		pe_dur;
+	size_t		pe_idx;		/* its chunk in pd */
+	size_t		pe_min;
+	size_t		pe_max;		/* clipped to the daymap */
+} pk_ent_t;
+
+/*
+ * The places an activity can go, best first, and which of them is next.
+ */
+typedef struct pk_level {
+	size_t		pl_pos[PK_BRANCH];
+	size_t		pl_fit[PK_BRANCH];
+	char		pl_any[PK_BRANCH];
+	int		pl_n;
+	int		pl_next;
+} pk_level_t;
+
+typedef struct pack {
+	daymap_t	*pk_map;
+	pk_ent_t	*pk_ents;
+	size_t		pk_n;
+	size_t		*pk_rest;	/* pk_rest[i] is the sum of i..n-1 */
+	size_t		pk_lo;		/* all of the windows, together */
+	size_t		pk_hi;
+	size_t		pk_ilo;		/* what all of the windows share */
+	size_t		pk_ihi;
+} pack_t;
+
+int
+pack_select(const char *name)
+{
+	if (name == NULL || strcmp(name, "bestfit") == 0) {
+		plan_sched = SCHED_BESTFIT;
+		return (0);
+	}
+	if (strcmp(name, "pack") == 0) {
+		plan_sched = SCHED_PACK;
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * Largest first. Of the same size, the ones with the least room go first,
+ * and beyond that the order of the day's chunks is kept, so the outcome doesn't
+ * depend on qsort.
+ */
+static int
+pk_cmp(const void *l, const void *r)
+{
+	const pk_ent_t *a = l;
+	const pk_ent_t *b = r;
+	size_t aw = a->pe_max - a->pe_min;
+	size_t bw = b->pe_max - b->pe_min;
+
+	if (a->pe_dur != b->pe_dur) {
+		return (a->pe_dur > b->pe_dur ? -1 : 1);
+	}
+	if (aw != bw) {
+		return (aw < bw ? -1 : 1);
+	}
+	return (a->pe_idx < b->pe_idx ? -1 : 1);
+}
+
+static int
+pk_same(pk_ent_t *a, pk_ent_t *b)
+{
+	return (a->pe_dur == b->pe_dur &&
+	    a->pe_min == b->pe_min && a->pe_max == b->pe_max);
+}
+
+/*
+ * Adds a place to the level, keeping the PK_BRANCH best (tightest) ones in
+ * order. A gap that every activity's window takes in whole (`any`) is as
+ * good as any other such gap of the same size, wherever in it the activity
+ * goes, so only one of those is kept.
+ */
+static void
+pk_cand(pk_level_t *pl, size_t pos, size_t fit, int any)
+{
+	int i;
+
+	for (i = 0; i < pl->pl_n; i++) {
+		if (pl->pl_pos[i] == pos ||
+		    (any && pl->pl_any[i] && pl->pl_fit[i] == fit)) {
+			return;
+		}
+	}
+	i = pl->pl_n;
+	if (i == PK_BRANCH) {
+		if (fit >= pl->pl_fit[i - 1]) {
+			return;
+		}
+		i--;
+	} else {
+		pl->pl_n++;
+	}
+	while (i > 0 && pl->pl_fit[i - 1] > fit) {
+		pl->pl_pos[i] = pl->pl_pos[i - 1];
+		pl->pl_fit[i] = pl->pl_fit[i - 1];
+		pl->pl_any[i] = pl->pl_any[i - 1];
+		i--;
+	}
+	pl->pl_pos[i] = pos;
+	pl->pl_fit[i] = fit;
+	pl->pl_any[i] = any;
+}
+
+/*
+ * Fills in the places that ents[i] can go, given what's been placed so far.
+ * `after` is where the previous chunk of the same activity went (or 0), and
+ * this one goes further along.
+ */
+static void
+pk_level(pack_t *pk, size_t i, pk_level_t *pl, size_t after)
+{
+	pk_ent_t *pe = &pk->pk_ents[i];
+	size_t len = pe->pe_dur;
+	size_t pos = (after > pe->pe_min ? after : pe->pe_min);
+	size_t start;
+	size_t end;
+	int any;
+
+	pl->pl_n = 0;
+	pl->pl_next = 0;
+	while (daymap_run(pk->pk_map, pos, pe->pe_max, &start, &end) == 0) {
+		if (end - start >= len) {
+			/*
+			 * A run that starts at `pos` may have started before
+			 * it, so only runs past it are known to be whole.
+			 */
+			any = (start > pos && start > pk->pk_ilo &&
+			    end < pk->pk_ihi);
+			pk_cand(pl, start, end - start, any);
+			pk_cand(pl, end - len, end - start, any);
+		}
+		pos = end;
+	}
+}
+
+/*
+ * Returns the free time between pk_lo and pk_hi that is in gaps of at least
+ * `len` slots.
+ */
+static size_t
+pk_usable(pack_t *pk, size_t len)
+{
+	size_t pos = pk->pk_lo;
+	size_t sum = 0;
+	size_t start;
+	size_t end;
+
+	while (daymap_run(pk->pk_map, pos, pk->pk_hi, &start, &end) == 0) {
+		if (end - start >= len) {
+			sum += end - start;
+		}
+		pos = end;
+	}
+	return (sum);
+}
+
+/*
+ * The search itself. Returns 0, with every activity placed in the daymap,
+ * if it found an arrangement, and -1 (with none of them placed) if it didn't.
+ */
+static int
+pk_search(pack_t *pk, size_t *loc, size_t *nodes)
+{
+	pk_level_t *pl;
+	size_t n = pk->pk_n;
+	size_t min = pk->pk_ents[n - 1].pe_dur;
+	size_t after;
+	size_t i = 0;
+	hrtime_t deadline = gethrtime() + PK_BUDGET;
+	int r = -1;
+
+	pl = umem_alloc(sizeof (pk_level_t) * n, UMEM_NOFAIL);
+	pk_level(pk, 0, &pl[0], 0);
+	for (;;) {
+		if (pl[i].pl_next == pl[i].pl_n) {
+			/*
+			 * Nowhere left to put this one, so go back and move
+			 * the one before it.
+			 */
+			if (i == 0) {
+				break;
+			}
+			i--;
+			daymap_free(pk->pk_map, loc[i],
+			    pk->pk_ents[i].pe_dur);
+			continue;
+		}
+
+		loc[i] = pl[i].pl_pos[pl[i].pl_next++];
+		daymap_claim(pk->pk_map, loc[i], pk->pk_ents[i].pe_dur);
+		if (++i == n) {
+			r = 0;
+			break;
+		}
+
+		if ((++*nodes % PK_CHECK) == 0 && gethrtime() > deadline) {
+			i--;
+			daymap_free(pk->pk_map, loc[i],
+			    pk->pk_ents[i].pe_dur);
+			break;
+		}
+
+		if (pk_usable(pk, min) < pk->pk_rest[i]) {
+			i--;
+			daymap_free(pk->pk_map, loc[i],
+			    pk->pk_ents[i].pe_dur);
+			continue;
+		}
+		after = (pk_same(&pk->pk_ents[i], &pk->pk_ents[i - 1]) ?
+		    loc[i - 1] + 1 : 0);
+		pk_level(pk, i, &pl[i], after);
+	}
+
+	/*
+	 * On the way out without an arrangement, everything placed so far is
+	 * taken back out.
+	 */
+	if (r != 0) {
+		while (i > 0) {
+			i--;
+			daymap_free(pk->pk_map, loc[i],
+			    pk->pk_ents[i].pe_dur);
+		}
+	}
+	umem_free(pl, sizeof (pk_level_t) * n);
+	return (r);
+}
+
+/*
+ * Tries to place every dynamic activity in pd, which place_acts() has already
+ * been through (so the static activities are in the daymap, as are the
+ * dynamic ones that fit). Returns 0 if they all fit, with pd_loc and
+ * pd_time set. Otherwise it returns -1, and pd is as it was.
+ */
+int
+pack_acts(plan_day_t *pd)
+{
+	pack_t pk;
+	size_t *loc;
+	size_t nodes = 0;
+	size_t i;
+	size_t j;
+	size_t n = 0;
+	int r;
+
+	for (i = 0; i < pd->pd_elems; i++) {
+		if (pd->pd_dur[i] == 0) {
+			continue;
+		}
+		/*
+		 * No ordering of the dynamic activities will help with a
+		 * static one that doesn't fit. The chunks of an activity with
+		 * constraints are left where they are, like the static ones
+		 * (they have to be placed together, see place_chunks()).
+		 */
+		if ((!PD_DYN(pd, i) || PD_CHAINED(pd, i)) &&
+		    pd->pd_loc[i] == -1) {
+			return (-1);
+		}
+		if (PD_DYN(pd, i) && !PD_CHAINED(pd, i)) {
+			n++;
+		}
+	}
+	if (n == 0) {
+		return (-1);
+	}
+
+	pk.pk_map = pd->pd_map;
+	pk.pk_n = n;
+	pk.pk_ents = umem_alloc(sizeof (pk_ent_t) * n, UMEM_NOFAIL);
+	pk.pk_rest = umem_alloc(sizeof (size_t) * (n + 1), UMEM_NOFAIL);
+	loc = umem_alloc(sizeof (size_t) * n, UMEM_NOFAIL);
+	pk.pk_lo = pd->pd_map->dm_nslots;
+	pk.pk_hi = 0;
+	pk.pk_ilo = 0;
+	pk.pk_ihi = pd->pd_map->dm_nslots;
+
+	/*
+	 * Take the dynamic activities back out of the daymap, and sort them.
+	 */
+	n = 0;
+	for (i = 0; i < pd->pd_elems; i++) {
+		if (!PD_DYN(pd, i) || PD_CHAINED(pd, i) || pd->pd_dur[i] == 0) {
+			continue;
+		}
+		if (pd->pd_loc[i] != -1) {
+			daymap_free(pd->pd_map, pd->pd_loc[i], pd->pd_dur[i]);
+		}
+		pk.pk_ents[n].pe_dur = pd->pd_dur[i];
+		pk.pk_ents[n].pe_idx = i;
+		pk.pk_ents[n].pe_min = pd->pd_min[i];
+		pk.pk_ents[n].pe_max = (pd->pd_max[i] < pd->pd_map->dm_nslots ?
+		    pd->pd_max[i] : pd->pd_map->dm_nslots);
+		if (pk.pk_ents[n].pe_min < pk.pk_lo) {
+			pk.pk_lo = pk.pk_ents[n].pe_min;
+		}
+		if (pk.pk_ents[n].pe_max > pk.pk_hi) {
+			pk.pk_hi = pk.pk_ents[n].pe_max;
+		}
+		if (pk.pk_ents[n].pe_min > pk.pk_ilo) {
+			pk.pk_ilo = pk.pk_ents[n].pe_min;
+		}
+		if (pk.pk_ents[n].pe_max < pk.pk_ihi) {
+			pk.pk_ihi = pk.pk_ents[n].pe_max;
+		}
+		n++;
+	}
+	qsort(pk.pk_ents, n, sizeof (pk_ent_t), pk_cmp);
+	pk.pk_rest[n] = 0;
+	for (i = n; i > 0; i--) {
+		pk.pk_rest[i - 1] = pk.pk_rest[i] + pk.pk_ents[i - 1].pe_dur;
+	}
+
+	if (pk_usable(&pk, pk.pk_ents[n - 1].pe_dur) < pk.pk_rest[0]) {
+		r = -1;
+	} else {
+		r = pk_search(&pk, loc, &nodes);
+	}
+	PLAN_PACK_DONE(r, n, nodes);
+
+	/*
+	 * Either the new arrangement goes in, or the old one goes back.
+	 */
+	for (i = 0; i < n; i++) {
+		j = pk.pk_ents[i].pe_idx;
+		if (r == 0) {
+			pd->pd_loc[j] = loc[i];
+			pd->pd_time[j] = loc[i];
+		} else if (pd->pd_loc[j] != -1) {
+			daymap_claim(pd->pd_map, pd->pd_loc[j], pd->pd_dur[j]);
+		}
+	}
+
+	umem_free(loc, sizeof (size_t) * n);
+	umem_free(pk.pk_rest, sizeof (size_t) * (n + 1));
+	umem_free(pk.pk_ents, sizeof (pk_ent_t) * n);
+	return (r);
+}
@@ -58,6 +58,42 @@ extern "C" {
 #define	PLAN_COMMIT_ACTS_LOOP_ENABLED() \
 	__dtraceenabled_plan___commit_acts_loop(0)
 #endif
+#define	PLAN_DAYMAP_ALLOC(arg0, arg1, arg2, arg3) \
+	__dtrace_plan___daymap_alloc(arg0, arg1, arg2, arg3)
+#ifndef	__sparc
+#define	PLAN_DAYMAP_ALLOC_ENABLED() \
+	__dtraceenabled_plan___daymap_alloc()
+#else
+#define	PLAN_DAYMAP_ALLOC_ENABLED() \
+	__dtraceenabled_plan___daymap_alloc(0)
+#endif
+#define	PLAN_DAYMAP_CREATE(arg0) \
+	__dtrace_plan___daymap_create(arg0)
+#ifndef	__sparc
+#define	PLAN_DAYMAP_CREATE_ENABLED() \
+	__dtraceenabled_plan___daymap_create()
+#else
+#define	PLAN_DAYMAP_CREATE_ENABLED() \
+	__dtraceenabled_plan___daymap_create(0)
+#endif
+#define	PLAN_DCACHE_HIT(arg0, arg1) \
+	__dtrace_plan___dcache_hit(arg0, arg1)
+#ifndef	__sparc
+#define	PLAN_DCACHE_HIT_ENABLED() \
+	__dtraceenabled_plan___dcache_hit()
+#else
+#define	PLAN_DCACHE_HIT_ENABLED() \
+	__dtraceenabled_plan___dcache_hit(0)
+#endif
+#define	PLAN_DCACHE_MISS(arg0, arg1) \
+	__dtrace_plan___dcache_miss(arg0, arg1)
+#ifndef	__sparc
+#define	PLAN_DCACHE_MISS_ENABLED() \
+	__dtraceenabled_plan___dcache_miss()
+#else
+#define	PLAN_DCACHE_MISS_ENABLED() \
+	__dtraceenabled_plan___dcache_miss(0)
+#endif
 #define	PLAN_DO_DUR(arg0, arg1) \
 	__dtrace_plan___do_dur(arg0, arg1)
 #ifndef	__sparc
@@ -85,6 +121,15 @@ extern "C" {
 #define	PLAN_NTIMES_ENABLED() \
 	__dtraceenabled_plan___ntimes(0)
 #endif
+#define	PLAN_PACK_DONE(arg0, arg1, arg2) \
+	__dtrace_plan___pack_done(arg0, arg1, arg2)
+#ifndef	__sparc
+#define	PLAN_PACK_DONE_ENABLED() \
+	__dtraceenabled_plan___pack_done()
+#else
+#define	PLAN_PACK_DONE_ENABLED() \
+	__dtraceenabled_plan___pack_done(0)
+#endif
 #define	PLAN_PARSE_DUR(arg0) \
 	__dtrace_plan___parse_dur(arg0)
 #ifndef	__sparc
@@ -139,24 +184,6 @@ extern "C" {
 #define	PLAN_SET_DUR_ENABLED() \
 	__dtraceenabled_plan___set_dur(0)
 #endif
-#define	PLAN_VMEM_CREATE(arg0) \
-	__dtrace_plan___vmem_create(arg0)
-#ifndef	__sparc
-#define	PLAN_VMEM_CREATE_ENABLED() \
-	__dtraceenabled_plan___vmem_create()
-#else
-#define	PLAN_VMEM_CREATE_ENABLED() \
-	__dtraceenabled_plan___vmem_create(0)
-#endif
-#define	PLAN_VMEM_XALLOC(arg0, arg1, arg2, arg3) \
-	__dtrace_plan___vmem_xalloc(arg0, arg1, arg2, arg3)
-#ifndef	__sparc
-#define	PLAN_VMEM_XALLOC_ENABLED() \
-	__dtraceenabled_plan___vmem_xalloc()
-#else
-#define	PLAN_VMEM_XALLOC_ENABLED() \
-	__dtraceenabled_plan___vmem_xalloc(0)
-#endif
 
 
 extern void __dtrace_plan___act_ptr(void *);
@@ -189,6 +216,30 @@ extern int __dtraceenabled_plan___commit_acts_loop(void);
 #else
 extern int __dtraceenabled_plan___commit_acts_loop(long);
 #endif
+extern void __dtrace_plan___daymap_alloc(int, size_t, size_t, size_t);
+#ifndef	__sparc
+extern int __dtraceenabled_plan___daymap_alloc(void);
+#else
+extern int __dtraceenabled_plan___daymap_alloc(long);
+#endif
+extern void __dtrace_plan___daymap_create(void *);
+#ifndef	__sparc
+extern int __dtraceenabled_plan___daymap_create(void);
+#else
+extern int __dtraceenabled_plan___daymap_create(long);
+#endif
+extern void __dtrace_plan___dcache_hit(int, int);
+#ifndef	__sparc
+extern int __dtraceenabled_plan___dcache_hit(void);
+#else
+extern int __dtraceenabled_plan___dcache_hit(long);
+#endif
+extern void __dtrace_plan___dcache_miss(int, int);
+#ifndef	__sparc
+extern int __dtraceenabled_plan___dcache_miss(void);
+#else
+extern int __dtraceenabled_plan___dcache_miss(long);
+#endif
 extern void __dtrace_plan___do_dur(void *, size_t);
 #ifndef	__sparc
 extern int __dtraceenabled_plan___do_dur(void);
@@ -207,6 +258,12 @@ extern int __dtraceenabled_plan___ntimes(void);
 #else
 extern int __dtraceenabled_plan___ntimes(long);
 #endif
+extern void __dtrace_plan___pack_done(int, size_t, size_t);
+#ifndef	__sparc
+extern int __dtraceenabled_plan___pack_done(void);
+#else
+extern int __dtraceenabled_plan___pack_done(long);
+#endif
 extern void __dtrace_plan___parse_dur(size_t);
 #ifndef	__sparc
 extern int __dtraceenabled_plan___parse_dur(void);
@@ -243,18 +300,6 @@ extern int __dtraceenabled_plan___set_dur(void);
 #else
 extern int __dtraceenabled_plan___set_dur(long);
 #endif
-extern void __dtrace_plan___vmem_create(void *);
-#ifndef	__sparc
-extern int __dtraceenabled_plan___vmem_create(void);
-#else
-extern int __dtraceenabled_plan___vmem_create(long);
-#endif
-extern void __dtrace_plan___vmem_xalloc(void *, size_t, void *, void *);
-#ifndef	__sparc
-extern int __dtraceenabled_plan___vmem_xalloc(void);
-#else
-extern int __dtraceenabled_plan___vmem_xalloc(long);
-#endif
 
 #else
 
@@ -268,12 +313,22 @@ extern int __dtraceenabled_plan___vmem_xalloc(long);
 #define	PLAN_COMMIT_ACT_ENABLED() (0)
 #define	PLAN_COMMIT_ACTS_LOOP(arg0)
 #define	PLAN_COMMIT_ACTS_LOOP_ENABLED() (0)
+#define	PLAN_DAYMAP_ALLOC(arg0, arg1, arg2, arg3)
+#define	PLAN_DAYMAP_ALLOC_ENABLED() (0)
+#define	PLAN_DAYMAP_CREATE(arg0)
+#define	PLAN_DAYMAP_CREATE_ENABLED() (0)
+#define	PLAN_DCACHE_HIT(arg0, arg1)
+#define	PLAN_DCACHE_HIT_ENABLED() (0)
+#define	PLAN_DCACHE_MISS(arg0, arg1)
+#define	PLAN_DCACHE_MISS_ENABLED() (0)
 #define	PLAN_DO_DUR(arg0, arg1)
 #define	PLAN_DO_DUR_ENABLED() (0)
 #define	PLAN_GOT_HERE(arg0)
 #define	PLAN_GOT_HERE_ENABLED() (0)
 #define	PLAN_NTIMES(arg0)
 #define	PLAN_NTIMES_ENABLED() (0)
+#define	PLAN_PACK_DONE(arg0, arg1, arg2)
+#define	PLAN_PACK_DONE_ENABLED() (0)
 #define	PLAN_PARSE_DUR(arg0)
 #define	PLAN_PARSE_DUR_ENABLED() (0)
 #define	PLAN_PRECOMMIT_DUR(arg0, arg1)
@@ -286,10 +341,6 @@ extern int __dtraceenabled_plan___vmem_xalloc(long);
 #define	PLAN_REALLOC_LOOP_ENABLED() (0)
 #define	PLAN_SET_DUR(arg0, arg1, arg2)
 #define	PLAN_SET_DUR_ENABLED() (0)
-#define	PLAN_VMEM_CREATE(arg0)
-#define	PLAN_VMEM_CREATE_ENABLED() (0)
-#define	PLAN_VMEM_XALLOC(arg0, arg1, arg2, arg3)
-#define	PLAN_VMEM_XALLOC_ENABLED() (0)
 
 #endif
 
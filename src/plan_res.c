@@ -0,0 +1,209 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "plan_impl.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * The resolution of a plandb: how many seconds there are in a slot, the unit
+ * that every time, duration and awake range in the store is counted in, and
+ * that the daymap places activities into. It used to be the minute, wired in
+ * everywhere, which is too coarse for shift planning and finer than long-range
+ * planning needs. So now it's a setting of the plandb, kept in
+ * ~/.plandb/resolution as a decimal number of seconds. Without the file, the
+ * resolution is a minute, and existing plandbs read as they always have.
+ *
+ * The resolution has to divide the day evenly, and ranges from a second
+ * (86400 slots a day) to an hour (24 slots). Changing it rescales everything
+ * in the store (see set_res() in plan_manip.c). The rescaled records and the
+ * new resolution go through the WAL in one transaction, and the file is only
+ * rewritten when that transaction is applied, so the store and the file
+ * can't disagree after a crash.
+ */
+
+int plan_res = RES_DEFAULT;
+size_t plan_slots = RES_DAYSECS / RES_DEFAULT;
+
+static int res_pdb_fd = -1;
+
+extern daymap_t *dmday;
+extern daymap_t *daymap_create(size_t);
+extern void daymap_destroy(daymap_t *);
+
+int
+res_valid(long secs)
+{
+	return (secs >= 1 && secs <= 3600 && RES_DAYSECS % secs == 0);
+}
+
+static int
+res_read(void)
+{
+	char buf[16];
+	ssize_t len;
+	long secs;
+	int fd = openat(res_pdb_fd, "resolution", O_RDONLY);
+
+	if (fd == -1) {
+		return (RES_DEFAULT);
+	}
+	len = read(fd, buf, sizeof (buf) - 1);
+	close(fd);
+	buf[len > 0 ? len : 0] = '\0';
+	secs = strtol(buf, NULL, 10);
+	if (!res_valid(secs)) {
+		fprintf(stderr, "plan: ignoring the invalid resolution in "
+		    "~/.plandb/resolution\n");
+		return (RES_DEFAULT);
+	}
+	return (secs);
+}
+
+/*
+ * Switches to a resolution of `secs`, giving the dmday daymap the new number
+ * of slots, if it has been created.
+ */
+static void
+res_use(int secs)
+{
+	if (secs == plan_res) {
+		return;
+	}
+	plan_res = secs;
+	plan_slots = RES_DAYSECS / secs;
+	if (dmday != NULL) {
+		daymap_destroy(dmday);
+		dmday = daymap_create(PD_SPANS * plan_slots);
+	}
+}
+
+/*
+ * Reads the resolution. This has to happen before the WAL is replayed (which
+ * may change it), and before anything is placed.
+ */
+void
+res_open(int pdb_fd)
+{
+	res_pdb_fd = pdb_fd;
+	res_use(res_read());
+}
+
+/*
+ * Picks up a resolution that another process has changed. The daemon calls
+ * this before every request.
+ */
+void
+res_sync(void)
+{
+	if (res_pdb_fd != -1) {
+		res_use(res_read());
+	}
+}
+
+/*
+ * Makes `secs` the resolution, and records it in ~/.plandb/resolution. This
+ * is called from the WAL, as its resolution records are applied.
+ */
+void
+res_apply(int secs)
+{
+	char buf[16];
+	int len = snprintf(buf, sizeof (buf), "%d\n", secs);
+	int fd;
+
+	fd = openat(res_pdb_fd, "resolution.tmp",
+	    O_CREAT | O_TRUNC | O_WRONLY, ALLRWX);
+	if (fd == -1) {
+		perror("resolution");
+		return;
+	}
+	if (write(fd, buf, len) != len || fsync(fd) != 0) {
+		perror("resolution");
+		close(fd);
+		return;
+	}
+	close(fd);
+	renameat(res_pdb_fd, "resolution.tmp", res_pdb_fd, "resolution");
+	(void) fsync(res_pdb_fd);
+	res_use(secs);
+}
+
+/*
+ * Converts a number of seconds to slots. Returns -1 if it isn't a whole
+ * number of slots.
+ */
+long
+res_from_secs(long secs)
+{
+	if (secs < 0 || secs % plan_res != 0) {
+		return (-1);
+	}
+	return (secs / plan_res);
+}
+
+/*
+ * Formats a slot of the day as "hh:mm", or as "hh:mm:ss" if the resolution is
+ * finer than a minute.
+ */
+void
+res_fmt_time(char *buf, size_t len, int slot)
+{
+	long secs = (long)slot * plan_res;
+
+	if (plan_res % 60 == 0) {
+		(void) snprintf(buf, len, "%.2ld:%.2ld", secs / 3600,
+		    (secs / 60) % 60);
+	} else {
+		(void) snprintf(buf, len, "%.2ld:%.2ld:%.2ld", secs / 3600,
+		    (secs / 60) % 60, secs % 60);
+	}
+}
+
+/*
+ * Formats a number of slots as a duration, "<hrs>h<mins>m" (with "<secs>s" on
+ * the end if the resolution is finer than a minute).
+ */
+void
+res_fmt_dur(char *buf, size_t len, size_t slots)
+{
+	long secs = (long)slots * plan_res;
+
+	if (plan_res % 60 == 0) {
+		(void) snprintf(buf, len, "%.2ldh%.2ldm", secs / 3600,
+		    (secs / 60) % 60);
+	} else {
+		(void) snprintf(buf, len, "%.2ldh%.2ldm%.2lds", secs / 3600,
+		    (secs / 60) % 60, secs % 60);
+	}
+}
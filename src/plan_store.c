@@ -0,0 +1,131 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <time.h>
+#include "plan_impl.h"
+
+/*
+ * This is the glue between the manip code and the storage backends. The
+ * backend is picked once, at start-up, and everything else goes through the
+ * `store` pointer.
+ */
+
+extern plan_store_t xattr_store;
+extern plan_store_t log_store;
+
+plan_store_t *store;
+
+static plan_store_t *store_tbl[] = {
+	&xattr_store,
+	&log_store,
+	NULL,
+};
+
+/*
+ * Selects the backend called `name`. A NULL name selects the default backend,
+ * which is the original directory-and-xattr layout.
+ */
+int
+plan_store_select(const char *name)
+{
+	int i = 0;
+
+	if (name == NULL) {
+		store = store_tbl[0];
+		return (0);
+	}
+
+	while (store_tbl[i] != NULL) {
+		if (strcmp(name, store_tbl[i]->ps_name) == 0) {
+			store = store_tbl[i];
+			return (0);
+		}
+		i++;
+	}
+
+	return (-1);
+}
+
+scope_t
+plan_scope(day_t day, tm_t *date)
+{
+	if (date) {
+		return ((date->tm_year + 1900) * 10000 +
+		    (date->tm_mon + 1) * 100 + date->tm_mday);
+	}
+
+	if (day < SUN || day > SAT) {
+		return (PS_GENERAL);
+	}
+
+	return (day);
+}
+
+/*
+ * Fills in the year, month and day of `tm` from a date scope.
+ */
+void
+scope_to_tm(scope_t s, tm_t *tm)
+{
+	bzero(tm, sizeof (tm_t));
+	tm->tm_year = (s / 10000) - 1900;
+	tm->tm_mon = ((s / 100) % 100) - 1;
+	tm->tm_mday = s % 100;
+	tm->tm_isdst = -1;
+	(void) mktime(tm);
+}
+
+void
+act_rec_init(act_rec_t *r, size_t ntimes)
+{
+	size_t i = 0;
+
+	r->ar_dyn = 1;
+	r->ar_dur = 0;
+	r->ar_gap = 0;
+	r->ar_spread = 0;
+	r->ar_ntimes = ntimes;
+	r->ar_time = NULL;
+	if (ntimes) {
+		r->ar_time = umem_alloc(ntimes * sizeof (int), UMEM_NOFAIL);
+	}
+	while (i < ntimes) {
+		r->ar_time[i] = -1;
+		i++;
+	}
+}
+
+void
+act_rec_free(act_rec_t *r)
+{
+	if (r->ar_ntimes) {
+		umem_free(r->ar_time, r->ar_ntimes * sizeof (int));
+	}
+	r->ar_ntimes = 0;
+	r->ar_time = NULL;
+}
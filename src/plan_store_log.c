@@ -0,0 +1,1246 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/avl.h>
+#include <fcntl.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "plan_impl.h"
+#include "plan_probes.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * This is the log-structured storage backend. The entire database lives in a
+ * single append-only file, ~/.plandb/plan.log. Every mutation appends one
+ * record to the end of the log, and nothing is ever rewritten in place. When
+ * the log is opened we read it from start to finish with a single read, and
+ * replay the records into an in-memory index (an AVL tree of scopes, each
+ * holding an AVL tree of activities and one of todos). From then on, all
+ * reads are served from memory.
+ *
+ * Because later records supersede earlier ones, the log accumulates garbage.
+ * When the number of records grows well beyond the number of live objects,
+ * we compact the log by writing the live objects into a new file and renaming
+ * it over the old one.
+ *
+ * Other processes may append to the log while we have it open (for example,
+ * the children of the plan daemon). log_sync() replays whatever was appended
+ * since we last looked, and starts over if the log was compacted under us.
+ * Appends, compaction and repair all hold a write lock on plan.log.lock (the
+ * log itself is renamed over by compaction, so it can't hold the lock). So a
+ * record is never half-written while another process truncates or compacts,
+ * and a compaction always includes every record appended before it.
+ *
+ * A record is a fixed header, followed by the name of the object it applies
+ * to, followed by a type-specific payload. The checksum covers the name and
+ * the payload, so that a torn write at the tail of the log (from a crash) is
+ * detected and discarded when the log is next opened.
+ */
+
+#define	LOG_MAGIC	"PLANLOG1"
+#define	LOG_MAGIC_LEN	8
+
+typedef enum lrec_type {
+	LR_SCOPE = 1,
+	LR_AWAKE,
+	LR_ACT,
+	LR_ACT_DEL,
+	LR_ACT_RN,
+	LR_ACT_DET,
+	LR_TODO,
+	LR_TODO_DEL,
+	LR_TODO_RN,
+	LR_TODO_DET,
+	LR_ACT_CHUNK,
+} lrec_type_t;
+
+typedef struct lrec_hdr {
+	uint32_t	lh_len;		/* length of name + payload */
+	uint16_t	lh_type;
+	uint16_t	lh_nlen;	/* length of name */
+	int32_t		lh_scope;
+	uint32_t	lh_sum;
+} lrec_hdr_t;
+
+/*
+ * The payload of an LR_ACT record, which is followed by la_ntimes start
+ * times.
+ */
+typedef struct lrec_act {
+	uint64_t	la_dur;
+	uint32_t	la_ntimes;
+	int32_t		la_dyn;
+} lrec_act_t;
+
+/*
+ * An activity with chunk constraints is an LR_ACT_CHUNK record instead, with
+ * this between the lrec_act_t and the start times. The other activities are
+ * written as they always were.
+ */
+typedef struct lrec_chunk {
+	uint32_t	lc_gap;
+	uint32_t	lc_spread;
+} lrec_chunk_t;
+
+typedef struct lrec_awake {
+	uint64_t	lw_base;
+	uint64_t	lw_off;
+} lrec_awake_t;
+
+typedef struct lg_act {
+	avl_node_t	la_node;
+	char		*la_name;
+	size_t		la_name_len;
+	act_rec_t	la_rec;
+	char		*la_det;
+	size_t		la_det_len;
+} lg_act_t;
+
+typedef struct lg_todo {
+	avl_node_t	lt_node;
+	char		*lt_name;
+	size_t		lt_name_len;
+	int		lt_time;
+	char		*lt_det;
+	size_t		lt_det_len;
+} lg_todo_t;
+
+typedef struct lg_scope {
+	avl_node_t	ls_node;
+	scope_t		ls_scope;
+	int		ls_awake;
+	size_t		ls_base;
+	size_t		ls_off;
+	avl_tree_t	ls_acts;
+	avl_tree_t	ls_todos;
+	void		*ls_occ;	/* its occupancy, see plan_occ.c */
+	size_t		ls_occ_len;
+} lg_scope_t;
+
+extern plan_store_t xattr_store;
+extern void atomic_read(int, void*, size_t);
+extern void atomic_write(int, void*, size_t);
+extern void act_rec_init(act_rec_t *, size_t);
+extern void act_rec_free(act_rec_t *);
+extern size_t plan_slots;
+
+static int log_fd = -1;
+static int log_pdb_fd = -1;
+static off_t log_off;
+static avl_tree_t log_scopes;
+static size_t log_nrecs;
+static size_t log_nlive;
+static int log_replaying;
+static int log_lk_fd = -1;
+static int log_locked;
+static int log_moved;
+
+static void log_refresh(void);
+
+static uint32_t
+log_sum(const void *buf, size_t len)
+{
+	const unsigned char *c = buf;
+	uint32_t h = 2166136261u;
+	size_t i = 0;
+
+	while (i < len) {
+		h ^= c[i];
+		h *= 16777619u;
+		i++;
+	}
+	return (h);
+}
+
+static int
+lg_scope_cmp(const void *l, const void *r)
+{
+	const lg_scope_t *ls = l;
+	const lg_scope_t *rs = r;
+
+	if (ls->ls_scope < rs->ls_scope) {
+		return (-1);
+	}
+	if (ls->ls_scope > rs->ls_scope) {
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Activities and todos both start with an avl_node_t followed by the name, so
+ * the same comparator serves both trees.
+ */
+typedef struct lg_named {
+	avl_node_t	ln_node;
+	char		*ln_name;
+} lg_named_t;
+
+static int
+lg_name_cmp(const void *l, const void *r)
+{
+	const lg_named_t *ln = l;
+	const lg_named_t *rn = r;
+	int c = strcmp(ln->ln_name, rn->ln_name);
+
+	if (c < 0) {
+		return (-1);
+	}
+	if (c > 0) {
+		return (1);
+	}
+	return (0);
+}
+
+static lg_scope_t *
+lg_scope_find(scope_t s, int create)
+{
+	lg_scope_t key;
+	lg_scope_t *ls;
+	avl_index_t where;
+
+	key.ls_scope = s;
+	ls = avl_find(&log_scopes, &key, &where);
+	if (ls != NULL || !create) {
+		return (ls);
+	}
+
+	ls = umem_zalloc(sizeof (lg_scope_t), UMEM_NOFAIL);
+	ls->ls_scope = s;
+	avl_create(&ls->ls_acts, lg_name_cmp, sizeof (lg_act_t),
+	    offsetof(lg_act_t, la_node));
+	avl_create(&ls->ls_todos, lg_name_cmp, sizeof (lg_todo_t),
+	    offsetof(lg_todo_t, lt_node));
+	avl_insert(&log_scopes, ls, where);
+	return (ls);
+}
+
+static void *
+lg_find(avl_tree_t *t, char *n)
+{
+	lg_named_t key;
+
+	key.ln_name = n;
+	return (avl_find(t, &key, NULL));
+}
+
+static char *
+lg_strdup(const char *s, size_t len, size_t *lenp)
+{
+	char *d = umem_zalloc(len + 1, UMEM_NOFAIL);
+
+	bcopy(s, d, len);
+	*lenp = len;
+	return (d);
+}
+
+static void
+lg_strfree(char **s, size_t *len)
+{
+	if (*s) {
+		umem_free(*s, *len + 1);
+	}
+	*s = NULL;
+	*len = 0;
+}
+
+static void
+lg_act_free(lg_act_t *la)
+{
+	lg_strfree(&la->la_name, &la->la_name_len);
+	lg_strfree(&la->la_det, &la->la_det_len);
+	act_rec_free(&la->la_rec);
+	umem_free(la, sizeof (lg_act_t));
+}
+
+static void
+lg_todo_free(lg_todo_t *lt)
+{
+	lg_strfree(&lt->lt_name, &lt->lt_name_len);
+	lg_strfree(&lt->lt_det, &lt->lt_det_len);
+	umem_free(lt, sizeof (lg_todo_t));
+}
+
+static void
+log_lock(short type)
+{
+	struct flock fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	(void) fcntl(log_lk_fd, F_SETLKW, &fl);
+	log_locked = (type != F_UNLCK);
+}
+
+/*
+ * If the log was compacted since we opened it, log_fd refers to the old,
+ * unlinked file, and anything we appended to it would be lost. So we move
+ * over to the new one. Our index no longer matches log_off in the new file,
+ * so the next log_sync() starts over from the beginning of it.
+ */
+static void
+log_follow(void)
+{
+	struct stat fst;
+	struct stat pst;
+
+	fstat(log_fd, &fst);
+	if (fstatat(log_pdb_fd, "plan.log", &pst, 0) == 0 &&
+	    (pst.st_ino != fst.st_ino || pst.st_dev != fst.st_dev)) {
+		close(log_fd);
+		log_fd = openat(log_pdb_fd, "plan.log", O_RDWR | O_APPEND);
+		log_moved = 1;
+	}
+}
+
+/*
+ * Appends a record to the log with a single write, under the lock unless the
+ * caller (open or compaction) already holds it. During replay we're
+ * rebuilding the index from records that are already in the log, so nothing
+ * is written.
+ *
+ * If other processes appended records that we haven't read yet, we leave
+ * log_off where it is, and the next scan reads theirs and then ours back in
+ * log order. Our own records are idempotent when replayed over the index.
+ */
+static void
+log_append(lrec_type_t type, scope_t s, const char *n, const void *pl,
+    size_t plen)
+{
+	lrec_hdr_t h;
+	size_t nlen = (n == NULL) ? 0 : strlen(n);
+	size_t sz = sizeof (h) + nlen + plen;
+	char *buf;
+	struct stat st;
+	int lk = !log_locked;
+
+	if (log_replaying) {
+		return;
+	}
+	log_nrecs++;
+
+	buf = umem_alloc(sz, UMEM_NOFAIL);
+	h.lh_len = nlen + plen;
+	h.lh_type = type;
+	h.lh_nlen = nlen;
+	h.lh_scope = s;
+	bcopy(n, buf + sizeof (h), nlen);
+	bcopy(pl, buf + sizeof (h) + nlen, plen);
+	h.lh_sum = log_sum(buf + sizeof (h), nlen + plen);
+	bcopy(&h, buf, sizeof (h));
+	if (lk) {
+		log_lock(F_WRLCK);
+		log_follow();
+	}
+	fstat(log_fd, &st);
+	atomic_write(log_fd, buf, sz);
+	if (st.st_size == log_off && !log_moved) {
+		log_off += sz;
+	}
+	if (lk) {
+		log_lock(F_UNLCK);
+	}
+	umem_free(buf, sz);
+}
+
+static void
+log_append_act(scope_t s, char *n, act_rec_t *r)
+{
+	int chunk = (r->ar_gap != 0 || r->ar_spread != 0);
+	size_t csz = chunk ? sizeof (lrec_chunk_t) : 0;
+	size_t tsz = r->ar_ntimes * sizeof (int32_t);
+	size_t sz = sizeof (lrec_act_t) + csz + tsz;
+	char *buf = umem_alloc(sz, UMEM_NOFAIL);
+	lrec_act_t la;
+	lrec_chunk_t lc;
+
+	la.la_dur = r->ar_dur;
+	la.la_ntimes = r->ar_ntimes;
+	la.la_dyn = r->ar_dyn;
+	lc.lc_gap = r->ar_gap;
+	lc.lc_spread = r->ar_spread;
+	bcopy(&la, buf, sizeof (la));
+	bcopy(&lc, buf + sizeof (la), csz);
+	bcopy(r->ar_time, buf + sizeof (la) + csz, tsz);
+	log_append(chunk ? LR_ACT_CHUNK : LR_ACT, s, n, buf, sz);
+	umem_free(buf, sz);
+}
+
+static void
+log_append_awake(scope_t s, size_t base, size_t off)
+{
+	lrec_awake_t lw;
+
+	lw.lw_base = base;
+	lw.lw_off = off;
+	log_append(LR_AWAKE, s, NULL, &lw, sizeof (lw));
+}
+
+/*
+ * The operations below each update the in-memory index and append the
+ * corresponding record. They are shared by the backend entry points and by
+ * replay.
+ *
+ * A day's occupancy (see plan_occ.c) is only kept in the index, and isn't
+ * logged. A process reads the whole log in when it opens it, so building a
+ * day's occupancy from the index, the first time it's needed, costs little
+ * next to that, while logging it would add a record the size of the day's
+ * maps to every change to an activity.
+ */
+static void
+lg_occ_drop(lg_scope_t *ls)
+{
+	if (ls->ls_occ != NULL) {
+		umem_free(ls->ls_occ, ls->ls_occ_len);
+		ls->ls_occ = NULL;
+		ls->ls_occ_len = 0;
+	}
+}
+
+static void
+log_occ_put(scope_t s, void *buf, size_t len)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+
+	if (ls == NULL) {
+		return;
+	}
+	lg_occ_drop(ls);
+	ls->ls_occ = umem_alloc(len, UMEM_NOFAIL);
+	ls->ls_occ_len = len;
+	bcopy(buf, ls->ls_occ, len);
+}
+
+static int
+lg_act_create(scope_t s, char *n)
+{
+	lg_scope_t *ls = lg_scope_find(s, 1);
+	lg_act_t *la;
+
+	if (lg_find(&ls->ls_acts, n) != NULL) {
+		return (-1);
+	}
+	la = umem_zalloc(sizeof (lg_act_t), UMEM_NOFAIL);
+	la->la_name = lg_strdup(n, strlen(n), &la->la_name_len);
+	act_rec_init(&la->la_rec, 1);
+	avl_add(&ls->ls_acts, la);
+	lg_occ_drop(ls);
+	log_nlive++;
+	log_append_act(s, n, &la->la_rec);
+	return (0);
+}
+
+static int
+lg_act_put(scope_t s, char *n, act_rec_t *r)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+
+	if (ls == NULL || (la = lg_find(&ls->ls_acts, n)) == NULL) {
+		return (-1);
+	}
+	act_rec_free(&la->la_rec);
+	act_rec_init(&la->la_rec, r->ar_ntimes);
+	la->la_rec.ar_dyn = r->ar_dyn;
+	la->la_rec.ar_dur = r->ar_dur;
+	la->la_rec.ar_gap = r->ar_gap;
+	la->la_rec.ar_spread = r->ar_spread;
+	bcopy(r->ar_time, la->la_rec.ar_time, r->ar_ntimes * sizeof (int));
+	lg_occ_drop(ls);
+	log_append_act(s, n, r);
+	return (0);
+}
+
+static int
+lg_act_destroy(scope_t s, char *n)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+
+	if (ls == NULL || (la = lg_find(&ls->ls_acts, n)) == NULL) {
+		return (-1);
+	}
+	avl_remove(&ls->ls_acts, la);
+	if (la->la_det) {
+		log_nlive--;
+	}
+	lg_act_free(la);
+	lg_occ_drop(ls);
+	log_nlive--;
+	log_append(LR_ACT_DEL, s, n, NULL, 0);
+	return (0);
+}
+
+static int
+lg_act_rename(scope_t s, char *old, char *new)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+
+	if (ls == NULL) {
+		return (0);
+	}
+	if (lg_find(&ls->ls_acts, new) != NULL) {
+		return (-1);
+	}
+	if ((la = lg_find(&ls->ls_acts, old)) == NULL) {
+		return (0);
+	}
+	avl_remove(&ls->ls_acts, la);
+	lg_strfree(&la->la_name, &la->la_name_len);
+	la->la_name = lg_strdup(new, strlen(new), &la->la_name_len);
+	avl_add(&ls->ls_acts, la);
+	log_append(LR_ACT_RN, s, old, new, strlen(new));
+	return (0);
+}
+
+static int
+lg_act_det(scope_t s, char *n, char *det, size_t len)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+
+	if (ls == NULL || (la = lg_find(&ls->ls_acts, n)) == NULL) {
+		return (-1);
+	}
+	if (la->la_det == NULL) {
+		log_nlive++;
+	}
+	lg_strfree(&la->la_det, &la->la_det_len);
+	la->la_det = lg_strdup(det, len, &la->la_det_len);
+	log_append(LR_ACT_DET, s, n, det, len);
+	return (0);
+}
+
+static int
+lg_todo_create(scope_t s, char *n)
+{
+	lg_scope_t *ls = lg_scope_find(s, 1);
+	lg_todo_t *lt;
+
+	if (lg_find(&ls->ls_todos, n) != NULL) {
+		return (-1);
+	}
+	lt = umem_zalloc(sizeof (lg_todo_t), UMEM_NOFAIL);
+	lt->lt_name = lg_strdup(n, strlen(n), &lt->lt_name_len);
+	avl_add(&ls->ls_todos, lt);
+	log_nlive++;
+	log_append(LR_TODO, s, n, &lt->lt_time, sizeof (int32_t));
+	return (0);
+}
+
+static int
+lg_todo_time(scope_t s, char *n, int time)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_todo_t *lt;
+
+	if (ls == NULL || (lt = lg_find(&ls->ls_todos, n)) == NULL) {
+		return (-1);
+	}
+	lt->lt_time = time;
+	log_append(LR_TODO, s, n, &lt->lt_time, sizeof (int32_t));
+	return (0);
+}
+
+static int
+lg_todo_destroy(scope_t s, char *n)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_todo_t *lt;
+
+	if (ls == NULL || (lt = lg_find(&ls->ls_todos, n)) == NULL) {
+		return (-1);
+	}
+	avl_remove(&ls->ls_todos, lt);
+	if (lt->lt_det) {
+		log_nlive--;
+	}
+	lg_todo_free(lt);
+	log_nlive--;
+	log_append(LR_TODO_DEL, s, n, NULL, 0);
+	return (0);
+}
+
+static int
+lg_todo_rename(scope_t s, char *old, char *new)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_todo_t *lt;
+
+	if (ls == NULL) {
+		return (0);
+	}
+	if (lg_find(&ls->ls_todos, new) != NULL) {
+		return (-1);
+	}
+	if ((lt = lg_find(&ls->ls_todos, old)) == NULL) {
+		return (0);
+	}
+	avl_remove(&ls->ls_todos, lt);
+	lg_strfree(&lt->lt_name, &lt->lt_name_len);
+	lt->lt_name = lg_strdup(new, strlen(new), &lt->lt_name_len);
+	avl_add(&ls->ls_todos, lt);
+	log_append(LR_TODO_RN, s, old, new, strlen(new));
+	return (0);
+}
+
+static int
+lg_todo_det(scope_t s, char *n, char *det, size_t len)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_todo_t *lt;
+
+	if (ls == NULL || (lt = lg_find(&ls->ls_todos, n)) == NULL) {
+		return (-1);
+	}
+	if (lt->lt_det == NULL) {
+		log_nlive++;
+	}
+	lg_strfree(&lt->lt_det, &lt->lt_det_len);
+	lt->lt_det = lg_strdup(det, len, &lt->lt_det_len);
+	log_append(LR_TODO_DET, s, n, det, len);
+	return (0);
+}
+
+static void
+lg_awake(scope_t s, size_t base, size_t off)
+{
+	lg_scope_t *ls = lg_scope_find(s, 1);
+
+	if (!ls->ls_awake) {
+		log_nlive++;
+	}
+	ls->ls_awake = 1;
+	ls->ls_base = base;
+	ls->ls_off = off;
+	log_append_awake(s, base, off);
+}
+
+/*
+ * Applies a single record read from the log to the in-memory index. Returns
+ * -1 if the record is malformed.
+ */
+static int
+log_apply(lrec_hdr_t *h, char *name, char *pl, size_t plen)
+{
+	lrec_act_t la;
+	lrec_chunk_t lc;
+	size_t csz;
+	act_rec_t r;
+	char *new;
+	size_t nl;
+	int32_t time;
+	lrec_awake_t lw;
+
+	switch (h->lh_type) {
+
+	case LR_SCOPE:
+		(void) lg_scope_find(h->lh_scope, 1);
+		break;
+
+	case LR_AWAKE:
+		if (plen != sizeof (lw)) {
+			return (-1);
+		}
+		bcopy(pl, &lw, sizeof (lw));
+		lg_awake(h->lh_scope, lw.lw_base, lw.lw_off);
+		break;
+
+	case LR_ACT:
+	case LR_ACT_CHUNK:
+		csz = (h->lh_type == LR_ACT_CHUNK) ? sizeof (lc) : 0;
+		if (plen < sizeof (la) + csz) {
+			return (-1);
+		}
+		bcopy(pl, &la, sizeof (la));
+		if (plen != sizeof (la) + csz +
+		    la.la_ntimes * sizeof (int32_t)) {
+			return (-1);
+		}
+		(void) lg_act_create(h->lh_scope, name);
+		act_rec_init(&r, la.la_ntimes);
+		r.ar_dur = la.la_dur;
+		r.ar_dyn = la.la_dyn;
+		if (csz != 0) {
+			bcopy(pl + sizeof (la), &lc, sizeof (lc));
+			r.ar_gap = lc.lc_gap;
+			r.ar_spread = lc.lc_spread;
+		}
+		bcopy(pl + sizeof (la) + csz, r.ar_time,
+		    la.la_ntimes * sizeof (int));
+		(void) lg_act_put(h->lh_scope, name, &r);
+		act_rec_free(&r);
+		break;
+
+	case LR_ACT_DEL:
+		(void) lg_act_destroy(h->lh_scope, name);
+		break;
+
+	case LR_ACT_RN:
+	case LR_TODO_RN:
+		new = lg_strdup(pl, plen, &nl);
+		if (h->lh_type == LR_ACT_RN) {
+			(void) lg_act_rename(h->lh_scope, name, new);
+		} else {
+			(void) lg_todo_rename(h->lh_scope, name, new);
+		}
+		lg_strfree(&new, &nl);
+		break;
+
+	case LR_ACT_DET:
+		(void) lg_act_det(h->lh_scope, name, pl, plen);
+		break;
+
+	case LR_TODO:
+		if (plen != sizeof (time)) {
+			return (-1);
+		}
+		bcopy(pl, &time, sizeof (time));
+		(void) lg_todo_create(h->lh_scope, name);
+		(void) lg_todo_time(h->lh_scope, name, time);
+		break;
+
+	case LR_TODO_DEL:
+		(void) lg_todo_destroy(h->lh_scope, name);
+		break;
+
+	case LR_TODO_DET:
+		(void) lg_todo_det(h->lh_scope, name, pl, plen);
+		break;
+
+	default:
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Reads everything in the log past log_off with one read, and replays every
+ * record in it. If `repair` is set and we find a torn or corrupt record,
+ * everything from that record onwards is cut off the log. Otherwise we stop
+ * at that record. Repair is only done under the lock, when no other process
+ * can be in the middle of writing a record, so a bad tail is really torn.
+ */
+static void
+log_scan(int repair)
+{
+	struct stat st;
+	char *buf;
+	size_t sz;
+	size_t off = 0;
+	lrec_hdr_t h;
+	char *name;
+
+	fstat(log_fd, &st);
+	if (st.st_size <= log_off) {
+		return;
+	}
+	sz = st.st_size - log_off;
+
+	buf = umem_alloc(sz, UMEM_NOFAIL);
+	lseek(log_fd, log_off, SEEK_SET);
+	atomic_read(log_fd, buf, sz);
+
+	log_replaying = 1;
+	while (off + sizeof (h) <= sz) {
+		bcopy(buf + off, &h, sizeof (h));
+		if (h.lh_nlen > h.lh_len ||
+		    off + sizeof (h) + h.lh_len > sz ||
+		    log_sum(buf + off + sizeof (h), h.lh_len) != h.lh_sum) {
+			break;
+		}
+		/*
+		 * The name isn't NUL-terminated in the log, so we copy it out.
+		 */
+		name = umem_zalloc(h.lh_nlen + 1, UMEM_NOFAIL);
+		bcopy(buf + off + sizeof (h), name, h.lh_nlen);
+		if (log_apply(&h, name, buf + off + sizeof (h) + h.lh_nlen,
+		    h.lh_len - h.lh_nlen) != 0) {
+			umem_free(name, h.lh_nlen + 1);
+			break;
+		}
+		umem_free(name, h.lh_nlen + 1);
+		log_nrecs++;
+		off += sizeof (h) + h.lh_len;
+	}
+	log_replaying = 0;
+	log_off += off;
+
+	if (off != sz && repair) {
+		fprintf(stderr, "plan.log: discarding %d bytes of torn or "
+		    "corrupt records\n", (int)(sz - off));
+		ftruncate(log_fd, log_off);
+	}
+	lseek(log_fd, 0, SEEK_END);
+	umem_free(buf, sz);
+}
+
+static void
+log_replay(void)
+{
+	struct stat st;
+
+	fstat(log_fd, &st);
+	if (st.st_size < LOG_MAGIC_LEN) {
+		atomic_write(log_fd, LOG_MAGIC, LOG_MAGIC_LEN);
+	}
+	log_off = LOG_MAGIC_LEN;
+	log_scan(1);
+}
+
+/*
+ * Throws away the entire in-memory index.
+ */
+static void
+log_reset(void)
+{
+	lg_scope_t *ls;
+	lg_act_t *la;
+	lg_todo_t *lt;
+	void *c = NULL;
+	void *ca;
+	void *ct;
+
+	while ((ls = avl_destroy_nodes(&log_scopes, &c)) != NULL) {
+		ca = NULL;
+		ct = NULL;
+		while ((la = avl_destroy_nodes(&ls->ls_acts, &ca)) != NULL) {
+			lg_act_free(la);
+		}
+		while ((lt = avl_destroy_nodes(&ls->ls_todos, &ct)) != NULL) {
+			lg_todo_free(lt);
+		}
+		avl_destroy(&ls->ls_acts);
+		avl_destroy(&ls->ls_todos);
+		if (ls->ls_occ != NULL) {
+			umem_free(ls->ls_occ, ls->ls_occ_len);
+		}
+		umem_free(ls, sizeof (lg_scope_t));
+	}
+	avl_destroy(&log_scopes);
+	avl_create(&log_scopes, lg_scope_cmp, sizeof (lg_scope_t),
+	    offsetof(lg_scope_t, ls_node));
+	log_nrecs = 0;
+	log_nlive = 0;
+}
+
+/*
+ * When the log is created for the first time, we seed it with whatever is
+ * in the directory layout, so that both backends can be compared on the
+ * same data.
+ */
+static void
+seed_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	scope_t s = *(scope_t *)arg;
+
+	(void) lg_act_create(s, n);
+	(void) lg_act_put(s, n, r);
+	if (det) {
+		(void) lg_act_det(s, n, det, strlen(det));
+	}
+	act_rec_free(r);
+}
+
+static void
+seed_todo(void *arg, char *n, int time, char *det)
+{
+	scope_t s = *(scope_t *)arg;
+
+	(void) lg_todo_create(s, n);
+	(void) lg_todo_time(s, n, time);
+	if (det) {
+		(void) lg_todo_det(s, n, det, strlen(det));
+	}
+}
+
+static void
+seed_scope(void *arg, scope_t s)
+{
+	size_t base;
+	size_t off;
+
+	if (s != PS_GENERAL) {
+		xattr_store.ps_awake_get(s, &base, &off);
+		if (base != 0 || off != plan_slots) {
+			lg_awake(s, base, off);
+		}
+		xattr_store.ps_act_walk(s, 1, seed_act, &s);
+	}
+	xattr_store.ps_todo_walk(s, 1, seed_todo, &s);
+}
+
+/*
+ * Writes every live object into a fresh log, and atomically replaces the old
+ * one with it. Called with the lock held. We first catch up with whatever
+ * other processes have appended, so none of it is dropped from the new log.
+ *
+ * log_append only advances log_off while the file is as long as it expects,
+ * so a short write anywhere leaves the new log shorter than log_off. If that
+ * happens, or the new log can't be synced or renamed, the old log stays.
+ */
+static void
+log_compact(void)
+{
+	struct stat st;
+	int nfd;
+	int ofd;
+	off_t ooff;
+	size_t onrecs;
+	lg_scope_t *ls;
+	lg_act_t *la;
+	lg_todo_t *lt;
+
+	log_refresh();
+	nfd = openat(log_pdb_fd, "plan.log.tmp",
+	    O_CREAT | O_TRUNC | O_RDWR, ALLRWX);
+	if (nfd == -1) {
+		return;
+	}
+	ofd = log_fd;
+	ooff = log_off;
+	onrecs = log_nrecs;
+
+	log_fd = nfd;
+	log_nrecs = 0;
+	log_off = LOG_MAGIC_LEN;
+	atomic_write(log_fd, LOG_MAGIC, LOG_MAGIC_LEN);
+	for (ls = avl_first(&log_scopes); ls != NULL;
+	    ls = AVL_NEXT(&log_scopes, ls)) {
+		if (ls->ls_awake) {
+			log_append_awake(ls->ls_scope, ls->ls_base,
+			    ls->ls_off);
+		}
+		if (!ls->ls_awake && avl_numnodes(&ls->ls_acts) == 0 &&
+		    avl_numnodes(&ls->ls_todos) == 0) {
+			log_append(LR_SCOPE, ls->ls_scope, NULL, NULL, 0);
+		}
+		for (la = avl_first(&ls->ls_acts); la != NULL;
+		    la = AVL_NEXT(&ls->ls_acts, la)) {
+			log_append_act(ls->ls_scope, la->la_name, &la->la_rec);
+			if (la->la_det) {
+				log_append(LR_ACT_DET, ls->ls_scope,
+				    la->la_name, la->la_det, la->la_det_len);
+			}
+		}
+		for (lt = avl_first(&ls->ls_todos); lt != NULL;
+		    lt = AVL_NEXT(&ls->ls_todos, lt)) {
+			log_append(LR_TODO, ls->ls_scope, lt->lt_name,
+			    &lt->lt_time, sizeof (int32_t));
+			if (lt->lt_det) {
+				log_append(LR_TODO_DET, ls->ls_scope,
+				    lt->lt_name, lt->lt_det, lt->lt_det_len);
+			}
+		}
+	}
+	if (fstat(nfd, &st) != 0 || st.st_size != log_off ||
+	    fsync(nfd) != 0 ||
+	    renameat(log_pdb_fd, "plan.log.tmp", log_pdb_fd, "plan.log") != 0) {
+		perror("plan.log: can't compact");
+		close(nfd);
+		(void) unlinkat(log_pdb_fd, "plan.log.tmp", 0);
+		log_fd = ofd;
+		log_off = ooff;
+		log_nrecs = onrecs;
+		return;
+	}
+	(void) fsync(log_pdb_fd);
+	close(ofd);
+	log_off = lseek(log_fd, 0, SEEK_END);
+}
+
+static int
+log_open(int pdb_fd)
+{
+	int seed = 0;
+
+	log_pdb_fd = pdb_fd;
+	avl_create(&log_scopes, lg_scope_cmp, sizeof (lg_scope_t),
+	    offsetof(lg_scope_t, ls_node));
+
+	log_lk_fd = openat(pdb_fd, "plan.log.lock", O_CREAT | O_RDWR,
+	    S_IRUSR | S_IWUSR);
+	if (log_lk_fd == -1) {
+		perror("plan.log.lock");
+		return (-1);
+	}
+	log_lock(F_WRLCK);
+	log_fd = openat(pdb_fd, "plan.log", O_RDWR | O_APPEND);
+	if (log_fd == -1) {
+		log_fd = openat(pdb_fd, "plan.log", O_CREAT | O_RDWR | O_APPEND,
+		    ALLRWX);
+		seed = 1;
+	}
+	if (log_fd == -1) {
+		perror("plan.log");
+		log_lock(F_UNLCK);
+		return (-1);
+	}
+
+	log_replay();
+
+	if (seed) {
+		(void) xattr_store.ps_open(pdb_fd);
+		xattr_store.ps_walk(seed_scope, NULL);
+		xattr_store.ps_close();
+	}
+	log_lock(F_UNLCK);
+	return (0);
+}
+
+/*
+ * We compact once the log holds 4 times as many records as live objects.
+ * The slack keeps us from compacting small databases over and over.
+ */
+static void
+log_close(void)
+{
+	if (log_nrecs > (4 * log_nlive) + 1024) {
+		log_lock(F_WRLCK);
+		log_compact();
+		log_lock(F_UNLCK);
+	}
+	close(log_fd);
+	close(log_lk_fd);
+	log_fd = -1;
+	log_lk_fd = -1;
+}
+
+/*
+ * Brings the index up to date with the log. Called with the lock held.
+ */
+static void
+log_refresh(void)
+{
+	log_follow();
+	if (log_moved) {
+		log_moved = 0;
+		log_reset();
+		log_replay();
+		return;
+	}
+	log_scan(1);
+}
+
+static void
+log_sync(void)
+{
+	log_lock(F_WRLCK);
+	log_refresh();
+	log_lock(F_UNLCK);
+}
+
+static void
+log_flush(void)
+{
+	fsync(log_fd);
+}
+
+static int
+log_have(scope_t s)
+{
+	if (PS_ISDATE(s)) {
+		return (lg_scope_find(s, 0) != NULL);
+	}
+	return (1);
+}
+
+static void
+log_walk(scope_walk_f cb, void *arg)
+{
+	lg_scope_t *ls;
+	day_t d = SUN;
+
+	while (d <= SAT) {
+		cb(arg, d);
+		d++;
+	}
+	for (ls = avl_first(&log_scopes); ls != NULL;
+	    ls = AVL_NEXT(&log_scopes, ls)) {
+		if (PS_ISDATE(ls->ls_scope)) {
+			cb(arg, ls->ls_scope);
+		}
+	}
+	cb(arg, PS_GENERAL);
+}
+
+static void
+log_range(scope_t from, scope_t to, scope_walk_f cb, void *arg)
+{
+	lg_scope_t key;
+	lg_scope_t *ls;
+	avl_index_t where;
+
+	key.ls_scope = from;
+	if ((ls = avl_find(&log_scopes, &key, &where)) == NULL) {
+		ls = avl_nearest(&log_scopes, where, AVL_AFTER);
+	}
+	while (ls != NULL && ls->ls_scope <= to) {
+		cb(arg, ls->ls_scope);
+		ls = AVL_NEXT(&log_scopes, ls);
+	}
+}
+
+static void
+log_awake_get(scope_t s, size_t *base, size_t *off)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+
+	if (ls == NULL || !ls->ls_awake) {
+		*base = 0;
+		*off = plan_slots;
+		return;
+	}
+	*base = ls->ls_base;
+	*off = ls->ls_off;
+}
+
+static void
+log_awake_put(scope_t s, size_t base, size_t off)
+{
+	lg_awake(s, base, off);
+}
+
+static int
+log_act_get(scope_t s, char *n, act_rec_t *r)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+
+	if (ls == NULL || (la = lg_find(&ls->ls_acts, n)) == NULL) {
+		return (-1);
+	}
+	act_rec_init(r, la->la_rec.ar_ntimes);
+	r->ar_dyn = la->la_rec.ar_dyn;
+	r->ar_dur = la->la_rec.ar_dur;
+	r->ar_gap = la->la_rec.ar_gap;
+	r->ar_spread = la->la_rec.ar_spread;
+	bcopy(la->la_rec.ar_time, r->ar_time, r->ar_ntimes * sizeof (int));
+	return (0);
+}
+
+static int
+log_act_det(scope_t s, char *n, char *det)
+{
+	return (lg_act_det(s, n, det, strlen(det)));
+}
+
+static void
+log_act_walk(scope_t s, int det, act_walk_f cb, void *arg)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_act_t *la;
+	act_rec_t r;
+
+	if (ls == NULL) {
+		return;
+	}
+	for (la = avl_first(&ls->ls_acts); la != NULL;
+	    la = AVL_NEXT(&ls->ls_acts, la)) {
+		(void) log_act_get(s, la->la_name, &r);
+		cb(arg, la->la_name, &r, det ? la->la_det : NULL);
+	}
+}
+
+static int
+log_occ_get(scope_t s, void *buf, size_t len)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+
+	if (ls == NULL || ls->ls_occ == NULL || ls->ls_occ_len != len) {
+		return (-1);
+	}
+	bcopy(ls->ls_occ, buf, len);
+	return (0);
+}
+
+static size_t
+log_act_count(scope_t s)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+
+	if (ls == NULL) {
+		return (0);
+	}
+	return (avl_numnodes(&ls->ls_acts));
+}
+
+static int
+log_todo_det(scope_t s, char *n, char *det)
+{
+	return (lg_todo_det(s, n, det, strlen(det)));
+}
+
+static void
+log_todo_walk(scope_t s, int det, todo_walk_f cb, void *arg)
+{
+	lg_scope_t *ls = lg_scope_find(s, 0);
+	lg_todo_t *lt;
+
+	if (ls == NULL) {
+		return;
+	}
+	for (lt = avl_first(&ls->ls_todos); lt != NULL;
+	    lt = AVL_NEXT(&ls->ls_todos, lt)) {
+		cb(arg, lt->lt_name, lt->lt_time, det ? lt->lt_det : NULL);
+	}
+}
+
+plan_store_t log_store = {
+	"log",
+	log_open,
+	log_close,
+	log_sync,
+	log_flush,
+	log_have,
+	log_walk,
+	log_range,
+	log_awake_get,
+	log_awake_put,
+	lg_act_create,
+	lg_act_destroy,
+	lg_act_rename,
+	log_act_get,
+	lg_act_put,
+	log_act_det,
+	log_act_walk,
+	log_act_count,
+	log_occ_get,
+	log_occ_put,
+	lg_todo_create,
+	lg_todo_destroy,
+	lg_todo_rename,
+	lg_todo_time,
+	log_todo_det,
+	log_todo_walk,
+};
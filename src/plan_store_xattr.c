@@ -0,0 +1,1337 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/avl.h>
+#include "plan_impl.h"
+#include "plan_probes.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * This is the original storage backend. Every day and date is a directory,
+ * and every activity and todo is a file in that directory. The contents of
+ * the file are the details, and the time, duration and dynamic-flag are
+ * stored in the "rec" extended attribute (see xattr_rec_t).
+ *
+ *	~/.plandb/days/<mon|tues|...>/{acts,todos}/<name>
+ *	~/.plandb/dates/YYYY/MM/DD/{acts,todos}/<name>
+ *	~/.plandb/todos/<name>
+ */
+
+extern int days_fd;
+extern int dates_fd;
+extern int todos_fd;
+
+extern void atomic_read(int, void*, size_t);
+extern void atomic_write(int, void*, size_t);
+extern void act_rec_init(act_rec_t *, size_t);
+extern void act_rec_free(act_rec_t *);
+extern size_t plan_slots;
+
+static char *daypath[] = {"sun", "mon", "tues", "wed", "thur", "fri", "sat"};
+
+/*
+ * Getting to a date's directory means walking dates/YYYY/MM/DD with an
+ * openat (and a mkdirat) per component, and a single list() opens the same
+ * date several times (to check that it exists, to read the awake range, and
+ * to read the acts and todos). So we keep the directory fds we've opened in a
+ * cache, keyed by the kind of directory and its scope, and close the least
+ * recently used one once the cache is full.
+ *
+ * The fds in the cache are lent to the callers, which must not close them.
+ * Plan never removes a directory, so a cached fd can't go stale.
+ */
+typedef enum dc_kind {
+	DC_YEAR,
+	DC_MONTH,
+	DC_SCOPE,
+	DC_ACTS,
+	DC_TODOS
+} dc_kind_t;
+
+typedef struct dc_ent {
+	avl_node_t	dc_avl;
+	struct dc_ent	*dc_prev;	/* more recently used */
+	struct dc_ent	*dc_next;	/* less recently used */
+	dc_kind_t	dc_kind;
+	scope_t		dc_scope;
+	int		dc_fd;
+} dc_ent_t;
+
+#define	DC_MAX	128
+
+static avl_tree_t dc_tree;
+static dc_ent_t *dc_mru;
+static dc_ent_t *dc_lru;
+static size_t dc_nents;
+
+static int
+dc_cmp(const void *l, const void *r)
+{
+	const dc_ent_t *le = l;
+	const dc_ent_t *re = r;
+
+	if (le->dc_kind != re->dc_kind) {
+		return (le->dc_kind < re->dc_kind ? -1 : 1);
+	}
+	if (le->dc_scope != re->dc_scope) {
+		return (le->dc_scope < re->dc_scope ? -1 : 1);
+	}
+	return (0);
+}
+
+static void
+dc_unlink(dc_ent_t *e)
+{
+	if (e->dc_prev != NULL) {
+		e->dc_prev->dc_next = e->dc_next;
+	} else {
+		dc_mru = e->dc_next;
+	}
+	if (e->dc_next != NULL) {
+		e->dc_next->dc_prev = e->dc_prev;
+	} else {
+		dc_lru = e->dc_prev;
+	}
+	e->dc_prev = NULL;
+	e->dc_next = NULL;
+}
+
+static void
+dc_push(dc_ent_t *e)
+{
+	e->dc_prev = NULL;
+	e->dc_next = dc_mru;
+	if (dc_mru != NULL) {
+		dc_mru->dc_prev = e;
+	} else {
+		dc_lru = e;
+	}
+	dc_mru = e;
+}
+
+static void
+dc_evict(dc_ent_t *e)
+{
+	dc_unlink(e);
+	avl_remove(&dc_tree, e);
+	close(e->dc_fd);
+	umem_free(e, sizeof (dc_ent_t));
+	dc_nents--;
+}
+
+static int
+dc_lookup(dc_kind_t kind, scope_t s)
+{
+	dc_ent_t key;
+	dc_ent_t *e;
+
+	key.dc_kind = kind;
+	key.dc_scope = s;
+	e = avl_find(&dc_tree, &key, NULL);
+	if (e == NULL) {
+		return (-1);
+	}
+	PLAN_DCACHE_HIT(kind, s);
+	if (e != dc_mru) {
+		dc_unlink(e);
+		dc_push(e);
+	}
+	return (e->dc_fd);
+}
+
+static void
+dc_insert(dc_kind_t kind, scope_t s, int fd)
+{
+	dc_ent_t *e;
+
+	if (dc_nents == DC_MAX) {
+		dc_evict(dc_lru);
+	}
+	e = umem_zalloc(sizeof (dc_ent_t), UMEM_NOFAIL);
+	e->dc_kind = kind;
+	e->dc_scope = s;
+	e->dc_fd = fd;
+	avl_add(&dc_tree, e);
+	dc_push(e);
+	dc_nents++;
+}
+
+/*
+ * The WAL truncates itself once the store has made its changes durable (see
+ * plan_wal.c), so xattr_flush() has to wait for the writes to reach the disk.
+ * sync() doesn't (on illumos it only schedules them), and fsync'ing every
+ * file as it's written would cost a sync write per activity. So the attrs we
+ * write are kept open here, along with the directories we add entries to, and
+ * xattr_flush() fsyncs them all at once. If too many pile up between
+ * flushes, we flush early.
+ */
+#define	XD_MAX	64
+
+static int xd_fds[XD_MAX];
+static size_t xd_nfds;
+
+static void
+xattr_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < xd_nfds; i++) {
+		(void) fsync(xd_fds[i]);
+		close(xd_fds[i]);
+	}
+	xd_nfds = 0;
+}
+
+/*
+ * Takes ownership of `fd`, which is closed by the next flush.
+ */
+static void
+xattr_dirty(int fd)
+{
+	if (fd == -1) {
+		return;
+	}
+	if (xd_nfds == XD_MAX) {
+		xattr_flush();
+	}
+	xd_fds[xd_nfds++] = fd;
+}
+
+/*
+ * Listing a range of dates would otherwise mean probing dates/YYYY/MM/DD for
+ * every date in the range, although most dates have nothing on them. So we
+ * keep an index of the dates that exist in ~/.plandb/dates.idx: a magic
+ * string followed by a record per year, each a bitmap with one bit per day of
+ * the year. The records are kept in the order the years were first used, and
+ * updated in place.
+ *
+ * A date is marked in the index before its directory is created, so the
+ * index never misses a date (though, after a crash, it may name a date whose
+ * directory was never created). If the index is missing or doesn't make
+ * sense, we rebuild it from the dates directory.
+ */
+#define	DI_MAGIC	"PLANDIX1"
+#define	DI_MAGICLEN	8
+#define	DI_NBYTES	46	/* 366 bits */
+
+typedef struct di_year {
+	uint16_t	dy_year;
+	uint8_t		dy_bits[DI_NBYTES];
+} di_year_t;
+
+static const short di_mdays[] =
+	{0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};
+
+static int di_fd = -1;
+static di_year_t *di_years;
+static size_t di_nyears;
+
+static void xattr_walk_dir(int, int, scope_t, scope_walk_f, void *);
+static void xattr_occ_drop(scope_t);
+
+static int
+di_leap(int y)
+{
+	return ((y % 4 == 0 && y % 100 != 0) || y % 400 == 0);
+}
+
+/*
+ * Day of the year (0-365) of a date scope.
+ */
+static int
+di_yday(scope_t s)
+{
+	int y = s / 10000;
+	int m = (s / 100) % 100;
+
+	if (m < 1 || m > 12) {
+		return (-1);
+	}
+	return (di_mdays[m - 1] + (s % 100) - 1 + (m > 2 && di_leap(y)));
+}
+
+static scope_t
+di_scope(int y, int yday)
+{
+	int m = 1;
+
+	if (yday > 59 && di_leap(y)) {
+		yday--;
+	} else if (yday == 59 && di_leap(y)) {
+		return (y * 10000 + 229);
+	}
+	while (m < 12 && yday >= di_mdays[m]) {
+		m++;
+	}
+	return (y * 10000 + m * 100 + yday - di_mdays[m - 1] + 1);
+}
+
+static di_year_t *
+di_find(int y)
+{
+	size_t i;
+
+	for (i = 0; i < di_nyears; i++) {
+		if (di_years[i].dy_year == y) {
+			return (&di_years[i]);
+		}
+	}
+	return (NULL);
+}
+
+static di_year_t *
+di_add(int y)
+{
+	di_year_t *ny = umem_zalloc((di_nyears + 1) * sizeof (di_year_t),
+	    UMEM_NOFAIL);
+
+	if (di_nyears != 0) {
+		bcopy(di_years, ny, di_nyears * sizeof (di_year_t));
+		umem_free(di_years, di_nyears * sizeof (di_year_t));
+	}
+	di_years = ny;
+	ny = &di_years[di_nyears++];
+	ny->dy_year = y;
+	return (ny);
+}
+
+static void
+di_reset(void)
+{
+	if (di_nyears != 0) {
+		umem_free(di_years, di_nyears * sizeof (di_year_t));
+	}
+	di_years = NULL;
+	di_nyears = 0;
+}
+
+static void
+di_set(scope_t s)
+{
+	di_year_t *dy;
+	int yday = di_yday(s);
+
+	if (yday == -1) {
+		return;
+	}
+	if ((dy = di_find(s / 10000)) == NULL) {
+		dy = di_add(s / 10000);
+	}
+	dy->dy_bits[yday / NBBY] |= 1 << (yday % NBBY);
+}
+
+static int
+di_test(scope_t s)
+{
+	di_year_t *dy = di_find(s / 10000);
+	int yday = di_yday(s);
+
+	if (dy == NULL || yday == -1) {
+		return (0);
+	}
+	return ((dy->dy_bits[yday / NBBY] & (1 << (yday % NBBY))) != 0);
+}
+
+static void
+di_lock(short type)
+{
+	struct flock fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	(void) fcntl(di_fd, F_SETLKW, &fl);
+}
+
+/*
+ * Reads the index into memory. Returns -1 if it isn't a valid index.
+ */
+static int
+di_load(void)
+{
+	char magic[DI_MAGICLEN];
+	struct stat st;
+	size_t i;
+
+	di_reset();
+	if (fstat(di_fd, &st) == -1 || st.st_size < DI_MAGICLEN ||
+	    (st.st_size - DI_MAGICLEN) % sizeof (di_year_t) != 0 ||
+	    pread(di_fd, magic, DI_MAGICLEN, 0) != DI_MAGICLEN ||
+	    bcmp(magic, DI_MAGIC, DI_MAGICLEN) != 0) {
+		return (-1);
+	}
+	if ((i = (st.st_size - DI_MAGICLEN) / sizeof (di_year_t)) == 0) {
+		return (0);
+	}
+	di_years = umem_alloc(i * sizeof (di_year_t), UMEM_NOFAIL);
+	di_nyears = i;
+	if (pread(di_fd, di_years, i * sizeof (di_year_t), DI_MAGICLEN) !=
+	    i * sizeof (di_year_t)) {
+		di_reset();
+		return (-1);
+	}
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+di_build_cb(void *arg, scope_t s)
+{
+	di_set(s);
+}
+
+static void
+di_build(void)
+{
+	di_reset();
+	xattr_walk_dir(dup(dates_fd), 0, 0, di_build_cb, NULL);
+	(void) ftruncate(di_fd, 0);
+	(void) pwrite(di_fd, DI_MAGIC, DI_MAGICLEN, 0);
+	if (di_nyears != 0) {
+		(void) pwrite(di_fd, di_years, di_nyears * sizeof (di_year_t),
+		    DI_MAGICLEN);
+	}
+	fsync(di_fd);
+}
+
+static void
+di_open(int pdb_fd)
+{
+	if ((di_fd = openat(pdb_fd, "dates.idx", O_RDWR | O_CREAT,
+	    S_IRUSR | S_IWUSR)) == -1) {
+		return;
+	}
+	di_lock(F_WRLCK);
+	if (di_load() == -1) {
+		di_build();
+	}
+	di_lock(F_UNLCK);
+}
+
+/*
+ * Marks a date in the index. Another process may have added years to the
+ * index since we read it, so we reread it under the lock before writing our
+ * record back.
+ */
+static void
+di_mark(scope_t s)
+{
+	di_year_t *dy;
+
+	if (di_fd == -1 || di_test(s)) {
+		return;
+	}
+	di_lock(F_WRLCK);
+	if (di_load() == -1) {
+		di_build();
+	}
+	if (!di_test(s)) {
+		di_set(s);
+		dy = di_find(s / 10000);
+		(void) pwrite(di_fd, dy, sizeof (di_year_t), DI_MAGICLEN +
+		    (dy - di_years) * sizeof (di_year_t));
+	}
+	di_lock(F_UNLCK);
+}
+
+/*
+ * Returns the (cached) fd of a directory. The year and month directories
+ * are keyed by YYYY and YYYYMM. If `create` is set, missing directories are
+ * created along the way; otherwise we return -1.
+ */
+static int
+dc_open(dc_kind_t kind, scope_t s, int create)
+{
+	char buf[5];
+	char *name = buf;
+	int pfd;
+	int fd;
+
+	if ((fd = dc_lookup(kind, s)) != -1) {
+		return (fd);
+	}
+	PLAN_DCACHE_MISS(kind, s);
+
+	switch (kind) {
+
+	case DC_YEAR:
+		pfd = dates_fd;
+		(void) snprintf(buf, sizeof (buf), "%04d", s);
+		break;
+
+	case DC_MONTH:
+		pfd = dc_open(DC_YEAR, s / 100, create);
+		(void) snprintf(buf, sizeof (buf), "%02d", s % 100);
+		break;
+
+	case DC_SCOPE:
+		if (PS_ISDATE(s)) {
+			pfd = dc_open(DC_MONTH, s / 100, create);
+			(void) snprintf(buf, sizeof (buf), "%02d", s % 100);
+		} else if (s >= SUN && s <= SAT) {
+			pfd = days_fd;
+			name = daypath[s];
+		} else {
+			return (-1);
+		}
+		break;
+
+	case DC_ACTS:
+		pfd = dc_open(DC_SCOPE, s, create);
+		name = "acts";
+		break;
+
+	case DC_TODOS:
+		/*
+		 * The general todo list lives in ~/.plandb/todos, which is
+		 * always open.
+		 */
+		if (s == PS_GENERAL) {
+			return (todos_fd);
+		}
+		pfd = dc_open(DC_SCOPE, s, create);
+		name = "todos";
+		break;
+
+	default:
+		return (-1);
+	}
+
+	if (pfd == -1) {
+		return (-1);
+	}
+	if (create) {
+		if (kind == DC_SCOPE && PS_ISDATE(s)) {
+			di_mark(s);
+		}
+		if (mkdirat(pfd, name, ALLRWX) == 0) {
+			xattr_dirty(dup(pfd));
+		}
+	}
+	if ((fd = openat(pfd, name, O_RDONLY)) == -1) {
+		return (-1);
+	}
+	dc_insert(kind, s, fd);
+	return (fd);
+}
+
+static int
+havedate(scope_t s)
+{
+	if (di_fd != -1 && !di_test(s)) {
+		return (0);
+	}
+	return (dc_open(DC_SCOPE, s, 0) != -1);
+}
+
+static int
+openscope(scope_t s)
+{
+	return (dc_open(DC_SCOPE, s, 1));
+}
+
+/*
+ * Opens the acts/ or todos/ directory of a scope.
+ */
+static int
+openscope_acts(scope_t s)
+{
+	return (dc_open(DC_ACTS, s, 1));
+}
+
+static int
+openscope_todos(scope_t s)
+{
+	return (dc_open(DC_TODOS, s, 1));
+}
+
+/*
+ * Opens a scope's acts/ or todos/ directory for reading with readdir. The
+ * DIR gets its own fd, since closedir() closes it. The new fd shares its
+ * offset with the cached one, so we have to rewind it.
+ */
+static DIR *
+opendir_dup(int fd)
+{
+	DIR *dir;
+	int dfd;
+
+	if (fd == -1 || (dfd = dup(fd)) == -1) {
+		return (NULL);
+	}
+	if ((dir = fdopendir(dfd)) == NULL) {
+		close(dfd);
+		return (NULL);
+	}
+	rewinddir(dir);
+	return (dir);
+}
+
+static int
+xattr_open(int pdb_fd)
+{
+	avl_create(&dc_tree, dc_cmp, sizeof (dc_ent_t),
+	    offsetof(dc_ent_t, dc_avl));
+	di_open(pdb_fd);
+	return (0);
+}
+
+static void
+xattr_close(void)
+{
+	while (dc_lru != NULL) {
+		dc_evict(dc_lru);
+	}
+	avl_destroy(&dc_tree);
+	while (xd_nfds > 0) {
+		close(xd_fds[--xd_nfds]);
+	}
+	di_reset();
+	if (di_fd != -1) {
+		close(di_fd);
+		di_fd = -1;
+	}
+}
+
+/*
+ * The directory fds we cache stay valid, but other processes may have added
+ * dates to the index.
+ */
+static void
+xattr_sync(void)
+{
+	if (di_fd != -1) {
+		di_lock(F_RDLCK);
+		(void) di_load();
+		di_lock(F_UNLCK);
+	}
+}
+
+static int
+xattr_have(scope_t s)
+{
+	if (PS_ISDATE(s)) {
+		return (havedate(s));
+	}
+	return (1);
+}
+
+static void
+xattr_walk_dir(int fd, int depth, scope_t s, scope_walk_f cb, void *arg)
+{
+	struct dirent *de;
+	DIR *dir = fdopendir(fd);
+
+	if (dir == NULL) {
+		close(fd);
+		return;
+	}
+	rewinddir(dir);
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		scope_t ns = (s * 100) + atoi(de->d_name);
+		if (depth == 2) {
+			cb(arg, ns);
+			continue;
+		}
+		int nfd = openat(fd, de->d_name, O_RDONLY);
+		if (nfd != -1) {
+			xattr_walk_dir(nfd, depth + 1, ns, cb, arg);
+		}
+	}
+	closedir(dir);
+}
+
+/*
+ * Calls `cb` once for every weekday, every date that has a directory, and the
+ * general todo list.
+ */
+static void
+xattr_walk(scope_walk_f cb, void *arg)
+{
+	day_t d = SUN;
+
+	while (d <= SAT) {
+		cb(arg, d);
+		d++;
+	}
+	xattr_walk_dir(dup(dates_fd), 0, 0, cb, arg);
+	cb(arg, PS_GENERAL);
+}
+
+/*
+ * Calls `cb` for every date from `from` to `to` that has a directory, going
+ * by the index (and checking that the directory is really there, in case it
+ * names a date that was never created).
+ */
+static void
+xattr_range(scope_t from, scope_t to, scope_walk_f cb, void *arg)
+{
+	di_year_t *dy;
+	int y, yday, last;
+
+	if (di_fd == -1) {
+		return;
+	}
+	for (y = from / 10000; y <= to / 10000; y++) {
+		if ((dy = di_find(y)) == NULL) {
+			continue;
+		}
+		yday = (y == from / 10000) ? di_yday(from) : 0;
+		last = (y == to / 10000) ? di_yday(to) : DI_NBYTES * NBBY - 1;
+		while (yday != -1 && yday <= last) {
+			if (dy->dy_bits[yday / NBBY] == 0) {
+				yday = (yday / NBBY + 1) * NBBY;
+				continue;
+			}
+			if ((dy->dy_bits[yday / NBBY] & (1 << (yday % NBBY))) &&
+			    dc_open(DC_SCOPE, di_scope(y, yday), 0) != -1) {
+				cb(arg, di_scope(y, yday));
+			}
+			yday++;
+		}
+	}
+}
+
+static void
+xattr_awake_get(scope_t s, size_t *base, size_t *off)
+{
+	int dfd = openscope(s);
+	int awake_xattr = openat(dfd, "awake", O_XATTR | O_RDONLY);
+	/*
+	 * If this day has no awake attr we apparently have full day on our
+	 * hands.
+	 */
+	if (awake_xattr == -1) {
+		*base = 0;
+		*off = plan_slots;
+	} else {
+		atomic_read(awake_xattr, base, sizeof (size_t));
+		atomic_read(awake_xattr, off, sizeof (size_t));
+	}
+	close(awake_xattr);
+}
+
+static void
+xattr_awake_put(scope_t s, size_t base, size_t off)
+{
+	int dfd = openscope(s);
+	int awake_xattr = openat(dfd, "awake",
+				O_XATTR | O_CREAT | O_RDWR, ALLRWX);
+
+	atomic_write(awake_xattr, &base, sizeof (size_t));
+	atomic_write(awake_xattr, &off, sizeof (size_t));
+	xattr_dirty(awake_xattr);
+}
+
+/*
+ * An activity's dyn flag, duration and chunk start times are packed into a
+ * single "rec" attr, so that reading or writing them is one open and one
+ * read or write (rather than an open, a read and a close for each of the
+ * "time", "dur" and "dyn" attrs we used to keep). The header is followed by
+ * xr_ntimes start times. An activity with chunk constraints has XR_FCHUNK
+ * set, and an xattr_chunk_t between the header and the times (the others
+ * are laid out as they always were). There can be as many chunks as there
+ * are slots in a day (up to RES_DAYSECS of them), but a buffer that big
+ * doesn't belong on the stack, so we read up to XR_NBUF times along with the
+ * header, and read any others straight into the act_rec_t.
+ */
+#define	XR_NBUF		1440
+
+typedef struct xattr_rec {
+	uint64_t	xr_dur;
+	uint32_t	xr_ntimes;
+	uint8_t		xr_dyn;
+	uint8_t		xr_flags;
+	uint8_t		xr_pad[2];
+} xattr_rec_t;
+
+#define	XR_FCHUNK	0x1
+
+typedef struct xattr_chunk {
+	uint32_t	xc_gap;
+	uint32_t	xc_spread;
+} xattr_chunk_t;
+
+#define	XR_HDR(f)	(sizeof (xattr_rec_t) + \
+	(((f) & XR_FCHUNK) ? sizeof (xattr_chunk_t) : 0))
+#define	XR_SIZE(f, n)	(XR_HDR(f) + (n) * sizeof (int32_t))
+
+static int
+xattr_rec_write(int act_fd, act_rec_t *r)
+{
+	char buf[XR_SIZE(XR_FCHUNK, XR_NBUF)];
+	xattr_rec_t xr;
+	xattr_chunk_t xc;
+	size_t n = r->ar_ntimes;
+	size_t hz;
+	int fd;
+
+	if (n > RES_DAYSECS) {
+		n = RES_DAYSECS;
+	}
+	bzero(&xr, sizeof (xr));
+	xr.xr_dur = r->ar_dur;
+	xr.xr_ntimes = n;
+	xr.xr_dyn = r->ar_dyn;
+	if (r->ar_gap != 0 || r->ar_spread != 0) {
+		xr.xr_flags |= XR_FCHUNK;
+	}
+	xc.xc_gap = r->ar_gap;
+	xc.xc_spread = r->ar_spread;
+	hz = XR_HDR(xr.xr_flags);
+	bcopy(&xr, buf, sizeof (xr));
+	bcopy(&xc, buf + sizeof (xr), hz - sizeof (xr));
+
+	fd = openat(act_fd, "rec", O_XATTR | O_CREAT | O_TRUNC | O_WRONLY,
+	    ALLRWX);
+	if (fd == -1) {
+		return (-1);
+	}
+	if (n <= XR_NBUF) {
+		bcopy(r->ar_time, buf + hz, n * sizeof (int32_t));
+		atomic_write(fd, buf, hz + n * sizeof (int32_t));
+	} else {
+		atomic_write(fd, buf, hz);
+		atomic_write(fd, r->ar_time, n * sizeof (int32_t));
+	}
+	xattr_dirty(fd);
+	return (0);
+}
+
+/*
+ * Returns -1 if the activity has no (valid) "rec" attr.
+ */
+static int
+xattr_rec_read(int act_fd, act_rec_t *r)
+{
+	char buf[XR_SIZE(XR_FCHUNK, XR_NBUF)];
+	xattr_rec_t xr;
+	xattr_chunk_t xc;
+	ssize_t len;
+	size_t hz;
+	size_t n;
+	int fd = openat(act_fd, "rec", O_XATTR | O_RDONLY);
+
+	if (fd == -1) {
+		return (-1);
+	}
+	len = read(fd, buf, sizeof (buf));
+	bcopy(buf, &xr, sizeof (xr));
+	hz = XR_HDR(xr.xr_flags);
+	if (len < (ssize_t)sizeof (xr) || xr.xr_ntimes > RES_DAYSECS ||
+	    len != MIN(sizeof (buf), XR_SIZE(xr.xr_flags, xr.xr_ntimes))) {
+		close(fd);
+		return (-1);
+	}
+	act_rec_init(r, xr.xr_ntimes);
+	r->ar_dur = xr.xr_dur;
+	r->ar_dyn = xr.xr_dyn;
+	if (xr.xr_flags & XR_FCHUNK) {
+		bcopy(buf + sizeof (xr), &xc, sizeof (xc));
+		r->ar_gap = xc.xc_gap;
+		r->ar_spread = xc.xc_spread;
+	}
+
+	/*
+	 * The first read took in as many of the times as fit in buf.
+	 */
+	n = (len - hz) / sizeof (int32_t);
+	bcopy(buf + hz, r->ar_time, n * sizeof (int32_t));
+	if (n < xr.xr_ntimes) {
+		len = read(fd, r->ar_time + n,
+		    (xr.xr_ntimes - n) * sizeof (int32_t));
+		if (len != (xr.xr_ntimes - n) * sizeof (int32_t)) {
+			close(fd);
+			act_rec_free(r);
+			return (-1);
+		}
+	}
+	close(fd);
+	return (0);
+}
+
+/*
+ * Activities created before there was a "rec" attr have separate "time",
+ * "dur" and "dyn" attrs. The first time we read such an activity, we pack
+ * them into a "rec", and remove them. Returns -1 if the old attrs aren't
+ * there (which also happens if another process has just migrated it).
+ */
+static int
+xattr_act_migrate(int act_fd, act_rec_t *r)
+{
+	struct stat time_stat;
+	int time_xattr = openat(act_fd, "time", O_XATTR | O_RDONLY);
+	int dur_xattr = openat(act_fd, "dur", O_XATTR | O_RDONLY);
+	int dyn_xattr = openat(act_fd, "dyn", O_XATTR | O_RDONLY);
+	int attr_dir;
+	int ret = -1;
+
+	if (time_xattr != -1 && dur_xattr != -1 && dyn_xattr != -1) {
+		fstat(time_xattr, &time_stat);
+		act_rec_init(r, (time_stat.st_size)/sizeof (int));
+		atomic_read(time_xattr, r->ar_time,
+		    r->ar_ntimes * sizeof (int));
+		atomic_read(dur_xattr, &r->ar_dur, sizeof (size_t));
+		atomic_read(dyn_xattr, &r->ar_dyn, sizeof (char));
+		ret = 0;
+	}
+	if (time_xattr != -1) {
+		close(time_xattr);
+	}
+	if (dur_xattr != -1) {
+		close(dur_xattr);
+	}
+	if (dyn_xattr != -1) {
+		close(dyn_xattr);
+	}
+	if (ret != 0 || xattr_rec_write(act_fd, r) != 0) {
+		return (ret);
+	}
+
+	if ((attr_dir = openat(act_fd, ".", O_XATTR | O_RDONLY)) != -1) {
+		(void) unlinkat(attr_dir, "time", 0);
+		(void) unlinkat(attr_dir, "dur", 0);
+		(void) unlinkat(attr_dir, "dyn", 0);
+		close(attr_dir);
+	}
+	return (0);
+}
+
+static int
+xattr_act_create(scope_t s, char *n)
+{
+	act_rec_t r;
+	int adfd = openscope_acts(s);
+	int afd = openat(adfd, n, O_RDWR, ALLRWX);
+	if (afd != -1) {
+		close(afd);
+		return (-1);
+	}
+	afd = openat(adfd, n, O_CREAT | O_RDWR, ALLRWX);
+	if (afd == -1) {
+		return (-1);
+	}
+	act_rec_init(&r, 1);
+	(void) xattr_rec_write(afd, &r);
+	act_rec_free(&r);
+	close(afd);
+	xattr_occ_drop(s);
+	return (0);
+}
+
+static int
+xattr_unlink(int dfd, char *n)
+{
+	int uaret = unlinkat(dfd, n, 0);
+	return (uaret == -1 ? -1 : 0);
+}
+
+static int
+xattr_rename(int dfd, char *old, char *new)
+{
+	int nfd = openat(dfd, new, O_RDONLY);
+	if (nfd >= 0) {
+		close(nfd);
+		return (-1);
+	}
+	renameat(dfd, old, dfd, new);
+	return (0);
+}
+
+static int
+xattr_act_destroy(scope_t s, char *n)
+{
+	if (xattr_unlink(openscope_acts(s), n) != 0) {
+		return (-1);
+	}
+	xattr_occ_drop(s);
+	return (0);
+}
+
+static int
+xattr_act_rename(scope_t s, char *old, char *new)
+{
+	return (xattr_rename(openscope_acts(s), old, new));
+}
+
+/*
+ * Reads the record of the activity open at `act_fd`, migrating it to a
+ * "rec" attr if need be.
+ */
+static void
+xattr_act_read(int act_fd, act_rec_t *r)
+{
+	if (xattr_rec_read(act_fd, r) == 0 ||
+	    xattr_act_migrate(act_fd, r) == 0 ||
+	    xattr_rec_read(act_fd, r) == 0) {
+		return;
+	}
+	act_rec_init(r, 1);
+}
+
+static int
+xattr_act_get(scope_t s, char *n, act_rec_t *r)
+{
+	int adfd = openscope_acts(s);
+	int afd = openat(adfd, n, O_RDWR);
+	if (afd == -1) {
+		return (-1);
+	}
+	xattr_act_read(afd, r);
+	close(afd);
+	return (0);
+}
+
+static int
+xattr_act_put(scope_t s, char *n, act_rec_t *r)
+{
+	int adfd = openscope_acts(s);
+	int afd = openat(adfd, n, O_RDWR);
+	if (afd == -1) {
+		return (-1);
+	}
+
+	int ret = xattr_rec_write(afd, r);
+	close(afd);
+	if (ret == 0) {
+		xattr_occ_drop(s);
+	}
+	return (ret);
+}
+
+/*
+ * Details are stored in the contents of the activity or todo file.
+ */
+static int
+xattr_det(int dfd, char *n, char *det)
+{
+	int fd = openat(dfd, n, O_RDWR | O_TRUNC);
+	if (fd == -1) {
+		return (-1);
+	}
+	size_t strsz = strlen(det);
+	atomic_write(fd, det, strsz);
+	close(fd);
+	return (0);
+}
+
+static int
+xattr_act_det(scope_t s, char *n, char *det)
+{
+	return (xattr_det(openscope_acts(s), n, det));
+}
+
+/*
+ * Reads the contents of `fd` into a NUL-terminated buffer, whose size is
+ * returned in `*len`. Empty files yield NULL.
+ */
+static char *
+read_det(int fd, size_t *len)
+{
+	struct stat det_stat;
+	char *det = NULL;
+
+	fstat(fd, &det_stat);
+	*len = det_stat.st_size + 1; /* +1 for \0 */
+	if (*len - 1) {
+		det = umem_zalloc(*len, UMEM_NOFAIL);
+		atomic_read(fd, det, *len - 1);
+	}
+	return (det);
+}
+
+static void
+xattr_act_walk(scope_t s, int det, act_walk_f cb, void *arg)
+{
+	struct dirent *de = NULL;
+	DIR *acts_dir = opendir_dup(openscope_acts(s));
+	act_rec_t r;
+	char *d;
+	size_t len;
+
+	if (acts_dir == NULL) {
+		return;
+	}
+	int afd = dirfd(acts_dir);
+
+	while ((de = readdir(acts_dir)) != NULL) {
+		/*
+		 * We skip the '.' and '..' dirents.
+		 */
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0) {
+			continue;
+		}
+
+		int act_fd = openat(afd, de->d_name, O_RDWR);
+		if (act_fd == -1) {
+			perror("act_fd");
+			exit(0);
+		}
+
+		xattr_act_read(act_fd, &r);
+		d = NULL;
+		if (det) {
+			d = read_det(act_fd, &len);
+		}
+		close(act_fd);
+
+		cb(arg, de->d_name, &r, d);
+
+		if (d) {
+			umem_free(d, len);
+		}
+	}
+	closedir(acts_dir);
+}
+
+/*
+ * There's no cheaper way to count a scope's activities than to read its
+ * directory, but that's still much cheaper than the walk, which opens each
+ * one and reads its attrs.
+ */
+static size_t
+xattr_act_count(scope_t s)
+{
+	struct dirent *de = NULL;
+	DIR *acts_dir = opendir_dup(openscope_acts(s));
+	size_t n = 0;
+
+	if (acts_dir == NULL) {
+		return (0);
+	}
+	while ((de = readdir(acts_dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0) {
+			continue;
+		}
+		n++;
+	}
+	closedir(acts_dir);
+	return (n);
+}
+
+/*
+ * A day's occupancy (see plan_occ.c) is the "occ" attr of its directory.
+ * Anything that changes one of the day's activities removes it, and the
+ * removal is synced with the rest of the changes, so that an occupancy that
+ * no longer matches the activities can't come back after a crash.
+ */
+static int
+xattr_occ_get(scope_t s, void *buf, size_t len)
+{
+	struct stat st;
+	int dfd = dc_open(DC_SCOPE, s, 0);
+	int fd;
+	int ret = -1;
+
+	if (dfd == -1 || (fd = openat(dfd, "occ", O_XATTR | O_RDONLY)) == -1) {
+		return (-1);
+	}
+	if (fstat(fd, &st) == 0 && st.st_size == len &&
+	    read(fd, buf, len) == len) {
+		ret = 0;
+	}
+	close(fd);
+	return (ret);
+}
+
+static void
+xattr_occ_put(scope_t s, void *buf, size_t len)
+{
+	int dfd = dc_open(DC_SCOPE, s, 0);
+	int fd;
+
+	if (dfd == -1 || (fd = openat(dfd, "occ",
+	    O_XATTR | O_CREAT | O_TRUNC | O_WRONLY, ALLRWX)) == -1) {
+		return;
+	}
+	atomic_write(fd, buf, len);
+	xattr_dirty(fd);
+}
+
+static void
+xattr_occ_drop(scope_t s)
+{
+	int dfd = dc_open(DC_SCOPE, s, 0);
+	int afd;
+
+	if (dfd == -1 ||
+	    (afd = openat(dfd, ".", O_XATTR | O_RDONLY)) == -1) {
+		return;
+	}
+	if (unlinkat(afd, "occ", 0) == 0) {
+		xattr_dirty(afd);
+	} else {
+		close(afd);
+	}
+}
+
+static int
+xattr_todo_create(scope_t s, char *n)
+{
+	int tdfd = openscope_todos(s);
+
+	int tfd = openat(tdfd, n, O_RDWR, ALLRWX);
+	if (tfd != -1) {
+		close(tfd);
+		return (-1);
+	}
+	int tval = 0;
+	tfd = openat(tdfd, n, O_CREAT | O_RDWR, ALLRWX);
+	if (tfd == -1) {
+		perror("ctodo");
+		exit(0);
+	}
+	int time_xattr = openat(tfd, "time",
+		O_XATTR | O_CREAT | O_RDWR, ALLRWX);
+	if (time_xattr == -1) {
+		perror("ctodo");
+		exit(0);
+	}
+	atomic_write(time_xattr, &tval, sizeof (int));
+	close(tfd);
+	close(time_xattr);
+	return (0);
+}
+
+static int
+xattr_todo_destroy(scope_t s, char *n)
+{
+	return (xattr_unlink(openscope_todos(s), n));
+}
+
+static int
+xattr_todo_rename(scope_t s, char *old, char *new)
+{
+	return (xattr_rename(openscope_todos(s), old, new));
+}
+
+static int
+xattr_todo_time(scope_t s, char *n, int time)
+{
+	int tdfd = openscope_todos(s);
+	int tfd = openat(tdfd, n, O_RDWR);
+	if (tfd == -1) {
+		return (-1);
+	}
+	int time_xattr = openat(tfd, "time", O_XATTR | O_CREAT | O_RDWR,
+		ALLRWX);
+	atomic_write(time_xattr, &time, sizeof (int));
+	close(tfd);
+	xattr_dirty(time_xattr);
+	return (0);
+}
+
+static int
+xattr_todo_det(scope_t s, char *n, char *det)
+{
+	return (xattr_det(openscope_todos(s), n, det));
+}
+
+static void
+xattr_todo_walk(scope_t s, int det, todo_walk_f cb, void *arg)
+{
+	struct dirent *de = NULL;
+	DIR *todos_dir = opendir_dup(openscope_todos(s));
+	int time;
+	char *d;
+	size_t len;
+
+	if (todos_dir == NULL) {
+		return;
+	}
+	int tfd = dirfd(todos_dir);
+
+	while ((de = readdir(todos_dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0) {
+			continue;
+		}
+		int todo_fd = openat(tfd, de->d_name, O_RDWR);
+		int time_xattr = openat(todo_fd, "time",
+			O_XATTR | O_RDWR | O_CREAT, ALLRWX);
+
+		time = 0;
+		atomic_read(time_xattr, &time, sizeof (int));
+		d = NULL;
+		if (det) {
+			d = read_det(todo_fd, &len);
+		}
+		close(time_xattr);
+		close(todo_fd);
+
+		cb(arg, de->d_name, time, d);
+
+		if (d) {
+			umem_free(d, len);
+		}
+	}
+	closedir(todos_dir);
+}
+
+plan_store_t xattr_store = {
+	"xattr",
+	xattr_open,
+	xattr_close,
+	xattr_sync,
+	xattr_flush,
+	xattr_have,
+	xattr_walk,
+	xattr_range,
+	xattr_awake_get,
+	xattr_awake_put,
+	xattr_act_create,
+	xattr_act_destroy,
+	xattr_act_rename,
+	xattr_act_get,
+	xattr_act_put,
+	xattr_act_det,
+	xattr_act_walk,
+	xattr_act_count,
+	xattr_occ_get,
+	xattr_occ_put,
+	xattr_todo_create,
+	xattr_todo_destroy,
+	xattr_todo_rename,
+	xattr_todo_time,
+	xattr_todo_det,
+	xattr_todo_walk,
+};
@@ -0,0 +1,832 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <sys/avl.h>
+#include "plan_impl.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * The text index, for searching the details of activities and todos.
+ * Details are only read from the store when listing with -d, and searching
+ * them would mean reading every activity in the plandb. Instead, we keep an
+ * inverted index from every word that appears in some details, to the
+ * activities and todos (the documents) it appears in, and how often.
+ *
+ * Like the name index (plan_names.c), it lives in an append-only file,
+ * ~/.plandb/text-<store>.idx, that is read into memory on the first search
+ * and rebuilt from the store if it's missing. Each record is one of:
+ *
+ *	TX_SET	a document's details were (re)written; the text follows
+ *	TX_DEL	a document was destroyed
+ *	TX_REN	a document was renamed; the new name follows
+ *
+ * In memory, every document knows its postings, so that rewriting or
+ * removing it only touches the words it contains. A search only visits the
+ * postings of the words it's given, and ranks documents by tf-idf.
+ */
+
+#define	TX_MAGIC	"PLANTXI1"
+#define	TX_MAGICLEN	8
+#define	TX_COMPACT	1024
+#define	TX_MAXWORD	64
+#define	TX_MAXRES	50
+
+typedef enum tx_op {
+	TX_SET = 1,
+	TX_DEL,
+	TX_REN
+} tx_op_t;
+
+typedef struct tx_hdr {
+	char		th_magic[TX_MAGICLEN];
+	uint32_t	th_gen;
+	uint32_t	th_pad;
+} tx_hdr_t;
+
+typedef struct tx_rec {
+	uint8_t		tr_op;
+	uint8_t		tr_kind;
+	uint16_t	tr_nlen;	/* length of the name */
+	int32_t		tr_scope;
+	uint32_t	tr_len;		/* length of the text or new name */
+} tx_rec_t;
+
+struct tx_post;
+
+typedef struct tx_doc {
+	avl_node_t	td_avl;
+	char		*td_name;
+	scope_t		td_scope;
+	nm_kind_t	td_kind;
+	struct tx_post	**td_posts;
+	size_t		td_nposts;
+	double		td_score;	/* during a search */
+} tx_doc_t;
+
+typedef struct tx_term {
+	avl_node_t	tt_avl;
+	char		*tt_word;
+	avl_tree_t	tt_posts;	/* by document */
+} tx_term_t;
+
+typedef struct tx_post {
+	avl_node_t	tp_avl;
+	tx_term_t	*tp_term;
+	tx_doc_t	*tp_doc;
+	uint32_t	tp_tf;
+} tx_post_t;
+
+extern plan_store_t *store;
+extern void atomic_write(int, void*, size_t);
+extern void act_rec_free(act_rec_t *);
+extern void scope_to_tm(scope_t, tm_t *);
+extern char *daystr[];
+
+static int tx_pdb_fd = -1;
+static int tx_fd = -1;
+static char tx_path[32];
+static avl_tree_t tx_docs;
+static avl_tree_t tx_terms;
+static int tx_loaded;
+static uint32_t tx_gen;
+static off_t tx_off;		/* how much of the file is in memory */
+static size_t tx_nrecs;		/* how many records are in the file */
+
+static int
+tx_doc_cmp(const void *l, const void *r)
+{
+	const tx_doc_t *dl = l;
+	const tx_doc_t *dr = r;
+	int c = strcmp(dl->td_name, dr->td_name);
+
+	if (c != 0) {
+		return (c < 0 ? -1 : 1);
+	}
+	if (dl->td_scope != dr->td_scope) {
+		return (dl->td_scope < dr->td_scope ? -1 : 1);
+	}
+	if (dl->td_kind != dr->td_kind) {
+		return (dl->td_kind < dr->td_kind ? -1 : 1);
+	}
+	return (0);
+}
+
+static int
+tx_term_cmp(const void *l, const void *r)
+{
+	int c = strcmp(((tx_term_t *)l)->tt_word, ((tx_term_t *)r)->tt_word);
+
+	if (c != 0) {
+		return (c < 0 ? -1 : 1);
+	}
+	return (0);
+}
+
+static int
+tx_post_cmp(const void *l, const void *r)
+{
+	const tx_post_t *pl = l;
+	const tx_post_t *pr = r;
+
+	if (pl->tp_doc != pr->tp_doc) {
+		return (pl->tp_doc < pr->tp_doc ? -1 : 1);
+	}
+	return (0);
+}
+
+static char *
+tx_strdup(const char *s, size_t len)
+{
+	char *d = umem_zalloc(len + 1, UMEM_NOFAIL);
+
+	bcopy(s, d, len);
+	return (d);
+}
+
+static void
+tx_strfree(char *s)
+{
+	umem_free(s, strlen(s) + 1);
+}
+
+static void
+tx_lock(short type)
+{
+	struct flock fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	(void) fcntl(tx_fd, F_SETLKW, &fl);
+}
+
+/*
+ * Returns the next word in the text at *tp (lower-cased, in `word`), or 0
+ * once there are none left. A word is a run of letters and digits.
+ */
+static int
+tx_word(const char **tp, char *word)
+{
+	const unsigned char *c = (const unsigned char *)*tp;
+	size_t len = 0;
+
+	while (*c != '\0' && !isalnum(*c)) {
+		c++;
+	}
+	if (*c == '\0') {
+		return (0);
+	}
+	while (isalnum(*c)) {
+		if (len < TX_MAXWORD) {
+			word[len++] = tolower(*c);
+		}
+		c++;
+	}
+	word[len] = '\0';
+	*tp = (const char *)c;
+	return (1);
+}
+
+static tx_term_t *
+tx_term(const char *word, int create)
+{
+	tx_term_t key;
+	tx_term_t *tt;
+	avl_index_t where;
+
+	key.tt_word = (char *)word;
+	if ((tt = avl_find(&tx_terms, &key, &where)) != NULL || !create) {
+		return (tt);
+	}
+	tt = umem_alloc(sizeof (tx_term_t), UMEM_NOFAIL);
+	tt->tt_word = tx_strdup(word, strlen(word));
+	avl_create(&tt->tt_posts, tx_post_cmp, sizeof (tx_post_t),
+	    offsetof(tx_post_t, tp_avl));
+	avl_insert(&tx_terms, tt, where);
+	return (tt);
+}
+
+/*
+ * Removes a document's postings, and any terms that are left without
+ * postings.
+ */
+static void
+tx_unpost(tx_doc_t *td)
+{
+	tx_post_t *tp;
+	tx_term_t *tt;
+	size_t i;
+
+	for (i = 0; i < td->td_nposts; i++) {
+		tp = td->td_posts[i];
+		tt = tp->tp_term;
+		avl_remove(&tt->tt_posts, tp);
+		umem_free(tp, sizeof (tx_post_t));
+		if (avl_numnodes(&tt->tt_posts) == 0) {
+			avl_remove(&tx_terms, tt);
+			avl_destroy(&tt->tt_posts);
+			tx_strfree(tt->tt_word);
+			umem_free(tt, sizeof (tx_term_t));
+		}
+	}
+	if (td->td_nposts != 0) {
+		umem_free(td->td_posts, td->td_nposts * sizeof (tx_post_t *));
+	}
+	td->td_posts = NULL;
+	td->td_nposts = 0;
+}
+
+/*
+ * Indexes the words in `text` under the document.
+ */
+static void
+tx_post(tx_doc_t *td, const char *text)
+{
+	char word[TX_MAXWORD + 1];
+	const char *c = text;
+	tx_post_t key;
+	tx_post_t *tp;
+	tx_term_t *tt;
+	avl_index_t where;
+	size_t sz = 0;
+
+	key.tp_doc = td;
+	while (tx_word(&c, word)) {
+		tt = tx_term(word, 1);
+		if ((tp = avl_find(&tt->tt_posts, &key, &where)) != NULL) {
+			tp->tp_tf++;
+			continue;
+		}
+		tp = umem_alloc(sizeof (tx_post_t), UMEM_NOFAIL);
+		tp->tp_term = tt;
+		tp->tp_doc = td;
+		tp->tp_tf = 1;
+		avl_insert(&tt->tt_posts, tp, where);
+
+		if (td->td_nposts * sizeof (tx_post_t *) == sz) {
+			size_t nsz = sz ? sz * 2 : 8 * sizeof (tx_post_t *);
+			tx_post_t **np = umem_alloc(nsz, UMEM_NOFAIL);
+			if (sz) {
+				bcopy(td->td_posts, np, sz);
+				umem_free(td->td_posts, sz);
+			}
+			td->td_posts = np;
+			sz = nsz;
+		}
+		td->td_posts[td->td_nposts++] = tp;
+	}
+
+	/*
+	 * Trim the postings array, so that its size can be worked out from
+	 * td_nposts when it's freed.
+	 */
+	if (sz != td->td_nposts * sizeof (tx_post_t *)) {
+		tx_post_t **np = NULL;
+		if (td->td_nposts != 0) {
+			np = umem_alloc(td->td_nposts * sizeof (tx_post_t *),
+			    UMEM_NOFAIL);
+			bcopy(td->td_posts, np,
+			    td->td_nposts * sizeof (tx_post_t *));
+		}
+		umem_free(td->td_posts, sz);
+		td->td_posts = np;
+	}
+}
+
+static tx_doc_t *
+tx_doc(nm_kind_t kind, scope_t s, char *n, int create)
+{
+	tx_doc_t key;
+	tx_doc_t *td;
+	avl_index_t where;
+
+	key.td_name = n;
+	key.td_scope = s;
+	key.td_kind = kind;
+	if ((td = avl_find(&tx_docs, &key, &where)) != NULL || !create) {
+		return (td);
+	}
+	td = umem_zalloc(sizeof (tx_doc_t), UMEM_NOFAIL);
+	td->td_name = tx_strdup(n, strlen(n));
+	td->td_scope = s;
+	td->td_kind = kind;
+	avl_insert(&tx_docs, td, where);
+	return (td);
+}
+
+static void
+tx_doc_free(tx_doc_t *td)
+{
+	tx_unpost(td);
+	avl_remove(&tx_docs, td);
+	tx_strfree(td->td_name);
+	umem_free(td, sizeof (tx_doc_t));
+}
+
+static void
+tx_clear(void)
+{
+	tx_doc_t *td;
+
+	if (!tx_loaded) {
+		return;
+	}
+	while ((td = avl_first(&tx_docs)) != NULL) {
+		tx_doc_free(td);
+	}
+	avl_destroy(&tx_docs);
+	avl_destroy(&tx_terms);
+	tx_loaded = 0;
+	tx_nrecs = 0;
+}
+
+static void
+tx_init(void)
+{
+	tx_clear();
+	avl_create(&tx_docs, tx_doc_cmp, sizeof (tx_doc_t),
+	    offsetof(tx_doc_t, td_avl));
+	avl_create(&tx_terms, tx_term_cmp, sizeof (tx_term_t),
+	    offsetof(tx_term_t, tt_avl));
+	tx_loaded = 1;
+}
+
+/*
+ * Applies a record to the in-memory index. Details that are empty (or have
+ * no words in them) don't make a document.
+ */
+static void
+tx_apply(tx_op_t op, nm_kind_t kind, scope_t s, char *n, char *arg)
+{
+	tx_doc_t *td = tx_doc(kind, s, n, op == TX_SET);
+	tx_doc_t *nd;
+
+	if (td == NULL) {
+		return;
+	}
+	switch (op) {
+
+	case TX_SET:
+		tx_unpost(td);
+		tx_post(td, arg);
+		if (td->td_nposts == 0) {
+			tx_doc_free(td);
+		}
+		break;
+
+	case TX_DEL:
+		tx_doc_free(td);
+		break;
+
+	case TX_REN:
+		/*
+		 * The new document takes over the old one's postings.
+		 */
+		if (strcmp(n, arg) == 0) {
+			break;
+		}
+		if ((nd = tx_doc(kind, s, arg, 0)) != NULL) {
+			tx_doc_free(nd);
+		}
+		avl_remove(&tx_docs, td);
+		tx_strfree(td->td_name);
+		td->td_name = tx_strdup(arg, strlen(arg));
+		avl_add(&tx_docs, td);
+		break;
+	}
+}
+
+/*
+ * Builds a record. Returns its length; the caller frees the buffer.
+ */
+static size_t
+tx_pack(char **bufp, tx_op_t op, nm_kind_t kind, scope_t s, char *n,
+    char *arg)
+{
+	tx_rec_t r;
+	size_t nlen = strlen(n);
+	size_t len = (arg == NULL) ? 0 : strlen(arg);
+	char *buf = umem_alloc(sizeof (r) + nlen + len, UMEM_NOFAIL);
+
+	r.tr_op = op;
+	r.tr_kind = kind;
+	r.tr_nlen = nlen;
+	r.tr_scope = s;
+	r.tr_len = len;
+	bcopy(&r, buf, sizeof (r));
+	bcopy(n, buf + sizeof (r), nlen);
+	bcopy(arg, buf + sizeof (r) + nlen, len);
+	*bufp = buf;
+	return (sizeof (r) + nlen + len);
+}
+
+/*
+ * Reads the records from tx_off to the end of the file into memory. Called
+ * with the lock held. Returns -1 if the file isn't a valid index.
+ */
+static int
+tx_read(void)
+{
+	struct stat st;
+	tx_hdr_t h;
+	tx_rec_t r;
+	char *buf;
+	char *name;
+	char *arg;
+	size_t sz;
+	size_t off = 0;
+
+	if (fstat(tx_fd, &st) != 0 || st.st_size < sizeof (h) ||
+	    pread(tx_fd, &h, sizeof (h), 0) != sizeof (h) ||
+	    bcmp(h.th_magic, TX_MAGIC, TX_MAGICLEN) != 0) {
+		return (-1);
+	}
+	if (!tx_loaded || h.th_gen != tx_gen || st.st_size < tx_off) {
+		tx_init();
+		tx_gen = h.th_gen;
+		tx_off = sizeof (h);
+	}
+	if ((sz = st.st_size - tx_off) == 0) {
+		return (0);
+	}
+
+	buf = umem_alloc(sz, UMEM_NOFAIL);
+	if (pread(tx_fd, buf, sz, tx_off) != sz) {
+		umem_free(buf, sz);
+		return (-1);
+	}
+	while (off + sizeof (r) <= sz) {
+		bcopy(buf + off, &r, sizeof (r));
+		if (off + sizeof (r) + r.tr_nlen + r.tr_len > sz) {
+			break;
+		}
+		if (r.tr_op < TX_SET || r.tr_op > TX_REN ||
+		    (r.tr_kind != NM_ACT && r.tr_kind != NM_TODO)) {
+			umem_free(buf, sz);
+			return (-1);
+		}
+		name = tx_strdup(buf + off + sizeof (r), r.tr_nlen);
+		arg = tx_strdup(buf + off + sizeof (r) + r.tr_nlen, r.tr_len);
+		tx_apply(r.tr_op, r.tr_kind, r.tr_scope, name, arg);
+		tx_strfree(name);
+		tx_strfree(arg);
+		off += sizeof (r) + r.tr_nlen + r.tr_len;
+		tx_nrecs++;
+	}
+	tx_off += off;
+	umem_free(buf, sz);
+	return (0);
+}
+
+/*
+ * Returns the words of a document, each repeated as many times as it appears
+ * in it. The caller frees the string.
+ */
+static char *
+tx_text(tx_doc_t *td)
+{
+	tx_term_t *tt;
+	char *text;
+	size_t len = 0;
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < td->td_nposts; i++) {
+		tt = td->td_posts[i]->tp_term;
+		len += (strlen(tt->tt_word) + 1) * td->td_posts[i]->tp_tf;
+	}
+	text = umem_zalloc(len + 1, UMEM_NOFAIL);
+	len = 0;
+	for (i = 0; i < td->td_nposts; i++) {
+		tt = td->td_posts[i]->tp_term;
+		for (j = 0; j < td->td_posts[i]->tp_tf; j++) {
+			len += sprintf(text + len, "%s ", tt->tt_word);
+		}
+	}
+	return (text);
+}
+
+/*
+ * Rewrites the index from memory, as a fresh file with a new generation.
+ * Called with the write lock held. We don't keep the details themselves in
+ * memory, only their words, so that's what we write out.
+ */
+static void
+tx_write(void)
+{
+	tx_hdr_t h;
+	tx_doc_t *td;
+	char *buf;
+	char *text;
+	char *rec;
+	size_t bufsz = 4096;
+	size_t len = sizeof (h);
+	size_t rlen;
+
+	buf = umem_alloc(bufsz, UMEM_NOFAIL);
+	bzero(&h, sizeof (h));
+	bcopy(TX_MAGIC, h.th_magic, TX_MAGICLEN);
+	h.th_gen = ++tx_gen;
+	bcopy(&h, buf, sizeof (h));
+	tx_nrecs = 0;
+
+	for (td = avl_first(&tx_docs); td != NULL;
+	    td = AVL_NEXT(&tx_docs, td)) {
+		text = tx_text(td);
+		rlen = tx_pack(&rec, TX_SET, td->td_kind, td->td_scope,
+		    td->td_name, text);
+		tx_strfree(text);
+		if (len + rlen > bufsz) {
+			size_t nsz = bufsz * 2;
+			while (nsz < len + rlen) {
+				nsz *= 2;
+			}
+			char *nbuf = umem_alloc(nsz, UMEM_NOFAIL);
+			bcopy(buf, nbuf, len);
+			umem_free(buf, bufsz);
+			buf = nbuf;
+			bufsz = nsz;
+		}
+		bcopy(rec, buf + len, rlen);
+		umem_free(rec, rlen);
+		len += rlen;
+		tx_nrecs++;
+	}
+
+	ftruncate(tx_fd, 0);
+	atomic_write(tx_fd, buf, len);
+	fsync(tx_fd);
+	tx_off = len;
+	umem_free(buf, bufsz);
+}
+
+typedef struct tx_build {
+	scope_t		tb_scope;
+} tx_build_t;
+
+/* ARGSUSED */
+static void
+tx_build_act(void *arg, char *n, act_rec_t *r, char *det)
+{
+	tx_build_t *tb = arg;
+
+	if (det != NULL) {
+		tx_apply(TX_SET, NM_ACT, tb->tb_scope, n, det);
+	}
+	act_rec_free(r);
+}
+
+/* ARGSUSED */
+static void
+tx_build_todo(void *arg, char *n, int time, char *det)
+{
+	tx_build_t *tb = arg;
+
+	if (det != NULL) {
+		tx_apply(TX_SET, NM_TODO, tb->tb_scope, n, det);
+	}
+}
+
+static void
+tx_build_scope(void *arg, scope_t s)
+{
+	tx_build_t tb;
+
+	tb.tb_scope = s;
+	if (s != PS_GENERAL) {
+		store->ps_act_walk(s, 1, tx_build_act, &tb);
+	}
+	store->ps_todo_walk(s, 1, tx_build_todo, &tb);
+}
+
+void
+text_open(int pdb_fd)
+{
+	tx_pdb_fd = pdb_fd;
+	(void) snprintf(tx_path, sizeof (tx_path), "text-%s.idx",
+	    store->ps_name);
+	tx_fd = openat(pdb_fd, tx_path, O_RDWR | O_APPEND);
+}
+
+void
+text_close(void)
+{
+	tx_clear();
+	if (tx_fd != -1) {
+		close(tx_fd);
+		tx_fd = -1;
+	}
+}
+
+static void
+tx_append(tx_op_t op, nm_kind_t kind, scope_t s, char *n, char *arg)
+{
+	char *buf;
+	size_t len;
+
+	if (tx_fd == -1) {
+		return;
+	}
+	len = tx_pack(&buf, op, kind, s, n, arg);
+	tx_lock(F_WRLCK);
+	atomic_write(tx_fd, buf, len);
+	tx_lock(F_UNLCK);
+	umem_free(buf, len);
+}
+
+void
+text_set(nm_kind_t kind, scope_t s, char *n, char *det)
+{
+	tx_append(TX_SET, kind, s, n, det);
+}
+
+void
+text_del(nm_kind_t kind, scope_t s, char *n)
+{
+	tx_append(TX_DEL, kind, s, n, NULL);
+}
+
+void
+text_rename(nm_kind_t kind, scope_t s, char *old, char *new)
+{
+	tx_append(TX_REN, kind, s, old, new);
+}
+
+/*
+ * Brings the in-memory index up to date with the file, building the file
+ * from the store if there isn't one, and compacting it if it's mostly dead
+ * records.
+ */
+static int
+tx_refresh(void)
+{
+	int err;
+
+	if (tx_fd == -1 && (tx_fd = openat(tx_pdb_fd, tx_path,
+	    O_CREAT | O_RDWR | O_APPEND, ALLRWX)) == -1) {
+		perror(tx_path);
+		return (-1);
+	}
+
+	tx_lock(F_RDLCK);
+	err = tx_read();
+	tx_lock(F_UNLCK);
+
+	if (err != 0 || tx_nrecs > 2 * avl_numnodes(&tx_docs) + TX_COMPACT) {
+		tx_lock(F_WRLCK);
+		if (tx_read() != 0) {
+			tx_init();
+			store->ps_walk(tx_build_scope, NULL);
+		}
+		tx_write();
+		tx_lock(F_UNLCK);
+	}
+	return (0);
+}
+
+static int
+tx_rank_cmp(const void *l, const void *r)
+{
+	const tx_doc_t *dl = *(tx_doc_t **)l;
+	const tx_doc_t *dr = *(tx_doc_t **)r;
+
+	if (dl->td_score != dr->td_score) {
+		return (dl->td_score > dr->td_score ? -1 : 1);
+	}
+	return (tx_doc_cmp(dl, dr));
+}
+
+/*
+ * Searches the details of every activity and todo for the given words, and
+ * prints the ones that have any of them, best match first. Dates outside of
+ * [from, to] are skipped; weekdays and the general todo list never are.
+ *
+ * A document scores (1 + ln tf) * ln(1 + N / df) for every word it has,
+ * where tf is the number of times the word appears in it, N is the number
+ * of documents, and df is the number of documents the word appears in. So
+ * rare words count for more than common ones, and a document with many of
+ * the words beats one with only a few.
+ */
+int
+text_search(char **words, int nwords, scope_t from, scope_t to)
+{
+	char word[TX_MAXWORD + 1];
+	const char *c;
+	tx_term_t *tt;
+	tx_post_t *tp;
+	tx_doc_t *td;
+	tx_doc_t **res = NULL;
+	size_t nres = 0;
+	size_t ressz = 0;
+	double n;
+	double idf;
+	size_t i;
+	int w;
+	char when[40];
+	tm_t t;
+
+	if (tx_refresh() != 0) {
+		return (0);
+	}
+	n = avl_numnodes(&tx_docs);
+
+	for (w = 0; w < nwords; w++) {
+		c = words[w];
+		while (tx_word(&c, word)) {
+			if ((tt = tx_term(word, 0)) == NULL) {
+				continue;
+			}
+			idf = log(1.0 + n / avl_numnodes(&tt->tt_posts));
+			for (tp = avl_first(&tt->tt_posts); tp != NULL;
+			    tp = AVL_NEXT(&tt->tt_posts, tp)) {
+				td = tp->tp_doc;
+				if (PS_ISDATE(td->td_scope) &&
+				    (td->td_scope < from || td->td_scope > to)) {
+					continue;
+				}
+				if (td->td_score == 0) {
+					if (nres * sizeof (tx_doc_t *) == ressz) {
+						size_t nsz = ressz ? ressz * 2 :
+						    64 * sizeof (tx_doc_t *);
+						tx_doc_t **nr = umem_alloc(nsz,
+						    UMEM_NOFAIL);
+						if (ressz) {
+							bcopy(res, nr, ressz);
+							umem_free(res, ressz);
+						}
+						res = nr;
+						ressz = nsz;
+					}
+					res[nres++] = td;
+				}
+				td->td_score += (1.0 + log(tp->tp_tf)) * idf;
+			}
+		}
+	}
+
+	if (nres == 0) {
+		printf("Nothing matches.\n");
+		return (0);
+	}
+
+	qsort(res, nres, sizeof (tx_doc_t *), tx_rank_cmp);
+	printf("%6s  %-20s %4s  %s\n", "SCORE", "WHEN", "KIND", "NAME");
+	for (i = 0; i < nres; i++) {
+		td = res[i];
+		if (i < TX_MAXRES) {
+			if (td->td_scope == PS_GENERAL) {
+				(void) snprintf(when, sizeof (when), "general");
+			} else if (PS_ISDATE(td->td_scope)) {
+				scope_to_tm(td->td_scope, &t);
+				(void) strftime(when, sizeof (when),
+				    "%Y-%m-%d (%a)", &t);
+			} else {
+				(void) snprintf(when, sizeof (when), "%s",
+				    daystr[td->td_scope]);
+			}
+			printf("%6.2f  %-20s %4s  %s\n", td->td_score, when,
+			    (td->td_kind == NM_TODO) ? "todo" : "act",
+			    td->td_name);
+		}
+		td->td_score = 0;
+	}
+	if (nres > TX_MAXRES) {
+		printf("(and %d more)\n", (int)(nres - TX_MAXRES));
+	}
+	umem_free(res, ressz);
+	return ((int)nres);
+}
@@ -0,0 +1,484 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <umem.h>
+#include <strings.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "plan_impl.h"
+#include "plan_probes.h"
+#define	ALLRWX (S_IRWXU | S_IRWXG | S_IRWXO)
+
+/*
+ * The write-ahead log. Rescheduling a day rewrites the time (and often the
+ * duration) of every activity in it, and if we crash halfway through, the day
+ * is left half old and half new. So instead of writing the results of a
+ * realloc straight to the store, commit_act_arr() and set_awake() hand them to
+ * the WAL, inside of a transaction:
+ *
+ *	wal_begin();
+ *	wal_awake(...); wal_act(...); wal_act(...); ...
+ *	wal_end();
+ *
+ * Records are buffered in memory until the outermost wal_end(). Then the
+ * whole transaction, followed by a commit record, goes to ~/.plandb/plan.wal
+ * with a single write and a single fsync, and only after that do we apply it
+ * to the store. Transactions nest, so a caller that changes many days (a
+ * whole week, or a batch) wraps them in one transaction and pays for one
+ * durable write instead of one per day (group commit).
+ *
+ * When the WAL is opened, every committed transaction in it is re-applied to
+ * the store (the records hold complete activity records, so applying them
+ * twice is harmless), and an uncommitted tail is thrown away. Once the store
+ * has flushed the changes, the WAL is truncated (a checkpoint). We checkpoint
+ * on close, and whenever the WAL grows past WAL_CKPT_SIZE.
+ *
+ * Several processes share the WAL, and each one's ps_flush only makes its own
+ * writes durable. So appending (and applying), replaying and truncating are
+ * all done under a write lock on plan.wal, and a checkpoint first re-applies
+ * the transactions in the WAL that other processes wrote, so that flushing
+ * covers them too. We remember where our own transactions went (and their
+ * checksums) to skip re-applying those.
+ */
+
+#define	WAL_CKPT_SIZE	(1024 * 1024)
+#define	WAL_NMINE	64
+
+typedef enum wal_type {
+	WAL_ACT = 1,
+	WAL_AWAKE,
+	WAL_COMMIT,
+	WAL_TODO,
+	WAL_RES,
+} wal_type_t;
+
+typedef enum wal_scan_how {
+	WS_NONE,
+	WS_ALL,
+	WS_OTHERS,
+} wal_scan_how_t;
+
+typedef struct wal_hdr {
+	uint32_t	wh_len;		/* length of name + payload */
+	uint16_t	wh_type;
+	uint16_t	wh_nlen;	/* length of name */
+	int32_t		wh_scope;
+	uint32_t	wh_sum;
+} wal_hdr_t;
+
+typedef struct wal_act {
+	uint64_t	wa_dur;
+	uint32_t	wa_ntimes;
+	int32_t		wa_dyn;
+	uint32_t	wa_gap;
+	uint32_t	wa_spread;
+} wal_act_t;
+
+typedef struct wal_awake {
+	uint64_t	ww_base;
+	uint64_t	ww_off;
+} wal_awake_t;
+
+/*
+ * A transaction that this process appended to the WAL.
+ */
+typedef struct wal_mine {
+	off_t		wm_off;
+	size_t		wm_len;
+	uint32_t	wm_sum;
+} wal_mine_t;
+
+extern plan_store_t *store;
+extern void atomic_read(int, void*, size_t);
+extern void atomic_write(int, void*, size_t);
+extern void act_rec_init(act_rec_t *, size_t);
+extern void act_rec_free(act_rec_t *);
+extern void res_apply(int);
+
+static int wal_fd = -1;
+static int wal_depth;
+static char *wal_buf;
+static size_t wal_bufsz;
+static size_t wal_buflen;
+static uint32_t wal_nrecs;
+static wal_mine_t wal_mine[WAL_NMINE];
+static size_t wal_nmine;
+static int wal_lost;	/* we wrote more than WAL_NMINE transactions */
+
+static uint32_t
+wal_sum(const void *buf, size_t len)
+{
+	const unsigned char *c = buf;
+	uint32_t h = 2166136261u;
+	size_t i = 0;
+
+	while (i < len) {
+		h ^= c[i];
+		h *= 16777619u;
+		i++;
+	}
+	return (h);
+}
+
+static void
+wal_lock(short type)
+{
+	struct flock fl;
+
+	bzero(&fl, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	(void) fcntl(wal_fd, F_SETLKW, &fl);
+}
+
+/*
+ * Is the transaction at `off` in the WAL one of ours?
+ */
+static int
+wal_ismine(off_t off, const char *txn, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < wal_nmine; i++) {
+		if (wal_mine[i].wm_off == off && wal_mine[i].wm_len == len &&
+		    wal_mine[i].wm_sum == wal_sum(txn, len)) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Appends a record to the in-memory transaction buffer.
+ */
+static void
+wal_put(wal_type_t type, scope_t s, const char *n, const void *pl1,
+    size_t plen1, const void *pl2, size_t plen2)
+{
+	wal_hdr_t h;
+	size_t nlen = (n == NULL) ? 0 : strlen(n);
+	size_t sz = sizeof (h) + nlen + plen1 + plen2;
+	char *rec;
+
+	if (wal_buflen + sz > wal_bufsz) {
+		size_t nsz = wal_bufsz ? wal_bufsz : 4096;
+		while (nsz < wal_buflen + sz) {
+			nsz *= 2;
+		}
+		char *nbuf = umem_alloc(nsz, UMEM_NOFAIL);
+		if (wal_bufsz) {
+			bcopy(wal_buf, nbuf, wal_buflen);
+			umem_free(wal_buf, wal_bufsz);
+		}
+		wal_buf = nbuf;
+		wal_bufsz = nsz;
+	}
+
+	rec = wal_buf + wal_buflen;
+	h.wh_len = nlen + plen1 + plen2;
+	h.wh_type = type;
+	h.wh_nlen = nlen;
+	h.wh_scope = s;
+	bcopy(n, rec + sizeof (h), nlen);
+	bcopy(pl1, rec + sizeof (h) + nlen, plen1);
+	bcopy(pl2, rec + sizeof (h) + nlen + plen1, plen2);
+	h.wh_sum = wal_sum(rec + sizeof (h), h.wh_len);
+	bcopy(&h, rec, sizeof (h));
+	wal_buflen += sz;
+	if (type != WAL_COMMIT) {
+		wal_nrecs++;
+	}
+}
+
+/*
+ * Applies a single record to the store.
+ */
+static void
+wal_apply(wal_hdr_t *h, char *name, char *pl, size_t plen)
+{
+	wal_act_t wa;
+	wal_awake_t ww;
+	act_rec_t r;
+	int32_t v;
+
+	switch (h->wh_type) {
+
+	case WAL_ACT:
+		bcopy(pl, &wa, sizeof (wa));
+		act_rec_init(&r, wa.wa_ntimes);
+		r.ar_dur = wa.wa_dur;
+		r.ar_dyn = wa.wa_dyn;
+		r.ar_gap = wa.wa_gap;
+		r.ar_spread = wa.wa_spread;
+		bcopy(pl + sizeof (wa), r.ar_time, wa.wa_ntimes * sizeof (int));
+		(void) store->ps_act_put(h->wh_scope, name, &r);
+		act_rec_free(&r);
+		break;
+
+	case WAL_AWAKE:
+		bcopy(pl, &ww, sizeof (ww));
+		store->ps_awake_put(h->wh_scope, ww.ww_base, ww.ww_off);
+		break;
+
+	case WAL_TODO:
+		bcopy(pl, &v, sizeof (v));
+		(void) store->ps_todo_time(h->wh_scope, name, v);
+		break;
+
+	case WAL_RES:
+		bcopy(pl, &v, sizeof (v));
+		res_apply(v);
+		break;
+	}
+}
+
+/*
+ * Walks the records in buf. Every transaction that ends in a valid commit
+ * record is applied to the store: all of them for WS_ALL, and only those that
+ * other processes wrote for WS_OTHERS (buf is then the whole WAL). Returns the
+ * number of bytes that make up complete, committed transactions.
+ */
+static size_t
+wal_scan(char *buf, size_t sz, wal_scan_how_t apply)
+{
+	size_t off = 0;
+	size_t txn = 0;
+	size_t good = 0;
+	uint32_t n = 0;
+	uint32_t ncommit;
+	wal_hdr_t h;
+	char *name;
+	size_t plen;
+
+	while (off + sizeof (h) <= sz) {
+		bcopy(buf + off, &h, sizeof (h));
+		if (h.wh_nlen > h.wh_len || off + sizeof (h) + h.wh_len > sz ||
+		    wal_sum(buf + off + sizeof (h), h.wh_len) != h.wh_sum) {
+			break;
+		}
+		plen = h.wh_len - h.wh_nlen;
+		if ((h.wh_type == WAL_ACT && plen < sizeof (wal_act_t)) ||
+		    (h.wh_type == WAL_AWAKE && plen != sizeof (wal_awake_t)) ||
+		    (h.wh_type == WAL_COMMIT && plen != sizeof (uint32_t)) ||
+		    (h.wh_type == WAL_TODO && plen != sizeof (int32_t)) ||
+		    (h.wh_type == WAL_RES && plen != sizeof (int32_t))) {
+			break;
+		}
+		off += sizeof (h) + h.wh_len;
+		if (h.wh_type != WAL_COMMIT) {
+			n++;
+			continue;
+		}
+
+		bcopy(buf + off - plen, &ncommit, sizeof (ncommit));
+		if (ncommit != n) {
+			break;
+		}
+
+		/*
+		 * This transaction is complete. Replay it.
+		 */
+		if (apply == WS_OTHERS && !wal_lost &&
+		    wal_ismine(txn, buf + txn, off - txn)) {
+			txn = off;
+		}
+		while (apply != WS_NONE && txn < off) {
+			bcopy(buf + txn, &h, sizeof (h));
+			plen = h.wh_len - h.wh_nlen;
+			name = umem_zalloc(h.wh_nlen + 1, UMEM_NOFAIL);
+			bcopy(buf + txn + sizeof (h), name, h.wh_nlen);
+			wal_apply(&h, name, buf + txn + sizeof (h) + h.wh_nlen,
+			    plen);
+			umem_free(name, h.wh_nlen + 1);
+			txn += sizeof (h) + h.wh_len;
+		}
+		txn = off;
+		good = off;
+		n = 0;
+	}
+	return (good);
+}
+
+/*
+ * Re-applies the transactions in the WAL that other processes wrote, makes
+ * the store durable, and empties the WAL. Called with the lock held, so no
+ * one is in the middle of appending, and an uncommitted tail can only be left
+ * over from a crash.
+ */
+static void
+wal_checkpoint(void)
+{
+	struct stat st;
+	char *buf;
+	size_t good;
+
+	if (fstat(wal_fd, &st) != 0 || st.st_size == 0) {
+		return;
+	}
+
+	buf = umem_alloc(st.st_size, UMEM_NOFAIL);
+	lseek(wal_fd, 0, SEEK_SET);
+	atomic_read(wal_fd, buf, st.st_size);
+	good = wal_scan(buf, st.st_size, WS_OTHERS);
+	if (good != st.st_size) {
+		fprintf(stderr, "plan.wal: discarding %d bytes of uncommitted "
+		    "changes\n", (int)(st.st_size - good));
+	}
+	umem_free(buf, st.st_size);
+
+	store->ps_flush();
+	ftruncate(wal_fd, 0);
+	wal_nmine = 0;
+	wal_lost = 0;
+}
+
+void
+wal_open(int pdb_fd)
+{
+	wal_fd = openat(pdb_fd, "plan.wal", O_CREAT | O_RDWR | O_APPEND,
+	    ALLRWX);
+	if (wal_fd == -1) {
+		perror("plan.wal");
+		return;
+	}
+	wal_lock(F_WRLCK);
+	wal_checkpoint();
+	wal_lock(F_UNLCK);
+}
+
+void
+wal_close(void)
+{
+	if (wal_fd == -1) {
+		return;
+	}
+	wal_lock(F_WRLCK);
+	wal_checkpoint();
+	wal_lock(F_UNLCK);
+	close(wal_fd);
+	wal_fd = -1;
+}
+
+void
+wal_begin(void)
+{
+	wal_depth++;
+}
+
+void
+wal_act(scope_t s, char *n, act_rec_t *r)
+{
+	wal_act_t wa;
+
+	wa.wa_dur = r->ar_dur;
+	wa.wa_ntimes = r->ar_ntimes;
+	wa.wa_dyn = r->ar_dyn;
+	wa.wa_gap = r->ar_gap;
+	wa.wa_spread = r->ar_spread;
+	wal_put(WAL_ACT, s, n, &wa, sizeof (wa), r->ar_time,
+	    r->ar_ntimes * sizeof (int));
+}
+
+void
+wal_awake(scope_t s, size_t base, size_t off)
+{
+	wal_awake_t ww;
+
+	ww.ww_base = base;
+	ww.ww_off = off;
+	wal_put(WAL_AWAKE, s, NULL, &ww, sizeof (ww), NULL, 0);
+}
+
+void
+wal_todo(scope_t s, char *n, int time)
+{
+	int32_t v = time;
+
+	wal_put(WAL_TODO, s, n, &v, sizeof (v), NULL, 0);
+}
+
+/*
+ * Records a change of resolution (see plan_res.c). It takes effect when the
+ * transaction is applied, after the records before it.
+ */
+void
+wal_res(int secs)
+{
+	int32_t v = secs;
+
+	wal_put(WAL_RES, 0, NULL, &v, sizeof (v), NULL, 0);
+}
+
+/*
+ * Ends a transaction. When the outermost transaction ends, it is made durable
+ * in the WAL, and then applied to the store.
+ */
+void
+wal_end(void)
+{
+	struct stat st;
+	uint32_t n = wal_nrecs;
+
+	wal_depth--;
+	if (wal_depth > 0 || wal_buflen == 0) {
+		return;
+	}
+
+	wal_put(WAL_COMMIT, 0, NULL, &n, sizeof (n), NULL, 0);
+	if (wal_fd == -1) {
+		(void) wal_scan(wal_buf, wal_buflen, WS_ALL);
+		wal_buflen = 0;
+		wal_nrecs = 0;
+		return;
+	}
+
+	/*
+	 * The transaction is applied under the lock too, so that whoever
+	 * checkpoints next finds it both in the WAL and in the store.
+	 */
+	wal_lock(F_WRLCK);
+	fstat(wal_fd, &st);
+	atomic_write(wal_fd, wal_buf, wal_buflen);
+	fsync(wal_fd);
+	if (wal_nmine < WAL_NMINE) {
+		wal_mine[wal_nmine].wm_off = st.st_size;
+		wal_mine[wal_nmine].wm_len = wal_buflen;
+		wal_mine[wal_nmine].wm_sum = wal_sum(wal_buf, wal_buflen);
+		wal_nmine++;
+	} else {
+		wal_lost = 1;
+	}
+	(void) wal_scan(wal_buf, wal_buflen, WS_ALL);
+	wal_buflen = 0;
+	wal_nrecs = 0;
+
+	if (fstat(wal_fd, &st) == 0 && st.st_size > WAL_CKPT_SIZE) {
+		wal_checkpoint();
+	}
+	wal_lock(F_UNLCK);
+}
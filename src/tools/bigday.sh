@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the Common Development
+# and Distribution License (the "License").  You may not use this file except
+# in compliance with the License.
+#
+# You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+# for the specific language governing permissions and limitations under the
+# License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each file and
+# include the License file at src/PLAN.LICENSE.  If applicable, add the
+# following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+# replaced with your own identifying information:
+# Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+
+#
+# Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+#
+
+#
+# Builds a Monday of n activities in a scratch plandb, for each n given (1000,
+# 10000 and 100000 if none are), and times "plan list -a mon" and a
+# "plan set duration" on it. Run it from src/, after "make plan":
+#
+#	PLAN_STORE=log tools/bigday.sh [-d] [n ...]
+#
+# With -d, each command is run under bigday.d instead, which breaks the time
+# down per entry. The day is filled by a batch script, with the activities
+# taking 1, 2 and 3 minutes in turn, so most of a large day doesn't fit.
+#
+
+plan=${PLAN:-./plan}
+dflag=0
+
+if [ "$1" = "-d" ]; then
+	dflag=1
+	shift
+fi
+if [ $# -eq 0 ]; then
+	set -- 1000 10000 100000
+fi
+
+run()
+{
+	if [ $dflag -eq 1 ]; then
+		dtrace -q -s tools/bigday.d -c "$plan $*"
+	else
+		/usr/bin/time -p $plan "$@" 2>&1 >/dev/null | grep real
+	fi
+}
+
+for n in "$@"; do
+	PLAN_DB=`mktemp -d` || exit 1
+	export PLAN_DB
+	script=$PLAN_DB.batch
+
+	i=0
+	while [ $i -lt $n ]; do
+		echo "create mon/a$i"
+		echo "set duration=00h0$((i % 3 + 1))m mon/a$i"
+		i=$((i + 1))
+	done > $script
+	$plan batch $script >/dev/null 2>&1
+
+	echo "n = $n"
+	echo "list -a mon:"
+	run list -a mon
+	echo "set duration=00h05m mon/a1:"
+	run set duration=00h05m mon/a1
+
+	rm -rf $PLAN_DB $script
+done
@@ -0,0 +1,508 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the Common Development
+ * and Distribution License (the "License").  You may not use this file except
+ * in compliance with the License.
+ *
+ * You can obtain a copy of the license at src/PLAN.LICENSE.  See the License
+ * for the specific language governing permissions and limitations under the
+ * License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each file and
+ * include the License file at src/PLAN.LICENSE.  If applicable, add the
+ * following below this CDDL HEADER, with the fields enclosed by brackets "[]"
+ * replaced with your own identifying information:
+ * Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2011, Nick Zivkovic. All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <umem.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef __sun
+#include <sys/vmem.h>
+#endif
+#include "plan_impl.h"
+
+/*
+ * Checks plan_daymap.c against a naive reference, and times it. Build it
+ * with "make daymap_check" in src/, and run
+ *
+ *	./daymap_check [-s seed] [-r rounds]
+ *
+ * to run random sequences of daymap_alloc (best and first fit),
+ * daymap_alloc_chain, daymap_free and daymap_claim against a map of one
+ * byte per slot that is searched a slot at a time. The day sizes include
+ * ones that end partway through a word, and the runs cross words. After
+ * every operation, the result and every bit of the map (and its summary
+ * words) have to match. It prints the seed and the first difference it
+ * finds, and exits 1.
+ *
+ *	./daymap_check -t [-r rounds]
+ *
+ * places a day of 24 activities of 10 to 60 minutes, each between random
+ * bounds, best fit, into a day of 1440 slots, and frees them, `rounds` times
+ * over, and prints the time per allocation. On illumos, it does the same with
+ * a vmem arena set up the way plan's used to be, for comparison.
+ */
+
+extern daymap_t *daymap_create(size_t);
+extern void daymap_destroy(daymap_t *);
+extern int daymap_alloc(daymap_t *, size_t, size_t, size_t, int);
+extern int daymap_alloc_chain(daymap_t *, size_t, size_t, size_t, size_t,
+    size_t, size_t, int *);
+extern void daymap_free(daymap_t *, size_t, size_t);
+extern void daymap_claim(daymap_t *, size_t, size_t);
+
+#define	CK_MAXALLOCS	512
+#define	CK_MAXCHAIN	3
+#define	TM_NACTS	24
+
+typedef struct ck_alloc {
+	size_t	ca_start;
+	size_t	ca_len;
+} ck_alloc_t;
+
+static uint64_t ck_seed;
+static uint64_t ck_state;
+static char *ck_ref;		/* 1 if the slot is free */
+static size_t ck_nslots;
+static ck_alloc_t ck_allocs[CK_MAXALLOCS];
+static size_t ck_nallocs;
+static long ck_nops;
+
+static uint64_t
+ck_rand(void)
+{
+	ck_state ^= ck_state << 13;
+	ck_state ^= ck_state >> 7;
+	ck_state ^= ck_state << 17;
+	return (ck_state);
+}
+
+static size_t
+ck_randn(size_t n)
+{
+	return (n == 0 ? 0 : ck_rand() % n);
+}
+
+static void
+ck_fail(const char *what, long want, long got)
+{
+	printf("seed %llu, op %ld: %s: expected %ld, got %ld\n",
+	    (unsigned long long)ck_seed, ck_nops, what, want, got);
+	exit(1);
+}
+
+/*
+ * The reference daymap_alloc. Goes over every maximal run of free slots, and
+ * takes the first one that fits (DM_FIRSTFIT) or the smallest whole run that
+ * fits, the earliest of those if there are several (DM_BESTFIT). An
+ * allocation goes at the start of its run, or at min, if that's later.
+ */
+static long
+ref_alloc(size_t len, size_t min, size_t max, int flags)
+{
+	size_t rs;
+	size_t re = 0;
+	size_t p;
+	size_t lim;
+	size_t best = 0;
+	size_t bestsz = 0;
+
+	if (max > ck_nslots) {
+		max = ck_nslots;
+	}
+	if (len == 0) {
+		return (-1);
+	}
+	while (re < ck_nslots) {
+		rs = re;
+		while (rs < ck_nslots && !ck_ref[rs]) {
+			rs++;
+		}
+		re = rs;
+		while (re < ck_nslots && ck_ref[re]) {
+			re++;
+		}
+		if (rs == re) {
+			break;
+		}
+		p = (rs > min ? rs : min);
+		lim = (re < max ? re : max);
+		if (p + len > lim) {
+			continue;
+		}
+		if (bestsz == 0 || re - rs < bestsz) {
+			best = p;
+			bestsz = re - rs;
+		}
+		if (flags & DM_FIRSTFIT) {
+			break;
+		}
+	}
+	if (bestsz == 0) {
+		return (-1);
+	}
+	for (p = best; p < best + len; p++) {
+		ck_ref[p] = 0;
+	}
+	return (best);
+}
+
+static int
+ref_isfree(size_t p, size_t len)
+{
+	size_t i;
+
+	for (i = p; i < p + len; i++) {
+		if (!ck_ref[i]) {
+			return (0);
+		}
+	}
+	return (1);
+}
+
+/*
+ * The reference daymap_alloc_chain: tries every layout, in order, and takes
+ * the first one that fits.
+ */
+static int
+ref_chain(size_t len, size_t n, size_t gap, size_t spread, size_t min,
+    size_t max, size_t i, long *locs)
+{
+	size_t p = (i == 0) ? min : locs[i - 1] + len + gap;
+
+	for (; p + len <= max; p++) {
+		if (i > 0 && spread != 0 && p + len - locs[0] > spread) {
+			return (-1);
+		}
+		if (!ref_isfree(p, len)) {
+			continue;
+		}
+		locs[i] = p;
+		if (i + 1 == n) {
+			if (spread == 0 || p + len - locs[0] <= spread) {
+				return (0);
+			}
+			continue;
+		}
+		if (ref_chain(len, n, gap, spread, min, max, i + 1, locs) ==
+		    0) {
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+static void
+ref_fill(size_t start, size_t len, int free)
+{
+	size_t i;
+
+	for (i = start; i < start + len && i < ck_nslots; i++) {
+		ck_ref[i] = free;
+	}
+}
+
+static void
+ck_remember(size_t start, size_t len)
+{
+	if (ck_nallocs < CK_MAXALLOCS) {
+		ck_allocs[ck_nallocs].ca_start = start;
+		ck_allocs[ck_nallocs].ca_len = len;
+		ck_nallocs++;
+	}
+}
+
+/*
+ * Every bit of the map, the bits past the end of the day, and the summary
+ * words have to agree with the reference.
+ */
+static void
+ck_compare(daymap_t *dm)
+{
+	size_t i;
+	size_t w;
+	uint64_t bit;
+	uint64_t mask;
+	int some;
+	int full;
+
+	for (i = 0; i < dm->dm_nwords * 64; i++) {
+		bit = (dm->dm_free[i / 64] >> (i % 64)) & 1;
+		if (bit != (i < ck_nslots ? ck_ref[i] : 0)) {
+			ck_fail("slot", i < ck_nslots ? ck_ref[i] : 0, bit);
+		}
+	}
+	for (w = 0; w < dm->dm_nwords; w++) {
+		mask = ~(uint64_t)0;
+		if (w == dm->dm_nwords - 1 && ck_nslots % 64) {
+			mask >>= 64 - ck_nslots % 64;
+		}
+		some = (dm->dm_some[w / 64] >> (w % 64)) & 1;
+		full = (dm->dm_full[w / 64] >> (w % 64)) & 1;
+		if (some != (dm->dm_free[w] != 0)) {
+			ck_fail("dm_some", dm->dm_free[w] != 0, some);
+		}
+		if (full != (dm->dm_free[w] == mask)) {
+			ck_fail("dm_full", dm->dm_free[w] == mask, full);
+		}
+	}
+}
+
+static void
+ck_round(size_t nslots, int nops)
+{
+	daymap_t *dm = daymap_create(nslots);
+	long want;
+	long got;
+	long rlocs[CK_MAXCHAIN];
+	int locs[CK_MAXCHAIN];
+	size_t len;
+	size_t min;
+	size_t max;
+	size_t n;
+	size_t gap;
+	size_t spread;
+	size_t i;
+	size_t op;
+	int flags;
+
+	ck_nslots = nslots;
+	ck_ref = umem_alloc(nslots, UMEM_NOFAIL);
+	ref_fill(0, nslots, 1);
+	ck_nallocs = 0;
+
+	while (nops-- > 0) {
+		ck_nops++;
+		op = ck_randn(100);
+		len = 1 + ck_randn(ck_randn(4) == 0 ? nslots : 70);
+		min = ck_randn(nslots + 8);
+		max = min + ck_randn(nslots + 8 - min + 1);
+		if (ck_randn(4) == 0) {
+			min = 0;
+			max = nslots;
+		}
+		if (op < 45) {
+			flags = ck_randn(2) ? DM_BESTFIT : DM_FIRSTFIT;
+			want = ref_alloc(len, min, max, flags);
+			got = daymap_alloc(dm, len, min, max, flags);
+			if (want != got) {
+				ck_fail(flags == DM_BESTFIT ? "bestfit" :
+				    "firstfit", want, got);
+			}
+			if (got != -1) {
+				ck_remember(got, len);
+			}
+		} else if (op < 60 && nslots <= 256) {
+			n = 1 + ck_randn(CK_MAXCHAIN);
+			len = 1 + ck_randn(12);
+			gap = ck_randn(12);
+			spread = ck_randn(2) ? 0 : n * len + ck_randn(60);
+			if (max > nslots) {
+				max = nslots;
+			}
+			want = ref_chain(len, n, gap, spread, min, max, 0,
+			    rlocs);
+			got = daymap_alloc_chain(dm, len, n, gap, spread, min,
+			    max, locs);
+			if (want != got) {
+				ck_fail("chain", want, got);
+			}
+			for (i = 0; got == 0 && i < n; i++) {
+				if (rlocs[i] != locs[i]) {
+					ck_fail("chain loc", rlocs[i], locs[i]);
+				}
+				ref_fill(locs[i], len, 0);
+				ck_remember(locs[i], len);
+			}
+		} else if (op < 85 && ck_nallocs > 0) {
+			i = ck_randn(ck_nallocs);
+			daymap_free(dm, ck_allocs[i].ca_start,
+			    ck_allocs[i].ca_len);
+			ref_fill(ck_allocs[i].ca_start, ck_allocs[i].ca_len, 1);
+			ck_allocs[i] = ck_allocs[--ck_nallocs];
+		} else if (op < 95) {
+			daymap_claim(dm, min, len);
+			if (min < nslots) {
+				ref_fill(min, len, 0);
+			}
+		} else if (min < nslots) {
+			if (len > nslots - min) {
+				len = nslots - min;
+			}
+			daymap_free(dm, min, len);
+			ref_fill(min, len, 1);
+		}
+		ck_compare(dm);
+	}
+	umem_free(ck_ref, nslots);
+	daymap_destroy(dm);
+}
+
+static long long
+tm_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/*
+ * The same days for each allocator: a duration and bounds per activity.
+ */
+static void
+tm_day(size_t *dur, size_t *min, size_t *max)
+{
+	size_t i;
+
+	for (i = 0; i < TM_NACTS; i++) {
+		dur[i] = 10 + ck_randn(51);
+		min[i] = ck_randn(1440 / 2);
+		max[i] = min[i] + 1440 / 2 + ck_randn(1440 / 2 - dur[i]);
+		if (ck_randn(2)) {
+			min[i] = 0;
+			max[i] = 1440;
+		}
+	}
+}
+
+static void
+tm_print(const char *what, long long ns, long nallocs, long nfail)
+{
+	printf("%-8s %8.1f ns per alloc (%ld allocs, %ld didn't fit)\n",
+	    what, nallocs ? (double)ns / nallocs : 0.0, nallocs, nfail);
+}
+
+static void
+tm_run(long rounds)
+{
+	daymap_t *dm = daymap_create(1440);
+	size_t dur[TM_NACTS];
+	size_t min[TM_NACTS];
+	size_t max[TM_NACTS];
+	int loc[TM_NACTS];
+	long long ns = 0;
+	long long t;
+	long nallocs = 0;
+	long nfail = 0;
+	long r;
+	size_t i;
+
+	ck_state = ck_seed;
+	for (r = 0; r < rounds; r++) {
+		tm_day(dur, min, max);
+		t = tm_now();
+		for (i = 0; i < TM_NACTS; i++) {
+			loc[i] = daymap_alloc(dm, dur[i], min[i], max[i],
+			    DM_BESTFIT);
+		}
+		ns += tm_now() - t;
+		for (i = 0; i < TM_NACTS; i++) {
+			if (loc[i] == -1) {
+				nfail++;
+				continue;
+			}
+			daymap_free(dm, loc[i], dur[i]);
+		}
+		nallocs += TM_NACTS;
+	}
+	tm_print("daymap", ns, nallocs, nfail);
+	daymap_destroy(dm);
+
+#ifdef __sun
+	/*
+	 * As plan_main.c used to set it up: a span can't start at 0, so the
+	 * arena starts at 1.
+	 */
+	vmem_t *vm = vmem_create("vmday", (void *)1, 1440, 1, NULL, NULL,
+	    NULL, 1, VM_NOSLEEP);
+	char *vloc[TM_NACTS];
+
+	ns = 0;
+	nallocs = 0;
+	nfail = 0;
+	ck_state = ck_seed;
+	for (r = 0; r < rounds; r++) {
+		tm_day(dur, min, max);
+		t = tm_now();
+		for (i = 0; i < TM_NACTS; i++) {
+			vloc[i] = vmem_xalloc(vm, dur[i], 0, 0, 0,
+			    (void *)(min[i] + 1), (void *)(max[i] + 1),
+			    VM_BESTFIT | VM_NOSLEEP);
+		}
+		ns += tm_now() - t;
+		for (i = 0; i < TM_NACTS; i++) {
+			if (vloc[i] == NULL) {
+				nfail++;
+				continue;
+			}
+			vmem_xfree(vm, vloc[i], dur[i]);
+		}
+		nallocs += TM_NACTS;
+	}
+	tm_print("vmem", ns, nallocs, nfail);
+	vmem_destroy(vm);
+#endif
+}
+
+int
+main(int ac, char *av[])
+{
+	static const size_t sizes[] = {1, 63, 64, 65, 130, 200, 256, 1440};
+	long rounds = -1;
+	int timing = 0;
+	int c;
+	long r;
+
+	ck_seed = (uint64_t)time(NULL);
+	while ((c = getopt(ac, av, "s:r:t")) != -1) {
+		switch (c) {
+		case 's':
+			ck_seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = atol(optarg);
+			break;
+		case 't':
+			timing = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t] [-s seed] "
+			    "[-r rounds]\n", av[0]);
+			return (2);
+		}
+	}
+	if (ck_seed == 0) {
+		ck_seed = 1;
+	}
+
+	if (timing) {
+		tm_run(rounds == -1 ? 100000 : rounds);
+		return (0);
+	}
+
+	ck_state = ck_seed;
+	if (rounds == -1) {
+		rounds = 2000;
+	}
+	for (r = 0; r < rounds; r++) {
+		ck_round(sizes[r % (sizeof (sizes) / sizeof (sizes[0]))],
+		    1000);
+	}
+	printf("seed %llu: %ld operations matched\n",
+	    (unsigned long long)ck_seed, ck_nops);
+	return (0);
+}